@@ -31,14 +31,40 @@ ArrayRealloc(VoidArray& a, size_t newCapInBytes)
     return pNewEnd;
 }
 
-inline char *
-ArrayGrowForAppend(VoidArray& a, uint additionalTs, uint sizeOfT)
+inline uint
+ArrayCapBytesForAppend(const VoidArray& a, uint additionalTs, uint sizeOfT)
 {
     uint const oldFilledBytes = uint(BytePtrSub(a.pEnd, a.pBegin));
     uint const minCapBytes    = oldFilledBytes + additionalTs * sizeOfT;
     uint const oldFilledTs    = oldFilledBytes / sizeOfT;
     ASSERT(oldFilledBytes < minCapBytes);
-    return ArrayRealloc(a, Max<uint>(((oldFilledTs * 3u) / 2u) * sizeOfT, minCapBytes));
+    return Max<uint>(((oldFilledTs * 3u) / 2u) * sizeOfT, minCapBytes);
+}
+
+inline char *
+ArrayGrowForAppend(VoidArray& a, uint additionalTs, uint sizeOfT)
+{
+    return ArrayRealloc(a, ArrayCapBytesForAppend(a, additionalTs, sizeOfT));
+}
+
+// Same as ArrayGrowForAppend, but the current storage may be the caller's inline buffer, which can't go to realloc.
+inline char *
+ArrayGrowForAppendMaybeInline(VoidArray& a, const void *pInline, uint additionalTs, uint sizeOfT)
+{
+    uint const newCapBytes = ArrayCapBytesForAppend(a, additionalTs, sizeOfT);
+    if (a.pBegin != pInline) {
+        return ArrayRealloc(a, newCapBytes);
+    }
+
+    size_t const origSizeInBytes = BytePtrSub(a.pEnd, a.pBegin);
+
+    char *const pBytes = static_cast<char *>(AllocateBytes(newCapBytes));
+    memcpy(pBytes, a.pBegin, origSizeInBytes);
+    char *const pNewEnd = pBytes + origSizeInBytes;
+    a.pBegin = pBytes;
+    a.pEnd = pNewEnd;
+    a.pCap = pBytes + newCapBytes;
+    return pNewEnd;
 }
 
 #if 0
@@ -154,3 +180,100 @@ public:
 #undef END
 #undef CAP
 };
+
+
+/*
+ * Array with room for N elements inline; only goes to the heap once it holds more than N.
+ * Growth past that point is the same as Array's.
+ * Not movable: pBegin may point into the object itself.
+ */
+template<typename T, uint N>
+class SmallArray {
+    static_assert(__is_trivial(T), "T must be trivial");
+    static_assert(N != 0, "use Array");
+
+    VoidArray a;
+    alignas(T) char inlineBuf[N * sizeof(T)];
+
+#define BEGIN reinterpret_cast<T *>(a.pBegin)
+#define END reinterpret_cast<T *>(a.pEnd)
+#define CAP reinterpret_cast<T *>(a.pCap)
+
+public:
+    SmallArray() : a{ inlineBuf, inlineBuf, inlineBuf + sizeof inlineBuf } {
+    }
+    ~SmallArray() {
+        if (!is_inline()) {
+            Deallocate(a.pBegin);
+        }
+    }
+
+    SmallArray(const SmallArray&) = delete;
+    SmallArray& operator=(const SmallArray&) = delete;
+
+    T *data() const { return BEGIN; }
+    T *begin() const { return BEGIN; }
+    T *end() const { return END; }
+    uint capacity() const { return uint(CAP - BEGIN); }
+    uint size() const { return uint(END - BEGIN); }
+    bool is_empty() const { return a.pBegin == a.pEnd; }
+    bool is_inline() const { return a.pBegin == inlineBuf; }
+
+    T& operator[](size_t i) { ASSERT(i < size_t(END - BEGIN)); return BEGIN[i]; }
+
+    T& pop()
+    {
+        ASSERT(BEGIN < END);
+
+        T *pBack = END;
+        a.pEnd = --pBack;
+        return *pBack;
+    }
+
+    T *set_size(size_t n)
+    {
+        ASSERT(size_t(CAP - BEGIN) >= n);
+        T *newEnd = BEGIN + n;
+        a.pEnd = newEnd;
+        return newEnd;
+    }
+
+    void clear()
+    {
+        a.pEnd = a.pBegin;
+    }
+
+    T* uninitialized_push()
+    {
+        T *oldEnd = END;
+        if (oldEnd == CAP) { // unlikely
+            oldEnd = reinterpret_cast<T *>(ArrayGrowForAppendMaybeInline(a, inlineBuf, 1, sizeof(T)));
+        }
+        a.pEnd = oldEnd + 1;
+        return oldEnd;
+    }
+
+    T* uninitialized_push_n(uint n)
+    {
+        T *oldEnd = END;
+        if (CAP - END < n) { // unlikely
+            oldEnd = reinterpret_cast<T *>(ArrayGrowForAppendMaybeInline(a, inlineBuf, n, sizeof(T)));
+        }
+        a.pEnd = oldEnd + n;
+        return oldEnd;
+    }
+
+    void push(const T& val)
+    {
+        *uninitialized_push() = val;
+    }
+
+    void push_n(const T *src, uint n)
+    {
+        memcpy(uninitialized_push_n(n), src, n * sizeof(T));
+    }
+
+#undef BEGIN
+#undef END
+#undef CAP
+};
@@ -0,0 +1,1760 @@
+#include "common.h"
+
+#include "Array.h"
+#include "pool.h"
+#include "lex.h"
+#include "compile.h"
+#include "message.h"
+#include "preprocess.h"
+#include "prescan.h"
+#include "spvsection.h"
+#include "spvreader.h"
+#include "spvlink.h"
+#include "spvpool.h"
+#include "dataflow.h"
+#include "spvunroll.h"
+#include "spvslp.h"
+#include "spvhalf.h"
+#include "half.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+/*
+    Benchmarks, run with "vkc bench".
+    These are for comparing alternatives on the same machine, not absolute numbers.
+**/
+
+static double
+NowSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t
+BenchRandNext(uint32_t *state) // xorshift32
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Sizes look like per-expression/per-block arrays: mostly a handful of elements, occasionally many.
+static uint
+BenchSmallArrayLength(uint32_t *rng)
+{
+    uint32_t const r = BenchRandNext(rng);
+    return (r & 15) == 0 ? 16 + (r >> 4) % 48 : 1 + (r >> 4) % 12;
+}
+
+template<class ArrayT>
+static void
+BenchArrayFill(const char *name, uint nArrays)
+{
+    uint32_t rng = 12345;
+    uint64_t nCapChanges = 0; // each is one AllocateBytes/ReallocateBytes
+    uint64_t checksum = 0;
+
+    double const t0 = NowSeconds();
+    for (uint i = 0; i < nArrays; ++i) {
+        ArrayT arr;
+        uint const n = BenchSmallArrayLength(&rng);
+        uint cap = arr.capacity();
+        for (uint j = 0; j < n; ++j) {
+            arr.push(j ^ i);
+            if (arr.capacity() != cap) {
+                cap = arr.capacity();
+                nCapChanges += 1;
+            }
+        }
+        for (uint32_t x : arr) {
+            checksum += x;
+        }
+    }
+    double const t1 = NowSeconds();
+
+    printf("%-24s %8.2f ms  %10llu allocs  (checksum %llu)\n", name, (t1 - t0) * 1e3,
+        (unsigned long long)nCapChanges, (unsigned long long)checksum);
+}
+
+static void
+BenchSmallArray()
+{
+    puts(__FUNCTION__);
+    enum { NumArrays = 2'000'000 };
+    BenchArrayFill<Array<uint32_t>>("Array<uint32_t>", NumArrays);
+    BenchArrayFill<SmallArray<uint32_t, 16>>("SmallArray<uint32_t, 16>", NumArrays);
+}
+
+/*
+    1M small nodes linked in random order, as IR/symbol graphs end up: build, walk, then churn: free half, refill,
+    and free them all.
+    The walk is dominated by cache and TLB misses, so that is where chunk page size shows up.
+**/
+enum { PoolBenchNodes = 1'000'000, PoolBenchWalks = 4 };
+
+static void
+BenchShuffle(uint32_t *order, uint n)
+{
+    uint32_t rng = 777;
+    for (uint i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    for (uint i = n - 1; i > 0; --i) {
+        uint const j = BenchRandNext(&rng) % (i + 1);
+        uint32_t const t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+}
+
+static void
+BenchMallocNodes(const uint32_t *order)
+{
+    struct Node { Node *next; uint32_t payload[2]; };
+    Node **nodes = Allocate<Node *>(PoolBenchNodes);
+
+    double const t0 = NowSeconds();
+    for (uint i = 0; i < PoolBenchNodes; ++i) {
+        nodes[i] = static_cast<Node *>(malloc(sizeof(Node)));
+        nodes[i]->payload[0] = i;
+    }
+    for (uint i = 0; i < PoolBenchNodes; ++i) {
+        nodes[order[i]]->next = i + 1 < PoolBenchNodes ? nodes[order[i + 1]] : nullptr;
+    }
+    uint64_t sum = 0;
+    double const t1 = NowSeconds();
+    for (uint w = 0; w < PoolBenchWalks; ++w) {
+        for (Node *n = nodes[order[0]]; n; n = n->next) {
+            sum += n->payload[0];
+        }
+    }
+    double const t2 = NowSeconds();
+    for (uint i = 0; i < PoolBenchNodes; i += 2) {
+        free(nodes[i]);
+    }
+    for (uint i = 0; i < PoolBenchNodes; i += 2) {
+        nodes[i] = static_cast<Node *>(malloc(sizeof(Node)));
+    }
+    for (uint i = 0; i < PoolBenchNodes; ++i) {
+        free(nodes[i]);
+    }
+    double const t3 = NowSeconds();
+    Deallocate(nodes);
+
+    printf("%-22s build %7.2f ms  walk %7.2f ms  churn %7.2f ms  (%zu-byte refs, sum %llu)\n", "malloc",
+        (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3, sizeof(Node *), (unsigned long long)sum);
+}
+
+static void
+BenchPoolNodes(const char *name, const uint32_t *order, PoolFlags flags)
+{
+    struct Node { PoolIndex next; uint32_t payload[1]; };
+    PoolIndex *nodes = Allocate<PoolIndex>(PoolBenchNodes);
+
+    double t0, t1, t2;
+    uint64_t sum = 0;
+    { // the pool goes away inside churn, as malloc's nodes are freed in it
+        t0 = NowSeconds();
+        Pool<Node> pool(flags);
+        for (uint i = 0; i < PoolBenchNodes; ++i) {
+            nodes[i] = pool.alloc();
+            pool[nodes[i]].payload[0] = i;
+        }
+        for (uint i = 0; i < PoolBenchNodes; ++i) {
+            pool[nodes[order[i]]].next = i + 1 < PoolBenchNodes ? nodes[order[i + 1]] : NullPoolIndex;
+        }
+        t1 = NowSeconds();
+        for (uint w = 0; w < PoolBenchWalks; ++w) {
+            for (PoolIndex n = nodes[order[0]]; n; n = pool[n].next) {
+                sum += pool[n].payload[0];
+            }
+        }
+        t2 = NowSeconds();
+        for (uint i = 0; i < PoolBenchNodes; i += 2) {
+            pool.free(nodes[i]);
+        }
+        for (uint i = 0; i < PoolBenchNodes; i += 2) {
+            nodes[i] = pool.alloc();
+        }
+    }
+    double const t3 = NowSeconds();
+    Deallocate(nodes);
+
+    printf("%-22s build %7.2f ms  walk %7.2f ms  churn %7.2f ms  (%zu-byte refs, sum %llu)\n", name,
+        (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3, sizeof(PoolIndex), (unsigned long long)sum);
+}
+
+static void
+BenchPool()
+{
+    puts(__FUNCTION__);
+    uint32_t *order = Allocate<uint32_t>(PoolBenchNodes);
+    BenchShuffle(order, PoolBenchNodes);
+    BenchMallocNodes(order);
+    BenchPoolNodes("Pool", order, 0);
+    BenchPoolNodes("Pool, huge pages", order, PoolFlag_HugePages);
+    Deallocate(order);
+}
+
+template<ScanFeatureFlags Features>
+static void
+BenchScanVariant(const char *name, view<const char> src)
+{
+    double const t0 = NowSeconds();
+    uint nTokens = 0;
+    Scanner sc;
+    Scanner_Init(&sc, src);
+    Token tok;
+    while (Scanner_NextTokenRawT<Features>(&sc, &tok) != Token_EOI) {
+        nTokens += 1;
+    }
+    double const t1 = NowSeconds();
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u tokens)\n", name, (t1 - t0) * 1e3, src.length / (t1 - t0) * 1e-6, nTokens);
+}
+
+static void
+BenchScanner()
+{
+    puts(__FUNCTION__);
+    // Comment-free, codegen-looking source, so every variant sees the same tokens:
+    static const char Line[] = "static_assert(t_123 * 45 + ~v_6 & 0 == 18446744073709551615 ^ x | 1);\n";
+    enum { NumLines = 200'000 };
+    uint const len = NumLines * (lengthof(Line) - 1);
+    char *src = Allocate<char>(len + 1);
+    for (uint i = 0; i < NumLines; ++i) {
+        memcpy(src + i * (lengthof(Line) - 1), Line, lengthof(Line) - 1);
+    }
+    src[len] = '\0';
+
+    BenchScanVariant<ScanFeatures_Full>("full", { src, len });
+    BenchScanVariant<ScanFeatures_MachineGenerated>("machine-generated", { src, len });
+    Deallocate(src);
+}
+
+/*
+    Operator-dense constant expressions, with every binary operator, so the time is mostly ParseExpr()'s operator
+    dispatch and folding. Then the dispatch alone over the same tokens: the 2x256 table ParseExpr() loads from,
+    against the switch on the TokenKind it used to have, both as here with values standing in for the OpInfos.
+**/
+static uint16_t
+BenchOpInfoSwitch(bool bAfterOperand, TokenKind k)
+{
+    if (!bAfterOperand) {
+        switch (k) {
+        case Token_Plus:             return 15 << 9 | 1;
+        case Token_Minus:            return 15 << 9 | 2;
+        case Token_UnaryLogicalNot:  return 15 << 9 | 3;
+        case Token_UnaryBitwiseNot:  return 15 << 9 | 4;
+        default:                     return 0;
+        }
+    }
+    switch (k) {
+    case Token_Mul:                  return 14 << 9 | 5;
+    case Token_Div:                  return 14 << 9 | 6;
+    case Token_Mod:                  return 14 << 9 | 7;
+    case Token_Plus:                 return 13 << 9 | 8;
+    case Token_Minus:                return 13 << 9 | 9;
+    case Token_LeftShift:            return 12 << 9 | 10;
+    case Token_RightShift:           return 12 << 9 | 11;
+    case Token_LessThan:             return 10 << 9 | 12;
+    case Token_LessEq:               return 10 << 9 | 13;
+    case Token_GreaterThan:          return 10 << 9 | 14;
+    case Token_GreaterEq:            return 10 << 9 | 15;
+    case Token_CmpEqual:             return 9 << 9 | 16;
+    case Token_CmpNotEq:             return 9 << 9 | 17;
+    case Token_Amp:                  return 8 << 9 | 18;
+    case Token_Caret:                return 7 << 9 | 19;
+    case Token_VBar:                 return 6 << 9 | 20;
+    case Token_LogicAnd:             return 5 << 9 | 21;
+    case Token_LogicOr:              return 4 << 9 | 22;
+    case Token_Question:             return 3 << 9 | 23 | 1 << 8;
+    case Token_Assign:               return 3 << 9 | 24 | 1 << 8;
+    case Token_AddAssign:            return 3 << 9 | 25 | 1 << 8;
+    case Token_SubAssign:            return 3 << 9 | 26 | 1 << 8;
+    case Token_MulAssign:            return 3 << 9 | 27 | 1 << 8;
+    case Token_DivAssign:            return 3 << 9 | 28 | 1 << 8;
+    case Token_ModAssign:            return 3 << 9 | 29 | 1 << 8;
+    case Token_LeftShiftAssign:      return 3 << 9 | 30 | 1 << 8;
+    case Token_RightShiftAssign:     return 3 << 9 | 31 | 1 << 8;
+    case Token_AndAssign:            return 3 << 9 | 32 | 1 << 8;
+    case Token_XorAssign:            return 3 << 9 | 33 | 1 << 8;
+    case Token_OrAssign:             return 3 << 9 | 34 | 1 << 8;
+    default:                         return 0;
+    }
+}
+
+// As ParseExpr() tracks it: an operator leaves an operand expected, a name, number or ')' completes one.
+template<class Dispatch>
+static uint64_t
+BenchDispatchTokens(const uint8_t *kinds, uint n, Dispatch dispatch)
+{
+    uint64_t sum = 0;
+    bool bAfterOperand = false;
+    for (uint i = 0; i < n; ++i) {
+        TokenKind const k = TokenKind(kinds[i]);
+        uint16_t const info = dispatch(bAfterOperand, k);
+        sum += info;
+        bAfterOperand = !info && (k == Token_Name || k == Token_NumberLiteral || k == Token_CloseParen);
+    }
+    return sum;
+}
+
+static void
+BenchExpressions()
+{
+    puts(__FUNCTION__);
+    static const char Line[] =
+        "static_assert(1 + 2 * 3 - 4 ^ 5 & 6 | 7 == 8 != 9 && -1 || !0 ? 7 / 2 % 5 << 2 >> 1 < 9 <= 1 > 0 >= 1 "
+        ": +4 * (~3 - 6) + 7);\n";
+    enum { NumLines = 100'000, NumRuns = 50 };
+    uint const len = 12 + NumLines * (lengthof(Line) - 1) + 1;
+    char *src = Allocate<char>(len + 1);
+    memcpy(src, "void main(){", 12);
+    for (uint i = 0; i < NumLines; ++i) {
+        memcpy(src + 12 + i * (lengthof(Line) - 1), Line, lengthof(Line) - 1);
+    }
+    src[len - 1] = '}';
+    src[len] = '\0';
+
+    MessageStream om;
+    CompileOptions options;
+    options.scanFeatures = ScanFeatures_MachineGenerated;
+    CompileResult result = CompileResult_Ok;
+    double best = 1e30;
+    for (uint r = 0; r < NumRuns; ++r) {
+        om.clear();
+        double const t0 = NowSeconds();
+        result = Compile({ src, len }, &om, &options);
+        best = std::min(best, NowSeconds() - t0);
+    }
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u messages)%s\n", "operator-dense", best * 1e3, len / best * 1e-6,
+        om.size(), result == CompileResult_Ok && om.size() == 0 ? "" : "  FAILED");
+
+    Array<uint8_t> kinds;
+    {
+        CompileAbortScope abortScope;
+        Scanner sc;
+        Scanner_Init(&sc, { src, len });
+        Token tok;
+        for (TokenKind k; (k = Scanner_NextTokenRaw(&sc, &tok)) != Token_EOI; ) {
+            kinds.push(uint8_t(k));
+        }
+    }
+    uint16_t table[2][256];
+    for (uint k = 0; k < 256; ++k) {
+        table[0][k] = BenchOpInfoSwitch(false, TokenKind(k));
+        table[1][k] = BenchOpInfoSwitch(true, TokenKind(k));
+    }
+    double bestTable = 1e30, bestSwitch = 1e30;
+    uint64_t sumTable = 0, sumSwitch = 0;
+    for (uint r = 0; r < NumRuns; ++r) {
+        double const t0 = NowSeconds();
+        sumTable = BenchDispatchTokens(kinds.data(), kinds.size(),
+            [&table](bool bAfterOperand, TokenKind k) { return table[bAfterOperand][k]; });
+        double const t1 = NowSeconds();
+        sumSwitch = BenchDispatchTokens(kinds.data(), kinds.size(), BenchOpInfoSwitch);
+        double const t2 = NowSeconds();
+        bestTable = std::min(bestTable, t1 - t0);
+        bestSwitch = std::min(bestSwitch, t2 - t1);
+    }
+    printf("%-22s %7.2f ms  %6.0f M tokens/s\n", "dispatch, table", bestTable * 1e3, kinds.size() / bestTable * 1e-6);
+    printf("%-22s %7.2f ms  %6.0f M tokens/s%s\n", "dispatch, switch", bestSwitch * 1e3,
+        kinds.size() / bestSwitch * 1e-6, sumTable == sumSwitch ? "" : "  FAILED");
+    Deallocate(src);
+}
+
+/*
+    A 4x4x4 permutation matrix over three constants: compiling each permutation with the constants as its
+    defaults, versus compiling once with them as specialization constants and specializing 64 times.
+**/
+static void
+BenchSpecialization()
+{
+    puts(__FUNCTION__);
+    static const char Line[] = "        static_assert((QUALITY * 2 + LIGHTS) * (SHADOWS ? 3 : 1) != 1000 && LIGHTS - QUALITY != 99);\n";
+    enum { NumLines = 2000, NumValues = 4 };
+    uint const len = 12 + NumLines * (lengthof(Line) - 1) + 1;
+    char *src = Allocate<char>(len + 1);
+    memcpy(src, "void main(){", 12);
+    for (uint i = 0; i < NumLines; ++i) {
+        memcpy(src + 12 + i * (lengthof(Line) - 1), Line, lengthof(Line) - 1);
+    }
+    src[len - 1] = '}';
+    src[len] = '\0';
+
+    static MessageStream om;
+    uint nCompiles = 0, nFailed = 0;
+
+    double const t0 = NowSeconds();
+    for (uint perm = 0; perm < NumValues * NumValues * NumValues; ++perm) {
+        SpecConstantDecl const decls[] = {
+            { "QUALITY", 0, perm % NumValues },
+            { "LIGHTS",  1, perm / NumValues % NumValues },
+            { "SHADOWS", 2, perm / (NumValues * NumValues) },
+        };
+        SpecializationInfo spec;
+        CompileOptions options;
+        options.specConstants = { decls, lengthof(decls) };
+        options.pSpecInfo = &spec;
+        om.clear();
+        Compile({ src, len }, &om, &options);
+        Specialize(spec, { }, &om);
+        nCompiles += 1;
+        nFailed += om.size();
+    }
+    double const t1 = NowSeconds();
+
+    static const SpecConstantDecl Decls[] = { { "QUALITY", 0, 0 }, { "LIGHTS", 1, 0 }, { "SHADOWS", 2, 0 } };
+    SpecializationInfo spec;
+    CompileOptions options;
+    options.specConstants = { Decls, lengthof(Decls) };
+    options.pSpecInfo = &spec;
+    om.clear();
+    Compile({ src, len }, &om, &options);
+    uint nSpecCompiles = 1, nSpecFailed = om.size();
+    for (uint perm = 0; perm < NumValues * NumValues * NumValues; ++perm) {
+        int64_t const values[] = { perm % NumValues, perm / NumValues % NumValues, perm / (NumValues * NumValues) };
+        om.clear();
+        Specialize(spec, { values, lengthof(values) }, &om);
+        nSpecFailed += om.size();
+    }
+    double const t2 = NowSeconds();
+    Deallocate(src);
+
+    printf("%-22s %8.2f ms  %3u compiles  (%u failed asserts)\n", "compile per permutation", (t1 - t0) * 1e3, nCompiles, nFailed);
+    printf("%-22s %8.2f ms  %3u compiles  (%u failed asserts)\n", "specialize", (t2 - t1) * 1e3, nSpecCompiles, nSpecFailed);
+}
+
+/*
+    64 variants sharing a 2000-line prelude and differing in a few final lines: compiling each variant
+    whole, versus compiling the prelude once and only the suffix per variant.
+**/
+static void
+BenchSharedPrefix()
+{
+    puts(__FUNCTION__);
+    static const char Line[] = "        static_assert((7 * 2 + 3) * (1 ? 3 : 1) != 1000 && 5 - 2 != 99);\n";
+    enum { NumLines = 2000, NumVariants = 64 };
+    uint const prefixLen = 12 + NumLines * (lengthof(Line) - 1);
+    char *src = Allocate<char>(prefixLen + 64 + 1);
+    memcpy(src, "void main(){", 12);
+    for (uint i = 0; i < NumLines; ++i) {
+        memcpy(src + 12 + i * (lengthof(Line) - 1), Line, lengthof(Line) - 1);
+    }
+
+    static MessageStream om;
+    uint nFailed = 0, nBytes = 0;
+
+    double const t0 = NowSeconds();
+    for (uint v = 0; v < NumVariants; ++v) {
+        int const suffixLen = snprintf(src + prefixLen, 64, "static_assert(%u != 63);}", v);
+        om.clear();
+        Compile({ src, prefixLen + suffixLen }, &om);
+        nFailed += om.size();
+        nBytes += prefixLen + suffixLen;
+    }
+    double const t1 = NowSeconds();
+
+    uint nPrefixFailed = 0, nSuffixBytes = 0;
+    src[prefixLen] = '\0';
+    CompilePrefixState prefix;
+    om.clear();
+    CompilePrefix({ src, prefixLen }, &om, nullptr, &prefix);
+    nPrefixFailed += om.size();
+    for (uint v = 0; v < NumVariants; ++v) {
+        char suffix[64];
+        int const suffixLen = snprintf(suffix, sizeof(suffix), "static_assert(%u != 63);}", v);
+        om.clear();
+        CompileSuffix(prefix, { suffix, uint(suffixLen) }, &om);
+        nPrefixFailed += om.size();
+        nSuffixBytes += suffixLen;
+    }
+    double const t2 = NowSeconds();
+    Deallocate(src);
+
+    printf("%-22s %8.2f ms  %8u bytes compiled  (%u failed asserts)\n", "whole variants", (t1 - t0) * 1e3, nBytes, nFailed);
+    printf("%-22s %8.2f ms  %8u bytes compiled  (%u failed asserts)\n", "prefix + suffixes", (t2 - t1) * 1e3,
+        prefixLen + nSuffixBytes, nPrefixFailed);
+}
+
+/*
+    1000 shaders, each including the same 40 guarded headers twice, as a build does. Only the first include
+    of each header reads and scans it; the rest are cache hits, or skipped by the guard.
+**/
+static void
+BenchIncludeCache()
+{
+    puts(__FUNCTION__);
+    enum { NumHeaders = 40, NumShaders = 1000, NumHeaderLines = 200 };
+    char dir[] = "/tmp/vkc_bench_XXXXXX";
+    if (!mkdtemp(dir)) {
+        puts("skipped, no temp dir");
+        return;
+    }
+    char path[512];
+    for (uint h = 0; h < NumHeaders; ++h) {
+        snprintf(path, sizeof(path), "%s/h%u.h", dir, h);
+        FILE *const fp = fopen(path, "wb");
+        fprintf(fp, "#ifndef H%u_H\n#define H%u_H\n", h, h);
+        for (uint i = 0; i < NumHeaderLines; ++i) {
+            fprintf(fp, "#define H%u_CONST_%u (%u * 2 + 1) // a comment to scan past\n", h, i, i);
+        }
+        fputs("#endif\n", fp);
+        fclose(fp);
+    }
+
+    Array<char> src;
+    for (uint pass = 0; pass < 2; ++pass) {
+        for (uint h = 0; h < NumHeaders; ++h) {
+            char line[64];
+            int const n = snprintf(line, sizeof(line), "#include \"h%u.h\"\n", h);
+            src.push_n(line, uint(n));
+        }
+    }
+    static const char Body[] = "void main(){ static_assert(H0_CONST_7 == 15); }";
+    src.push_n(Body, lengthof(Body)); // with its '\0'
+
+    snprintf(path, sizeof(path), "%s/main.c", dir);
+    PreprocessOptions options;
+    options.path = path;
+    static MessageStream om;
+    IncludeCacheStats const before = GetIncludeCacheStats();
+    uint nTokens = 0;
+    double const t0 = NowSeconds();
+    for (uint s = 0; s < NumShaders; ++s) {
+        Array<Token> tokens;
+        om.clear();
+        Preprocess({ src.data(), src.size() - 1 }, &om, &options, &tokens);
+        nTokens += tokens.size();
+    }
+    double const t1 = NowSeconds();
+    IncludeCacheStats const after = GetIncludeCacheStats();
+    ClearIncludeCache();
+
+    printf("%-22s %8.2f ms  %llu hits, %llu misses, %llu skipped, %.1f MB not read or scanned  (%u tokens)\n",
+        "preprocess", (t1 - t0) * 1e3, (unsigned long long)(after.nHits - before.nHits),
+        (unsigned long long)(after.nMisses - before.nMisses), (unsigned long long)(after.nSkipped - before.nSkipped),
+        (after.bytesSaved - before.bytesSaved) * 1e-6, nTokens);
+
+    // The same headers as a precompiled module, mapped as each worker would after the library was built once:
+    char modulePath[512];
+    snprintf(modulePath, sizeof(modulePath), "%s/lib.vkcm", dir);
+    Array<char> moduleSrc; // the includes without the body, '\0'-terminated for the scanner
+    moduleSrc.push_n(src.data(), src.size() - lengthof(Body));
+    moduleSrc.push('\0');
+    om.clear();
+    WritePrecompiledModule({ moduleSrc.data(), moduleSrc.size() - 1 }, &om, &options, modulePath);
+    ClearIncludeCache();
+    double const t2 = NowSeconds();
+    const PrecompiledModule *const mod = MapPrecompiledModule(modulePath);
+    double const t3 = NowSeconds();
+    PreprocessOptions moduleOptions = options;
+    moduleOptions.module = mod;
+    uint nModuleTokens = 0;
+    for (uint s = 0; s < NumShaders; ++s) {
+        Array<Token> tokens;
+        om.clear();
+        Preprocess({ src.data(), src.size() - 1 }, &om, &moduleOptions, &tokens);
+        nModuleTokens += tokens.size();
+    }
+    double const t4 = NowSeconds();
+    UnmapPrecompiledModule(mod);
+    remove(modulePath);
+
+    printf("%-22s %8.2f ms  (map %.1f us, %u tokens)\n", "preprocess with module", (t4 - t3) * 1e3, (t3 - t2) * 1e6, nModuleTokens);
+
+    for (uint h = 0; h < NumHeaders; ++h) {
+        snprintf(path, sizeof(path), "%s/h%u.h", dir, h);
+        remove(path);
+    }
+    remove(dir);
+}
+
+/*
+    A generated compute shader's worth of functions with comments: finding the top-level blocks with the
+    structural pre-scan, versus tokenizing everything, which a split on tokens would need first.
+**/
+static void
+BenchStructuralIndex()
+{
+    puts(__FUNCTION__);
+    static const char Function[] =
+        "// helper, generated\n"
+        "void f(){\n"
+        "    static_assert(t_123 * 45 + ~v_6 & 0 == 18446744073709551615 ^ x | 1); /* keep */\n"
+        "    { static_assert(a * b == c); }\n"
+        "}\n";
+    enum { NumFunctions = 40'000 };
+    uint const len = NumFunctions * (lengthof(Function) - 1);
+    char *src = Allocate<char>(len + 1);
+    for (uint i = 0; i < NumFunctions; ++i) {
+        memcpy(src + i * (lengthof(Function) - 1), Function, lengthof(Function) - 1);
+    }
+    src[len] = '\0';
+
+    StructuralIndex index;
+    double const t0 = NowSeconds();
+    BuildStructuralIndex({ src, len }, &index);
+    double const t1 = NowSeconds();
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u blocks)\n", "structural index", (t1 - t0) * 1e3, len / (t1 - t0) * 1e-6,
+        index.blocks.size());
+
+    BenchScanVariant<ScanFeatures_Full>("tokenize", { src, len });
+    Deallocate(src);
+}
+
+/*
+    SPIR-V read, validate and disassemble throughput, over a module linked from SpvSections the way the emitter
+    will produce them. Also a gate: the module must validate and have exactly the expected number of words, so a
+    change in what a section or the link step emits shows up here.
+**/
+enum { SpvBenchFunctions = 4096, SpvBenchAddsPerFunction = 60 };
+enum : SpvId { SpvBenchInt = 1, SpvBenchVoid = 2, SpvBenchFnType = 3, SpvBenchOne = 4, SpvBenchFirstLocal = 5 };
+
+static const uint32_t SpvBenchPrologue[] = {
+    2 << 16 | SpvOp_Capability, 1,                        // Shader
+    3 << 16 | SpvOp_MemoryModel, 0, 1,                    // Logical GLSL450
+    4 << 16 | SpvOp_TypeInt, SpvBenchInt, 32, 1,
+    2 << 16 | SpvOp_TypeVoid, SpvBenchVoid,
+    3 << 16 | SpvOp_TypeFunction, SpvBenchFnType, SpvBenchVoid,
+    4 << 16 | SpvOp_Constant, SpvBenchInt, SpvBenchOne, 1,
+};
+
+static void
+EmitSpvBenchFunction(SpvSection *s)
+{
+    SpvId const fn = SpvSection_NewLocalId(s);
+    SpvSection_PushOp(s, SpvOp_Function, 5);
+    SpvSection_PushWord(s, SpvBenchVoid);
+    SpvSection_PushLocalId(s, fn);
+    SpvSection_PushWord(s, 0);
+    SpvSection_PushWord(s, SpvBenchFnType);
+    SpvSection_PushOp(s, SpvOp_Label, 2);
+    SpvSection_PushLocalId(s, SpvSection_NewLocalId(s));
+    SpvId prev = SpvSection_NewLocalId(s);
+    SpvSection_PushOp(s, SpvOp_IAdd, 5);
+    SpvSection_PushWord(s, SpvBenchInt);
+    SpvSection_PushLocalId(s, prev);
+    SpvSection_PushWord(s, SpvBenchOne);
+    SpvSection_PushWord(s, SpvBenchOne);
+    for (uint i = 1; i < SpvBenchAddsPerFunction; ++i) {
+        SpvId const sum = SpvSection_NewLocalId(s);
+        SpvSection_PushOp(s, SpvOp_IAdd, 5);
+        SpvSection_PushWord(s, SpvBenchInt);
+        SpvSection_PushLocalId(s, sum);
+        SpvSection_PushLocalId(s, prev);
+        SpvSection_PushWord(s, SpvBenchOne);
+        prev = sum;
+    }
+    SpvSection_PushOp(s, SpvOp_Return, 1);
+    SpvSection_PushOp(s, SpvOp_FunctionEnd, 1);
+}
+
+static void
+CountSpvText(void *user, const char *text, uint nBytes)
+{
+    (void)text;
+    *static_cast<uint64_t *>(user) += nBytes;
+}
+
+static bool
+BenchSpvReader()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> module;
+    uint32_t *header = module.uninitialized_push_n(sizeof(SpvHeader) / sizeof(uint32_t));
+    module.push_n(SpvBenchPrologue, lengthof(SpvBenchPrologue));
+    SpvId bound = SpvBenchFirstLocal;
+    for (uint k = 0; k < SpvBenchFunctions; ++k) { // one section at a time, linked as it's done
+        SpvSection section;
+        EmitSpvBenchFunction(&section);
+        const SpvSection *const one = &section;
+        bound = SpvLinkSections({ &one, 1 }, bound, &module);
+    }
+    header = module.data();
+    header[0] = SpvMagic;
+    header[1] = 0x00010300;
+    header[2] = 0;
+    header[3] = bound;
+    header[4] = 0;
+
+    bool bOk = true;
+    uint const expectedWords = 5 + lengthof(SpvBenchPrologue) + SpvBenchFunctions * (5 + 2 + 5 * SpvBenchAddsPerFunction + 1 + 1);
+    if (module.size() != expectedWords) {
+        printf("FAILED: module has %u words, %u expected\n", module.size(), expectedWords);
+        bOk = false;
+    }
+    view<const uint32_t> const words = { module.data(), module.size() };
+    double const mb = module.size() * sizeof(uint32_t) * 1e-6;
+
+    enum { Reps = 5 };
+    double tRead = 1e9, tValidate = 1e9, tDisassemble = 1e9;
+    uint nInstructions = 0;
+    uint64_t nTextBytes = 0;
+    for (uint rep = 0; rep < Reps; ++rep) {
+        double const t0 = NowSeconds();
+        SpvReader r;
+        const SpvHeader *h;
+        SpvInstruction inst;
+        nInstructions = 0;
+        if (!SpvReader_Begin(&r, words, &h)) {
+            printf("FAILED: no module header\n");
+            bOk = false;
+            break;
+        }
+        while (SpvReader_Next(&r, &inst)) {
+            nInstructions += 1;
+        }
+        double const t1 = NowSeconds();
+        SpvValidationError error;
+        if (!SpvValidate(words, &error)) {
+            printf("FAILED: invalid module at word %u: %s\n", error.wordOffset, error.what);
+            bOk = false;
+            break;
+        }
+        double const t2 = NowSeconds();
+        nTextBytes = 0;
+        SpvDisassemble(words, CountSpvText, &nTextBytes);
+        double const t3 = NowSeconds();
+        tRead = Min(tRead, t1 - t0);
+        tValidate = Min(tValidate, t2 - t1);
+        tDisassemble = Min(tDisassemble, t3 - t2);
+    }
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u instructions)\n", "spv read", tRead * 1e3, mb / tRead, nInstructions);
+    printf("%-22s %7.2f ms  %6.0f MB/s\n", "spv validate", tValidate * 1e3, mb / tValidate);
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%.1f MB of text)\n", "spv disassemble", tDisassemble * 1e3, mb / tDisassemble,
+        nTextBytes * 1e-6);
+    return bOk;
+}
+
+/*
+    Linking a library split into modules: each exports one function by name and imports the previous module's,
+    and all of them declare the same int type, function type and constant, which the link deduplicates.
+    Also a gate on the linked module: it must validate and have exactly the expected number of words.
+**/
+enum { SpvLinkBenchModules = 512, SpvLinkBenchFunctions = 16, SpvLinkBenchAdds = 24 };
+
+static void
+PushSpvLinkBenchName(Array<uint32_t> *m, uint k) // "f" and 4 hex digits, 2 words
+{
+    static const char Hex[] = "0123456789abcdef";
+    char name[8] = { 'f', Hex[k >> 12 & 15], Hex[k >> 8 & 15], Hex[k >> 4 & 15], Hex[k & 15] };
+    uint32_t words[2];
+    memcpy(words, name, sizeof(words));
+    m->push_n(words, 2);
+}
+
+static void
+BuildSpvLinkBenchModule(uint k, Array<uint32_t> *m)
+{
+    enum : SpvId { Int = 1, FnType = 2, One = 3, Exported = 4, Imported = 5, FirstLocal = 6 };
+    SpvId next = FirstLocal;
+    m->clear();
+    uint32_t const prologue[] = {
+        SpvMagic, 0x00010300, 0, 0, 0,
+        2 << 16 | 17, 1,
+        2 << 16 | 17, 5,
+        3 << 16 | 14, 0, 1,
+        6 << 16 | 71, Exported, 41,
+    };
+    m->push_n(prologue, lengthof(prologue));
+    PushSpvLinkBenchName(m, k);
+    m->push(0); // Export
+    if (k) {
+        uint32_t const decorate[] = { 6 << 16 | 71, Imported, 41 };
+        m->push_n(decorate, lengthof(decorate));
+        PushSpvLinkBenchName(m, k - 1);
+        m->push(1); // Import
+    }
+    uint32_t const types[] = {
+        4 << 16 | 21, Int, 32, 1,
+        4 << 16 | 33, FnType, Int, Int,
+        4 << 16 | 43, Int, One, 1,
+    };
+    m->push_n(types, lengthof(types));
+    if (k) {
+        uint32_t const declaration[] = { 5 << 16 | 54, Int, Imported, 0, FnType, 3 << 16 | 55, Int, next++, 1 << 16 | 56 };
+        m->push_n(declaration, lengthof(declaration));
+    }
+    for (uint f = 0; f < SpvLinkBenchFunctions; ++f) {
+        SpvId const param = next + 1;
+        uint32_t const begin[] = { 5 << 16 | 54, Int, f == 0 ? uint32_t(Exported) : next, 0, FnType, 3 << 16 | 55, Int, param, 2 << 16 | 248, param + 1 };
+        m->push_n(begin, lengthof(begin));
+        next += 3;
+        SpvId prev = param;
+        for (uint i = 0; i < SpvLinkBenchAdds; ++i) {
+            uint32_t const add[] = { 5 << 16 | 128, Int, next, prev, One };
+            m->push_n(add, lengthof(add));
+            prev = next++;
+        }
+        if (f == 0 && k) {
+            uint32_t const call[] = { 5 << 16 | 57, Int, next, Imported, prev };
+            m->push_n(call, lengthof(call));
+            prev = next++;
+        }
+        uint32_t const end[] = { 2 << 16 | 254, prev, 1 << 16 | 56 };
+        m->push_n(end, lengthof(end));
+    }
+    (*m)[3] = next;
+}
+
+static bool
+BenchSpvLink()
+{
+    puts(__FUNCTION__);
+    uint32_t *offsets = Allocate<uint32_t>(SpvLinkBenchModules + 1);
+    Array<uint32_t> all, module;
+    for (uint k = 0; k < SpvLinkBenchModules; ++k) {
+        BuildSpvLinkBenchModule(k, &module);
+        offsets[k] = all.size();
+        all.push_n(module.data(), module.size());
+    }
+    offsets[SpvLinkBenchModules] = all.size();
+    view<const uint32_t> *const modules = Allocate<view<const uint32_t>>(SpvLinkBenchModules);
+    for (uint k = 0; k < SpvLinkBenchModules; ++k) {
+        modules[k] = { all.data() + offsets[k], offsets[k + 1] - offsets[k] };
+    }
+    double const mb = all.size() * sizeof(uint32_t) * 1e-6;
+
+    enum { Reps = 5 };
+    double tLink = 1e9;
+    Array<uint32_t> out;
+    bool bOk = true;
+    for (uint rep = 0; rep < Reps && bOk; ++rep) {
+        double const t0 = NowSeconds();
+        SpvLinkError error;
+        if (!SpvLinkModules({ modules, SpvLinkBenchModules }, &error, &out)) {
+            printf("FAILED: link error in module %u at word %u: %s\n", error.moduleIndex, error.wordOffset, error.what);
+            bOk = false;
+        }
+        tLink = Min(tLink, NowSeconds() - t0);
+    }
+    SpvValidationError error;
+    if (bOk && !SpvValidate({ out.data(), out.size() }, &error)) {
+        printf("FAILED: linked module invalid at word %u: %s\n", error.wordOffset, error.what);
+        bOk = false;
+    }
+    uint const functionWords = 5 + 3 + 2 + 5 * SpvLinkBenchAdds + 2 + 1;
+    uint const expectedWords = 5 + 2 + 3 + 12 + SpvLinkBenchModules * SpvLinkBenchFunctions * functionWords + (SpvLinkBenchModules - 1) * 5;
+    if (bOk && out.size() != expectedWords) {
+        printf("FAILED: linked module has %u words, %u expected\n", out.size(), expectedWords);
+        bOk = false;
+    }
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u modules, %.1f MB in, %.1f MB out)\n", "spv link", tLink * 1e3, mb / tLink,
+        SpvLinkBenchModules, mb, out.size() * sizeof(uint32_t) * 1e-6);
+    Deallocate(modules);
+    Deallocate(offsets);
+    return bOk;
+}
+
+/*
+    256x256 constant tables through the constant pool: one of hashed bytes, whose rows are all different but whose
+    elements are 256 distinct values, and one tiled every 16 rows. Against the words of emitting every element and
+    row as its own constant, and the compile's peak memory, which should follow the pool rather than the table.
+**/
+static bool
+BenchConstantTable(const char *name, uint rowPeriod)
+{
+    enum { Side = 256, Reps = 5 };
+    Array<char> source;
+    source.push_n("void main(){\nconstexpr int Table[256][256] = {\n", 47);
+    for (uint i = 0; i < Side; ++i) {
+        source.push('{');
+        for (uint j = 0; j < Side; ++j) {
+            char number[16];
+            uint32_t h = (i % rowPeriod) * 0x9e3779b1u ^ j * 0x85ebca6bu;
+            h ^= h >> 15;
+            source.push_n(number, snprintf(number, sizeof(number), "%u,", (h * 0xc2b2ae35u) >> 24));
+        }
+        source.push_n("},\n", 3);
+    }
+    source.push_n("};\n}\0", 6);
+
+    double best = 1e30;
+    int64_t peak = 0;
+    SpvPool pool;
+    bool bOk = true;
+    for (uint rep = 0; rep < Reps && bOk; ++rep) {
+        SpvPool_Clear(&pool);
+        CompileOptions options;
+        options.scanFeatures = ScanFeatures_MachineGenerated;
+        options.pConstantPool = &pool;
+        options.pPeakBytes = rep == 0 ? &peak : nullptr; // the pool's growth counts only while it is new
+        MessageStream om;
+        double const t0 = NowSeconds();
+        bOk = Compile({ source.data(), source.size() - 1 }, &om, &options) == CompileResult_Ok;
+        best = Min(best, NowSeconds() - t0);
+    }
+    if (!bOk) {
+        printf("FAILED: %s did not compile\n", name);
+        return false;
+    }
+    uint const naiveWords = Side * Side * 4 + Side * (3 + Side) + 3 + Side;
+    printf("%-22s %7.2f ms  %5.1f M elements/s  (%u words, %.1f%% of one constant per element, peak %.0f KB)\n", name,
+        best * 1e3, Side * Side / best * 1e-6, pool.words.size(), 100.0 * pool.words.size() / naiveWords, peak / 1024.0);
+    return true;
+}
+
+static bool
+BenchConstantArrays()
+{
+    puts(__FUNCTION__);
+    bool bOk = true;
+    bOk &= BenchConstantTable("hashed bytes", 256);
+    bOk &= BenchConstantTable("tiled every 16 rows", 16);
+    return bOk;
+}
+
+/*
+    Liveness and reaching definitions on a 10k-block graph shaped like a heavily unrolled loop: a chain of
+    if/else diamonds under one loop header, with an inner loop back edge every few iterations. For liveness every
+    block defines two values and uses two of the last few dozen blocks' that dominate it, and every 64th block's
+    value is carried around the outer loop, so the sets are small next to the 20k bits. Each problem is solved with dense and with sparse sets, which must agree.
+**/
+enum { FlowBenchBlocks = 10000, FlowBenchWindow = 48, FlowBenchInnerLoop = 8, FlowBenchVariables = 512 };
+
+struct FlowBenchPolicy {
+    uint nBits;
+    const Array<uint32_t> *genBegin, *gen, *killBegin, *kill;
+
+    view<const uint32_t> Gen(uint b) const { return { gen->data() + genBegin->data()[b], genBegin->data()[b + 1] - genBegin->data()[b] }; }
+    view<const uint32_t> Kill(uint b) const { return { kill->data() + killBegin->data()[b], killBegin->data()[b + 1] - killBegin->data()[b] }; }
+};
+
+template<FlowDirection Direction>
+struct FlowBenchUnion : FlowBenchPolicy {
+    static constexpr FlowDirection direction = Direction;
+    static constexpr FlowMeet meet = FlowMeet_Union;
+};
+
+template<class Policy> static bool
+BenchSolve(const char *name, const FlowGraph *g, const Policy& policy)
+{
+    enum { Reps = 3 };
+    FlowOptions options, sparseOptions;
+    options.maxDenseBytes = uint64_t(1) << 30;
+    sparseOptions.maxDenseBytes = 0;
+    FlowSolution dense, sparse;
+    double tDense = 1e9, tSparse = 1e9;
+    for (uint rep = 0; rep < Reps; ++rep) {
+        double const t0 = NowSeconds();
+        SolveDataflow(g, policy, options, &dense);
+        double const t1 = NowSeconds();
+        SolveDataflow(g, policy, sparseOptions, &sparse);
+        tDense = Min(tDense, t1 - t0);
+        tSparse = Min(tSparse, NowSeconds() - t1);
+    }
+    bool bOk = !dense.bSparse && sparse.bSparse;
+    uint64_t nBits = 0;
+    Array<uint32_t> a, b;
+    for (uint block = 0; block < g->nBlocks && bOk; ++block) {
+        for (int bOut = 0; bOut < 2 && bOk; ++bOut) {
+            FlowSolution_GetSet(&dense, block, bOut, &a);
+            FlowSolution_GetSet(&sparse, block, bOut, &b);
+            bOk = a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(uint32_t)) == 0;
+            nBits += a.size();
+        }
+    }
+    printf("%-22s %7.2f ms dense  %7.2f ms sparse  (%u blocks, %u bits, %.1f visits per block, %.0f bits per set)%s\n",
+        name, tDense * 1e3, tSparse * 1e3, g->nBlocks, policy.nBits, double(dense.nSweeps) / g->nBlocks,
+        double(nBits) / (2 * g->nBlocks), bOk ? "" : "  FAILED: dense and sparse differ");
+    return bOk;
+}
+
+static bool
+BenchDataflow()
+{
+    puts(__FUNCTION__);
+    // Block 0 is the outer loop header, then diamonds: condition, then, else, join.
+    uint const nDiamonds = (FlowBenchBlocks - 2) / 4;
+    uint const nBlocks = 2 + 4 * nDiamonds; // the last is the exit
+    Array<uint32_t> edges;
+    auto const Edge = [&](uint from, uint to) {
+        edges.push(from);
+        edges.push(to);
+    };
+    for (uint d = 0; d < nDiamonds; ++d) {
+        uint const cond = 1 + 4 * d;
+        Edge(cond == 1 ? 0 : cond - 1, cond);
+        Edge(cond, cond + 1);
+        Edge(cond, cond + 2);
+        Edge(cond + 1, cond + 3);
+        Edge(cond + 2, cond + 3);
+        if (d % FlowBenchInnerLoop == FlowBenchInnerLoop - 1) {
+            Edge(cond + 3, cond - 4 * (FlowBenchInnerLoop - 1));
+        }
+    }
+    Edge(nBlocks - 2, 0);
+    Edge(0, nBlocks - 1);
+    FlowGraph g;
+    FlowGraph_Build(&g, nBlocks, 0, { edges.data(), edges.size() });
+
+    // Block b defines 2b and 2b + 1.
+    uint32_t rng = 12345;
+    Array<uint32_t> genBegin, gen, killBegin, kill, uses;
+    for (uint b = 0; b < nBlocks; ++b) {
+        genBegin.push(gen.size());
+        killBegin.push(kill.size());
+        kill.push(2 * b);
+        kill.push(2 * b + 1);
+        uses.clear();
+        for (uint i = 0; i < 2 && b > 1; ++i) {
+            uint from = b - 1 - BenchRandNext(&rng) % Min<uint>(b - 1, FlowBenchWindow);
+            from -= from % 4 == 2 ? 1 : from % 4 == 3 ? 2 : 0; // then and else only dominate themselves
+            uses.push(2 * from + (BenchRandNext(&rng) & 1));
+        }
+        if (b == 0) {
+            for (uint carried = 64; carried + 1 < nBlocks; carried += 64) {
+                uses.push(2 * carried);
+            }
+        }
+        std::sort(uses.begin(), uses.end());
+        uses.set_size(uint(std::unique(uses.begin(), uses.end()) - uses.begin()));
+        gen.push_n(uses.data(), uses.size());
+    }
+    genBegin.push(gen.size());
+    killBegin.push(kill.size());
+
+    FlowBenchPolicy const base = { 2 * nBlocks, &genBegin, &gen, &killBegin, &kill };
+    bool bOk = BenchSolve("dataflow liveness", &g, FlowBenchUnion<Flow_Backward>{ base });
+
+    // Reaching definitions: block b assigns variable b % FlowBenchVariables, killing its other assignments.
+    // The then and else blocks assign nothing.
+    Array<uint32_t> defBegin, def, otherBegin, other;
+    for (uint b = 0; b < nBlocks; ++b) {
+        defBegin.push(def.size());
+        otherBegin.push(other.size());
+        if (b % 4 == 2 || b % 4 == 3) {
+            continue;
+        }
+        def.push(b);
+        for (uint d = b % FlowBenchVariables; d < nBlocks; d += FlowBenchVariables) {
+            if (d != b && d % 4 != 2 && d % 4 != 3) other.push(d);
+        }
+    }
+    defBegin.push(def.size());
+    otherBegin.push(other.size());
+    FlowBenchPolicy const defs = { nBlocks, &defBegin, &def, &otherBegin, &other };
+    bOk &= BenchSolve("dataflow reaching defs", &g, FlowBenchUnion<Flow_Forward>{ defs });
+    return bOk;
+}
+
+/*
+    Loop unrolling over a module of the loops in TestSpvUnroll(), summing squares: every other one runs 16 times and
+    is unrolled fully and folded away, the others run 512 times and are unrolled by 8.
+**/
+enum { SpvUnrollBenchLoops = 4096, SpvUnrollBenchIds = 12 };
+
+static void
+BuildSpvUnrollBenchModule(Array<uint32_t> *pOut)
+{
+    uint32_t const globals[] = {
+        SpvMagic, 0x00010000, 0, 8 + SpvUnrollBenchIds * SpvUnrollBenchLoops, 0,
+        2 << 16 | 17, 1,                         // OpCapability Shader
+        3 << 16 | 14, 0, 1,                      // OpMemoryModel Logical GLSL450
+        4 << 16 | 21, 1, 32, 1,                  // %1 = OpTypeInt 32 1
+        2 << 16 | 20, 2,                         // %2 = OpTypeBool
+        3 << 16 | 33, 3, 1,                      // %3 = OpTypeFunction %1
+        4 << 16 | 43, 1, 4, 0,                   // %4 = OpConstant %1 0
+        4 << 16 | 43, 1, 5, 1,                   // %5 = OpConstant %1 1
+        4 << 16 | 43, 1, 6, 16,                  // %6 = OpConstant %1 16
+        4 << 16 | 43, 1, 7, 512,                 // %7 = OpConstant %1 512
+    };
+    pOut->clear();
+    pOut->push_n(globals, lengthof(globals));
+    for (uint k = 0; k < SpvUnrollBenchLoops; ++k) {
+        uint32_t const f = 8 + SpvUnrollBenchIds * k; // then entry, header, i, sum, compare, merge, cont, body, ...
+        uint32_t const function[] = {
+            5 << 16 | 54, 1, f, 0, 3,
+            2 << 16 | 248, f + 1,
+            2 << 16 | 249, f + 2,
+            2 << 16 | 248, f + 2,
+            7 << 16 | 245, 1, f + 3, 4, f + 1, f + 10, f + 7,
+            7 << 16 | 245, 1, f + 4, 4, f + 1, f + 11, f + 7,
+            5 << 16 | 177, 2, f + 5, f + 3, k & 1 ? 7u : 6u,
+            4 << 16 | 246, f + 6, f + 7, 0,
+            4 << 16 | 250, f + 5, f + 8, f + 6,
+            2 << 16 | 248, f + 8,
+            5 << 16 | 132, 1, f + 9, f + 3, f + 3,
+            2 << 16 | 249, f + 7,
+            2 << 16 | 248, f + 7,
+            5 << 16 | 128, 1, f + 10, f + 3, 5,
+            5 << 16 | 128, 1, f + 11, f + 4, f + 9,
+            2 << 16 | 249, f + 2,
+            2 << 16 | 248, f + 6,
+            2 << 16 | 254, f + 4,
+            1 << 16 | 56,
+        };
+        pOut->push_n(function, lengthof(function));
+    }
+}
+
+static bool
+BenchSpvUnroll()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> module, out;
+    BuildSpvUnrollBenchModule(&module);
+    double const mb = module.size() * sizeof(uint32_t) * 1e-6;
+
+    enum { Reps = 5 };
+    double tUnroll = 1e9;
+    SpvUnrollReport report;
+    bool bOk = true;
+    for (uint rep = 0; rep < Reps && bOk; ++rep) {
+        double const t0 = NowSeconds();
+        bOk = SpvUnrollLoops({ module.data(), module.size() }, SpvUnrollOptions(), &out, &report);
+        tUnroll = Min(tUnroll, NowSeconds() - t0);
+    }
+    uint nFull = 0, nPartial = 0;
+    for (const SpvUnrollLoop& loop : report.loops) {
+        nFull += loop.decision == SpvUnroll_Full;
+        nPartial += loop.decision == SpvUnroll_Partial && loop.factor == 8;
+    }
+    SpvValidationError error;
+    if (!bOk || !SpvValidate({ out.data(), out.size() }, &error)) {
+        printf("FAILED: unrolled module invalid at word %u: %s\n", bOk ? error.wordOffset : 0, bOk ? error.what : "input");
+        bOk = false;
+    }
+    if (bOk && (nFull != SpvUnrollBenchLoops / 2 || nPartial != SpvUnrollBenchLoops / 2)) {
+        printf("FAILED: %u loops unrolled fully and %u by 8, %u each expected\n", nFull, nPartial, SpvUnrollBenchLoops / 2);
+        bOk = false;
+    }
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u loops, %.1f MB in, %.1f MB out, %+d instructions)\n", "spv unroll",
+        tUnroll * 1e3, mb / tUnroll, SpvUnrollBenchLoops, mb, out.size() * sizeof(uint32_t) * 1e-6,
+        report.instructionDelta);
+    return bOk;
+}
+
+/*
+    SLP vectorization over a module of the first function in TestSpvSlp(), v * s + w one lane at a time: each becomes
+    a vector multiply and add, with s splatted.
+**/
+enum { SpvSlpBenchFunctions = 4096, SpvSlpBenchIds = 18 };
+
+static void
+BuildSpvSlpBenchModule(Array<uint32_t> *pOut)
+{
+    uint32_t const globals[] = {
+        SpvMagic, 0x00010000, 0, 4 + SpvSlpBenchIds * SpvSlpBenchFunctions, 0,
+        2 << 16 | 17, 1,                         // OpCapability Shader
+        3 << 16 | 14, 0, 1,                      // OpMemoryModel Logical GLSL450
+        3 << 16 | 22, 1, 32,                     // %1 = OpTypeFloat 32
+        4 << 16 | 23, 2, 1, 3,                   // %2 = OpTypeVector %1 3
+        6 << 16 | 33, 3, 2, 2, 2, 1,             // %3 = OpTypeFunction %2 %2 %2 %1
+    };
+    pOut->clear();
+    pOut->push_n(globals, lengthof(globals));
+    for (uint k = 0; k < SpvSlpBenchFunctions; ++k) {
+        uint32_t const f = 4 + SpvSlpBenchIds * k; // then v, w, s, the label, 4 per lane and the result
+        uint32_t const header[] = {
+            5 << 16 | 54, 2, f, 0, 3,
+            3 << 16 | 55, 2, f + 1,
+            3 << 16 | 55, 2, f + 2,
+            3 << 16 | 55, 1, f + 3,
+            2 << 16 | 248, f + 4,
+        };
+        pOut->push_n(header, lengthof(header));
+        for (uint32_t j = 0; j < 3; ++j) {
+            uint32_t const x = f + 5 + 4 * j;
+            uint32_t const lane[] = {
+                5 << 16 | 81, 1, x, f + 1, j,
+                5 << 16 | 81, 1, x + 1, f + 2, j,
+                5 << 16 | 133, 1, x + 2, x, f + 3,
+                5 << 16 | 129, 1, x + 3, x + 2, x + 1,
+            };
+            pOut->push_n(lane, lengthof(lane));
+        }
+        uint32_t const end[] = {
+            6 << 16 | 80, 2, f + 17, f + 8, f + 12, f + 16,
+            2 << 16 | 254, f + 17,
+            1 << 16 | 56,
+        };
+        pOut->push_n(end, lengthof(end));
+    }
+}
+
+static bool
+BenchSpvSlp()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> module, out;
+    BuildSpvSlpBenchModule(&module);
+    double const mb = module.size() * sizeof(uint32_t) * 1e-6;
+
+    enum { Reps = 5 };
+    double tSlp = 1e9;
+    SpvSlpReport report;
+    bool bOk = true;
+    for (uint rep = 0; rep < Reps && bOk; ++rep) {
+        double const t0 = NowSeconds();
+        bOk = SpvSlpVectorize({ module.data(), module.size() }, SpvSlpOptions(), &out, &report);
+        tSlp = Min(tSlp, NowSeconds() - t0);
+    }
+    SpvValidationError error;
+    if (!bOk || !SpvValidate({ out.data(), out.size() }, &error)) {
+        printf("FAILED: vectorized module invalid at word %u: %s\n", bOk ? error.wordOffset : 0, bOk ? error.what : "input");
+        bOk = false;
+    }
+    if (bOk && (report.nTrees != SpvSlpBenchFunctions || report.nScalarOps != 6 * SpvSlpBenchFunctions)) {
+        printf("FAILED: %u trees of %u scalar ops, %u of 6 expected\n", report.nTrees, report.nScalarOps,
+            SpvSlpBenchFunctions);
+        bOk = false;
+    }
+    printf("%-22s %7.2f ms  %6.0f MB/s  (%u functions, %.1f MB in, %.1f MB out, %+d instructions)\n", "spv slp",
+        tSlp * 1e3, mb / tSlp, SpvSlpBenchFunctions, mb, out.size() * sizeof(uint32_t) * 1e-6,
+        report.instructionDelta);
+    return bOk;
+}
+
+/*
+    Precision demotion over a module of the function in TestSpvHalf(): each has four values to demote, one constant op
+    to fold, and in 16 bits three conversions. Then the half conversions alone, whichever path is built in against
+    the software one, over every half and back.
+**/
+enum { SpvHalfBenchFunctions = 4096, SpvHalfBenchIds = 22 };
+
+static void
+BuildSpvHalfBenchModule(Array<uint32_t> *pOut)
+{
+    uint32_t const globals[] = {
+        SpvMagic, 0x00010000, 0, 8 + SpvHalfBenchIds * SpvHalfBenchFunctions, 0,
+        2 << 16 | SpvOp_Capability, 1,                  // Shader
+        3 << 16 | SpvOp_MemoryModel, 0, 1,              // Logical GLSL450
+    };
+    pOut->clear();
+    pOut->push_n(globals, lengthof(globals));
+    for (uint k = 0; k < SpvHalfBenchFunctions; ++k) {
+        uint32_t const decorate[] = { 3 << 16 | SpvOp_Decorate, 8 + SpvHalfBenchIds * k + 1, 0 }; // the first parameter
+        pOut->push_n(decorate, lengthof(decorate));
+    }
+    uint32_t const types[] = {
+        3 << 16 | SpvOp_TypeFloat, 1, 32,               // %1 = float
+        2 << 16 | SpvOp_TypeBool, 2,
+        5 << 16 | SpvOp_TypeFunction, 3, 1, 1, 1,       // %3 = float(float, float)
+        4 << 16 | SpvOp_Constant, 1, 4, 0x40000000,     // %4 = 2.0
+        4 << 16 | SpvOp_Constant, 1, 5, 0x3f000000,     // %5 = 0.5
+        4 << 16 | SpvOp_Constant, 1, 6, 0x49742400,     // %6 = 1e6
+        4 << 16 | SpvOp_Constant, 1, 7, 0x42800000,     // %7 = 64.0
+    };
+    pOut->push_n(types, lengthof(types));
+    for (uint k = 0; k < SpvHalfBenchFunctions; ++k) {
+        uint32_t const f = 8 + SpvHalfBenchIds * k; // then the ids of TestSpvHalf()'s from 11, less 10
+        uint32_t const function[] = {
+            5 << 16 | SpvOp_Function, 1, f, 0, 3,
+            3 << 16 | SpvOp_FunctionParameter, 1, f + 1,
+            3 << 16 | SpvOp_FunctionParameter, 1, f + 2,
+            2 << 16 | SpvOp_Label, f + 3,
+            5 << 16 | SpvOp_FMul, 1, f + 4, f + 1, 4,
+            5 << 16 | SpvOp_FMul, 1, f + 5, 4, 5,
+            5 << 16 | SpvOp_FAdd, 1, f + 6, f + 4, f + 5,
+            5 << 16 | SpvOp_FAdd, 1, f + 7, f + 6, f + 2,
+            5 << 16 | SpvOp_FMul, 1, f + 8, f + 6, 6,
+            5 << 16 | SpvOp_FMul, 1, f + 9, 5, 5,
+            5 << 16 | SpvOp_FAdd, 1, f + 10, f + 7, f + 9,
+            2 << 16 | SpvOp_Branch, f + 11,
+            2 << 16 | SpvOp_Label, f + 11,
+            7 << 16 | SpvOp_Phi, 1, f + 12, f + 6, f + 3, f + 15, f + 14,
+            7 << 16 | SpvOp_Phi, 1, f + 13, 4, f + 3, f + 16, f + 14,
+            4 << 16 | SpvOp_LoopMerge, f + 17, f + 14, 0,
+            2 << 16 | SpvOp_Branch, f + 14,
+            2 << 16 | SpvOp_Label, f + 14,
+            5 << 16 | SpvOp_FMul, 1, f + 15, f + 12, 4,
+            5 << 16 | SpvOp_FAdd, 1, f + 16, f + 13, 5,
+            5 << 16 | SpvOp_FOrdLessThan, 2, f + 18, f + 15, 7,
+            4 << 16 | SpvOp_BranchConditional, f + 18, f + 11, f + 17,
+            2 << 16 | SpvOp_Label, f + 17,
+            5 << 16 | SpvOp_FAdd, 1, f + 19, f + 15, f + 16,
+            5 << 16 | SpvOp_FAdd, 1, f + 20, f + 10, f + 8,
+            5 << 16 | SpvOp_FAdd, 1, f + 21, f + 19, f + 20,
+            2 << 16 | SpvOp_ReturnValue, f + 21,
+            1 << 16 | SpvOp_FunctionEnd,
+        };
+        pOut->push_n(function, lengthof(function));
+    }
+}
+
+static bool
+BenchSpvHalf()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> module, out;
+    BuildSpvHalfBenchModule(&module);
+    double const mb = module.size() * sizeof(uint32_t) * 1e-6;
+
+    bool bOk = true;
+    for (uint8_t mode : { SpvHalf_RelaxedPrecision, SpvHalf_Float16 }) {
+        enum { Reps = 5 };
+        double tDemote = 1e9;
+        SpvHalfOptions options;
+        options.mode = mode;
+        SpvHalfReport report;
+        bool bDemoted = true;
+        for (uint rep = 0; rep < Reps && bDemoted; ++rep) {
+            double const t0 = NowSeconds();
+            bDemoted = SpvDemotePrecision({ module.data(), module.size() }, options, &out, &report);
+            tDemote = Min(tDemote, NowSeconds() - t0);
+        }
+        SpvValidationError error;
+        if (!bDemoted || !SpvValidate({ out.data(), out.size() }, &error)) {
+            printf("FAILED: demoted module invalid at word %u: %s\n", bDemoted ? error.wordOffset : 0,
+                bDemoted ? error.what : "input");
+            bOk = false;
+            continue;
+        }
+        uint const nConversions = mode == SpvHalf_Float16 ? 3 : 0;
+        if (report.nDemoted != 4 * SpvHalfBenchFunctions || report.nFolded != SpvHalfBenchFunctions ||
+            report.nConversions != nConversions * SpvHalfBenchFunctions) {
+            printf("FAILED: %u demoted, %u folded, %u conversions; %u, %u and %u expected\n", report.nDemoted,
+                report.nFolded, report.nConversions, 4 * SpvHalfBenchFunctions, SpvHalfBenchFunctions,
+                nConversions * SpvHalfBenchFunctions);
+            bOk = false;
+        }
+        printf("%-22s %7.2f ms  %6.0f MB/s  (%u functions, %.1f MB in, %u demoted, %+d instructions)\n",
+            mode == SpvHalf_Float16 ? "spv half float16" : "spv half relaxed", tDemote * 1e3, mb / tDemote,
+            SpvHalfBenchFunctions, mb, report.nDemoted, report.instructionDelta);
+    }
+
+    enum { Rounds = 64 };
+    double tPath[2] = { 1e9, 1e9 };
+    uint32_t sums[2] = { };
+    for (uint path = 0; path < 2; ++path) {
+        double const t0 = NowSeconds();
+        for (uint round = 0; round < Rounds; ++round) {
+            for (uint h = 0; h < 0x10000; ++h) {
+                uint16_t const x = uint16_t(h ^ round);
+                sums[path] += path ? Half_FromFloatSoft(Half_ToFloatSoft(x) * 1.5f) : Half_FromFloat(Half_ToFloat(x) * 1.5f);
+            }
+        }
+        tPath[path] = NowSeconds() - t0;
+    }
+    if (sums[0] != sums[1]) {
+        printf("FAILED: the half conversion paths disagree\n");
+        bOk = false;
+    }
+    double const nConverted = 2.0 * Rounds * 0x10000;
+    printf("%-22s %7.2f ms  %6.0f M/s   (%s; software %.0f M/s)\n", "half conversions", tPath[0] * 1e3,
+        nConverted / tPath[0] * 1e-6, Half_bF16C ? "F16C" : "software", nConverted / tPath[1] * 1e-6);
+    return bOk;
+}
+
+/*
+    Complexity check, run with "vkc bench complexity [fuzz seconds]".
+
+    Each construct is generated at doubling sizes, and the growth exponent of scan and compile time is fitted
+    over them: t ~ n^k. n log n over these sizes gives k of about 1.1, a quadratic cliff 2, so anything past
+    MaxGrowthExponent fails. Then random inputs are built from source fragments, mutating the ones that reached
+    scanner token pairs or compile outcomes not seen before, and any that takes longer than a per-byte budget fails.
+**/
+enum { ComplexityMinLog2Size = 13, ComplexityMaxLog2Size = 20, ComplexityReps = 3 };
+static constexpr double MaxGrowthExponent = 1.3;
+static constexpr double MinFitSeconds = 20e-6; // shorter runs are mostly timer noise
+
+typedef void (*ComplexityGenFn)(Array<char> *body, uint n); // appends about n bytes of function body
+
+static void
+ComplexityAppend(Array<char> *body, const char *s)
+{
+    body->push_n(s, uint(strlen(s)));
+}
+
+static void
+GenBlockComment(Array<char> *body, uint n)
+{
+    ComplexityAppend(body, "/*");
+    for (uint i = 0; i < n; ++i) {
+        body->push(i % 64 == 63 ? '\n' : 'x');
+    }
+    ComplexityAppend(body, "*/ static_assert(1);");
+}
+
+static void
+GenLineComments(Array<char> *body, uint n)
+{
+    while (body->size() < n) {
+        ComplexityAppend(body, "// static_assert(0); a comment, not code\n");
+    }
+}
+
+static void
+GenLongExpression(Array<char> *body, uint n)
+{
+    ComplexityAppend(body, "static_assert(1");
+    while (body->size() < n) {
+        ComplexityAppend(body, " + 2 * 3 - (4 ^ 4)");
+    }
+    ComplexityAppend(body, " != 0);");
+}
+
+static void
+GenNestedExpressions(Array<char> *body, uint n)
+{
+    while (body->size() < n) {
+        ComplexityAppend(body, "static_assert(((((((((((1 + 1) * 2) - 1) | 8) & 15) ^ 3) == 14) ? 5 : 6) != 0)));\n");
+    }
+}
+
+// Declarations of every type keyword a function body takes, each under its own name.
+static void
+GenKeywords(Array<char> *body, uint n)
+{
+    for (uint i = 0; body->size() < n; ++i) {
+        char line[160];
+        snprintf(line, sizeof line, "constexpr bool b%u = 1; constexpr char c%u = 2; constexpr short s%u = 3; "
+            "constexpr int i%u = 4; constexpr long l%u = 5; static_assert(b%u);\n", i, i, i, i, i, i);
+        ComplexityAppend(body, line);
+    }
+}
+
+static void
+GenStatements(Array<char> *body, uint n)
+{
+    while (body->size() < n) {
+        ComplexityAppend(body, "static_assert(12 + 30 == 42);\n");
+    }
+}
+
+static void
+GenSpecStatements(Array<char> *body, uint n)
+{
+    while (body->size() < n) {
+        ComplexityAppend(body, "static_assert(A * 2 + 1 != B);\n");
+    }
+}
+
+static void
+GenHugeLiteral(Array<char> *body, uint n)
+{
+    ComplexityAppend(body, "static_assert(1");
+    for (uint i = 0; i < n; ++i) {
+        body->push('0');
+    }
+    ComplexityAppend(body, " != 0);");
+}
+
+// Strings are at most 127 bytes and only a static_assert's message, so as many of those as fit.
+static void
+GenLongStrings(Array<char> *body, uint n)
+{
+    while (body->size() < n) {
+        ComplexityAppend(body, "static_assert(1, \"");
+        for (uint i = 0; i < 127; ++i) {
+            body->push('s');
+        }
+        ComplexityAppend(body, "\");\n");
+    }
+}
+
+static const SpecConstantDecl ComplexitySpecConstants[] = { { "A", 0, 1 }, { "B", 1, 2 } };
+
+// "void main(){" body "}" and the '\0' the scanner stops on, which is not part of the returned view.
+static view<const char>
+ComplexityWrap(Array<char> *src, view<const char> body)
+{
+    src->clear();
+    ComplexityAppend(src, "void main(){\n    "); // Compile() wants 20 bytes even for an empty body
+    src->push_n(body.ptr, body.length);
+    src->push_n("\n}\n\0", 4);
+    return { src->data(), src->size() - 1 };
+}
+
+// Seconds for one full scan; NotImplemented() in the scanner is caught and ends it early.
+static double
+TimeScan(view<const char> src, uint *pnTokens)
+{
+    double const t0 = NowSeconds();
+    uint nTokens = 0;
+    CompileAbortScope abortScope;
+    try {
+        Scanner sc;
+        Scanner_Init(&sc, src);
+        Token tok;
+        while (Scanner_NextTokenRaw(&sc, &tok) != Token_EOI) {
+            nTokens += 1;
+        }
+    }
+    catch (const CompileAbort&) {
+    }
+    *pnTokens = nTokens;
+    return NowSeconds() - t0;
+}
+
+static double
+TimeCompile(view<const char> src, MessageStream *oms, CompileResult *pResult, int64_t *pPeakBytes = nullptr)
+{
+    CompileOptions options;
+    options.pPeakBytes = pPeakBytes;
+    options.specConstants = { ComplexitySpecConstants, lengthof(ComplexitySpecConstants) };
+    SpecializationInfo specInfo;
+    options.pSpecInfo = &specInfo;
+    oms->clear();
+    double const t0 = NowSeconds();
+    *pResult = Compile(src, oms, &options);
+    return NowSeconds() - t0;
+}
+
+// Least squares slope of log t over log n, over the points long enough to time; 0 if fewer than 3.
+static double
+FitGrowthExponent(const double *sizes, const double *seconds, uint n)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    uint m = 0;
+    for (uint i = 0; i < n; ++i) {
+        if (seconds[i] < MinFitSeconds) {
+            continue;
+        }
+        double const x = log2(sizes[i]), y = log2(seconds[i]);
+        sx += x; sy += y; sxx += x * x; sxy += x * y;
+        m += 1;
+    }
+    if (m < 3) {
+        return 0;
+    }
+    return (m * sxy - sx * sy) / (m * sxx - sx * sx);
+}
+
+static bool
+CheckConstructScaling(const char *name, ComplexityGenFn gen)
+{
+    enum { NumSizes = ComplexityMaxLog2Size - ComplexityMinLog2Size + 1 };
+    double sizes[NumSizes], scanSeconds[NumSizes], compileSeconds[NumSizes];
+    Array<char> body, src;
+    MessageStream om;
+    CompileResult result = CompileResult_Ok;
+    int64_t peakBytes = 0;
+    for (uint i = 0; i < NumSizes; ++i) {
+        body.clear();
+        gen(&body, 1u << (ComplexityMinLog2Size + i));
+        view<const char> const s = ComplexityWrap(&src, { body.data(), body.size() });
+        sizes[i] = s.length;
+        scanSeconds[i] = compileSeconds[i] = 1e30;
+        for (uint r = 0; r < ComplexityReps; ++r) {
+            uint nTokens;
+            scanSeconds[i] = std::min(scanSeconds[i], TimeScan(s, &nTokens));
+            compileSeconds[i] = std::min(compileSeconds[i], TimeCompile(s, &om, &result, &peakBytes));
+        }
+    }
+    double const kScan = FitGrowthExponent(sizes, scanSeconds, NumSizes);
+    double const kCompile = FitGrowthExponent(sizes, compileSeconds, NumSizes);
+    bool const bOk = kScan <= MaxGrowthExponent && kCompile <= MaxGrowthExponent;
+    printf("%-20s scan n^%.2f  compile n^%.2f  (%.2f / %.2f ms at %u KB, compile %s, peak %lld KB)%s\n", name, kScan,
+        kCompile, scanSeconds[NumSizes - 1] * 1e3, compileSeconds[NumSizes - 1] * 1e3, uint(sizes[NumSizes - 1]) >> 10,
+        result == CompileResult_Ok ? "ok" : "aborted", (long long)(peakBytes >> 10), bOk ? "" : "  FAILED");
+    return bOk;
+}
+
+static const char *const FuzzFragments[] = {
+    "static_assert(", "(", ")", ";", "{", "}", ",", "?", ":", "1", "0", "42", "18446744073709551615", "100000000000000000000",
+    "+", "-", "*", "&", "|", "^", "<<", ">>", "==", "!=", "&&", "||", "!", "~", "A", "B", "x", "int2(", "int3(", "bool4(",
+    ".xy", ".zw", ".x", "void", "int", "half", "\"str\"", "\"", "/*", "*/", "/* c */", "// c\n", "\n", " ", "#", "0x1", "1.5",
+    "constexpr int c = ", "c", "return ", "if (", "[", "]", "constexpr int t[] = {",
+};
+
+/*
+    Coverage is what the input reached that is visible from outside: which token kind followed which in the
+    scanner, and how the compile ended (the NotImplemented() text included). A mutation that reaches something
+    new joins the corpus.
+**/
+enum { FuzzMaxBody = 4096, FuzzCorpusMax = 512, FuzzNumTokenKinds = Token_CloseBracket + 1 };
+
+struct FuzzCoverage {
+    bool tokenPairs[FuzzNumTokenKinds][FuzzNumTokenKinds] = { };
+    bool results[256] = { };
+    Array<const char *> abortInfos;
+};
+
+struct FuzzCorpusEntry {
+    uint32_t offset; // into the corpus bytes
+    uint32_t length;
+};
+
+static bool
+FuzzCollectCoverage(FuzzCoverage *cov, view<const char> src, CompileResult result, const MessageStream& om)
+{
+    bool bNew = false;
+    {
+        CompileAbortScope abortScope;
+        try {
+            Scanner sc;
+            Scanner_Init(&sc, src);
+            Token tok;
+            TokenKind prev = Token_EOI;
+            for (;;) {
+                TokenKind const k = Scanner_NextTokenRaw(&sc, &tok);
+                bNew |= !cov->tokenPairs[prev][k];
+                cov->tokenPairs[prev][k] = true;
+                if (k == Token_EOI) {
+                    break;
+                }
+                prev = k;
+            }
+        }
+        catch (const CompileAbort&) {
+        }
+    }
+    bNew |= !cov->results[result];
+    cov->results[result] = true;
+    if (result != CompileResult_Ok) {
+        bool bSeen = false;
+        for (const char *info : cov->abortInfos) {
+            bSeen |= info == om.abortInfo;
+        }
+        if (!bSeen) {
+            cov->abortInfos.push(om.abortInfo);
+            bNew = true;
+        }
+    }
+    return bNew;
+}
+
+static void
+FuzzReplace(Array<char> *body, const Array<char>& with)
+{
+    body->clear();
+    body->push_n(with.data(), with.size());
+}
+
+static void
+FuzzMutate(Array<char> *body, uint32_t *rng)
+{
+    uint const n = body->size();
+    uint const a = n ? BenchRandNext(rng) % n : 0;
+    uint const b = n ? a + BenchRandNext(rng) % (n - a) : 0;
+    switch (BenchRandNext(rng) % 4) {
+    case 0: { // insert a fragment
+        const char *const f = FuzzFragments[BenchRandNext(rng) % lengthof(FuzzFragments)];
+        Array<char> out;
+        out.push_n(body->data(), a);
+        ComplexityAppend(&out, f);
+        out.push_n(body->data() + a, n - a);
+        FuzzReplace(body, out);
+    } break;
+    case 1: // delete a span
+        if (n) {
+            memmove(body->data() + a, body->data() + b, n - b);
+            body->set_size(n - (b - a));
+        }
+        break;
+    case 2: { // repeat a span, what generated code does
+        Array<char> out;
+        out.push_n(body->data(), b);
+        uint const k = 1 + BenchRandNext(rng) % 8;
+        for (uint i = 0; i < k; ++i) {
+            out.push_n(body->data() + a, b - a);
+        }
+        out.push_n(body->data() + b, n - b);
+        FuzzReplace(body, out);
+    } break;
+    case 3: // a statement, to get past the first error
+        ComplexityAppend(body, "static_assert(");
+        for (uint i = 0, k = 1 + BenchRandNext(rng) % 6; i < k; ++i) {
+            ComplexityAppend(body, FuzzFragments[BenchRandNext(rng) % lengthof(FuzzFragments)]);
+        }
+        ComplexityAppend(body, ");\n");
+        break;
+    }
+    if (body->size() > FuzzMaxBody) {
+        body->set_size(FuzzMaxBody);
+    }
+}
+
+// Inputs are at most FuzzMaxBody bytes, which take microseconds in linear time; this is far off that.
+static constexpr double FuzzSecondsPerInput = 0.05;
+
+static bool
+FuzzForSlowInputs(double budgetSeconds)
+{
+    FuzzCoverage cov;
+    Array<char> corpusBytes;
+    Array<FuzzCorpusEntry> corpus;
+    ComplexityAppend(&corpusBytes, "static_assert(1 + 2 == 3);\n");
+    corpus.push({ 0, corpusBytes.size() });
+
+    uint32_t rng = 2024;
+    uint64_t nInputs = 0;
+    double worstSeconds = 0;
+    bool bOk = true;
+    Array<char> body, src;
+    MessageStream om;
+    double const tEnd = NowSeconds() + budgetSeconds;
+    while (NowSeconds() < tEnd) {
+        body.clear();
+        FuzzCorpusEntry const parent = corpus[BenchRandNext(&rng) % corpus.size()];
+        body.push_n(corpusBytes.data() + parent.offset, parent.length);
+        for (uint i = 0, k = 1 + BenchRandNext(&rng) % 4; i < k; ++i) {
+            FuzzMutate(&body, &rng);
+        }
+        view<const char> const s = ComplexityWrap(&src, { body.data(), body.size() });
+
+        CompileResult result;
+        uint nTokens;
+        double seconds = TimeScan(s, &nTokens) + TimeCompile(s, &om, &result);
+        for (uint r = 1; r < ComplexityReps && seconds > FuzzSecondsPerInput; ++r) { // or was it preempted?
+            seconds = std::min(seconds, TimeScan(s, &nTokens) + TimeCompile(s, &om, &result));
+        }
+        nInputs += 1;
+        worstSeconds = std::max(worstSeconds, seconds);
+        if (seconds > FuzzSecondsPerInput) {
+            printf("slow input, %.2f ms for %u bytes:\n%.*s\n", seconds * 1e3, s.length, int(s.length), s.ptr);
+            bOk = false;
+            break;
+        }
+        if (FuzzCollectCoverage(&cov, s, result, om) && corpus.size() < FuzzCorpusMax) {
+            corpus.push({ corpusBytes.size(), body.size() });
+            corpusBytes.push_n(body.data(), body.size());
+        }
+    }
+    printf("%-20s %llu inputs, corpus %u, %u abort sites, slowest %.1f us%s\n", "fuzz", (unsigned long long)nInputs,
+        corpus.size(), cov.abortInfos.size(), worstSeconds * 1e6, bOk ? "" : "  FAILED");
+    return bOk;
+}
+
+int RunComplexityCheck(double fuzzSeconds)
+{
+    puts(__FUNCTION__);
+    static const struct {
+        const char *name;
+        ComplexityGenFn gen;
+    } Constructs[] = {
+        { "block comment", GenBlockComment },
+        { "line comments", GenLineComments },
+        { "long expression", GenLongExpression },
+        { "nested expressions", GenNestedExpressions },
+        { "keywords", GenKeywords },
+        { "statements", GenStatements },
+        { "spec statements", GenSpecStatements },
+        { "huge literal", GenHugeLiteral },
+        { "long strings", GenLongStrings },
+    };
+    uint nFailed = 0;
+    for (const auto& c : Constructs) {
+        nFailed += !CheckConstructScaling(c.name, c.gen);
+    }
+    nFailed += !FuzzForSlowInputs(fuzzSeconds);
+    return nFailed ? 1 : 0;
+}
+
+int RunBenchmarks()
+{
+    BenchSmallArray();
+    BenchPool();
+    BenchScanner();
+    BenchExpressions();
+    BenchSpecialization();
+    BenchSharedPrefix();
+    BenchIncludeCache();
+    BenchStructuralIndex();
+    bool bOk = BenchSpvReader();
+    bOk &= BenchSpvLink();
+    bOk &= BenchConstantArrays();
+    bOk &= BenchDataflow();
+    bOk &= BenchSpvUnroll();
+    bOk &= BenchSpvSlp();
+    bOk &= BenchSpvHalf();
+    return bOk ? 0 : 1;
+}
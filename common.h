@@ -70,6 +70,36 @@ inline constexpr view<const char> operator""_view(const char *strlit, size_t n)
 noreturn_void NotImplementedImpl(const char *file, int line, const char *info);
 #define NotImplemented(info) NotImplementedImpl(__FILE__, __LINE__, info)
 
+/*
+ * The failure path of Compile() and the other entry points. While one of them is running on a thread, NotImplemented()
+ * and running out of memory throw a CompileAbort, which the entry point turns into its CompileResult and a
+ * Message_CompileAborted, instead of exiting the process. Nothing is checked on the happy path, and the unwind runs
+ * the destructors that free whatever the compile had allocated. Outside of them (tools, tests) both still exit.
+ */
+enum CompileResult : uint8_t {
+    CompileResult_Ok,
+    CompileResult_NotImplemented, // anything that went through NotImplemented(), malformed input included
+    CompileResult_OutOfMemory,
+    CompileResult_OverMemoryBudget, // CompileOptions::memoryBudgetBytes, or a single request over MaxAlloc
+};
+
+struct CompileAbort {
+    CompileResult result;
+    const char *file;
+    int line;
+    const char *info;
+};
+
+extern thread_local uint tlsCompileAbortScopes; // defined in default_alloc.cpp
+noreturn_void OutOfMemory(const char *what); // for memory not from AllocateBytes(); what is perror()'s, outside one
+
+struct CompileAbortScope {
+    CompileAbortScope() { tlsCompileAbortScopes += 1; }
+    ~CompileAbortScope() { tlsCompileAbortScopes -= 1; }
+    CompileAbortScope(const CompileAbortScope&) = delete;
+    void operator=(const CompileAbortScope&) = delete;
+};
+
 
 enum BuiltinTypeKind : uint8_t {
     BuiltinType_none        =  0,
@@ -92,6 +122,7 @@ enum LexErrorKind : uint8_t {
 	LexError_NameTooLong,
     LexError_BlockCommentNoEnd,   // Got "/*", but hit EOI before a "*/". 
     LexError_BlockCommentNoBegin, // Got "*/", without a previous "/*"
+    LexError_StringNoEnd,         // Got '"', but hit the end of the line first.
 };
 
 typedef unsigned SpvId;
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+#include "lex.h"
+#include "Array.h"
+
+class MessageStream;
+struct SpvPool;
+
+// A name in the source that is a specialization constant rather than a value known at compile time.
+struct SpecConstantDecl {
+    const char *name;
+    uint32_t specId;
+    int64_t defaultValue;
+};
+
+enum SpecNodeKind : uint8_t {
+    SpecNode_Literal,  // OpConstant
+    SpecNode_Constant, // OpSpecConstant
+    SpecNode_Op,       // OpSpecConstantOp
+};
+
+/*
+ * One node of the expression graph over specialization constants. Operands are indices of earlier nodes,
+ * so evaluating in order is always valid.
+ */
+struct SpecNode {
+    SpecNodeKind kind;
+    uint8_t op; // SpecNode_Op: the parser's TypelessOp
+    uint8_t nOperands;
+    bool bUnsigned; // SpecNode_Op: for /, %, >> and <, <=, >, >=
+    uint32_t specId; // SpecNode_Constant
+    uint32_t operands[3];
+    int64_t value; // SpecNode_Literal: the value, SpecNode_Constant: the default
+};
+
+struct DeferredStaticAssert {
+    uint32_t node;
+    int32_t line;
+};
+
+// What Compile() leaves for specialization time, when CompileOptions::specConstants is non-empty.
+struct SpecializationInfo {
+    const SpecializationInfo *parent = nullptr; // set by CompileSuffix(): the prefix's, which must outlive this
+    uint32_t nodeBase = 0; // number of nodes in the parent chain; node indices are across the whole chain
+    Array<SpecNode> nodes;
+    Array<DeferredStaticAssert> deferredAsserts;
+};
+
+/*
+ * Calls to constexpr functions are evaluated at compile time, by replaying the tokens of their bodies, and each
+ * (function, arguments) result is memoized. A call that runs out of one of these budgets would be left to run
+ * time; there is no code generation to leave it to yet, so the compile stops with a Message_ConstexprBudgetExceeded.
+ */
+enum ConstexprBudget : uint8_t {
+    ConstexprBudget_Steps,  // statements, loop iterations and calls, counted per outermost call
+    ConstexprBudget_Memory, // the interpreter's variables and memo table; a full memo table just stops growing
+    ConstexprBudget_Depth,  // nested calls, ConstexprMaxCallDepth
+};
+
+enum { ConstexprMaxCallDepth = 256 };
+
+struct CompileOptions {
+    ScanFeatureFlags scanFeatures = ScanFeatures_Full; // ScanFeatures_MachineGenerated for codegen-produced source
+    bool bReportConditionalLowering = false; // a Message_ConditionalLowering for each &&, || and ?: site
+
+    // Expressions using these are kept as SpecNodes instead of being folded, and static_asserts
+    // depending on them are deferred to Specialize(). pSpecInfo must be set if any are given.
+    view<const SpecConstantDecl> specConstants = { };
+    SpecializationInfo *pSpecInfo = nullptr;
+
+    uint32_t constexprStepBudget = 1u << 20;
+    uint32_t constexprMemoryBytes = 8u << 20;
+
+    // Where constexpr arrays go, each as one OpConstantComposite tree named after it. Not freed with the compile's
+    // other memory, and on failure it keeps what was added; if null, the compile uses a pool of its own.
+    SpvPool *pConstantPool = nullptr;
+
+    // Past this many bytes live at once the compile fails with CompileResult_OverMemoryBudget; 0 for no limit.
+    uint64_t memoryBudgetBytes = 0;
+    int64_t *pPeakBytes = nullptr; // if set, receives the compile's peak, failed or not (see AllocBudgetScope)
+};
+
+// The source is "void main(){" and statements, after any constexpr function and variable definitions.
+// Anything but CompileResult_Ok also leaves a Message_CompileAborted last in oms; all the compile allocated is freed.
+CompileResult Compile(view<const char> source, MessageStream *oms, const CompileOptions *options = nullptr);
+
+// Same, from Preprocess() output; options->scanFeatures is not used.
+CompileResult CompilePreprocessed(view<const Token> tokens, MessageStream *oms, const CompileOptions *options = nullptr);
+
+/*
+ * For variants that share a long prelude and differ only at the end: CompilePrefix() compiles the shared start of
+ * the function (it must not close it) once, then each variant's CompileSuffix() pays only for its own statements.
+ * The prefix's messages are reported once, by CompilePrefix(). A suffix's SpecializationInfo refers to the prefix's
+ * rather than copying it, and Specialize() on it covers both; without one, a suffix's static_asserts on spec
+ * constants go unchecked. A prefix state whose CompilePrefix() failed must not be used for suffixes. The prefix
+ * must start with "void main(){", and constexpr names it declares are not visible to suffixes.
+ */
+struct CompilePrefixState {
+    CompileOptions options; // pSpecInfo is &specInfo
+    SpecializationInfo specInfo;
+    Array<uint32_t> specConstantNodes;
+    uint32_t lineno = 1; // where the prefix ended, suffix lines number on from it
+};
+
+CompileResult CompilePrefix(view<const char> source, MessageStream *oms, const CompileOptions *options, CompilePrefixState *pOut);
+CompileResult CompileSuffix(const CompilePrefixState& prefix, view<const char> suffix, MessageStream *oms, SpecializationInfo *pSpecInfo = nullptr);
+
+// Checks the deferred static_asserts for one set of values indexed by specId; ids past the end take their default.
+void Specialize(const SpecializationInfo& info, view<const int64_t> specValues, MessageStream *oms);
@@ -0,0 +1,424 @@
+#include "common.h"
+
+#include "dataflow.h"
+#include "spvreader.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define DATAFLOW_SSE2 1
+#else
+    #define DATAFLOW_SSE2 0
+#endif
+
+#if defined _MSC_VER
+    #include <intrin.h>
+#endif
+
+static uint
+CountTrailingZeros64(uint64_t x)
+{
+    ASSERT(x);
+#if defined _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return uint(i);
+#else
+    return uint(__builtin_ctzll(x));
+#endif
+}
+
+/*
+    Each kernel is an Op with the same operation on 128 bits and on 64, applied two words at a time, then to
+    the last odd one. Whether dst changed is accumulated as the OR of old ^ new, tested once at the end.
+**/
+struct BitsOpUnion {
+#if DATAFLOW_SSE2
+    static __m128i Vec(__m128i d, __m128i s) { return _mm_or_si128(d, s); }
+#endif
+    static uint64_t Scalar(uint64_t d, uint64_t s) { return d | s; }
+};
+
+struct BitsOpIntersect {
+#if DATAFLOW_SSE2
+    static __m128i Vec(__m128i d, __m128i s) { return _mm_and_si128(d, s); }
+#endif
+    static uint64_t Scalar(uint64_t d, uint64_t s) { return d & s; }
+};
+
+struct BitsOpDiff {
+#if DATAFLOW_SSE2
+    static __m128i Vec(__m128i d, __m128i s) { return _mm_andnot_si128(s, d); }
+#endif
+    static uint64_t Scalar(uint64_t d, uint64_t s) { return d & ~s; }
+};
+
+template<class Op> static bool
+BitsApply(uint64_t *dst, const uint64_t *src, uint n)
+{
+    uint i = 0;
+    uint64_t changed = 0;
+#if DATAFLOW_SSE2
+    __m128i changedVec = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+        __m128i const d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i const r = Op::Vec(d, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+        changedVec = _mm_or_si128(changedVec, _mm_xor_si128(d, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), r);
+    }
+    changed = _mm_movemask_epi8(_mm_cmpeq_epi8(changedVec, _mm_setzero_si128())) != 0xffff;
+#endif
+    for (; i < n; ++i) {
+        uint64_t const r = Op::Scalar(dst[i], src[i]);
+        changed |= dst[i] ^ r;
+        dst[i] = r;
+    }
+    return changed != 0;
+}
+
+bool Bits_Union(uint64_t *dst, const uint64_t *src, uint n) { return BitsApply<BitsOpUnion>(dst, src, n); }
+bool Bits_Intersect(uint64_t *dst, const uint64_t *src, uint n) { return BitsApply<BitsOpIntersect>(dst, src, n); }
+bool Bits_Diff(uint64_t *dst, const uint64_t *src, uint n) { return BitsApply<BitsOpDiff>(dst, src, n); }
+
+bool Bits_GenKill(uint64_t *dst, const uint64_t *in, const uint64_t *gen, const uint64_t *kill, uint n)
+{
+    uint i = 0;
+    uint64_t changed = 0;
+#if DATAFLOW_SSE2
+    __m128i changedVec = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+        __m128i const d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i const r = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(gen + i)),
+            _mm_andnot_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(kill + i)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))));
+        changedVec = _mm_or_si128(changedVec, _mm_xor_si128(d, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), r);
+    }
+    changed = _mm_movemask_epi8(_mm_cmpeq_epi8(changedVec, _mm_setzero_si128())) != 0xffff;
+#endif
+    for (; i < n; ++i) {
+        uint64_t const r = gen[i] | (in[i] & ~kill[i]);
+        changed |= dst[i] ^ r;
+        dst[i] = r;
+    }
+    return changed != 0;
+}
+
+
+void SortedUnion(view<const uint32_t> a, view<const uint32_t> b, Array<uint32_t> *pOut)
+{
+    pOut->clear();
+    uint32_t *const out = pOut->uninitialized_push_n(a.length + b.length);
+    uint i = 0, j = 0, n = 0;
+    while (i < a.length && j < b.length) {
+        uint32_t const x = a.ptr[i], y = b.ptr[j];
+        out[n++] = x < y ? x : y;
+        i += x <= y;
+        j += y <= x;
+    }
+    for (; i < a.length; ++i) out[n++] = a.ptr[i];
+    for (; j < b.length; ++j) out[n++] = b.ptr[j];
+    pOut->set_size(n);
+}
+
+void SortedGenKill(view<const uint32_t> in, view<const uint32_t> gen, view<const uint32_t> kill, Array<uint32_t> *pOut)
+{
+    pOut->clear();
+    uint32_t *const out = pOut->uninitialized_push_n(in.length + gen.length);
+    uint i = 0, j = 0, k = 0, n = 0;
+    while (i < in.length || j < gen.length) {
+        if (j == gen.length || (i < in.length && in.ptr[i] < gen.ptr[j])) {
+            uint32_t const x = in.ptr[i++];
+            while (k < kill.length && kill.ptr[k] < x) ++k;
+            if (k == kill.length || kill.ptr[k] != x) {
+                out[n++] = x;
+            }
+        }
+        else {
+            i += i < in.length && in.ptr[i] == gen.ptr[j];
+            out[n++] = gen.ptr[j++];
+        }
+    }
+    pOut->set_size(n);
+}
+
+
+void FlowGraph_Build(FlowGraph *g, uint nBlocks, uint entry, view<const uint32_t> edges)
+{
+    ASSERT(edges.length % 2 == 0 && (entry < nBlocks || nBlocks == 0));
+    g->nBlocks = nBlocks;
+    g->entry = entry;
+    uint const nEdges = edges.length / 2;
+    for (int pass = 0; pass < 2; ++pass) { // succs, then preds
+        Array<uint32_t>& begin = pass == 0 ? g->succBegin : g->predBegin;
+        Array<uint32_t>& list = pass == 0 ? g->succs : g->preds;
+        begin.clear();
+        list.clear();
+        uint32_t *const b = begin.uninitialized_push_n(nBlocks + 1);
+        memset(b, 0, (nBlocks + 1) * sizeof(uint32_t));
+        for (uint e = 0; e < nEdges; ++e) {
+            b[edges.ptr[2 * e + pass] + 1] += 1;
+        }
+        for (uint i = 0; i < nBlocks; ++i) {
+            b[i + 1] += b[i];
+        }
+        uint32_t *const l = list.uninitialized_push_n(nEdges);
+        for (uint e = 0; e < nEdges; ++e) { // b[i] walks to the end of block i's range, then is moved back below
+            l[b[edges.ptr[2 * e + pass]]++] = edges.ptr[2 * e + 1 - pass];
+        }
+        for (uint i = nBlocks; i > 0; --i) {
+            b[i] = b[i - 1];
+        }
+        b[0] = 0;
+    }
+}
+
+void FlowGraph_ReversePostorder(const FlowGraph *g, Array<uint32_t> *pOrder)
+{
+    pOrder->clear();
+    if (g->nBlocks == 0) {
+        return;
+    }
+    Array<uint8_t> visited;
+    memset(visited.uninitialized_push_n(g->nBlocks), 0, g->nBlocks);
+    Array<uint32_t> stack; // pairs: block, index of its next successor to look at
+    stack.push(g->entry);
+    stack.push(g->succBegin.data()[g->entry]);
+    visited[g->entry] = 1;
+    while (!stack.is_empty()) {
+        uint const top = stack.size() - 2;
+        uint32_t const b = stack[top];
+        uint32_t const next = stack[top + 1];
+        if (next == g->succBegin.data()[b + 1]) {
+            pOrder->push(b);
+            stack.set_size(top);
+            continue;
+        }
+        stack[top + 1] = next + 1;
+        uint32_t const s = g->succs.data()[next];
+        if (!visited[s]) {
+            visited[s] = 1;
+            stack.push(s);
+            stack.push(g->succBegin.data()[s]);
+        }
+    }
+    std::reverse(pOrder->begin(), pOrder->end());
+}
+
+void FlowWorklist_Init(FlowWorklist *w, const FlowGraph *g, FlowDirection direction)
+{
+    FlowGraph_ReversePostorder(g, &w->order);
+    if (direction == Flow_Backward) {
+        std::reverse(w->order.begin(), w->order.end());
+    }
+    uint const n = w->order.size();
+    w->position.clear();
+    memset(w->position.uninitialized_push_n(g->nBlocks), 0xff, g->nBlocks * sizeof(uint32_t));
+    for (uint i = 0; i < n; ++i) {
+        w->position[w->order[i]] = i;
+    }
+    uint const nWords = (n + 63) / 64;
+    w->pending.clear();
+    uint64_t *const pending = w->pending.uninitialized_push_n(nWords);
+    memset(pending, 0xff, nWords * sizeof(uint64_t));
+    if (n & 63) {
+        pending[nWords - 1] = (uint64_t(1) << (n & 63)) - 1;
+    }
+}
+
+uint FlowWorklist_Next(FlowWorklist *w, uint from)
+{
+    uint const nWords = w->pending.size();
+    uint64_t *const pending = w->pending.data();
+    if (nWords == 0) {
+        return ~0u;
+    }
+    uint i = from >> 6;
+    uint64_t bits = pending[i] & (~uint64_t(0) << (from & 63));
+    for (uint step = 0; !bits; ++step) { // once around, back to the part of the first word before from
+        if (step == nWords) {
+            return ~0u;
+        }
+        i = i + 1 == nWords ? 0 : i + 1;
+        bits = pending[i];
+    }
+    uint const bit = CountTrailingZeros64(bits);
+    pending[i] &= ~(uint64_t(1) << bit);
+    return i * 64 + bit;
+}
+
+void FlowSparse_Compact(FlowSolution *s)
+{
+    Array<uint32_t> live;
+    uint32_t *const ranges = s->sparseRanges.data();
+    for (uint i = 0; i < s->sparseRanges.size(); i += 2) {
+        uint32_t const begin = live.size();
+        live.push_n(s->sparseBits.data() + ranges[i], ranges[i + 1] - ranges[i]);
+        ranges[i] = begin;
+        ranges[i + 1] = live.size();
+    }
+    s->sparseBits.clear();
+    s->sparseBits.push_n(live.data(), live.size());
+    s->sparseCompactAt = 2 * live.size() + 4 * s->nBlocks + 1024;
+}
+
+void FlowSolution_GetSet(const FlowSolution *s, uint block, bool bOut, Array<uint32_t> *pBits)
+{
+    pBits->clear();
+    if (s->bSparse) {
+        const uint32_t *const range = &s->sparseRanges.data()[4 * block + 2 * bOut];
+        pBits->push_n(s->sparseBits.data() + range[0], range[1] - range[0]);
+        return;
+    }
+    const uint64_t *const row = &s->dense.data()[(2 * size_t(block) + bOut) * s->nWords];
+    for (uint i = 0; i < s->nWords; ++i) {
+        for (uint64_t bits = row[i]; bits; bits &= bits - 1) {
+            pBits->push(i * 64 + CountTrailingZeros64(bits));
+        }
+    }
+}
+
+
+// (block, value) pairs to per-block lists, sorted and without duplicates.
+static void
+BucketSortedUnique(uint nBlocks, view<const uint32_t> pairs, Array<uint32_t> *pBegin, Array<uint32_t> *pValues)
+{
+    pBegin->clear();
+    pValues->clear();
+    uint32_t *const begin = pBegin->uninitialized_push_n(nBlocks + 1);
+    memset(begin, 0, (nBlocks + 1) * sizeof(uint32_t));
+    for (uint i = 0; i < pairs.length; i += 2) {
+        begin[pairs.ptr[i] + 1] += 1;
+    }
+    for (uint b = 0; b < nBlocks; ++b) {
+        begin[b + 1] += begin[b];
+    }
+    uint32_t *const values = pValues->uninitialized_push_n(pairs.length / 2);
+    Array<uint32_t> fill;
+    fill.push_n(begin, nBlocks);
+    for (uint i = 0; i < pairs.length; i += 2) {
+        values[fill[pairs.ptr[i]]++] = pairs.ptr[i + 1];
+    }
+    uint n = 0; // compacting in place as the duplicates go
+    for (uint b = 0; b < nBlocks; ++b) {
+        uint32_t *const first = values + begin[b], *const last = values + begin[b + 1];
+        std::sort(first, last);
+        begin[b] = n;
+        for (const uint32_t *p = first; p != last; ++p) {
+            if (p == first || *p != p[-1]) {
+                values[n++] = *p;
+            }
+        }
+    }
+    begin[nBlocks] = n;
+    pValues->set_size(n);
+}
+
+enum : uint32_t { SpvFlowLabelBit = 0x80000000u, SpvFlowNone = ~0u }; // idMap: a block if the bit is set, else a value
+
+void SpvBuildFunctionFlow(view<const uint32_t> function, uint32_t bound, SpvFunctionFlow *pOut)
+{
+    SpvFunctionFlow *const f = pOut;
+    if (f->idMap.size() < bound) {
+        uint const old = f->idMap.size();
+        memset(f->idMap.uninitialized_push_n(bound - old), 0xff, (bound - old) * sizeof(uint32_t));
+    }
+    uint32_t *const idMap = f->idMap.data();
+    f->valueIds.clear();
+
+    // Number the blocks and values, and where each value is defined:
+    Array<uint32_t> defBlock; // per value, SpvFlowNone for parameters
+    uint nBlocks = 0;
+    SpvReader r = { function.ptr, function.ptr + function.length };
+    SpvInstruction inst;
+    while (SpvReader_Next(&r, &inst)) {
+        const SpvOpInfo *const op = SpvLookupOp(inst.opcode);
+        uint const resultWord = SpvResultWord(op);
+        if (inst.opcode == SpvOp_Function || !resultWord) {
+            continue;
+        }
+        uint32_t const id = inst.words[resultWord];
+        if (inst.opcode == SpvOp_Label) {
+            idMap[id] = SpvFlowLabelBit | nBlocks++;
+            continue;
+        }
+        idMap[id] = f->valueIds.size();
+        f->valueIds.push(id);
+        defBlock.push(inst.opcode == SpvOp_FunctionParameter ? SpvFlowNone : nBlocks - 1);
+    }
+    uint const nValues = f->valueIds.size();
+
+    // Uses, as (block, value) pairs, and edges:
+    Array<uint32_t> uses, phiUses, edges;
+    auto const Use = [&](uint32_t block, uint32_t id) {
+        uint32_t const v = idMap[id];
+        if (v != SpvFlowNone && !(v & SpvFlowLabelBit) && defBlock[v] != block) {
+            uses.push(block);
+            uses.push(v);
+        }
+    };
+    r = { function.ptr, function.ptr + function.length };
+    uint32_t block = SpvFlowNone;
+    while (SpvReader_Next(&r, &inst)) {
+        const uint32_t *const w = inst.words;
+        switch (inst.opcode) {
+        case SpvOp_Label:
+            block = idMap[w[1]] & ~SpvFlowLabelBit;
+            continue;
+        case SpvOp_Phi: // (value, predecessor) pairs, each value used at the end of its predecessor
+            for (uint i = 3; i + 1 < inst.nWords; i += 2) {
+                uint32_t const pred = idMap[w[i + 1]] & ~SpvFlowLabelBit;
+                Use(pred, w[i]);
+                if (idMap[w[i]] != SpvFlowNone) {
+                    phiUses.push(pred);
+                    phiUses.push(idMap[w[i]]);
+                }
+            }
+            continue;
+        case SpvOp_Branch:
+            edges.push(block);
+            edges.push(idMap[w[1]] & ~SpvFlowLabelBit);
+            continue;
+        case SpvOp_BranchConditional:
+            Use(block, w[1]);
+            edges.push(block);
+            edges.push(idMap[w[2]] & ~SpvFlowLabelBit);
+            if (w[3] != w[2]) {
+                edges.push(block);
+                edges.push(idMap[w[3]] & ~SpvFlowLabelBit);
+            }
+            continue;
+        }
+        if (block == SpvFlowNone) {
+            continue; // OpFunction, parameters
+        }
+        SpvForEachOperandWord(w, SpvLookupOp(inst.opcode), [&](uint i, char kind) {
+            if (kind == 'i' || kind == 'f') {
+                Use(block, w[i]);
+            }
+        });
+    }
+    FlowGraph_Build(&f->graph, nBlocks, 0, { edges.data(), edges.size() });
+
+    BucketSortedUnique(nBlocks, { uses.data(), uses.size() }, &f->genBegin, &f->gen);
+    BucketSortedUnique(nBlocks, { phiUses.data(), phiUses.size() }, &f->phiUseBegin, &f->phiUses);
+    Array<uint32_t> defs;
+    for (uint v = 0; v < nValues; ++v) {
+        if (defBlock[v] != SpvFlowNone) {
+            defs.push(defBlock[v]);
+            defs.push(v);
+        }
+    }
+    BucketSortedUnique(nBlocks, { defs.data(), defs.size() }, &f->killBegin, &f->kill);
+
+    for (uint32_t id : f->valueIds) {
+        idMap[id] = SpvFlowNone;
+    }
+    r = { function.ptr, function.ptr + function.length };
+    while (SpvReader_Next(&r, &inst)) {
+        if (inst.opcode == SpvOp_Label) {
+            idMap[inst.words[1]] = SpvFlowNone;
+        }
+    }
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+#include <string.h>
+
+/*
+ * Iterative dataflow over a control-flow graph, for the classic bit-vector problems: liveness, reaching
+ * definitions, available values. A problem is a policy (see SpvLivenessPolicy at the end for one) giving its
+ * direction, its meet, the number of bits, and each block's gen and kill sets as sorted lists of bits. The solver
+ * then finds, for every block, the fixpoint of
+ *     out = gen | (in & ~kill)
+ *     in  = the meet of the outs of its predecessors (successors, going backward)
+ * visiting blocks from a worklist kept in reverse postorder (postorder going backward), so most problems settle in
+ * a couple of passes even with many loops.
+ *
+ * Sets are dense bitsets, one row per block, combined with SSE2 where available. When the rows of a huge function
+ * would pass FlowOptions::maxDenseBytes, union problems fall back to sorted lists of bits, which only cost what is
+ * actually in the sets. Intersection problems are always dense, their sets start full.
+ */
+struct FlowGraph {
+    uint nBlocks = 0;
+    uint entry = 0;
+    Array<uint32_t> succBegin; // nBlocks + 1 offsets into succs
+    Array<uint32_t> succs;
+    Array<uint32_t> predBegin; // likewise
+    Array<uint32_t> preds;
+};
+
+// edges are (from, to) pairs.
+void FlowGraph_Build(FlowGraph *g, uint nBlocks, uint entry, view<const uint32_t> edges);
+
+// The blocks reachable from the entry, in reverse postorder. Unreachable ones are left out.
+void FlowGraph_ReversePostorder(const FlowGraph *g, Array<uint32_t> *pOrder);
+
+enum FlowDirection : uint8_t { Flow_Forward, Flow_Backward };
+enum FlowMeet : uint8_t { FlowMeet_Union, FlowMeet_Intersect };
+
+struct FlowOptions {
+    uint64_t maxDenseBytes = uint64_t(64) << 20; // over this, union problems use sorted lists
+};
+
+/*
+    Dense bitset kernels over n uint64_t words. The ones writing dst return whether it changed.
+**/
+bool Bits_Union(uint64_t *dst, const uint64_t *src, uint n);      // dst |= src
+bool Bits_Intersect(uint64_t *dst, const uint64_t *src, uint n);  // dst &= src
+bool Bits_Diff(uint64_t *dst, const uint64_t *src, uint n);       // dst &= ~src
+bool Bits_GenKill(uint64_t *dst, const uint64_t *in, const uint64_t *gen, const uint64_t *kill, uint n); // dst = gen | (in & ~kill)
+
+inline bool Bits_Test(const uint64_t *bits, uint i) { return bits[i >> 6] >> (i & 63) & 1; }
+inline void Bits_Set(uint64_t *bits, uint i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+
+// Sorted lists of bits; the outputs may not alias the inputs.
+void SortedUnion(view<const uint32_t> a, view<const uint32_t> b, Array<uint32_t> *pOut);
+void SortedGenKill(view<const uint32_t> in, view<const uint32_t> gen, view<const uint32_t> kill, Array<uint32_t> *pOut);
+
+/*
+    The in and out set of every block, dense or sparse: in is the meet of the neighbours' outs, out is after the
+    block's transfer. Going backward in is at the end of the block, out at its start. Blocks not reachable from the
+    entry keep their initial sets.
+**/
+struct FlowSolution {
+    bool bSparse = false;
+    uint nBlocks = 0;
+    uint nBits = 0;
+    uint nWords = 0; // per dense row
+    Array<uint64_t> dense; // rows: in of block 0, out of block 0, in of block 1, ...
+    Array<uint32_t> sparseBits; // append-only, each set a range of it
+    Array<uint32_t> sparseRanges; // begin, end of in then out, per block
+    uint sparseCompactAt = 0; // sparseBits size over which old versions of the sets are dropped
+    uint nSweeps = 0; // blocks visited
+};
+
+inline bool
+FlowSolution_Contains(const FlowSolution *s, uint block, bool bOut, uint bit)
+{
+    if (!s->bSparse) {
+        return Bits_Test(&s->dense.data()[(2 * size_t(block) + bOut) * s->nWords], bit);
+    }
+    const uint32_t *const range = &s->sparseRanges.data()[4 * block + 2 * bOut];
+    const uint32_t *lo = s->sparseBits.data() + range[0], *hi = s->sparseBits.data() + range[1];
+    while (lo < hi) { // lower_bound
+        const uint32_t *const mid = lo + (hi - lo) / 2;
+        if (*mid < bit) lo = mid + 1; else hi = mid;
+    }
+    return lo != s->sparseBits.data() + range[1] && *lo == bit;
+}
+
+// The bits of a set, in increasing order.
+void FlowSolution_GetSet(const FlowSolution *s, uint block, bool bOut, Array<uint32_t> *pBits);
+
+
+// Implementation details of SolveDataflow():
+
+struct FlowWorklist {
+    Array<uint64_t> pending; // by position in the visiting order
+    Array<uint32_t> order;   // block at each position
+    Array<uint32_t> position; // of each block, ~0u if not visited
+};
+
+void FlowWorklist_Init(FlowWorklist *w, const FlowGraph *g, FlowDirection direction);
+uint FlowWorklist_Next(FlowWorklist *w, uint from); // first pending position at or after from, wrapping; ~0u if none
+void FlowSparse_Compact(FlowSolution *s); // keeps only the current sets, then doubles sparseCompactAt past them
+
+/*
+    Policy requirements, with P the policy type:
+        static constexpr FlowDirection direction;
+        static constexpr FlowMeet meet;
+        uint nBits;
+        view<const uint32_t> Gen(uint block) const;  // sorted, each bit below nBits
+        view<const uint32_t> Kill(uint block) const; // likewise
+    The boundary (in of the entry going forward, of the exits going backward) is the empty set.
+**/
+template<class Policy>
+void SolveDataflow(const FlowGraph *g, const Policy& policy, const FlowOptions& options, FlowSolution *pOut)
+{
+    bool const bForward = Policy::direction == Flow_Forward;
+    bool const bUnion = Policy::meet == FlowMeet_Union;
+    const Array<uint32_t>& fromBegin = bForward ? g->predBegin : g->succBegin; // where the meet reads from
+    const Array<uint32_t>& from = bForward ? g->preds : g->succs;
+    const Array<uint32_t>& toBegin = bForward ? g->succBegin : g->predBegin; // who to revisit on a change
+    const Array<uint32_t>& to = bForward ? g->succs : g->preds;
+
+    FlowSolution *const s = pOut;
+    s->nBlocks = g->nBlocks;
+    s->nBits = policy.nBits;
+    s->nWords = (policy.nBits + 63) / 64;
+    s->nSweeps = 0;
+    s->dense.clear();
+    s->sparseBits.clear();
+    s->sparseRanges.clear();
+    uint64_t const denseBytes = uint64_t(4) * g->nBlocks * s->nWords * sizeof(uint64_t); // in, out, gen, kill
+    s->bSparse = bUnion && denseBytes > options.maxDenseBytes;
+    if (!s->bSparse && denseBytes / 2 / sizeof(uint64_t) > ~0u) { // more rows than an Array holds
+        NotImplemented("dataflow sets too large");
+    }
+
+    FlowWorklist worklist;
+    FlowWorklist_Init(&worklist, g, Policy::direction);
+
+    if (!s->bSparse) {
+        uint const nWords = s->nWords;
+        size_t const rowsWords = 2 * size_t(g->nBlocks) * nWords;
+        uint64_t *const rows = s->dense.uninitialized_push_n(uint(rowsWords));
+        Array<uint64_t> genKill;
+        uint64_t *const gk = genKill.uninitialized_push_n(uint(rowsWords));
+        memset(gk, 0, rowsWords * sizeof(uint64_t));
+        for (uint b = 0; b < g->nBlocks; ++b) {
+            for (uint32_t bit : policy.Gen(b)) Bits_Set(gk + 2 * size_t(b) * nWords, bit);
+            for (uint32_t bit : policy.Kill(b)) Bits_Set(gk + (2 * size_t(b) + 1) * nWords, bit);
+        }
+        // Union: everything starts empty. Intersect: outs start full (minus the bits past nBits), ins at the boundary empty.
+        memset(rows, 0, rowsWords * sizeof(uint64_t));
+        if (!bUnion) {
+            for (uint b = 0; b < g->nBlocks; ++b) {
+                uint64_t *const out = rows + (2 * size_t(b) + 1) * nWords;
+                memset(out, 0xff, nWords * sizeof(uint64_t));
+                if (policy.nBits & 63) {
+                    out[nWords - 1] = (uint64_t(1) << (policy.nBits & 63)) - 1;
+                }
+            }
+        }
+
+        for (uint pos = FlowWorklist_Next(&worklist, 0); pos != ~0u; pos = FlowWorklist_Next(&worklist, pos)) {
+            uint const b = worklist.order[pos];
+            s->nSweeps += 1;
+            uint64_t *const in = rows + 2 * size_t(b) * nWords;
+            uint64_t *const out = in + nWords;
+            uint const i0 = fromBegin.data()[b], i1 = fromBegin.data()[b + 1];
+            if (i0 == i1) {
+                memset(in, 0, nWords * sizeof(uint64_t)); // the boundary
+            }
+            else {
+                memcpy(in, rows + (2 * size_t(from.data()[i0]) + 1) * nWords, nWords * sizeof(uint64_t));
+                for (uint i = i0 + 1; i < i1; ++i) {
+                    const uint64_t *const other = rows + (2 * size_t(from.data()[i]) + 1) * nWords;
+                    if (bUnion) Bits_Union(in, other, nWords); else Bits_Intersect(in, other, nWords);
+                }
+            }
+            const uint64_t *const gen = gk + 2 * size_t(b) * nWords;
+            if (Bits_GenKill(out, in, gen, gen + nWords, nWords)) {
+                for (uint i = toBegin.data()[b]; i < toBegin.data()[b + 1]; ++i) {
+                    uint const p = worklist.position.data()[to.data()[i]];
+                    if (p != ~0u) Bits_Set(worklist.pending.data(), p);
+                }
+            }
+        }
+        return;
+    }
+
+    // Sparse: every set starts empty, as the range [0, 0).
+    memset(s->sparseRanges.uninitialized_push_n(4 * g->nBlocks), 0, 4 * g->nBlocks * sizeof(uint32_t));
+    s->sparseCompactAt = 4 * g->nBlocks + 1024;
+    Array<uint32_t> in, merged, out;
+    for (uint pos = FlowWorklist_Next(&worklist, 0); pos != ~0u; pos = FlowWorklist_Next(&worklist, pos)) {
+        uint const b = worklist.order[pos];
+        s->nSweeps += 1;
+        in.clear();
+        for (uint i = fromBegin.data()[b]; i < fromBegin.data()[b + 1]; ++i) {
+            const uint32_t *const r = &s->sparseRanges.data()[4 * from.data()[i] + 2];
+            SortedUnion({ in.data(), in.size() }, { s->sparseBits.data() + r[0], r[1] - r[0] }, &merged);
+            in.clear();
+            in.push_n(merged.data(), merged.size());
+        }
+        SortedGenKill({ in.data(), in.size() }, policy.Gen(b), policy.Kill(b), &out);
+
+        uint32_t *r = &s->sparseRanges.data()[4 * b];
+        bool const bChanged = out.size() != r[3] - r[2] || memcmp(out.data(), s->sparseBits.data() + r[2], out.size() * sizeof(uint32_t)) != 0;
+        if (in.size() != r[1] - r[0] || memcmp(in.data(), s->sparseBits.data() + r[0], in.size() * sizeof(uint32_t)) != 0) {
+            r[0] = s->sparseBits.size();
+            s->sparseBits.push_n(in.data(), in.size());
+            r[1] = s->sparseBits.size();
+        }
+        if (bChanged) {
+            r[2] = s->sparseBits.size();
+            s->sparseBits.push_n(out.data(), out.size());
+            r[3] = s->sparseBits.size();
+            for (uint i = toBegin.data()[b]; i < toBegin.data()[b + 1]; ++i) {
+                uint const p = worklist.position.data()[to.data()[i]];
+                if (p != ~0u) Bits_Set(worklist.pending.data(), p);
+            }
+        }
+        if (s->sparseBits.size() > s->sparseCompactAt) {
+            FlowSparse_Compact(s);
+        }
+    }
+}
+
+
+/*
+ * Liveness of the values of a SPIR-V function: which of its results (and parameters) may still be used on entry
+ * to and exit from each block. Values are numbered locally, in the order the function defines them; globals are
+ * always available and left out. An OpPhi's operands are used at the end of their predecessor block: they are in its
+ * gen unless it defines them, and in phiUses, to add to its live-out.
+ *
+ * With SpvLivenessPolicy, out is a block's live-in and in its live-out (phiUses aside).
+ */
+struct SpvFunctionFlow {
+    FlowGraph graph; // a block per OpLabel, in order; the entry is block 0
+    Array<uint32_t> valueIds; // SPIR-V id of each local value
+    Array<uint32_t> genBegin, gen;   // per block: values used before any definition in it (upward exposed)
+    Array<uint32_t> killBegin, kill; // per block: values it defines
+    Array<uint32_t> phiUseBegin, phiUses; // per block: values its successors' OpPhis take from it
+
+    Array<uint32_t> idMap; // scratch, ~0u for ids not in the function: reuse one SpvFunctionFlow for a module's functions
+};
+
+// function: the words from its OpFunction to its OpFunctionEnd, of a module that passes SpvValidate(). bound: the module's.
+void SpvBuildFunctionFlow(view<const uint32_t> function, uint32_t bound, SpvFunctionFlow *pOut);
+
+struct SpvLivenessPolicy {
+    static constexpr FlowDirection direction = Flow_Backward;
+    static constexpr FlowMeet meet = FlowMeet_Union;
+    uint nBits;
+    const SpvFunctionFlow *flow;
+
+    view<const uint32_t> Gen(uint b) const
+    {
+        return { flow->gen.data() + flow->genBegin.data()[b], flow->genBegin.data()[b + 1] - flow->genBegin.data()[b] };
+    }
+    view<const uint32_t> Kill(uint b) const
+    {
+        return { flow->kill.data() + flow->killBegin.data()[b], flow->killBegin.data()[b + 1] - flow->killBegin.data()[b] };
+    }
+};
@@ -1,50 +1,310 @@
 #include "common.h" // ASSERT
 
+#include "default_alloc.h"
+
 #include <stdlib.h>
 #include <stdio.h> // perror
+#include <string.h> // memset
 
 enum : uint32_t { MaxAlloc = 1u<<30 }; // 1 GB
 
+static thread_local AllocTag tlsAllocTag = AllocTag_Misc;
+thread_local uint tlsCompileAbortScopes = 0;
+
+noreturn_void
+OutOfMemory(const char *what)
+{
+	if (tlsCompileAbortScopes) {
+		throw CompileAbort{ CompileResult_OutOfMemory, __FILE__, __LINE__, "out of memory" };
+	}
+	perror(what);
+	exit(1);
+}
+
+static noreturn_void
+OverMemoryBudget(const char *info)
+{
+	if (tlsCompileAbortScopes) {
+		throw CompileAbort{ CompileResult_OverMemoryBudget, __FILE__, __LINE__, info };
+	}
+	fprintf(stderr, "%s\n", info);
+	exit(1);
+}
+
+static void
+CheckAllocSize(size_t nbytes)
+{
+	if (nbytes > MaxAlloc) {
+		OverMemoryBudget("allocation over MaxAlloc");
+	}
+}
+
+/*
+    Every block carries an AllocHeader, whatever ALLOC_STATS says, so the live bytes a budget is checked against are
+    always known: Deallocate() can't tell a block allocated inside a budget scope from one allocated before it.
+**/
+static thread_local int64_t tlsLiveBytes = 0;
+
+// Of the innermost AllocBudgetScope, in tlsLiveBytes terms.
+static thread_local int64_t tlsBudgetEndBytes = INT64_MAX;
+static thread_local int64_t tlsBudgetPeakBytes = 0;
+
+#if ALLOC_STATS
+static thread_local AllocStats tlsAllocStats;
+#endif
+
+// Before growing the live bytes by growth, so a block over budget is never allocated; a freed block may have been
+// allocated before the scope, so this is against the thread's live bytes rather than a count of the scope's own blocks.
+static void
+CheckBudget(int64_t growth)
+{
+	if (tlsLiveBytes + growth > tlsBudgetEndBytes) {
+		OverMemoryBudget("memory budget exceeded");
+	}
+}
+
+// Kept at 16 bytes so blocks stay as aligned as malloc's.
+struct alignas(16) AllocHeader {
+	uint64_t nbytes;
+	AllocTag tag;
+};
+static_assert(sizeof(AllocHeader) == 16, "");
+
+#if ALLOC_STATS
+static void
+ChargeTagBytes(AllocTagStats *s, int64_t delta)
+{
+	s->curBytes += delta;
+	s->peakBytes = Max(s->peakBytes, s->curBytes);
+}
+#endif
+
+// Once the memory is there: a failed malloc or realloc doesn't count toward the budget scope's peak.
+static void
+ChargeBytes(AllocTag tag, int64_t delta)
+{
+	tlsLiveBytes += delta;
+	tlsBudgetPeakBytes = Max(tlsBudgetPeakBytes, tlsLiveBytes);
+#if ALLOC_STATS
+	ChargeTagBytes(&tlsAllocStats.total, delta);
+	ChargeTagBytes(&tlsAllocStats.tags[tag], delta);
+#else
+	(void)tag;
+#endif
+}
+
+static void
+CountAlloc(AllocTag tag)
+{
+#if ALLOC_STATS
+	tlsAllocStats.total.nAllocs += 1;
+	tlsAllocStats.tags[tag].nAllocs += 1;
+#else
+	(void)tag;
+#endif
+}
+
+static void
+CountFree(AllocTag tag)
+{
+#if ALLOC_STATS
+	tlsAllocStats.total.nFrees += 1;
+	tlsAllocStats.tags[tag].nFrees += 1;
+#else
+	(void)tag;
+#endif
+}
+
+static void *
+OnAllocated(void *m, size_t nbytes)
+{
+	AllocHeader *const h = static_cast<AllocHeader *>(m);
+	h->nbytes = nbytes;
+	h->tag = tlsAllocTag;
+	ChargeBytes(h->tag, int64_t(nbytes));
+	CountAlloc(h->tag);
+	return h + 1;
+}
+
 void *
-AllocateBytes(size_t nbytes) noexcept
+AllocateBytes(size_t nbytes)
 {
-	ASSERT(nbytes <= MaxAlloc);
-	void *const m = malloc(nbytes);
+	CheckAllocSize(nbytes);
+	CheckBudget(int64_t(nbytes));
+	void *const m = malloc(sizeof(AllocHeader) + nbytes);
 	if (!m) {
-		perror("malloc");
-		exit(1);
+		OutOfMemory("malloc");
 	}
-	return m;
+	return OnAllocated(m, nbytes);
 }
 
 void *
-ReallocateBytes(void *p, size_t nbytes) noexcept
+ReallocateBytes(void *p, size_t nbytes)
 {
-	ASSERT(nbytes <= MaxAlloc);
-	void *const m = realloc(p, nbytes);
+	CheckAllocSize(nbytes);
+	if (!p) {
+		return AllocateBytes(nbytes);
+	}
+	AllocHeader *const h = static_cast<AllocHeader *>(p) - 1;
+	uint64_t const oldBytes = h->nbytes;
+	CheckBudget(Max<int64_t>(int64_t(nbytes) - int64_t(oldBytes), 0));
+	AllocTag const tag = h->tag;
+	uintptr_t const oldAddr = uintptr_t(h);
+	void *const m = realloc(h, sizeof(AllocHeader) + nbytes);
 	if (!m) {
-		perror("realloc");
-		exit(1);
+		OutOfMemory("realloc");
+	}
+	AllocHeader *const nh = static_cast<AllocHeader *>(m);
+	nh->nbytes = nbytes;
+	ChargeBytes(tag, int64_t(nbytes) - int64_t(oldBytes));
+#if ALLOC_STATS
+	AllocStats& st = tlsAllocStats;
+	st.total.nReallocs += 1;
+	st.tags[tag].nReallocs += 1;
+	if (uintptr_t(m) != oldAddr) {
+		uint64_t const copied = Min<uint64_t>(oldBytes, nbytes);
+		st.total.reallocCopyBytes += copied;
+		st.tags[tag].reallocCopyBytes += copied;
 	}
-	return m;
+#else
+	(void)oldAddr;
+#endif
+	return nh + 1;
 }
 
 void *
-AllocateZeroedBytes(size_t nbytes) noexcept
+AllocateZeroedBytes(size_t nbytes)
 {
-	ASSERT(nbytes <= MaxAlloc);
-	void *const m = calloc(nbytes, 1);
+	CheckAllocSize(nbytes);
+	CheckBudget(int64_t(nbytes));
+	void *const m = calloc(sizeof(AllocHeader) + nbytes, 1);
 	if (!m) {
-		perror("calloc");
-		exit(1);
+		OutOfMemory("calloc");
 	}
-	return m;
+	return OnAllocated(m, nbytes);
 }
 
 void
 Deallocate(const void *p) noexcept
 {
-	free(const_cast<void *>(p));
+	if (!p) {
+		return;
+	}
+	const AllocHeader *const h = static_cast<const AllocHeader *>(p) - 1;
+	ChargeBytes(h->tag, -int64_t(h->nbytes));
+	CountFree(h->tag);
+	free(const_cast<AllocHeader *>(h));
+}
+
+AllocTag
+ChargeMappedBytes(size_t nbytes)
+{
+	CheckAllocSize(nbytes);
+	CheckBudget(int64_t(nbytes));
+	ChargeBytes(tlsAllocTag, int64_t(nbytes));
+	CountAlloc(tlsAllocTag);
+	return tlsAllocTag;
+}
+
+void
+UnchargeMappedBytes(size_t nbytes, AllocTag tag) noexcept
+{
+	ChargeBytes(tag, -int64_t(nbytes));
+	CountFree(tag);
+}
+
+
+
+AllocTag
+SetAllocTag(AllocTag tag) noexcept
+{
+	ASSERT(tag < AllocTag_EnumEnd);
+	AllocTag const prev = tlsAllocTag;
+	tlsAllocTag = tag;
+	return prev;
+}
+
+AllocTag
+GetAllocTag() noexcept
+{
+	return tlsAllocTag;
+}
+
+AllocBudgetScope::AllocBudgetScope(uint64_t limitBytes) noexcept
+{
+	prevEndBytes = tlsBudgetEndBytes;
+	prevPeakBytes = tlsBudgetPeakBytes;
+	baseBytes = tlsLiveBytes;
+	if (limitBytes && int64_t(limitBytes) < tlsBudgetEndBytes - baseBytes) {
+		tlsBudgetEndBytes = baseBytes + int64_t(limitBytes);
+	}
+	tlsBudgetPeakBytes = baseBytes;
+}
+
+AllocBudgetScope::~AllocBudgetScope()
+{
+	tlsBudgetEndBytes = prevEndBytes;
+	tlsBudgetPeakBytes = Max(prevPeakBytes, tlsBudgetPeakBytes); // the outer scope's peak includes this one's
+}
+
+int64_t
+AllocBudgetScope::PeakBytes() const noexcept
+{
+	return tlsBudgetPeakBytes - baseBytes;
+}
+
+int64_t
+GetLiveBytes() noexcept
+{
+	return tlsLiveBytes;
+}
+
+AllocStats
+GetAllocStats() noexcept
+{
+#if ALLOC_STATS
+	return tlsAllocStats;
+#else
+	AllocStats st;
+	memset(&st, 0, sizeof st);
+	return st;
+#endif
+}
+
+void
+ResetAllocPeaks() noexcept
+{
+#if ALLOC_STATS
+	AllocStats& st = tlsAllocStats;
+	st.total.peakBytes = st.total.curBytes;
+	for (AllocTagStats& s : st.tags) {
+		s.peakBytes = s.curBytes;
+	}
+#endif
+}
+
+static AllocTagStats
+DiffTagStats(const AllocTagStats& before, const AllocTagStats& after)
+{
+	AllocTagStats d;
+	d.curBytes         = after.curBytes - before.curBytes;
+	d.peakBytes        = after.peakBytes - before.curBytes;
+	d.nAllocs          = after.nAllocs - before.nAllocs;
+	d.nReallocs        = after.nReallocs - before.nReallocs;
+	d.nFrees           = after.nFrees - before.nFrees;
+	d.reallocCopyBytes = after.reallocCopyBytes - before.reallocCopyBytes;
+	return d;
+}
+
+AllocStats
+DiffAllocStats(const AllocStats& before, const AllocStats& after) noexcept
+{
+	AllocStats d;
+	d.total = DiffTagStats(before.total, after.total);
+	for (uint i = 0; i < AllocTag_EnumEnd; ++i) {
+		d.tags[i] = DiffTagStats(before.tags[i], after.tags[i]);
+	}
+	return d;
 }
 
 
@@ -1,12 +1,91 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
-void* AllocateBytes(size_t nbytes) noexcept;
-void* AllocateZeroedBytes(size_t nbytes) noexcept;
-void* ReallocateBytes(void *p, size_t nbytes) noexcept;
+/*
+ * Allocation accounting. Every block carries a small header with its size and tag, and each thread counts its live
+ * bytes, so budgets and peaks (AllocBudgetScope) work in every build, with no synchronization. The per-tag stats
+ * are on by default in DEBUG builds only; build with ALLOC_STATS=1 for them in bench numbers, or ALLOC_STATS=0 to
+ * compile them out of a debug build. Without them the stats functions return zeros.
+ */
+#ifndef ALLOC_STATS
+    #if defined DEBUG || defined _DEBUG
+        #define ALLOC_STATS 1
+    #else
+        #define ALLOC_STATS 0
+    #endif
+#endif
+
+// Subsystem an allocation is charged to, taken from the calling thread's current tag.
+enum AllocTag : uint8_t {
+    AllocTag_Misc       = 0,
+    AllocTag_Lexer      = 1,
+    AllocTag_Parser     = 2,
+    AllocTag_Types      = 3, // SpvPool's types and constants
+#define AllocTag_EnumEnd  4
+};
+
+struct AllocTagStats {
+    int64_t curBytes; // signed: a block freed on another thread than it was allocated on is charged there
+    int64_t peakBytes;
+    uint64_t nAllocs;
+    uint64_t nReallocs;
+    uint64_t nFrees;
+    uint64_t reallocCopyBytes; // bytes moved by reallocs that could not grow in place
+};
+
+struct AllocStats {
+    AllocTagStats total;
+    AllocTagStats tags[AllocTag_EnumEnd];
+};
+
+void* AllocateBytes(size_t nbytes); // throws CompileAbort inside a compile, else exits, if out of memory
+void* AllocateZeroedBytes(size_t nbytes); // throws CompileAbort inside a compile, else exits, if out of memory
+void* ReallocateBytes(void *p, size_t nbytes); // throws CompileAbort inside a compile, else exits, if out of memory
 void Deallocate(const void *p) noexcept;
 
+// For memory that doesn't come from these functions, such as chunks mapped from the OS: nbytes counted as live and
+// against the budget like a block, before it is mapped. Returns the tag charged, to give back with the release.
+AllocTag ChargeMappedBytes(size_t nbytes);
+void UnchargeMappedBytes(size_t nbytes, AllocTag tag) noexcept;
+
 template<class T> T* Allocate(size_t n) { return (T *) AllocateBytes(n * sizeof(T)); }
 template<class T> T* AllocateZeroed(size_t n) { return (T *) AllocateZeroedBytes(n * sizeof(T)); }
 template<class T> T* Reallocate(void *p, size_t n) { return (T *) ReallocateBytes(p, n * sizeof(T)); }
+
+AllocTag SetAllocTag(AllocTag tag) noexcept; // returns the previous tag
+AllocTag GetAllocTag() noexcept;
+
+struct AllocTagScope {
+    AllocTag prev;
+    explicit AllocTagScope(AllocTag tag) : prev(SetAllocTag(tag)) { }
+    ~AllocTagScope() { SetAllocTag(prev); }
+    AllocTagScope(const AllocTagScope&) = delete;
+    void operator=(const AllocTagScope&) = delete;
+};
+
+/*
+ * A cap on the bytes the calling thread has live, for a region such as one compile: an allocation that would
+ * take them more than limitBytes past what was live when the scope began fails like malloc running out, except
+ * that a compile reports CompileResult_OverMemoryBudget. Nested scopes only ever tighten it. The scope also
+ * tracks its own high-water mark. Requests over MaxAlloc fail the same way, budget or not.
+ */
+struct AllocBudgetScope {
+    int64_t prevEndBytes;
+    int64_t prevPeakBytes;
+    int64_t baseBytes;
+    explicit AllocBudgetScope(uint64_t limitBytes) noexcept; // 0 for no limit
+    ~AllocBudgetScope();
+    int64_t PeakBytes() const noexcept; // most bytes live at once since the scope began, above what was live then
+    AllocBudgetScope(const AllocBudgetScope&) = delete;
+    void operator=(const AllocBudgetScope&) = delete;
+};
+
+int64_t GetLiveBytes() noexcept; // the calling thread's, with or without ALLOC_STATS
+AllocStats GetAllocStats() noexcept; // snapshot of the calling thread's counters
+void ResetAllocPeaks() noexcept; // peaks = current, so a following snapshot's peaks are for the region after this call
+
+/* Counters are after - before. Peaks are relative to before's current bytes, so they give the
+   high-water mark of the region if ResetAllocPeaks() was called when before was taken. */
+AllocStats DiffAllocStats(const AllocStats& before, const AllocStats& after) noexcept;
@@ -0,0 +1,94 @@
+#include "common.h"
+
+#include "half.h"
+
+#include <string.h>
+
+#if defined __F16C__ || (defined _MSC_VER && defined __AVX2__)
+    #include <immintrin.h>
+    #define HALF_F16C 1
+#else
+    #define HALF_F16C 0
+#endif
+
+const bool Half_bF16C = HALF_F16C;
+
+uint16_t Half_FromFloatSoft(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t const sign = x >> 16 & 0x8000;
+    uint32_t const abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) { // infinity, or NaN with the top of its payload and the quiet bit
+        return uint16_t(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | (abs >> 13 & 0x3ff) : 0));
+    }
+    if (abs >= 0x477ff000) { // 65520, halfway from the largest half to 2^16, and up
+        return uint16_t(sign | 0x7c00);
+    }
+    if (abs <= 0x33000000) { // 2^-25, halfway to the smallest subnormal, and down
+        return uint16_t(sign);
+    }
+
+    // Shift the significand down to units of half's last bit, 2^-24 for subnormals, and round to even. A carry out
+    // of the significand goes into the exponent, which is what it should do.
+    uint32_t bits;
+    uint shift;
+    if (abs < 0x38800000) { // 2^-14, the smallest normal half
+        bits = (abs & 0x7fffff) | 0x800000;
+        shift = 126 - (abs >> 23);
+    }
+    else {
+        bits = abs - ((127 - 15) << 23);
+        shift = 13;
+    }
+    uint32_t const q = bits >> shift;
+    uint32_t const rem = bits & ((1u << shift) - 1);
+    uint32_t const tie = 1u << (shift - 1);
+    return uint16_t(sign | (q + (rem > tie || (rem == tie && (q & 1)))));
+}
+
+float Half_ToFloatSoft(uint16_t h)
+{
+    uint32_t const sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = h >> 10 & 0x1f;
+    uint32_t m = h & 0x3ff;
+    uint32_t x;
+    if (exponent == 0x1f) {
+        x = sign | 0x7f800000 | (m ? 0x400000 | m << 13 : 0);
+    }
+    else if (exponent == 0 && m == 0) {
+        x = sign;
+    }
+    else {
+        if (exponent == 0) { // subnormal, normalized
+            exponent = 1;
+            while (!(m & 0x400)) {
+                m <<= 1;
+                exponent -= 1;
+            }
+            m &= 0x3ff;
+        }
+        x = sign | (exponent + 127 - 15) << 23 | m << 13;
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+uint16_t Half_FromFloat(float f)
+{
+#if HALF_F16C
+    return uint16_t(_cvtss_sh(f, 0)); // round to nearest even
+#else
+    return Half_FromFloatSoft(f);
+#endif
+}
+
+float Half_ToFloat(uint16_t h)
+{
+#if HALF_F16C
+    return _cvtsh_ss(h);
+#else
+    return Half_ToFloatSoft(h);
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+
+/*
+ * IEEE binary16, as the bits of a uint16_t, for folding half-precision constants exactly.
+ *
+ * Conversions round to nearest even, overflow to infinity and keep NaN payloads quieted, as F16C's vcvtps2ph does:
+ * that is used where the build targets it, and the software path gives the same bits everywhere else. The arithmetic
+ * is done in float and rounded once to half. Float carries 24 bits, at least twice half's 11 plus 2, so the double
+ * rounding is innocuous and the results are the correctly rounded half ones for +, -, * and /.
+ */
+uint16_t Half_FromFloat(float f);
+float Half_ToFloat(uint16_t h); // exact
+
+// Always the software path, to check the other against.
+uint16_t Half_FromFloatSoft(float f);
+float Half_ToFloatSoft(uint16_t h);
+
+extern const bool Half_bF16C; // Half_FromFloat() and Half_ToFloat() are the F16C instructions
+
+inline bool
+Half_IsFinite(uint16_t h)
+{
+    return (h & 0x7c00) != 0x7c00;
+}
+
+inline uint16_t
+Half_Negate(uint16_t a)
+{
+    return uint16_t(a ^ 0x8000);
+}
+
+inline uint16_t Half_Add(uint16_t a, uint16_t b) { return Half_FromFloat(Half_ToFloat(a) + Half_ToFloat(b)); }
+inline uint16_t Half_Sub(uint16_t a, uint16_t b) { return Half_FromFloat(Half_ToFloat(a) - Half_ToFloat(b)); }
+inline uint16_t Half_Mul(uint16_t a, uint16_t b) { return Half_FromFloat(Half_ToFloat(a) * Half_ToFloat(b)); }
+inline uint16_t Half_Div(uint16_t a, uint16_t b) { return Half_FromFloat(Half_ToFloat(a) / Half_ToFloat(b)); }
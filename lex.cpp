@@ -2,6 +2,8 @@
 
 #include "lex.h"
 
+#include <string.h> // memcmp
+
 #define MaxNameLength 0x7f
 
 inline bool IsValidNameFirstChar(uint c)
@@ -29,10 +31,8 @@ FinishIntegerLiteral(const ubyte *p, Token *token, uint64_t raw)
 
     token->numberLiteralBuiltinType = (raw >> 32) ? BuiltinType_g64 : BuiltinType_g32;
 
-    if ((*p | 32) == 'u') {
-        ++p;
-        token->bNumberLiteralUnsigned = true;
-    }
+    token->bNumberLiteralUnsigned = (*p | 32) == 'u'; // the token may be reused, so set either way
+    p += token->bNumberLiteralUnsigned;
 
     if ((*p | 32) == 'l') {
         NotImplemented("long suffix");
@@ -50,9 +50,14 @@ FinishIntegerLiteral(const ubyte *p, Token *token, uint64_t raw)
     The token is "raw", in that:
         - The final type of a numeric literal is not known.
         - A unary negate ('-') infront of a numeric literal may be a seperate token.
+
+    Features is a mask of ScanFeature_*; whatever is left out is compiled out:
+        - Without ScanFeature_Comments, '/' is never a comment start.
+        - Without ScanFeature_TrackLines, '\n' is plain whitespace and lineno is left alone.
 **/
+template<ScanFeatureFlags Features>
 TokenKind
-Scanner_NextTokenRaw(Scanner *scanner, Token *token)
+Scanner_NextTokenRawT(Scanner *scanner, Token *token)
 {
     ASSERT(*scanner->pSrcSentinel == '\0');
 
@@ -69,24 +74,31 @@ Scanner_NextTokenRaw(Scanner *scanner, Token *token)
     uint64_t mantissa;
     int exponent10;
 #endif
-    // Skip whitespace and comments:
+    // Skip whitespace and comments. The sentinel is a '\0', so the end check only happens when one is read:
     for (;;) {
-        if (p >= pSentinel) {
-            token->kind = Token_EOI;
-            scanner->pSrcCurr = pSentinel;
-            return Token_EOI;
-        }
         c = *p++; // consume
         switch (c) {
+            case '\0':
+                if (p > pSentinel) {
+                    token->kind = Token_EOI;
+                    scanner->pSrcCurr = pSentinel;
+                    return Token_EOI;
+                }
+                break; // embedded '\0', invalid byte
             case '\n':
-                scanner->lineno += 1;
-                token->lineno = scanner->lineno;
+                if (Features & ScanFeature_TrackLines) {
+                    scanner->lineno += 1;
+                    token->lineno = scanner->lineno;
+                }
                 continue;
             case ' ': case '\r':
                 continue;
             case '\t':
                 continue; // something about tab alignment
             case '/': {
+                if (!(Features & ScanFeature_Comments)) {
+                    break;
+                }
                 uint const c1 = *p; // peek
                 if (c1 == '/') {
                     do c = *++p; while (c != 0 && c != '\n');
@@ -107,8 +119,10 @@ Scanner_NextTokenRaw(Scanner *scanner, Token *token)
                         }
                         c = *p++; // consume
                         if (c == '\n') {
-                            scanner->lineno += 1;
-                            token->lineno = scanner->lineno;
+                            if (Features & ScanFeature_TrackLines) {
+                                scanner->lineno += 1;
+                                token->lineno = scanner->lineno;
+                            }
                             continue;
                         }
                         if (c == '/' && p[-2] == '*') {
@@ -125,28 +139,101 @@ Scanner_NextTokenRaw(Scanner *scanner, Token *token)
 
     switch (c) {
     case '*': {
-        if (*p == '/') {
+        if ((Features & ScanFeature_Comments) && *p == '/') {
             SetLexError(token, LexError_BlockCommentNoBegin);
             break;
         }
-        token->kind = Token_Mul;
+        if (*p == '=') { ++p; token->kind = Token_MulAssign; } else { token->kind = Token_Mul; }
     } break;
+    // With ScanFeature_Comments a '/' starting a comment never gets here; without it "//" is two Token_Divs:
+    case '/': if (*p == '=') { ++p; token->kind = Token_DivAssign;        } else { token->kind = Token_Div; }               break;
+    case '%': if (*p == '=') { ++p; token->kind = Token_ModAssign;        } else { token->kind = Token_Mod; }               break;
     case '!': if (*p == '=') { ++p; token->kind = Token_CmpNotEq;         } else { token->kind = Token_UnaryLogicalNot; }   break;
     case '=': if (*p == '=') { ++p; token->kind = Token_CmpEqual;         } else { token->kind = Token_Assign; }            break;
-    case '+': if (*p == '+') { ++p; token->kind = Token_Inc;              } else { token->kind = Token_Plus; }              break;
-    case '-': if (*p == '-') { ++p; token->kind = Token_Dec;              } else { token->kind = Token_Minus; }             break;
-    case '&': if (*p == '&') { ++p; token->kind = Token_LogicAnd;         } else { token->kind = Token_Amp; }               break;
-    case '|': if (*p == '|') { ++p; token->kind = Token_LogicOr;          } else { token->kind = Token_VBar; }              break;
-    case '<': if (*p == '<') { ++p; token->kind = Token_LeftShift;        } else { token->kind = Token_LessThan; }          break; // TODO: <=
-    case '>': if (*p == '>') { ++p; token->kind = Token_RightShift;       } else { token->kind = Token_GreaterThan; }       break; // TODO: >=
-    case '^': token->kind = Token_Caret;            break;
+    case '^': if (*p == '=') { ++p; token->kind = Token_XorAssign;        } else { token->kind = Token_Caret; }             break;
+    case '+':
+        if      (*p == '+') { ++p; token->kind = Token_Inc; }
+        else if (*p == '=') { ++p; token->kind = Token_AddAssign; }
+        else                {      token->kind = Token_Plus; }
+        break;
+    case '-':
+        if      (*p == '-') { ++p; token->kind = Token_Dec; }
+        else if (*p == '=') { ++p; token->kind = Token_SubAssign; }
+        else                {      token->kind = Token_Minus; }
+        break;
+    case '&':
+        if      (*p == '&') { ++p; token->kind = Token_LogicAnd; }
+        else if (*p == '=') { ++p; token->kind = Token_AndAssign; }
+        else                {      token->kind = Token_Amp; }
+        break;
+    case '|':
+        if      (*p == '|') { ++p; token->kind = Token_LogicOr; }
+        else if (*p == '=') { ++p; token->kind = Token_OrAssign; }
+        else                {      token->kind = Token_VBar; }
+        break;
+    case '<':
+        if      (*p == '<') { ++p; if (*p == '=') { ++p; token->kind = Token_LeftShiftAssign; } else { token->kind = Token_LeftShift; } }
+        else if (*p == '=') { ++p; token->kind = Token_LessEq; }
+        else                {      token->kind = Token_LessThan; }
+        break;
+    case '>':
+        if      (*p == '>') { ++p; if (*p == '=') { ++p; token->kind = Token_RightShiftAssign; } else { token->kind = Token_RightShift; } }
+        else if (*p == '=') { ++p; token->kind = Token_GreaterEq; }
+        else                {      token->kind = Token_GreaterThan; }
+        break;
     case '~': token->kind = Token_UnaryBitwiseNot;  break;
+    case '?': token->kind = Token_Question;         break;
+    case ':': token->kind = Token_Colon;            break;
+    case '#': token->kind = Token_Hash;             break;
     case ',': token->kind = Token_Comma;            break;
     case ';': token->kind = Token_SemiColon;        break;
     case '{': token->kind = Token_OpenCurly;        break;
     case '}': token->kind = Token_CloseCurly;       break;
     case '(': token->kind = Token_OpenParen;        break;
     case ')': token->kind = Token_CloseParen;       break;
+    case '[': token->kind = Token_OpenBracket;      break;
+    case ']': token->kind = Token_CloseBracket;     break;
+    case '.': {
+        if (uint(*p - '0') < 10u) {
+            NotImplemented("FP literals");
+        }
+        const ubyte *first = p;
+        while (IsValidNameTrailingChar(*p)) {
+            p++;
+        }
+        uint32_t const n = uint32_t(p - first);
+        if (n == 0) { // digits were handled above
+            SetLexError(token, LexError_InvalidByte);
+            token->data.error.invalidByte = c;
+        }
+        else if (n <= MaxNameLength) {
+            token->kind = Token_DotName;
+            token->nameLength = n;
+            token->data.nameBegin = first;
+        }
+        else {
+            SetLexError(token, LexError_NameTooLong);
+        }
+    } break;
+    case '"': {
+        const ubyte *first = p;
+        while (*p != '"' && *p != '\n' && *p != '\0') {
+            p++;
+        }
+        if (*p != '"') {
+            SetLexError(token, LexError_StringNoEnd);
+            break;
+        }
+        uint32_t const n = uint32_t(p++ - first);
+        if (n <= MaxNameLength) {
+            token->kind = Token_StringLiteral;
+            token->nameLength = n;
+            token->data.nameBegin = first;
+        }
+        else {
+            SetLexError(token, LexError_NameTooLong);
+        }
+    } break;
     case '0': {
         uint const c1 = *p;
         uint const lower = c1 | 32u;
@@ -214,10 +301,10 @@ Scanner_NextTokenRaw(Scanner *scanner, Token *token)
             token->nameLength = n;
             token->data.nameBegin = first;
             // this sucks but lets get something going
-            static struct {
-                const char *str; TokenKind eToken;
+            static const struct {
+                const char *str; uint8_t len; TokenKind eToken;
             } KeyWords[] = {
-            #define F(name) { #name, Token_Kw_##name }
+            #define F(name) { #name, uint8_t(sizeof #name - 1), Token_Kw_##name }
                 F(static_assert),
                 F(void),
                 F(char),
@@ -228,16 +315,19 @@ Scanner_NextTokenRaw(Scanner *scanner, Token *token)
                 F(half),
                 F(float),
                 F(double),
+                F(constexpr),
+                F(return),
+                F(if),
+                F(else),
+                F(for),
+                F(while),
+                F(break),
+                F(continue),
             #undef F
             };
             for (const auto &entry : KeyWords) {
-                uint i = 0;
-                for (; i < n; ++i) {
-                    if (first[i] != entry.str[i]) {
-                        break;
-                    }
-                }
-                if (entry.str[i] == 0) {
+                // Length first, so "intx" isn't "int" and most entries are rejected without touching the text.
+                if (entry.len == n && memcmp(first, entry.str, n) == 0) {
                     token->kind = entry.eToken;
                     break;
                 }
@@ -256,3 +346,8 @@ Scanner_NextTokenRaw(Scanner *scanner, Token *token)
     scanner->pSrcCurr = p;
     return token->kind;
 }
+
+template TokenKind Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(Scanner *, Token *);
+template TokenKind Scanner_NextTokenRawT<ScanFeature_Comments>(Scanner *, Token *);
+template TokenKind Scanner_NextTokenRawT<ScanFeature_TrackLines>(Scanner *, Token *);
+template TokenKind Scanner_NextTokenRawT<ScanFeatures_Full>(Scanner *, Token *);
@@ -6,7 +6,7 @@ enum TokenKind : uint8_t {
 	Token_EOI,              // end of input
 	Token_LexError,
 	Token_Name,	            
-	Token_DotName,	        
+	Token_DotName,	        // .xyz, name excludes the '.'
 	Token_NumberLiteral,	// 0 0xf -5 1.5f
 	Token_SemiColon,		// ;
 	Token_Comma,		    // ,
@@ -15,6 +15,8 @@ enum TokenKind : uint8_t {
 	Token_OpenCurly,		// {
 	Token_CloseCurly,		// }
 	Token_Mul,		        // *
+    Token_Div,              // /
+    Token_Mod,              // %
 	Token_Plus,             // +
 	Token_Minus,            // -
 	Token_Inc,              // ++
@@ -28,11 +30,27 @@ enum TokenKind : uint8_t {
 	Token_GreaterThan,      // >
 	Token_LeftShift,        // <<
 	Token_RightShift,       // >>
+    Token_LessEq,           // <=
+    Token_GreaterEq,        // >=
 	Token_Assign,           // =
+    Token_AddAssign,        // +=
+    Token_SubAssign,        // -=
+    Token_MulAssign,        // *=
+    Token_DivAssign,        // /=
+    Token_ModAssign,        // %=
+    Token_LeftShiftAssign,  // <<=
+    Token_RightShiftAssign, // >>=
+    Token_AndAssign,        // &=
+    Token_XorAssign,        // ^=
+    Token_OrAssign,         // |=
 	Token_CmpEqual,         // ==
 	Token_CmpNotEq,         // !=
 	Token_UnaryLogicalNot,  // !
 	Token_UnaryBitwiseNot,  // ~
+	Token_Question,         // ?
+	Token_Colon,            // :
+	Token_Hash,             // #, only meaningful to the preprocessor
+	Token_StringLiteral,    // "abc", no escapes; nameBegin/nameLength hold the text between the quotes
 	Token_Kw_static_assert, // static_assert
 	Token_Kw_void,
 	Token_Kw_char,
@@ -43,13 +61,23 @@ enum TokenKind : uint8_t {
 	Token_Kw_half,
 	Token_Kw_float,
 	Token_Kw_double,
+	Token_Kw_constexpr,
+	Token_Kw_return,
+	Token_Kw_if,
+	Token_Kw_else,
+	Token_Kw_for,
+	Token_Kw_while,
+	Token_Kw_break,
+	Token_Kw_continue,
+	Token_OpenBracket,      // [
+	Token_CloseBracket,     // ]
 };
 
 struct Token {
 	TokenKind kind;
     BuiltinTypeKind numberLiteralBuiltinType; // only valid if Token_NumberLiteral
     bool bNumberLiteralUnsigned; // only valid if Token_NumberLiteral
-    uint8_t nameLength; // Token_Name
+    uint8_t nameLength; // Token_Name, Token_DotName, Token_StringLiteral
 
     int32_t lineno;
 
@@ -59,7 +87,7 @@ struct Token {
         double numberDouble; // Token_NumberLiteral
         float numberFloat; // Token_NumberLiteral, maybe keep as double?
 
-        const ubyte *nameBegin; // Token_Name, NOTE: points into the source text!
+        const ubyte *nameBegin; // Token_Name, Token_DotName, Token_StringLiteral, NOTE: points into the source text!
 
         struct {
             uint8_t invalidByte; // LexError_InvalidByte
@@ -76,8 +104,25 @@ struct Scanner
     uint32_t lineno;
 };
 
+typedef uint ScanFeatureFlags;
+enum : ScanFeatureFlags {
+    ScanFeature_Comments   = 1u << 0,
+    ScanFeature_TrackLines = 1u << 1, // else Token::lineno stays at the value the scanner started with
+
+    ScanFeatures_Full = ScanFeature_Comments | ScanFeature_TrackLines, // hand-written source
+    ScanFeatures_MachineGenerated = 0, // codegen-produced source: no comments, positions not needed
+};
+
+// Instantiated in lex.cpp for every combination of the flags above.
+template<ScanFeatureFlags Features>
 TokenKind
-Scanner_NextTokenRaw(Scanner *scanner, Token *token);
+Scanner_NextTokenRawT(Scanner *scanner, Token *token);
+
+inline TokenKind
+Scanner_NextTokenRaw(Scanner *scanner, Token *token)
+{
+    return Scanner_NextTokenRawT<ScanFeatures_Full>(scanner, token);
+}
 
 inline void
 Scanner_Init(Scanner *scanner, view<const char> input)
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
+#include "spvreader.h"
 
 // #include "Array.h"
 // template class Array<uint32_t>;
@@ -9,6 +11,9 @@
 noreturn_void
 NotImplementedImpl(const char *file, int line, const char *info)
 {
+    if (tlsCompileAbortScopes) {
+        throw CompileAbort{ CompileResult_NotImplemented, file, line, info };
+    }
     printf("\nNotImplemented at %s:%d, %s.\n", file, line, info);
 #ifdef _DEBUG
     __debugbreak();
@@ -19,13 +24,82 @@ NotImplementedImpl(const char *file, int line, const char *info)
 
 
 void Scanner_TestRaw();
+void TestSmallArray();
+void TestAllocStats();
+void TestPool();
+void TestPreprocessor();
+void TestSpvSectionLink();
+void TestSpvReader();
+void TestSpvLink();
+void TestSpvPool();
+void TestDataflow();
+void TestSpvUnroll();
+void TestSpvSlp();
+void TestHalf();
+void TestSpvHalf();
 int TestSimpleNoCode();
+int TestConstantFoldOracle();
+int TestStructuralIndex();
+
+int RunBenchmarks();
+int RunComplexityCheck(double fuzzSeconds);
+
+static void
+WriteToFile(void *user, const char *text, uint nBytes)
+{
+    fwrite(text, 1, nBytes, static_cast<FILE *>(user));
+}
 
-int main()
+// "vkc spv file.spv": validates the module and disassembles it to stdout. Exits with 1 if it is invalid.
+static int
+RunSpvTool(const char *path)
 {
+    SpvMappedFile file;
+    if (!SpvMapFile(path, &file)) {
+        fprintf(stderr, "%s: can't read it, or not a whole number of words\n", path);
+        return 1;
+    }
+    SpvDisassemble(file.words, WriteToFile, stdout);
+    SpvValidationError error;
+    bool const bValid = SpvValidate(file.words, &error);
+    if (!bValid) {
+        fprintf(stderr, "%s: invalid at word %u: %s\n", path, error.wordOffset, error.what);
+    }
+    SpvUnmapFile(&file);
+    return bValid ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        if (argc > 2 && strcmp(argv[2], "complexity") == 0) {
+            return RunComplexityCheck(argc > 3 ? atof(argv[3]) : 10.0);
+        }
+        return RunBenchmarks();
+    }
+    if (argc > 2 && strcmp(argv[1], "spv") == 0) {
+        return RunSpvTool(argv[2]);
+    }
+
     Scanner_TestRaw();
+    TestSmallArray();
+    TestAllocStats();
+    TestPool();
+    TestPreprocessor();
+    TestSpvSectionLink();
+    TestSpvReader();
+    TestSpvLink();
+    TestSpvPool();
+    TestDataflow();
+    TestSpvUnroll();
+    TestSpvSlp();
+    TestHalf();
+    TestSpvHalf();
     puts("\n\n");
     TestSimpleNoCode();
+    puts("\n\n");
+    TestConstantFoldOracle();
+    TestStructuralIndex();
 
 
 #if 0
@@ -7,6 +7,11 @@ enum MessageEnum : uint8_t {
     Message_StaticAssertFailed = 1,
     Message_IntLiteralOver64Bits = 2,
     Message_NoSignWrapViolated = 3, // nsw
+    Message_ConditionalLowering = 4, // remark, only with CompileOptions::bReportConditionalLowering; miscU8 is the ExprModeEnum chosen
+    Message_IncludeNotFound = 5,
+    Message_ErrorDirective = 6, // #error
+    Message_CompileAborted = 7, // always the last one, miscU8 is the CompileResult, MessageStream::abortInfo says why
+    Message_ConstexprBudgetExceeded = 8, // line of the outermost call, miscU8 is the ConstexprBudget that ran out
 };
 
 struct Message {
@@ -22,10 +27,13 @@ class MessageStream {
     Message messages[256];
 
 public:
-    Message *PushRaw();
+    const char *abortInfo = nullptr; // with Message_CompileAborted, static text
+
+    Message *PushRaw(); // keeps the last slot free for PushAbort()
+    Message *PushAbort();
     // char *AllocString(uint nbytes); 
     const Message *begin() const { return messages; }
     const Message *end() const { return messages + nMessages; }
     uint size() const { return nMessages; }
-    void clear() { nMessages = 0; }
+    void clear() { nMessages = 0; abortInfo = nullptr; }
 };
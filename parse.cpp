@@ -1,11 +1,21 @@
 #include "common.h"
 #include "message.h"
 #include "lex.h"
+#include "compile.h"
 #include "type.h"
+#include "default_alloc.h"
+#include "spvreader.h" // opcodes
+#include "spvpool.h"
 
 #include <string.h>
 #include <stdio.h> // devel
 
+// Parser tracing to stdout, on in debug builds:
+#ifndef DEVEL_PRINTS
+    #define DEVEL_PRINTS is_debug
+#endif
+#define devel_printf(...) (DEVEL_PRINTS ? (void)printf(__VA_ARGS__) : (void)0)
+
 enum TypelessOp : uint8_t {
     TypelessOp_UnaryPlus, // just typechecks is arithmetic and nulls out Variable ref (leaving Value)
     TypelessOp_UnaryNegate,
@@ -17,17 +27,40 @@ enum TypelessOp : uint8_t {
     TypelessOp_Add,
     TypelessOp_Sub,
     TypelessOp_Mul,
+    TypelessOp_Div, // these four are signed or unsigned by their operands' types, SpecNode::bUnsigned
+    TypelessOp_Mod,
+    TypelessOp_ShiftLeft,
+    TypelessOp_ShiftRight,
     TypelessOp_CmpEqual,
     TypelessOp_CmpNotEq,
-    TypelessOp_Assign,
+    TypelessOp_CmpLess, // and these four
+    TypelessOp_CmpLessEq,
+    TypelessOp_CmpGreater,
+    TypelessOp_CmpGreaterEq,
+    TypelessOp_LogicalAnd,
+    TypelessOp_LogicalOr,
+    TypelessOp_TernarySelect, // what a '?' becomes once its ':' is seen, takes 3 args
+    TypelessOp_Assign, // Assign through OrAssign must stay in this order, see IsAssignment()
+    TypelessOp_AddAssign,
+    TypelessOp_SubAssign,
+    TypelessOp_MulAssign,
+    TypelessOp_DivAssign,
+    TypelessOp_ModAssign,
+    TypelessOp_ShiftLeftAssign,
+    TypelessOp_ShiftRightAssign,
+    TypelessOp_AndAssign,
+    TypelessOp_XorAssign,
+    TypelessOp_OrAssign,
     // TypelessOp_Index, // transformed 
     TypelessOp_CallOrFunctionalCast, // transformed 
 #define TypelessOp_LowEnumEnd (TypelessOp_CallOrFunctionalCast + 1)
     TypelessOp_OpenParen,
     TypelessOp_CloseParen,
-#define TypelessOp_ParserEnumEnd (TypelessOp_CloseParen + 1)
+    TypelessOp_TernaryQuestion, // only a marker on the stack, the '?' of an unfinished ?:
+#define TypelessOp_ParserEnumEnd (TypelessOp_TernaryQuestion + 1)
 };
 constexpr uint IsRightAssocFlag = 1u << 8, PrecShift = 9u;
+static_assert(TypelessOp_ParserEnumEnd <= IsRightAssocFlag, "TypelessOp must fit below OpInfo's flags");
 // https://en.cppreference.com/w/cpp/language/operator_precedence
 // GLSL is similar: https://www.khronos.org/registry/OpenGL/specs/gl/GLSLangSpec.4.60.html#operators
 // NOTE: those docs have lower values for higher, but do DoStackedOp() wants the other way, hence the (31 - x).
@@ -49,14 +82,24 @@ enum OpInfo : uint16_t {
 
     // 5:
     OpInfo_Mul                  = (31 - 5) << PrecShift | TypelessOp_Mul,
+    OpInfo_Div                  = (31 - 5) << PrecShift | TypelessOp_Div,
+    OpInfo_Mod                  = (31 - 5) << PrecShift | TypelessOp_Mod,
 
     // 6:
     OpInfo_Add                  = (31 - 6) << PrecShift | TypelessOp_Add,
     OpInfo_Sub                  = (31 - 6) << PrecShift | TypelessOp_Sub,
 
-    // 7:                           = (31 - 7)
-    // 8:                           = (31 - 8)
-    // 9:                           = (31 - 9)
+    // 7:
+    OpInfo_ShiftLeft            = (31 - 7) << PrecShift | TypelessOp_ShiftLeft,
+    OpInfo_ShiftRight           = (31 - 7) << PrecShift | TypelessOp_ShiftRight,
+
+    // 8:                           = (31 - 8), <=>
+
+    // 9:
+    OpInfo_CmpLess              = (31 - 9) << PrecShift | TypelessOp_CmpLess,
+    OpInfo_CmpLessEq            = (31 - 9) << PrecShift | TypelessOp_CmpLessEq,
+    OpInfo_CmpGreater           = (31 - 9) << PrecShift | TypelessOp_CmpGreater,
+    OpInfo_CmpGreaterEq         = (31 - 9) << PrecShift | TypelessOp_CmpGreaterEq,
 
     //10:
     OpInfo_CmpEqual             = (31 -10) << PrecShift | TypelessOp_CmpEqual,
@@ -71,97 +114,263 @@ enum OpInfo : uint16_t {
     //13:
     OpInfo_BitwiseOr            = (31 -13) << PrecShift | TypelessOp_BitwiseOr,
 
-    //14:                           = (31 -14)
-    //15:                           = (31 -15)
+    //14:
+    OpInfo_LogicalAnd           = (31 -14) << PrecShift | TypelessOp_LogicalAnd,
+
+    //15:
+    OpInfo_LogicalOr            = (31 -15) << PrecShift | TypelessOp_LogicalOr,
 
     //16, right assoc:
+    OpInfo_TernaryQuestion      = (31 -16) << PrecShift | TypelessOp_TernaryQuestion | IsRightAssocFlag,
+    OpInfo_TernarySelect        = (31 -16) << PrecShift | TypelessOp_TernarySelect   | IsRightAssocFlag,
     OpInfo_Assign               = (31 -16) << PrecShift | TypelessOp_Assign     | IsRightAssocFlag,
+    OpInfo_AddAssign            = (31 -16) << PrecShift | TypelessOp_AddAssign  | IsRightAssocFlag,
+    OpInfo_SubAssign            = (31 -16) << PrecShift | TypelessOp_SubAssign  | IsRightAssocFlag,
+    OpInfo_MulAssign            = (31 -16) << PrecShift | TypelessOp_MulAssign  | IsRightAssocFlag,
+    OpInfo_DivAssign            = (31 -16) << PrecShift | TypelessOp_DivAssign  | IsRightAssocFlag,
+    OpInfo_ModAssign            = (31 -16) << PrecShift | TypelessOp_ModAssign  | IsRightAssocFlag,
+    OpInfo_ShiftLeftAssign      = (31 -16) << PrecShift | TypelessOp_ShiftLeftAssign  | IsRightAssocFlag,
+    OpInfo_ShiftRightAssign     = (31 -16) << PrecShift | TypelessOp_ShiftRightAssign | IsRightAssocFlag,
+    OpInfo_AndAssign            = (31 -16) << PrecShift | TypelessOp_AndAssign  | IsRightAssocFlag,
+    OpInfo_XorAssign            = (31 -16) << PrecShift | TypelessOp_XorAssign  | IsRightAssocFlag,
+    OpInfo_OrAssign             = (31 -16) << PrecShift | TypelessOp_OrAssign   | IsRightAssocFlag,
 
     //17:                           = (31 -17)
 
     //18: group openings
     OpInfo_OpenParen            = (31 -18) << PrecShift | TypelessOp_OpenParen,
+    OpInfo_CloseParenCollapse   = (31 -18) << PrecShift | TypelessOp_CloseParen   | IsRightAssocFlag, // collapses down to the matching '('
 
     //special:
     OpInfo_StackStartMinPrecSentinel = 0,
-    OpInfo_FinalCollapse             = 1,
+    OpInfo_FinalCollapse             = IsRightAssocFlag, // precedence 0, so collapses everything but the sentinel
     OpInfo_Invalid                   = 0x7fff
 };
 static TypelessOp GetTypelessOp(OpInfo info)
 {
     return TypelessOp(uint8_t(info));
 }
-#if 0 // dont have a sep OpKind for compund ops, handle += as + followed by a =
-static bool IsCompoundAssign(OpInfo info)
+static bool IsAssignment(TypelessOp op)
 {
-    return false;
+    return uint(op - TypelessOp_Assign) <= uint(TypelessOp_OrAssign - TypelessOp_Assign);
 }
-#endif
 static bool DoStackedOp(OpInfo stacked, OpInfo incoming)
 {
     static_assert(OpInfo_StackStartMinPrecSentinel < OpInfo_FinalCollapse, "");
     ASSERT((stacked >> PrecShift) != 0 || stacked == OpInfo_StackStartMinPrecSentinel);
     ASSERT((incoming >> PrecShift) != 0 || incoming == OpInfo_FinalCollapse);
 
-    return (stacked & ~IsRightAssocFlag) >= incoming;
+    // Only precedence and associativity may take part, the TypelessOp bits must not,
+    // otherwise ops of equal precedence (== and !=) would associate by enum order:
+    return (stacked & ~(IsRightAssocFlag | 0xffu)) >= (incoming & ~0xffu);
 }
 
 static bool IsUnary(TypelessOp kind)
 {
-    enum : uint32_t { YesBits = 
-        1u << TypelessOp_CallOrFunctionalCast |
-        1u << TypelessOp_UnaryPlus |
-        1u << TypelessOp_UnaryNegate |
-        1u << TypelessOp_UnaryLogicalNot |
-        1u << TypelessOp_UnaryBitwiseNot
-    };
+    static_assert(TypelessOp_CallOrFunctionalCast < 64, "");
+    constexpr uint64_t YesBits =
+        uint64_t(1) << TypelessOp_CallOrFunctionalCast |
+        uint64_t(1) << TypelessOp_UnaryPlus |
+        uint64_t(1) << TypelessOp_UnaryNegate |
+        uint64_t(1) << TypelessOp_UnaryLogicalNot |
+        uint64_t(1) << TypelessOp_UnaryBitwiseNot;
     return YesBits >> kind & 1;
 }
 
-
-// Could also just store this in lexer token struct since it knows what TokenKind it fills in:
-static OpInfo OpInfoFromToken(TokenKind t)
+static bool IsComparison(TypelessOp kind)
 {
-    switch (t) {
-    default:
-        ASSERT(0);
-        unreachable;
-    case Token_UnaryLogicalNot: return OpInfo_UnaryLogicalNot;
-    case Token_UnaryBitwiseNot: return OpInfo_UnaryBitwiseNot;
+    return kind == TypelessOp_CmpEqual || kind == TypelessOp_CmpNotEq || uint(kind - TypelessOp_CmpLess) < 4u;
+}
+
 
-    /* Only call with these if known to be non-unary: */
-    case Token_Mul: return OpInfo_Mul;
-    case Token_Plus: return OpInfo_Add; 
-    case Token_Minus: return OpInfo_Sub;
+/*
+    Operator dispatch: the OpInfo of a token is one load, indexed by whether an operand was just completed
+    (then a '-' is binary, else unary) and by the TokenKind. OpInfo_Invalid if the token is no operator there.
+    '(', ')' and ':' are not in it, they open, close or split a group rather than collapse by precedence.
+**/
+struct OpInfoTable {
+    OpInfo info[2][256];
+};
 
-    case Token_CmpEqual: return OpInfo_CmpEqual;
-    case Token_CmpNotEq: return OpInfo_CmpNotEq;
-    case Token_Amp: return OpInfo_BitwiseAnd;
-    case Token_Caret: return OpInfo_BitwiseXor;
-    case Token_VBar: return OpInfo_BitwiseOr;
-    case Token_Assign: return OpInfo_Assign;
-    case Token_OpenParen: return OpInfo_OpenParen;
+static constexpr OpInfoTable
+MakeOpInfoTable()
+{
+    OpInfoTable t = { };
+    for (uint i = 0; i < 256; ++i) {
+        t.info[0][i] = t.info[1][i] = OpInfo_Invalid;
     }
+    // Where an operand is expected:
+    t.info[0][Token_Plus]             = OpInfo_UnaryPlus;
+    t.info[0][Token_Minus]            = OpInfo_UnaryNegate;
+    t.info[0][Token_UnaryLogicalNot]  = OpInfo_UnaryLogicalNot;
+    t.info[0][Token_UnaryBitwiseNot]  = OpInfo_UnaryBitwiseNot;
+    // After one:
+    t.info[1][Token_Mul]              = OpInfo_Mul;
+    t.info[1][Token_Div]              = OpInfo_Div;
+    t.info[1][Token_Mod]              = OpInfo_Mod;
+    t.info[1][Token_Plus]             = OpInfo_Add;
+    t.info[1][Token_Minus]            = OpInfo_Sub;
+    t.info[1][Token_LeftShift]        = OpInfo_ShiftLeft;
+    t.info[1][Token_RightShift]       = OpInfo_ShiftRight;
+    t.info[1][Token_LessThan]         = OpInfo_CmpLess;
+    t.info[1][Token_LessEq]           = OpInfo_CmpLessEq;
+    t.info[1][Token_GreaterThan]      = OpInfo_CmpGreater;
+    t.info[1][Token_GreaterEq]        = OpInfo_CmpGreaterEq;
+    t.info[1][Token_CmpEqual]         = OpInfo_CmpEqual;
+    t.info[1][Token_CmpNotEq]         = OpInfo_CmpNotEq;
+    t.info[1][Token_Amp]              = OpInfo_BitwiseAnd;
+    t.info[1][Token_Caret]            = OpInfo_BitwiseXor;
+    t.info[1][Token_VBar]             = OpInfo_BitwiseOr;
+    t.info[1][Token_LogicAnd]         = OpInfo_LogicalAnd;
+    t.info[1][Token_LogicOr]          = OpInfo_LogicalOr;
+    t.info[1][Token_Question]         = OpInfo_TernaryQuestion;
+    t.info[1][Token_Assign]           = OpInfo_Assign;
+    t.info[1][Token_AddAssign]        = OpInfo_AddAssign;
+    t.info[1][Token_SubAssign]        = OpInfo_SubAssign;
+    t.info[1][Token_MulAssign]        = OpInfo_MulAssign;
+    t.info[1][Token_DivAssign]        = OpInfo_DivAssign;
+    t.info[1][Token_ModAssign]        = OpInfo_ModAssign;
+    t.info[1][Token_LeftShiftAssign]  = OpInfo_ShiftLeftAssign;
+    t.info[1][Token_RightShiftAssign] = OpInfo_ShiftRightAssign;
+    t.info[1][Token_AndAssign]        = OpInfo_AndAssign;
+    t.info[1][Token_XorAssign]        = OpInfo_XorAssign;
+    t.info[1][Token_OrAssign]         = OpInfo_OrAssign;
+    return t;
 }
 
+static constexpr OpInfoTable OpInfoByToken = MakeOpInfoTable();
+
 Message *MessageStream::PushRaw()
 {
     uint n = this->nMessages;
-    if (n >= lengthof(this->messages)) { NotImplemented("too many messages"); }
+    if (n >= lengthof(this->messages) - 1) { NotImplemented("too many messages"); }
+    return &this->messages[this->nMessages++];
+}
+
+// Never fails: takes the slot PushRaw() leaves free, or the last message if called twice.
+Message *MessageStream::PushAbort()
+{
+    if (this->nMessages == lengthof(this->messages)) {
+        this->nMessages -= 1;
+    }
     return &this->messages[this->nMessages++];
 }
 
 
+enum { ImmLanes = 4 };
+
+struct ImmediateData {
+    union {
+        // Vectors have one lane per component, widened to 64 bits like scalars are.
+        // Scalars are kept splatted across all lanes, so u64/s64/f32 alias lane 0.
+        uint64_t u64x4[ImmLanes];
+
+        uint64_t u64; // used for bool ops too
+        int64_t s64; // used for bool ops too
+        float f32;
+    } small;
+};
+
+// ParseOpArg flags:
+enum : uint8_t {
+    ArgFlagImmediate                   = 1u << 0, // no SpvId(s) made for constants yet, stored inline
+    // FlagScalarizedVector         = 1u << 1, // if set, means doing operations as N scalar ops instead of 1 vector op
+    /* Only used during parsing: */
+    ArgFlagResultOfComparsion          = 1u << 2, // used to warn against (a & b == c), likely intended ((a & b) == c). Cmp ops have higher prec than binop bitwise.
+    ArgFlagAllowImplicitCvtToBool      = 1u << 3, // literals and vars/names of type scalar integer or pointer with no operators applied, except for ().
+    ArgFlagResultOfAssignment          = 1u << 4,
+    ArgFlagResultOfDiscardableFuncRet  = 1u << 5,
+    ArgFlagSpecConstantOp              = 1u << 6, // not immediate, imm.small.u64 is an index into SpecializationInfo::nodes
+};
+
+struct ParseOpArg {
+    TypeDescriptor typedesc;
+    uint8_t flags;
+    ImmediateData imm;
+};
+
+/*
+    Constexpr functions and variables. A function's body is kept as its tokens, and a call replays them through the
+    same statement and expression parsing as the rest, with the call's variables on top of Context::vars. Names are
+    interned, so variables and memo keys compare 32-bit ids rather than text. What is there is what helpers that
+    compute tables need: integer scalars and vectors, locals, assignments, if/else, for, while and return.
+    Constant arrays live in the SPIR-V constant pool only, as the OpConstantComposite tree they are emitted as;
+    indexing one reads the element back from there.
+**/
+struct NameEntry {
+    const ubyte *text; // into the source
+    uint32_t hash;
+    uint32_t function; // index into Context::functions, ~0u if none has this name
+    uint32_t innermostVar; // index + 1 into Context::vars of the declaration of this name now in scope, 0 if none
+    uint8_t length;
+};
+
+struct ConstexprVariable {
+    uint32_t name;
+    uint32_t shadowedVar; // what the name's innermostVar was before this declaration
+    bool bMutable; // parameters and locals of a function that aren't constexpr
+    SpvValueId arrayId; // a constant array's OpConstantComposite, value then only holds the element type
+    ParseOpArg value;
+};
+
+struct ConstexprFunction {
+    TypeDescriptor returnType;
+    uint32_t name;
+    uint32_t firstParam, nParams; // into Context::paramTypes and paramNames
+    uint32_t body; // into Context::functionTokens
+};
+
+struct MemoEntry {
+    uint32_t function;
+    uint32_t hash;
+    uint32_t firstLane; // into ConstexprMemo::lanes: the lanes of each argument, as many as its vector size
+    ParseOpArg result;
+};
+
+struct ConstexprMemo {
+    Array<MemoEntry> entries;
+    Array<uint64_t> lanes;
+    Array<uint32_t> table; // open addressing on the hash: index into entries + 1, 0 if empty
+};
+
 enum { TokenBufModMask = 7u };
 
 struct Context {
 
     Scanner scanner;
-    uint8_t peekIndex;
-    Token tokenbuf[TokenBufModMask + 1]; // LL(1), so in theory array size could be 2 [2]. NOTE: calling GetAndAdvance() invalidate's all pointers... may screw myself here.
+    uint8_t peekIndex = 0;
+    Token tokenbuf[TokenBufModMask + 1] = { }; // LL(1), so in theory array size could be 2 [2]. NOTE: calling GetAndAdvance() invalidate's all pointers... may screw myself here.
 
     // Could "move" stuff in here to avoid indirections for things like oms, then move back at the end.
     MessageStream *oms = nullptr;
+    const CompileOptions *options = nullptr;
+    SpecializationInfo *specInfo = nullptr; // where SpecNodes go, CompileOptions::pSpecInfo or a suffix's own
+    Array<uint32_t> specConstantNodes; // per CompileOptions::specConstants entry: its SpecNode, ~0u until used
+    view<const uint32_t> prefixSpecConstantNodes = { }; // compiling a suffix: the prefix's table, until specConstantNodes is copied from it
+
+    TokenKind (*pfnNextToken)(Scanner *, Token *) = Scanner_NextTokenRaw; // variant picked by CompileOptions::scanFeatures
+    const Token *pReplay = nullptr; // CompilePreprocessed() and constexpr calls: tokens come from here, up to its Token_EOI, instead of the scanner
+
+    // Constexpr evaluation:
+    Array<NameEntry> names;
+    Array<uint32_t> nameTable; // open addressing on the hash: index into names + 1, 0 if empty
+    Array<ConstexprVariable> vars; // the globals, then main's, then a frame per call being evaluated
+    uint nGlobals = 0;
+    uint frameBase = 0; // a call sees vars from here on, and the globals
+    uint scopeBase = 0; // vars from here on are in the innermost scope, whose names can't be declared again
+    Array<ConstexprFunction> functions;
+    Array<TypeDescriptor> paramTypes;
+    Array<uint32_t> paramNames;
+    Array<Token> functionTokens; // each body from its '{' to its '}', then a Token_EOI
+    ConstexprMemo memo;
+    ParseOpArg returnValue = { };
+    uint callDepth = 0;
+    uint32_t steps = 0; // since the outermost call began
+    int32_t outermostCallLine = 0;
+    uint deadDepth = 0; // in operands that a ?:, && or || with a known condition discards: no calls are made
+    SpvPool *pool = nullptr; // CompileOptions::pConstantPool, or ownPool
+    SpvPool ownPool;
+    Array<SpvValueId> compositeStack; // constituents of the constant array composites being parsed, innermost last
 
     Context() = default;
     Context(const Context&) = delete;
@@ -174,8 +383,14 @@ GetAndAdvance(Context *ctx)
     static_assert(((TokenBufModMask + 1) & TokenBufModMask) == 0 && TokenBufModMask, "");
     uint oldPeek = ctx->peekIndex, newPeek;
     ctx->peekIndex = newPeek = ((oldPeek + 1) & TokenBufModMask);
-    Scanner_NextTokenRaw(&ctx->scanner, &ctx->tokenbuf[newPeek]);
-    printf("GetAndAdvance: got %d\n", ctx->tokenbuf[oldPeek].kind);
+    if (ctx->pReplay) {
+        ctx->tokenbuf[newPeek] = *ctx->pReplay;
+        ctx->pReplay += ctx->pReplay->kind != Token_EOI;
+    }
+    else {
+        ctx->pfnNextToken(&ctx->scanner, &ctx->tokenbuf[newPeek]);
+    }
+    devel_printf("GetAndAdvance: got %d\n", ctx->tokenbuf[oldPeek].kind);
     return &ctx->tokenbuf[oldPeek];
 }
 
@@ -185,43 +400,37 @@ Peek(const Context *ctx)
     return &ctx->tokenbuf[ctx->peekIndex];
 }
 
+// Replaying, makes p the next token; loops go back this way.
 static void
-Expect(Context *ctx, TokenKind eToken)
+ReplayFrom(Context *ctx, const Token *p)
 {
-    if (GetAndAdvance(ctx)->kind != eToken) {
-        NotImplemented("Handle Expect(token) mismatch");
-    }
+    ASSERT(ctx->pReplay);
+    ctx->tokenbuf[ctx->peekIndex] = *p;
+    ctx->pReplay = p + (p->kind != Token_EOI);
 }
 
+// Replaying, where Peek() came from.
+static const Token *
+ReplayPosition(const Context *ctx)
+{
+    return Peek(ctx)->kind == Token_EOI ? ctx->pReplay : ctx->pReplay - 1;
+}
 
-struct ImmediateData {
-    union {
-        //uint64_t v2u64[2];
-        //uint32_t v4u32[4];
-        //float v4f32[4];
-
-        uint64_t u64; // used for bool ops too
-        uint64_t s64; // used for bool ops too
-        float f32;
-    } small;
+// What a call saves of the caller's tokens, to replay the callee's and come back.
+struct TokenStreamState {
+    Token tokenbuf[TokenBufModMask + 1];
+    const Token *pReplay;
+    uint8_t peekIndex;
 };
 
-// ParseOpArg flags:
-enum : uint8_t {
-    ArgFlagImmediate                   = 1u << 0, // no SpvId(s) made for constants yet, stored inline
-    // FlagScalarizedVector         = 1u << 1, // if set, means doing operations as N scalar ops instead of 1 vector op
-    /* Only used during parsing: */
-    ArgFlagResultOfComparsion          = 1u << 2, // used to warn against (a & b == c), likely intended ((a & b) == c). Cmp ops have higher prec than binop bitwise.
-    ArgFlagAllowImplicitCvtToBool      = 1u << 3, // literals and vars/names of type scalar integer or pointer with no operators applied, except for ().
-    ArgFlagResultOfAssignment          = 1u << 4,
-    ArgFlagResultOfDiscardableFuncRet  = 1u << 5,
-};
+static void
+Expect(Context *ctx, TokenKind eToken)
+{
+    if (GetAndAdvance(ctx)->kind != eToken) {
+        NotImplemented("Handle Expect(token) mismatch");
+    }
+}
 
-struct ParseOpArg {
-    TypeDescriptor typedesc;
-    uint8_t flags;
-    ImmediateData imm;
-};
 
 enum ExprModeEnum : uint8_t {
     ExprMode_Regular,
@@ -242,59 +451,479 @@ enum {
     ExprParseFlagCommaContinues = 1u << 1
 };
 
+/*
+    Immediate folding kernels. They always do all ImmLanes lanes, whatever the component count:
+    the loops have a fixed trip count and no per-size cases, so they compile to a couple of SIMD ops,
+    and since scalars are splatted, scalar-vector ops need no splat step.
+    Lanes past a vector's size are don't-care. Unsigned math so wrapping isn't UB, the bits are the same.
+**/
+static void
+FoldUnaryLanes(TypelessOp op, uint64_t *x)
+{
+    switch (op) {
+    case TypelessOp_UnaryPlus:       break;
+    case TypelessOp_UnaryNegate:     for (uint i = 0; i < ImmLanes; ++i) x[i] = 0 - x[i]; break;
+    case TypelessOp_UnaryLogicalNot: for (uint i = 0; i < ImmLanes; ++i) x[i] = x[i] == 0; break;
+    case TypelessOp_UnaryBitwiseNot: for (uint i = 0; i < ImmLanes; ++i) x[i] = ~x[i]; break;
+    default: ASSERT(0);
+    }
+}
+
+static uint64_t
+SignedDiv(uint64_t a, uint64_t b) // b != 0, and INT64_MIN / -1 wraps instead of trapping
+{
+    return b == ~uint64_t(0) ? 0 - a : uint64_t(int64_t(a) / int64_t(b));
+}
+
+static uint64_t
+SignedMod(uint64_t a, uint64_t b)
+{
+    return b == ~uint64_t(0) ? 0 : uint64_t(int64_t(a) % int64_t(b));
+}
+
+/* Division by zero gives 0 and shift counts are taken mod 64, so that don't-care lanes and values only known
+   at specialization (where SPIR-V leaves these undefined) can't trap. Known operands are checked before, by
+   CheckFoldableLanes(). bUnsigned only matters to /, %, >> and the orderings. */
+static void
+FoldBinaryLanes(TypelessOp op, uint64_t *a, const uint64_t *b, bool bUnsigned)
+{
+    switch (op) {
+    case TypelessOp_Add:        for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] + b[i]; break;
+    case TypelessOp_Sub:        for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] - b[i]; break;
+    case TypelessOp_Mul:        for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] * b[i]; break;
+    case TypelessOp_Div:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = b[i] ? a[i] / b[i] : 0;
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = b[i] ? SignedDiv(a[i], b[i]) : 0;
+        break;
+    case TypelessOp_Mod:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = b[i] ? a[i] % b[i] : 0;
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = b[i] ? SignedMod(a[i], b[i]) : 0;
+        break;
+    case TypelessOp_ShiftLeft:  for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] << (b[i] & 63); break;
+    case TypelessOp_ShiftRight:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] >> (b[i] & 63);
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = uint64_t(int64_t(a[i]) >> (b[i] & 63));
+        break;
+    case TypelessOp_BitwiseAnd: for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] & b[i]; break;
+    case TypelessOp_BitwiseXor: for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] ^ b[i]; break;
+    case TypelessOp_BitwiseOr:  for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] | b[i]; break;
+    case TypelessOp_CmpEqual:   for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] == b[i]; break;
+    case TypelessOp_CmpNotEq:   for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] != b[i]; break;
+    case TypelessOp_CmpLess:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] < b[i];
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = int64_t(a[i]) < int64_t(b[i]);
+        break;
+    case TypelessOp_CmpLessEq:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] <= b[i];
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = int64_t(a[i]) <= int64_t(b[i]);
+        break;
+    case TypelessOp_CmpGreater:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] > b[i];
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = int64_t(a[i]) > int64_t(b[i]);
+        break;
+    case TypelessOp_CmpGreaterEq:
+        if (bUnsigned) for (uint i = 0; i < ImmLanes; ++i) a[i] = a[i] >= b[i];
+        else           for (uint i = 0; i < ImmLanes; ++i) a[i] = int64_t(a[i]) >= int64_t(b[i]);
+        break;
+    case TypelessOp_LogicalAnd: for (uint i = 0; i < ImmLanes; ++i) a[i] = (a[i] != 0) & (b[i] != 0); break;
+    case TypelessOp_LogicalOr:  for (uint i = 0; i < ImmLanes; ++i) a[i] = (a[i] != 0) | (b[i] != 0); break;
+    default: ASSERT(0);
+    }
+}
+
+// What C leaves undefined is an error when the operand is known; only the first n lanes are real. A shift count
+// must be less than the width of the left operand a, after C's integer promotions.
+static void
+CheckFoldableLanes(TypelessOp op, TypeDescriptor a, const uint64_t *b, uint n)
+{
+    uint const width = LeafBuiltin(a) == BuiltinType_g64 ? 64 : 32;
+    for (uint i = 0; i < n; ++i) {
+        if ((op == TypelessOp_Div || op == TypelessOp_Mod) && b[i] == 0) {
+            NotImplemented("division by zero in a constant expression");
+        }
+        if ((op == TypelessOp_ShiftLeft || op == TypelessOp_ShiftRight) && b[i] >= width) {
+            NotImplemented("shift count negative or not less than the operand's width");
+        }
+    }
+}
+
+// C's usual arithmetic conversions, as far as signedness goes; a shift takes it from its left operand.
+static bool
+IsUnsignedOp(TypelessOp op, TypeDescriptor a, TypeDescriptor b)
+{
+    return LeafIsUnsigned(a) || (op != TypelessOp_ShiftRight && LeafIsUnsigned(b));
+}
+
+static void
+SelectLanes(uint64_t *cond, const uint64_t *t, const uint64_t *f) // result replaces cond
+{
+    for (uint i = 0; i < ImmLanes; ++i) cond[i] = cond[i] ? t[i] : f[i];
+}
+
+/* Vector op vector must match in size, vector op scalar is component-wise. Comparing vectors gives a bool vector.
+   Otherwise the result has the wider of the two integer types (a shift its left operand's), signed as
+   IsUnsignedOp() folds it. */
+static TypeDescriptor
+BinaryResultType(TypelessOp op, TypeDescriptor a, TypeDescriptor b)
+{
+    uint const na = LeafVectorSize(a), nb = LeafVectorSize(b);
+    if (na != nb && na != 1 && nb != 1) {
+        NotImplemented("vector size mismatch");
+    }
+    TypeDescriptor const t = na >= nb ? a : b;
+    if (op == TypelessOp_LogicalAnd || op == TypelessOp_LogicalOr) {
+        return MakeLeafVectorTypeDesc(BuiltinType_bool, LeafVectorSize(t), 0);
+    }
+    if (IsComparison(op)) {
+        return LeafVectorSize(t) > 1 ? MakeLeafVectorTypeDesc(BuiltinType_bool, LeafVectorSize(t), 0) : t;
+    }
+    bool const bShift = op == TypelessOp_ShiftLeft || op == TypelessOp_ShiftRight;
+    BuiltinTypeKind const builtin = bShift ? LeafBuiltin(a) : Max(LeafBuiltin(a), LeafBuiltin(b));
+    return MakeLeafVectorTypeDesc(builtin, LeafVectorSize(t),
+        IsUnsignedOp(op, a, b) ? TypeDescLeafFlags(TypeDescLeafFlag_Unsigned) : 0);
+}
+
+/*
+    How a &&, || or ?: site gets lowered, operands[0] being the condition.
+    A known condition folds the site away. Otherwise a branch costs divergence when the condition varies
+    across invocations, so if everything the branch would skip is cheap and has no side effects, it is
+    evaluated unconditionally and combined with OpSelect/OpLogicalAnd/OpLogicalOr.
+    Else it stays short-circuit control flow (ExprMode_Regular).
+**/
+static ExprModeEnum
+ChooseConditionalLowering(TypelessOp op, const ParseOpArg *operands, uint nOperands)
+{
+    if (operands[0].flags & ArgFlagImmediate) {
+        return ExprMode_Immediate;
+    }
+    for (uint i = 1; i < nOperands; ++i) {
+        if (operands[i].flags & (ArgFlagResultOfAssignment | ArgFlagResultOfDiscardableFuncRet)) {
+            return ExprMode_Regular; // side effects must not happen unconditionally
+        }
+        if (!(operands[i].flags & ArgFlagImmediate)) {
+            return ExprMode_Regular; // only immediates are known to be cheap until args carry a cost
+        }
+    }
+    switch (op) {
+    case TypelessOp_LogicalAnd:    return ExprMode_LogicalAnd;
+    case TypelessOp_LogicalOr:     return ExprMode_LogicalOr;
+    case TypelessOp_TernarySelect: return ExprMode_TernarySelect;
+    default:
+        ASSERT(0);
+        unreachable;
+    }
+}
+
+static void
+ReportConditionalLowering(Context *ctx, int32_t line, ExprModeEnum mode)
+{
+    static const char *const ModeNames[] = { "branch", "folded", "OpSelect", "OpLogicalAnd", "OpLogicalOr" };
+    devel_printf("conditional on line %d: %s\n", line, ModeNames[mode]);
+    if (ctx->options->bReportConditionalLowering) {
+        Message *m = ctx->oms->PushRaw();
+        *m = { };
+        m->type = Message_ConditionalLowering;
+        m->miscU8 = mode;
+        m->line = line;
+    }
+}
+
+static bool
+VectorTypeFromName(const ubyte *name, uint n, TypeDescriptor *pType)
+{
+    static const struct {
+        const char *str; uint8_t len; BuiltinTypeKind builtin;
+    } ScalarNames[] = {
+        { "bool",   4, BuiltinType_bool },
+        { "char",   4, BuiltinType_g8   },
+        { "short",  5, BuiltinType_g16  },
+        { "int",    3, BuiltinType_g32  },
+        { "long",   4, BuiltinType_g64  },
+        { "half",   4, BuiltinType_fp16 },
+        { "float",  5, BuiltinType_fp32 },
+        { "double", 6, BuiltinType_fp64 },
+    };
+    uint const size = n ? name[n - 1] - '0' : 0;
+    if (size - 2 > 2u) {
+        return false;
+    }
+    for (const auto& entry : ScalarNames) {
+        if (entry.len == n - 1 && memcmp(name, entry.str, n - 1) == 0) {
+            *pType = MakeLeafVectorTypeDesc(entry.builtin, size, 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+// ".xyzw" or ".rgba" on a vector immediate. One letter gives a scalar (splatted), more give a vector.
+static void
+ApplySwizzle(ParseOpArg *arg, const ubyte *letters, uint n)
+{
+    uint const size = LeafVectorSize(arg->typedesc);
+    if (size == 1 || n > ImmLanes) {
+        NotImplemented("swizzle of a scalar or more than 4 components");
+    }
+    ASSERT(arg->flags & ArgFlagImmediate);
+
+    uint64_t src[ImmLanes];
+    memcpy(src, arg->imm.small.u64x4, sizeof src);
+    for (uint i = 0; i < n; ++i) {
+        uint lane;
+        switch (letters[i]) {
+        case 'x': case 'r': lane = 0; break;
+        case 'y': case 'g': lane = 1; break;
+        case 'z': case 'b': lane = 2; break;
+        case 'w': case 'a': lane = 3; break;
+        default: NotImplemented("bad swizzle letter");
+        }
+        if (lane >= size) {
+            NotImplemented("swizzle past the vector's size");
+        }
+        arg->imm.small.u64x4[i] = src[lane];
+    }
+    if (n == 1) {
+        for (uint i = 1; i < ImmLanes; ++i) arg->imm.small.u64x4[i] = arg->imm.small.u64x4[0];
+    }
+    arg->typedesc = LeafWithVectorSize(arg->typedesc, n);
+}
+
+static uint32_t
+PushSpecNode(Context *ctx, const SpecNode& node)
+{
+    Array<SpecNode>& nodes = ctx->specInfo->nodes;
+    nodes.push(node);
+    return ctx->specInfo->nodeBase + nodes.size() - 1;
+}
+
+static bool
+LookupSpecConstant(Context *ctx, const Token *tok, ParseOpArg *arg)
+{
+    view<const SpecConstantDecl> const decls = ctx->options->specConstants;
+    for (uint i = 0; i < decls.length; ++i) {
+        const SpecConstantDecl& decl = decls.ptr[i];
+        if (strlen(decl.name) != tok->nameLength || memcmp(decl.name, tok->data.nameBegin, tok->nameLength) != 0) {
+            continue;
+        }
+        uint32_t nodeIndex = ctx->specConstantNodes.size() ? ctx->specConstantNodes[i] : ctx->prefixSpecConstantNodes.ptr[i];
+        if (nodeIndex == ~0u) {
+            SpecNode node = { };
+            node.kind = SpecNode_Constant;
+            node.specId = decl.specId;
+            node.value = decl.defaultValue;
+            nodeIndex = PushSpecNode(ctx, node);
+
+            // A suffix shares its prefix's table until the first constant the prefix never used:
+            if (!ctx->specConstantNodes.size()) {
+                ASSERT(ctx->prefixSpecConstantNodes.length == decls.length);
+                memcpy(ctx->specConstantNodes.uninitialized_push_n(decls.length), ctx->prefixSpecConstantNodes.ptr,
+                    decls.length * sizeof(uint32_t));
+            }
+            ctx->specConstantNodes[i] = nodeIndex;
+        }
+        arg->typedesc = MakeLeafTypeDesc(BuiltinType_g32, 0);
+        arg->flags = ArgFlagSpecConstantOp;
+        arg->imm.small.u64 = nodeIndex;
+        return true;
+    }
+    return false;
+}
+
+// An operand of a spec op. Immediates become literal nodes, as they would become OpConstants.
+static uint32_t
+SpecNodeOfArg(Context *ctx, const ParseOpArg *arg)
+{
+    if (LeafVectorSize(arg->typedesc) != 1) {
+        NotImplemented("vector specialization constant ops");
+    }
+    if (arg->flags & ArgFlagSpecConstantOp) {
+        return uint32_t(arg->imm.small.u64);
+    }
+    ASSERT(arg->flags & ArgFlagImmediate);
+    SpecNode node = { };
+    node.kind = SpecNode_Literal;
+    node.value = arg->imm.small.s64;
+    return PushSpecNode(ctx, node);
+}
+
+// What folding does when some operand is only known at specialization time. The result replaces operands[0].
+static void
+FoldToSpecOp(Context *ctx, TypelessOp op, ParseOpArg *operands, uint nOperands, bool bUnsigned = false)
+{
+    SpecNode node = { };
+    node.kind = SpecNode_Op;
+    node.op = op;
+    node.bUnsigned = bUnsigned;
+    node.nOperands = uint8_t(nOperands);
+    for (uint i = 0; i < nOperands; ++i) {
+        node.operands[i] = SpecNodeOfArg(ctx, &operands[i]);
+    }
+    operands[0].flags = ArgFlagSpecConstantOp;
+    operands[0].imm.small.u64 = PushSpecNode(ctx, node);
+}
+
+static void ParseExpr(Context *ctx, ParsedExprResult *result, uint exprParseFlags);
+static bool ParseConstexprName(Context *ctx, ParseOpArg *arg, uint exprParseFlags);
+
+/* T2(a, b), T4(vec2, z, w), T3(s) (splat): components are concatenated, as in GLSL.
+   Peek() is the '(' after the type name. */
+static void
+ParseVectorConstructor(Context *ctx, TypeDescriptor type, ParseOpArg *arg, uint exprParseFlags)
+{
+    Expect(ctx, Token_OpenParen);
+    if (LeafBuiltin(type) >= BuiltinType_fp16) {
+        NotImplemented("FP immediates");
+    }
+
+    uint const size = LeafVectorSize(type);
+    uint64_t lanes[ImmLanes] = { };
+    uint nFilled = 0;
+    for (;;) {
+        ParsedExprResult sub;
+        ParseExpr(ctx, &sub, exprParseFlags & ~ExprParseFlagCommaContinues);
+        if (!(sub.arg.flags & ArgFlagImmediate)) {
+            NotImplemented("vector specialization constants");
+        }
+        uint const subSize = LeafVectorSize(sub.arg.typedesc);
+        if (nFilled + subSize > size) {
+            NotImplemented("too many vector constructor components");
+        }
+        memcpy(lanes + nFilled, sub.arg.imm.small.u64x4, subSize * sizeof lanes[0]);
+        nFilled += subSize;
+
+        TokenKind const k = GetAndAdvance(ctx)->kind;
+        if (k == Token_CloseParen) {
+            break;
+        }
+        if (k != Token_Comma) {
+            NotImplemented("Handle Expect(token) mismatch");
+        }
+    }
+    if (nFilled == 1) {
+        for (uint i = 1; i < size; ++i) lanes[i] = lanes[0];
+    }
+    else if (nFilled != size) {
+        NotImplemented("too few vector constructor components");
+    }
+    if (LeafBuiltin(type) == BuiltinType_bool) {
+        for (uint i = 0; i < ImmLanes; ++i) lanes[i] = lanes[i] != 0;
+    }
+
+    arg->typedesc = type;
+    arg->flags = ArgFlagImmediate;
+    memcpy(arg->imm.small.u64x4, lanes, sizeof lanes);
+}
+
 static void
 ParseExpr(Context *ctx, ParsedExprResult *result, uint exprParseFlags)
 {
     enum { MaxArgs = 32, MaxOps = 32 };
     ParseOpArg args[MaxArgs];
-    OpInfo ops[MaxOps]; // might want line info too.
+    OpInfo ops[MaxOps];
+    int32_t opLines[MaxOps]; // line of the token each op came from, for reports
+    bool opDead[MaxOps]; // the operand being parsed for this op is discarded, it counts in ctx->deadDepth
     ParseOpArg *argsEnd = args;
     // NOTE:
     OpInfo *opsEnd = ops + 1;
     ops[0] = OpInfo_StackStartMinPrecSentinel;
+    opDead[0] = false;
 
     int groupOpeningsEnd = 0;
+    int32_t tokLine = 0;
 
-    auto const CollapseSubexpr = [&](OpInfo incomingInfo) {
-        ASSERT(incomingInfo != OpInfo_Invalid);
-        for (OpInfo stackedInfo; DoStackedOp((stackedInfo = opsEnd[-1]), incomingInfo); --opsEnd) {
-            TypelessOp const op = GetTypelessOp(stackedInfo);
-            if (IsUnary(op)) {
-                int64_t x = argsEnd[-1].imm.small.s64;
-                int64_t r;
-                switch (op) {
-                case TypelessOp_UnaryPlus:       r = +x; break;
-                case TypelessOp_UnaryNegate:     r = -x; break;
-                case TypelessOp_UnaryLogicalNot: r = !x; break;
-                case TypelessOp_UnaryBitwiseNot: r = ~x; break;
-                default: ASSERT(0);
+    // Pops the top op and folds it into the top arg(s).
+    auto const ApplyTopOp = [&]() {
+        --opsEnd;
+        ctx->deadDepth -= opDead[opsEnd - ops];
+        TypelessOp const op = GetTypelessOp(*opsEnd);
+        if (op == TypelessOp_TernaryQuestion) {
+            NotImplemented("'?' without ':'");
+        }
+        ASSERT(op < TypelessOp_LowEnumEnd); // a '(' is only ever popped by its ')'
+        if (IsUnary(op)) {
+            if (argsEnd[-1].flags & ArgFlagImmediate) {
+                FoldUnaryLanes(op, argsEnd[-1].imm.small.u64x4);
+            }
+            else {
+                FoldToSpecOp(ctx, op, &argsEnd[-1], 1);
+            }
+        }
+        else if (op == TypelessOp_TernarySelect) {
+            ASSERT(argsEnd - args >= 3);
+            ParseOpArg *const c = &argsEnd[-3];
+            ReportConditionalLowering(ctx, opLines[opsEnd - ops], ChooseConditionalLowering(op, c, 3));
+            TypeDescriptor const t = BinaryResultType(op, argsEnd[-2].typedesc, argsEnd[-1].typedesc);
+            if (LeafVectorSize(c->typedesc) > LeafVectorSize(t)) {
+                NotImplemented("vector condition with scalar arms");
+            }
+            if (c->flags & argsEnd[-2].flags & argsEnd[-1].flags & ArgFlagImmediate) {
+                SelectLanes(c->imm.small.u64x4, argsEnd[-2].imm.small.u64x4, argsEnd[-1].imm.small.u64x4);
+            }
+            else if ((c->flags & ArgFlagImmediate) && LeafVectorSize(c->typedesc) == 1) {
+                *c = c->imm.small.u64 ? argsEnd[-2] : argsEnd[-1];
+            }
+            else {
+                FoldToSpecOp(ctx, op, c, 3);
+            }
+            c->typedesc = t;
+            argsEnd -= 2;
+        }
+        else if (IsAssignment(op)) {
+            NotImplemented("assignment inside an expression");
+        }
+        else { // binary
+            ASSERT(argsEnd - args >= 2);
+            ParseOpArg *const a = &argsEnd[-2];
+            const ParseOpArg *const b = &argsEnd[-1];
+            if (op == TypelessOp_LogicalAnd || op == TypelessOp_LogicalOr) {
+                ReportConditionalLowering(ctx, opLines[opsEnd - ops], ChooseConditionalLowering(op, a, 2));
+            }
+            bool const bUnsigned = IsUnsignedOp(op, a->typedesc, b->typedesc);
+            TypeDescriptor const leftType = a->typedesc;
+            a->typedesc = BinaryResultType(op, a->typedesc, b->typedesc);
+            if (ctx->deadDepth) {
+                // The value is discarded, and what it would trap on may be what the condition guards against.
+            }
+            else {
+                if (b->flags & ArgFlagImmediate) {
+                    CheckFoldableLanes(op, leftType, b->imm.small.u64x4, LeafVectorSize(a->typedesc));
                 }
-                argsEnd[-1].imm.small.s64 = r;
-                ASSERT(argsEnd[-1].flags & ArgFlagImmediate);
-            }
-            else { // assume binary for now
-                ASSERT(argsEnd - args >= 2);
-                int64_t a = argsEnd[-2].imm.small.s64;
-                int64_t b = argsEnd[-1].imm.small.s64;
-                int64_t c;
-                switch (op) {
-                case TypelessOp_Add:        c = a + b; break;
-                case TypelessOp_Sub:        c = a - b; break;
-                case TypelessOp_Mul:        c = a * b; break;
-                case TypelessOp_BitwiseAnd: c = a & b; break;
-                case TypelessOp_BitwiseXor: c = a ^ b; break;
-                case TypelessOp_BitwiseOr:  c = a | b; break;
-                case TypelessOp_CmpEqual:   c = (a == b), printf("%lld == %lld\n", a, b); break;
-                case TypelessOp_CmpNotEq:   c = (a != b), printf("%lld != %lld\n", a, b); break;
-                default: ASSERT(0);
+                if (a->flags & b->flags & ArgFlagImmediate) {
+                    FoldBinaryLanes(op, a->imm.small.u64x4, b->imm.small.u64x4, bUnsigned);
+                }
+                else {
+                    FoldToSpecOp(ctx, op, a, 2, bUnsigned);
                 }
-                argsEnd -= 1;
-                argsEnd[-1].imm.small.s64 = c;
-                ASSERT(argsEnd[-1].flags & ArgFlagImmediate);
             }
+            argsEnd -= 1;
+        }
+    };
+    auto const CollapseStacked = [&](OpInfo incomingInfo) {
+        ASSERT(incomingInfo != OpInfo_Invalid);
+        while (DoStackedOp(opsEnd[-1], incomingInfo)) {
+            ApplyTopOp();
         }
         ASSERT(opsEnd > ops); // above sentinel
-        *opsEnd++ = incomingInfo;
+    };
+    // A known left operand of && or ||, or condition of ?:, makes the next operand dead or not.
+    auto const IsKnownScalar = [](const ParseOpArg *arg) {
+        return (arg->flags & ArgFlagImmediate) && LeafVectorSize(arg->typedesc) == 1;
+    };
+    auto const PushOp = [&](OpInfo info) {
+        TypelessOp const op = GetTypelessOp(info);
+        bool bDead = false;
+        if ((op == TypelessOp_LogicalAnd || op == TypelessOp_LogicalOr || info == OpInfo_TernaryQuestion) &&
+            IsKnownScalar(&argsEnd[-1])) {
+            bDead = (argsEnd[-1].imm.small.u64 != 0) == (op == TypelessOp_LogicalOr);
+        }
+        opLines[opsEnd - ops] = tokLine;
+        opDead[opsEnd - ops] = bDead;
+        ctx->deadDepth += bDead;
+        *opsEnd++ = info;
+    };
+    auto const CollapseSubexpr = [&](OpInfo incomingInfo) {
+        CollapseStacked(incomingInfo);
+        PushOp(incomingInfo);
     };
 
     bool bLastWasArgOrGroupClose = false; // maybe have on stack that is union of op and arg?
@@ -308,8 +937,15 @@ ParseExpr(Context *ctx, ParsedExprResult *result, uint exprParseFlags)
             NotImplemented("");
         }
 
-        OpInfo incomingInfo = OpInfo_Invalid;
         const Token *tok = Peek(ctx);
+        tokLine = tok->lineno;
+        OpInfo const incomingInfo = OpInfoByToken.info[bLastWasArgOrGroupClose][tok->kind];
+        if (incomingInfo != OpInfo_Invalid) {
+            bLastWasArgOrGroupClose = false; // a prefix op leaves it false, a binary one expects an operand next
+            GetAndAdvance(ctx);
+            CollapseSubexpr(incomingInfo);
+            continue;
+        }
         switch (tok->kind) {
         case Token_Comma: {
             if (!(exprParseFlags & ExprParseFlagCommaContinues)) {
@@ -325,109 +961,1214 @@ ParseExpr(Context *ctx, ParsedExprResult *result, uint exprParseFlags)
             ParseOpArg *arg = argsEnd++;
             arg->typedesc = MakeLeafTypeDesc(tok->numberLiteralBuiltinType, tok->bNumberLiteralUnsigned ? TypeDescLeafFlag_Unsigned : 0);
             arg->flags = ArgFlagImmediate;
-            arg->imm.small.s64 = tok->data.numberRawU64;
+            for (uint i = 0; i < ImmLanes; ++i) arg->imm.small.u64x4[i] = tok->data.numberRawU64;
             GetAndAdvance(ctx);
             continue; // NOTE
         } break;
-        case Token_Plus:
-        case Token_Minus:
-            if (!bLastWasArgOrGroupClose) { // is unary?
-                // bLastWasArgOrGroupClose still false, desired
-                incomingInfo = tok->kind == Token_Plus ? OpInfo_UnaryPlus : OpInfo_UnaryNegate;
+        case Token_Name: {
+            if (bLastWasArgOrGroupClose) {
+                NotImplemented("syntax error");
+            }
+            bLastWasArgOrGroupClose = true;
+            TypeDescriptor vecType;
+            if (VectorTypeFromName(tok->data.nameBegin, tok->nameLength, &vecType)) {
                 GetAndAdvance(ctx);
-                break;
-            } // else, fallthru:
-        case Token_Mul:
-        case Token_Caret:
-        case Token_VBar:
-        case Token_Amp:
-        case Token_CmpEqual:
-        case Token_CmpNotEq: {
-            bLastWasArgOrGroupClose = false;
-            incomingInfo = OpInfoFromToken(tok->kind);
+                ParseVectorConstructor(ctx, vecType, argsEnd++, exprParseFlags);
+                continue;
+            }
+            if (ParseConstexprName(ctx, argsEnd, exprParseFlags)) {
+                argsEnd += 1;
+                continue;
+            }
+            if (!LookupSpecConstant(ctx, tok, argsEnd++)) {
+                NotImplemented("names in expressions");
+            }
+            GetAndAdvance(ctx);
+            continue;
+        } break;
+        case Token_DotName: {
+            if (!bLastWasArgOrGroupClose) {
+                NotImplemented("syntax error");
+            }
+            // Postfix binds tightest, so it applies to the last arg right away:
+            ApplySwizzle(&argsEnd[-1], tok->data.nameBegin, tok->nameLength);
             GetAndAdvance(ctx);
+            continue;
         } break;
         case Token_OpenParen: {
-            NotImplemented("");
+            if (bLastWasArgOrGroupClose) {
+                NotImplemented("calls");
+            }
+            GetAndAdvance(ctx);
+            PushOp(OpInfo_OpenParen); // pushed as is, an opening must not collapse what is below it
+            groupOpeningsEnd += 1;
+            continue;
         } break;
         case Token_CloseParen: {
-            // could also handle a parenthesized expr by first pushing a '(', or just checking for it
             if (groupOpeningsEnd <= 0) {
-                goto endloop;
+                goto endloop; // belongs to the caller
+            }
+            if (!bLastWasArgOrGroupClose) {
+                NotImplemented("syntax error");
+            }
+            GetAndAdvance(ctx);
+            CollapseStacked(OpInfo_CloseParenCollapse);
+            ASSERT(opsEnd[-1] == OpInfo_OpenParen);
+            --opsEnd;
+            groupOpeningsEnd -= 1;
+            continue; // bLastWasArgOrGroupClose stays true
+        } break;
+        case Token_Colon: {
+            if (!bLastWasArgOrGroupClose) {
+                NotImplemented("syntax error");
+            }
+            // The middle operand is everything above the nearest '?', like a group; a finished ?: in there is nested.
+            while (opsEnd[-1] != OpInfo_TernaryQuestion) {
+                if (opsEnd[-1] == OpInfo_StackStartMinPrecSentinel || opsEnd[-1] == OpInfo_OpenParen) {
+                    NotImplemented("':' without '?'");
+                }
+                ApplyTopOp();
+            }
+            opsEnd[-1] = OpInfo_TernarySelect; // keeps the '?' line
+            ctx->deadDepth -= opDead[opsEnd - 1 - ops]; // the middle was dead, now the last one may be
+            opDead[opsEnd - 1 - ops] = IsKnownScalar(&argsEnd[-2]) && argsEnd[-2].imm.small.u64 != 0;
+            ctx->deadDepth += opDead[opsEnd - 1 - ops];
+            bLastWasArgOrGroupClose = false;
+            GetAndAdvance(ctx);
+            continue;
+        } break;
+        default: {
+            if (OpInfoByToken.info[!bLastWasArgOrGroupClose][tok->kind] != OpInfo_Invalid) {
+                NotImplemented("syntax error"); // an operator, but not where it is
             }
-            NotImplemented("");
-        } break;
-        default: {
             goto endloop;
         }
         } // end switch
-        CollapseSubexpr(incomingInfo);
     }
 endloop:
+    if (groupOpeningsEnd > 0) {
+        NotImplemented("missing ')'");
+    }
+    if (!bLastWasArgOrGroupClose) {
+        NotImplemented("expression ends early"); // empty, or after an operator
+    }
     CollapseSubexpr(OpInfo_FinalCollapse);
     ASSERT(argsEnd == args + 1);
     ASSERT(opsEnd == ops + 2 && ops[0] == OpInfo_StackStartMinPrecSentinel && ops[1] == OpInfo_FinalCollapse);
     result->arg = args[0];
-    ASSERT(result->arg.flags & ArgFlagImmediate);
-    printf("result.s64 = %lld\n", (long long)result->arg.imm.small.s64);
+    ASSERT(result->arg.flags & (ArgFlagImmediate | ArgFlagSpecConstantOp));
+    devel_printf("result.s64 = %lld\n", (long long)result->arg.imm.small.s64);
 }
 // __data_u64[]
 // abs()
+
+static uint32_t
+HashName(const ubyte *p, uint n) // FNV-1a
+{
+    uint32_t h = 2166136261u;
+    for (uint i = 0; i < n; ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Open addressing tables of index + 1: rebuilt at twice the size once half full, from each entry's hash.
+template<class HashOf> static void
+GrowTable(Array<uint32_t> *table, uint nEntries, HashOf hashOf)
+{
+    if (2 * (nEntries + 1) <= table->size()) {
+        return;
+    }
+    uint const size = Max(64u, 2 * table->size());
+    table->clear();
+    uint32_t *const slots = table->uninitialized_push_n(size);
+    memset(slots, 0, size * sizeof(uint32_t));
+    for (uint i = 0; i < nEntries; ++i) {
+        uint h = hashOf(i) & (size - 1);
+        while (slots[h]) {
+            h = (h + 1) & (size - 1);
+        }
+        slots[h] = i + 1;
+    }
+}
+
+// The interned id of a name; ~0u if it was never seen and !bInsert.
+static uint32_t
+FindName(Context *ctx, const ubyte *text, uint length, bool bInsert)
+{
+    if (bInsert) {
+        GrowTable(&ctx->nameTable, ctx->names.size(), [ctx](uint i) { return ctx->names[i].hash; });
+    }
+    if (ctx->nameTable.is_empty()) {
+        return ~0u;
+    }
+    uint32_t const hash = HashName(text, length);
+    uint const mask = ctx->nameTable.size() - 1;
+    for (uint h = hash & mask;; h = (h + 1) & mask) {
+        uint32_t const slot = ctx->nameTable[h];
+        if (!slot) {
+            if (!bInsert) {
+                return ~0u;
+            }
+            ctx->names.push({ text, hash, ~0u, 0, uint8_t(length) });
+            ctx->nameTable[h] = ctx->names.size();
+            return ctx->names.size() - 1;
+        }
+        const NameEntry& e = ctx->names[slot - 1];
+        if (e.hash == hash && e.length == length && memcmp(e.text, text, length) == 0) {
+            return slot - 1;
+        }
+    }
+}
+
+static uint32_t
+ExpectName(Context *ctx)
+{
+    const Token *const tok = GetAndAdvance(ctx);
+    if (tok->kind != Token_Name) {
+        NotImplemented("expected a name");
+    }
+    return FindName(ctx, tok->data.nameBegin, tok->nameLength, true);
+}
+
+// Innermost first; a call sees its own variables and the globals.
+static ConstexprVariable *
+FindVariable(Context *ctx, uint32_t name)
+{
+    ConstexprVariable *const vars = ctx->vars.data();
+    for (uint i = ctx->vars.size(); i > ctx->frameBase; --i) {
+        if (vars[i - 1].name == name) return &vars[i - 1];
+    }
+    for (uint i = ctx->frameBase ? ctx->nGlobals : 0; i > 0; --i) {
+        if (vars[i - 1].name == name) return &vars[i - 1];
+    }
+    return nullptr;
+}
+
+static uint64_t
+ConstexprBytes(const Context *ctx)
+{
+    return uint64_t(ctx->vars.size()) * sizeof(ConstexprVariable) + uint64_t(ctx->memo.entries.size()) * sizeof(MemoEntry) +
+        uint64_t(ctx->memo.lanes.size()) * sizeof(uint64_t) + uint64_t(ctx->memo.table.size()) * sizeof(uint32_t);
+}
+
+static noreturn_void
+ConstexprFallback(Context *ctx, ConstexprBudget budget)
+{
+    Message *const m = ctx->oms->PushRaw();
+    *m = { };
+    m->type = Message_ConstexprBudgetExceeded;
+    m->miscU8 = budget;
+    m->line = ctx->outermostCallLine;
+    NotImplemented("constexpr call over budget, and no code generation to leave it to");
+}
+
+static void
+PushVariable(Context *ctx, uint32_t name, bool bMutable, const ParseOpArg& value)
+{
+    if (ctx->callDepth && ConstexprBytes(ctx) + sizeof(ConstexprVariable) > ctx->options->constexprMemoryBytes) {
+        ConstexprFallback(ctx, ConstexprBudget_Memory);
+    }
+    NameEntry& e = ctx->names[name];
+    if (e.innermostVar > ctx->scopeBase) {
+        NotImplemented("declared twice in the same scope");
+    }
+    ConstexprVariable *const v = ctx->vars.uninitialized_push();
+    v->name = name;
+    v->shadowedVar = e.innermostVar;
+    v->bMutable = bMutable;
+    v->arrayId = NullValueId;
+    v->value = value;
+    e.innermostVar = ctx->vars.size();
+}
+
+// Ends the scope that began at vars[scope], uncovering what its declarations shadowed.
+static void
+PopVariables(Context *ctx, uint scope)
+{
+    for (uint i = ctx->vars.size(); i > scope; --i) {
+        const ConstexprVariable& v = ctx->vars[i - 1];
+        ctx->names[v.name].innermostVar = v.shadowedVar;
+    }
+    ctx->vars.set_size(scope);
+}
+
+// "int", "long", "int3", ...; false, consuming nothing, if Peek() is no type.
+static bool
+ParseDeclaredType(Context *ctx, TypeDescriptor *pType)
+{
+    const Token *const tok = Peek(ctx);
+    BuiltinTypeKind builtin;
+    switch (tok->kind) {
+    case Token_Kw_bool:  builtin = BuiltinType_bool; break;
+    case Token_Kw_char:  builtin = BuiltinType_g8;   break;
+    case Token_Kw_short: builtin = BuiltinType_g16;  break;
+    case Token_Kw_int:   builtin = BuiltinType_g32;  break;
+    case Token_Kw_long:  builtin = BuiltinType_g64;  break;
+    case Token_Kw_half:
+    case Token_Kw_float:
+    case Token_Kw_double:
+        NotImplemented("FP immediates");
+    case Token_Name:
+        if (!VectorTypeFromName(tok->data.nameBegin, tok->nameLength, pType)) {
+            return false;
+        }
+        if (LeafBuiltin(*pType) >= BuiltinType_fp16) {
+            NotImplemented("FP immediates");
+        }
+        GetAndAdvance(ctx);
+        return true;
+    default:
+        return false;
+    }
+    *pType = MakeLeafTypeDesc(builtin, 0);
+    GetAndAdvance(ctx);
+    return true;
+}
+
+// What a variable of the type holds of v: its low bits, sign- or zero-extended back to the 64-bit lane.
+static uint64_t
+WrapToLeafType(uint64_t v, TypeDescriptor type)
+{
+    BuiltinTypeKind const builtin = LeafBuiltin(type);
+    if (builtin == BuiltinType_bool) {
+        return v != 0;
+    }
+    uint const shift = 64 - (8u << (builtin - BuiltinType_g8));
+    return LeafIsUnsigned(type) ? v << shift >> shift : uint64_t(int64_t(v << shift) >> shift);
+}
+
+// As initializing or assigning a variable of that type, or passing or returning it. Scalars splat, and folding on
+// 64-bit lanes is wrapped to the type's width here.
+static void
+ConvertToDeclaredType(ParseOpArg *arg, TypeDescriptor type)
+{
+    uint const size = LeafVectorSize(type), argSize = LeafVectorSize(arg->typedesc);
+    if (argSize != size && argSize != 1) {
+        NotImplemented("vector size mismatch");
+    }
+    if (arg->flags & ArgFlagSpecConstantOp) {
+        if (size != 1) {
+            NotImplemented("vector specialization constants");
+        }
+    }
+    else {
+        for (uint i = 0; i < ImmLanes; ++i) arg->imm.small.u64x4[i] = WrapToLeafType(arg->imm.small.u64x4[i], type);
+    }
+    arg->typedesc = type;
+    arg->flags &= ArgFlagImmediate | ArgFlagSpecConstantOp;
+}
+
+// An expression in a constexpr function, which has to be known: specialization constants can't branch.
+static void
+EvalImmediate(Context *ctx, ParseOpArg *arg)
+{
+    ParsedExprResult r;
+    ParseExpr(ctx, &r, ExprParseFlagMustBeConstexpr);
+    if (!(r.arg.flags & ArgFlagImmediate)) {
+        NotImplemented("specialization constants in constexpr functions");
+    }
+    *arg = r.arg;
+}
+
+// Past an expression that is not run: up to the ';', ',' or ')' that ends it.
+static void
+SkipExpr(Context *ctx)
+{
+    int depth = 0;
+    for (;;) {
+        TokenKind const k = Peek(ctx)->kind;
+        if (k == Token_EOI) {
+            NotImplemented("expression ends early");
+        }
+        if (depth == 0 && (k == Token_SemiColon || k == Token_Comma || k == Token_CloseParen)) {
+            return;
+        }
+        depth += k == Token_OpenParen;
+        depth -= k == Token_CloseParen;
+        GetAndAdvance(ctx);
+    }
+}
+
+// "= expr" after a declaration's name, without the ';'.
 static void
-ParseParenthesizedExpr(Context *ctx, ParsedExprResult *result, uint exprParseFlags)
+ParseVariableInit(Context *ctx, uint32_t name, TypeDescriptor type, bool bMutable, bool bRun)
 {
+    Expect(ctx, Token_Assign);
+    if (!bRun) {
+        SkipExpr(ctx);
+        return;
+    }
+    ParseOpArg value;
+    if (ctx->callDepth) {
+        EvalImmediate(ctx, &value);
+    }
+    else {
+        ParsedExprResult r;
+        ParseExpr(ctx, &r, ExprParseFlagMustBeConstexpr);
+        value = r.arg;
+    }
+    ConvertToDeclaredType(&value, type);
+    PushVariable(ctx, name, bMutable, value);
+}
+
+/*
+    Constant arrays. The initializer goes into the constant pool as it is parsed: each element's constant, then at
+    each '}' the OpConstantComposite of the elements before it, popped off Context::compositeStack. So only one
+    row per dimension is held at a time, and equal rows, and equal elements, are one constant in the pool.
+**/
+enum { MaxArrayDims = 8, MaxArrayLength = 0xffff - 3 }; // OpConstantComposite's word count has 16 bits
+
+struct ArrayDeclaration {
+    TypeDescriptor elementType;
+    uint nDims;
+    uint32_t dims[MaxArrayDims]; // dims[0] is 0 for "[]" until its initializer is parsed
+    SpvTypeId types[MaxArrayDims + 1]; // types[i] is the array type of dimension i, types[nDims] the element's
+    SpvValueId zeros[MaxArrayDims + 1]; // of types[i], for elements not initialized; 0 until needed
+};
+
+static SpvTypeId
+LeafSpvType(Context *ctx, TypeDescriptor type)
+{
+    BuiltinTypeKind const builtin = LeafBuiltin(type);
+    SpvTypeId const scalar = builtin == BuiltinType_bool ? SpvPool_BoolType(ctx->pool) :
+        SpvPool_IntType(ctx->pool, 8u << (builtin - BuiltinType_g8), !LeafIsUnsigned(type));
+    uint const size = LeafVectorSize(type);
+    return size == 1 ? scalar : SpvPool_VectorType(ctx->pool, scalar, size);
+}
+
+// Of a value wrapped as ConvertToDeclaredType() does, so an element reads back as the scalar it was initialized from.
+static SpvValueId
+LeafConstant(Context *ctx, const ParseOpArg& arg, SpvTypeId type)
+{
+    uint const size = LeafVectorSize(arg.typedesc);
+    bool const bBool = LeafBuiltin(arg.typedesc) == BuiltinType_bool;
+    SpvTypeId const scalarType = size == 1 ? type : SpvTypeId(SpvPool_Instruction(ctx->pool, type)[2]);
+    SpvValueId lanes[4];
+    for (uint i = 0; i < size; ++i) {
+        uint64_t const v = WrapToLeafType(arg.imm.small.u64x4[i], arg.typedesc);
+        lanes[i] = bBool ? SpvPool_Bool(ctx->pool, v != 0) : SpvPool_Int(ctx->pool, scalarType, v);
+        ASSERT(SpvPool_IntValue(ctx->pool, lanes[i]) == v);
+    }
+    return size == 1 ? lanes[0] : SpvPool_Composite(ctx->pool, type, { lanes, size });
+}
+
+static SpvValueId
+ZeroConstant(Context *ctx, ArrayDeclaration *decl, uint level)
+{
+    if (!decl->zeros[level]) {
+        if (level == decl->nDims) {
+            ParseOpArg zero = { };
+            zero.typedesc = decl->elementType;
+            decl->zeros[level] = LeafConstant(ctx, zero, decl->types[level]);
+        }
+        else {
+            SpvValueId const element = ZeroConstant(ctx, decl, level + 1);
+            uint const base = ctx->compositeStack.size();
+            SpvValueId *const row = ctx->compositeStack.uninitialized_push_n(decl->dims[level]);
+            for (uint i = 0; i < decl->dims[level]; ++i) row[i] = element;
+            decl->zeros[level] = SpvPool_Composite(ctx->pool, decl->types[level], { row, decl->dims[level] });
+            ctx->compositeStack.set_size(base);
+        }
+    }
+    return decl->zeros[level];
+}
+
+// "{ ... }" for dimension level; elements left out are zero, as in C.
+static SpvValueId
+ParseArrayInitializer(Context *ctx, ArrayDeclaration *decl, uint level)
+{
+    Expect(ctx, Token_OpenCurly);
+    Array<SpvValueId>& stack = ctx->compositeStack;
+    uint const base = stack.size();
+    uint const maxLength = decl->dims[level] ? decl->dims[level] : uint(MaxArrayLength);
+    while (Peek(ctx)->kind != Token_CloseCurly) {
+        if (stack.size() - base == maxLength) {
+            NotImplemented(decl->dims[level] ? "too many initializers" :
+                           "more than 65532 elements: a SPIR-V instruction has at most 65535 words");
+        }
+        SpvValueId element;
+        if (level + 1 < decl->nDims) {
+            if (Peek(ctx)->kind != Token_OpenCurly) {
+                NotImplemented("array initializer without braces for each dimension");
+            }
+            element = ParseArrayInitializer(ctx, decl, level + 1);
+        }
+        else {
+            ParsedExprResult r;
+            ParseExpr(ctx, &r, ExprParseFlagMustBeConstexpr);
+            if (!(r.arg.flags & ArgFlagImmediate)) {
+                NotImplemented("specialization constants in constant arrays");
+            }
+            ConvertToDeclaredType(&r.arg, decl->elementType);
+            element = LeafConstant(ctx, r.arg, decl->types[decl->nDims]);
+        }
+        stack.push(element);
+        if (Peek(ctx)->kind != Token_Comma) {
+            break;
+        }
+        GetAndAdvance(ctx);
+    }
+    Expect(ctx, Token_CloseCurly);
+
+    uint const n = stack.size() - base;
+    if (!decl->dims[level]) {
+        if (n == 0) {
+            NotImplemented("arrays of no elements");
+        }
+        decl->dims[level] = n;
+        decl->types[level] = SpvPool_ArrayType(ctx->pool, decl->types[level + 1], n);
+    }
+    if (n < decl->dims[level]) {
+        SpvValueId const zero = ZeroConstant(ctx, decl, level + 1);
+        SpvValueId *const rest = stack.uninitialized_push_n(decl->dims[level] - n);
+        for (uint i = 0; i < decl->dims[level] - n; ++i) rest[i] = zero;
+    }
+    SpvValueId const id = SpvPool_Composite(ctx->pool, decl->types[level], { stack.data() + base, decl->dims[level] });
+    stack.set_size(base);
+    return id;
+}
+
+// "[4][2] = { ... }" after the type and name of a constexpr array, without the ';'.
+static void
+ParseArrayDeclaration(Context *ctx, uint32_t name, TypeDescriptor elementType, bool bRun)
+{
+    if (!bRun) {
+        int depth = 0;
+        for (;;) {
+            TokenKind const k = Peek(ctx)->kind;
+            if (k == Token_EOI) {
+                NotImplemented("missing ';'");
+            }
+            if (depth == 0 && k == Token_SemiColon) {
+                return;
+            }
+            depth += k == Token_OpenCurly || k == Token_OpenParen || k == Token_OpenBracket;
+            depth -= k == Token_CloseCurly || k == Token_CloseParen || k == Token_CloseBracket;
+            GetAndAdvance(ctx);
+        }
+    }
+
+    ArrayDeclaration decl = { };
+    decl.elementType = elementType;
+    while (Peek(ctx)->kind == Token_OpenBracket) {
+        GetAndAdvance(ctx);
+        if (decl.nDims == MaxArrayDims) {
+            NotImplemented("arrays of more than 8 dimensions");
+        }
+        uint32_t length = 0;
+        if (decl.nDims != 0 || Peek(ctx)->kind != Token_CloseBracket) {
+            ParsedExprResult r;
+            ParseExpr(ctx, &r, ExprParseFlagMustBeConstexpr);
+            if (!(r.arg.flags & ArgFlagImmediate) || LeafVectorSize(r.arg.typedesc) != 1 ||
+                r.arg.imm.small.u64 - 1 >= MaxArrayLength) {
+                NotImplemented("array length must be a known integer from 1 to 65532");
+            }
+            length = uint32_t(r.arg.imm.small.u64);
+        }
+        Expect(ctx, Token_CloseBracket);
+        decl.dims[decl.nDims++] = length;
+    }
+    Expect(ctx, Token_Assign);
+
+    // All array types but the outermost's, whose length may come from the initializer:
+    decl.types[decl.nDims] = LeafSpvType(ctx, elementType);
+    for (uint i = decl.nDims - 1; i > 0; --i) {
+        decl.types[i] = SpvPool_ArrayType(ctx->pool, decl.types[i + 1], decl.dims[i]);
+    }
+    if (decl.dims[0]) {
+        decl.types[0] = SpvPool_ArrayType(ctx->pool, decl.types[1], decl.dims[0]);
+    }
+    SpvValueId const id = ParseArrayInitializer(ctx, &decl, 0);
+
+    ParseOpArg element = { };
+    element.typedesc = elementType;
+    element.flags = ArgFlagImmediate;
+    PushVariable(ctx, name, false, element);
+    ctx->vars[ctx->vars.size() - 1].arrayId = id;
+    if (!ctx->callDepth) {
+        const NameEntry& e = ctx->names[name];
+        SpvPool_Name(ctx->pool, id, { reinterpret_cast<const char *>(e.text), e.length });
+    }
+}
+
+// "[i][j]" after the name of a constant array: an element, read back from the pool.
+static void
+ParseArrayElement(Context *ctx, SpvValueId id, TypeDescriptor elementType, ParseOpArg *arg, uint exprParseFlags)
+{
+    const SpvPool *const pool = ctx->pool;
+    for (;;) {
+        const uint32_t *const inst = SpvPool_Instruction(pool, id);
+        const uint32_t *const type = SpvPool_Instruction(pool, inst[1]);
+        if (uint16_t(type[0]) != SpvOp_TypeArray) {
+            break;
+        }
+        if (Peek(ctx)->kind != Token_OpenBracket) {
+            NotImplemented("arrays as values, only their elements");
+        }
+        GetAndAdvance(ctx);
+        ParsedExprResult r;
+        ParseExpr(ctx, &r, exprParseFlags & ~ExprParseFlagCommaContinues);
+        Expect(ctx, Token_CloseBracket);
+
+        // A dead operand's index may well be out of bounds, since the condition is what guards it:
+        uint64_t index = r.arg.imm.small.u64;
+        if (!(r.arg.flags & ArgFlagImmediate) && !ctx->deadDepth) {
+            NotImplemented("indexing with a specialization constant");
+        }
+        if (LeafVectorSize(r.arg.typedesc) != 1) {
+            NotImplemented("vector index");
+        }
+        if (!(r.arg.flags & ArgFlagImmediate) || index >= SpvPool_IntValue(pool, SpvValueId(type[3]))) {
+            if (!ctx->deadDepth) {
+                NotImplemented("array index out of bounds");
+            }
+            index = 0;
+        }
+        id = SpvValueId(SpvPool_Instruction(pool, id)[3 + index]);
+    }
+
+    *arg = { };
+    arg->typedesc = elementType;
+    arg->flags = ArgFlagImmediate;
+    uint const size = LeafVectorSize(elementType);
+    if (size == 1) {
+        uint64_t const v = WrapToLeafType(SpvPool_IntValue(pool, id), elementType);
+        for (uint i = 0; i < ImmLanes; ++i) arg->imm.small.u64x4[i] = v;
+    }
+    else {
+        const uint32_t *const inst = SpvPool_Instruction(pool, id);
+        for (uint i = 0; i < size; ++i) {
+            arg->imm.small.u64x4[i] = WrapToLeafType(SpvPool_IntValue(pool, SpvValueId(inst[3 + i])), elementType);
+        }
+    }
+}
+
+// "x = e", "x += e" and the other compound assignments, "x++", "++x", "x--", "--x"; without the ';'.
+static void
+ParseAssignment(Context *ctx, bool bRun)
+{
+    static const TypelessOp CompoundOps[] = { // from TypelessOp_Assign on
+        TypelessOp_Assign, TypelessOp_Add, TypelessOp_Sub, TypelessOp_Mul, TypelessOp_Div, TypelessOp_Mod,
+        TypelessOp_ShiftLeft, TypelessOp_ShiftRight, TypelessOp_BitwiseAnd, TypelessOp_BitwiseXor, TypelessOp_BitwiseOr,
+    };
+    static_assert(lengthof(CompoundOps) == TypelessOp_OrAssign - TypelessOp_Assign + 1, "");
+
+    TokenKind k = GetAndAdvance(ctx)->kind;
+    bool const bPrefix = k == Token_Inc || k == Token_Dec;
+    const Token *const nameTok = bPrefix ? GetAndAdvance(ctx) : &ctx->tokenbuf[(ctx->peekIndex - 1) & TokenBufModMask];
+    if (nameTok->kind != Token_Name) {
+        NotImplemented("expected a statement");
+    }
+    uint32_t const name = FindName(ctx, nameTok->data.nameBegin, nameTok->nameLength, false);
+    if (!bPrefix) {
+        k = GetAndAdvance(ctx)->kind;
+    }
+
+    TypelessOp op;
+    ParseOpArg rhs = { };
+    if (k == Token_Inc || k == Token_Dec) {
+        op = k == Token_Inc ? TypelessOp_Add : TypelessOp_Sub;
+        rhs.typedesc = MakeLeafTypeDesc(BuiltinType_g32, 0);
+        rhs.flags = ArgFlagImmediate;
+        for (uint i = 0; i < ImmLanes; ++i) rhs.imm.small.u64x4[i] = 1;
+    }
+    else {
+        OpInfo const info = OpInfoByToken.info[1][k];
+        if (info == OpInfo_Invalid || !IsAssignment(GetTypelessOp(info))) {
+            NotImplemented("expected an assignment");
+        }
+        op = CompoundOps[GetTypelessOp(info) - TypelessOp_Assign];
+        if (!bRun) {
+            SkipExpr(ctx);
+            return;
+        }
+        EvalImmediate(ctx, &rhs);
+    }
+    if (!bRun) {
+        return;
+    }
+
+    // Looked up after the right side, whose calls may have moved the variables:
+    ConstexprVariable *const var = name == ~0u ? nullptr : FindVariable(ctx, name);
+    if (!var) {
+        NotImplemented("assignment to an undeclared name");
+    }
+    if (!var->bMutable) {
+        NotImplemented("assignment to a constexpr variable");
+    }
+    TypeDescriptor const type = var->value.typedesc;
+    if (op != TypelessOp_Assign) {
+        ParseOpArg a = var->value;
+        bool const bUnsigned = IsUnsignedOp(op, a.typedesc, rhs.typedesc);
+        a.typedesc = BinaryResultType(op, a.typedesc, rhs.typedesc);
+        CheckFoldableLanes(op, type, rhs.imm.small.u64x4, LeafVectorSize(a.typedesc));
+        FoldBinaryLanes(op, a.imm.small.u64x4, rhs.imm.small.u64x4, bUnsigned);
+        rhs = a;
+    }
+    ConvertToDeclaredType(&rhs, type);
+    var->value = rhs;
+}
+
+// A declaration or an assignment, as in a statement or a for's parentheses; without the ';'.
+static void
+ParseSimpleStatement(Context *ctx, bool bRun)
+{
+    bool const bConstexpr = Peek(ctx)->kind == Token_Kw_constexpr;
+    if (bConstexpr) {
+        GetAndAdvance(ctx);
+    }
+    TypeDescriptor type;
+    if (ParseDeclaredType(ctx, &type)) {
+        uint32_t const name = ExpectName(ctx);
+        if (Peek(ctx)->kind != Token_OpenBracket) {
+            ParseVariableInit(ctx, name, type, !bConstexpr, bRun);
+        }
+        else if (bConstexpr) {
+            ParseArrayDeclaration(ctx, name, type, bRun);
+        }
+        else {
+            NotImplemented("arrays that are not constexpr");
+        }
+        return;
+    }
+    if (bConstexpr) {
+        NotImplemented("expected a type");
+    }
+    ParseAssignment(ctx, bRun);
+}
+
+static bool
+ParseCondition(Context *ctx, bool bRun)
+{
+    bool bCond = false;
+    if (bRun) {
+        ParseOpArg c;
+        EvalImmediate(ctx, &c);
+        if (LeafVectorSize(c.typedesc) != 1) {
+            NotImplemented("vector condition");
+        }
+        bCond = c.imm.small.u64 != 0;
+    }
+    else {
+        SkipExpr(ctx);
+    }
+    return bCond;
+}
+
+enum ExecResult : uint8_t { Exec_Next, Exec_Return, Exec_Break, Exec_Continue };
+
+static ExecResult ExecBlock(Context *ctx, bool bRun, uint scopeBase);
+static ExecResult ExecScoped(Context *ctx, bool bRun);
+
+/*
+    One statement of a constexpr function: run if bRun, else only parsed past, so the tokens end up after it
+    either way. Loops go back by replaying from their condition; a return, break or continue skips the rest of
+    each enclosing statement up to where it is handled.
+**/
+static ExecResult
+ExecStatement(Context *ctx, bool bRun)
+{
+    if (bRun && ++ctx->steps > ctx->options->constexprStepBudget) {
+        ConstexprFallback(ctx, ConstexprBudget_Steps);
+    }
+    TokenKind const k = Peek(ctx)->kind;
+    switch (k) {
+    case Token_SemiColon:
+        GetAndAdvance(ctx);
+        return Exec_Next;
+    case Token_OpenCurly:
+        return ExecBlock(ctx, bRun, ctx->vars.size());
+    case Token_Kw_if: {
+        GetAndAdvance(ctx);
+        Expect(ctx, Token_OpenParen);
+        bool const bCond = ParseCondition(ctx, bRun);
+        Expect(ctx, Token_CloseParen);
+        ExecResult const rThen = ExecScoped(ctx, bCond);
+        ExecResult rElse = Exec_Next;
+        if (Peek(ctx)->kind == Token_Kw_else) {
+            GetAndAdvance(ctx);
+            rElse = ExecScoped(ctx, bRun && !bCond);
+        }
+        return bCond ? rThen : rElse;
+    }
+    case Token_Kw_while: {
+        GetAndAdvance(ctx);
+        const Token *const cond = ReplayPosition(ctx);
+        for (;;) {
+            Expect(ctx, Token_OpenParen);
+            bool const bCond = ParseCondition(ctx, bRun);
+            Expect(ctx, Token_CloseParen);
+            ExecResult const r = ExecScoped(ctx, bCond);
+            if (!bCond || r == Exec_Break) return Exec_Next;
+            if (r == Exec_Return) return r;
+            ReplayFrom(ctx, cond);
+        }
+    }
+    case Token_Kw_for: {
+        GetAndAdvance(ctx);
+        Expect(ctx, Token_OpenParen);
+        uint const scope = ctx->vars.size(), outerScopeBase = ctx->scopeBase;
+        ctx->scopeBase = scope;
+        if (Peek(ctx)->kind != Token_SemiColon) {
+            ParseSimpleStatement(ctx, bRun);
+        }
+        Expect(ctx, Token_SemiColon);
+        const Token *const cond = ReplayPosition(ctx);
+        ExecResult result = Exec_Next;
+        for (;;) {
+            bool const bCond = Peek(ctx)->kind == Token_SemiColon ? bRun : ParseCondition(ctx, bRun);
+            Expect(ctx, Token_SemiColon);
+            const Token *const step = ReplayPosition(ctx);
+            if (Peek(ctx)->kind != Token_CloseParen) {
+                SkipExpr(ctx);
+            }
+            Expect(ctx, Token_CloseParen);
+            ExecResult const r = ExecScoped(ctx, bCond);
+            if (!bCond || r == Exec_Break) break;
+            if (r == Exec_Return) {
+                result = r;
+                break;
+            }
+            ReplayFrom(ctx, step);
+            if (Peek(ctx)->kind != Token_CloseParen) {
+                ParseSimpleStatement(ctx, true);
+            }
+            ReplayFrom(ctx, cond);
+        }
+        PopVariables(ctx, scope);
+        ctx->scopeBase = outerScopeBase;
+        return result;
+    }
+    case Token_Kw_return: {
+        GetAndAdvance(ctx);
+        if (bRun) {
+            ParseOpArg value;
+            EvalImmediate(ctx, &value);
+            ctx->returnValue = value; // after the expression, whose calls set it too
+        }
+        else {
+            SkipExpr(ctx);
+        }
+        Expect(ctx, Token_SemiColon);
+        return bRun ? Exec_Return : Exec_Next;
+    }
+    case Token_Kw_break:
+    case Token_Kw_continue:
+        GetAndAdvance(ctx);
+        Expect(ctx, Token_SemiColon);
+        return !bRun ? Exec_Next : k == Token_Kw_break ? Exec_Break : Exec_Continue;
+    default:
+        ParseSimpleStatement(ctx, bRun);
+        Expect(ctx, Token_SemiColon);
+        return Exec_Next;
+    }
+}
+
+// A '{' statement list; a name declared in it since vars[scopeBase] can't be declared again before its '}'.
+static ExecResult
+ExecBlock(Context *ctx, bool bRun, uint scopeBase)
+{
+    Expect(ctx, Token_OpenCurly);
+    uint const scope = ctx->vars.size(), outerScopeBase = ctx->scopeBase;
+    ctx->scopeBase = scopeBase;
+    ExecResult result = Exec_Next;
+    while (Peek(ctx)->kind != Token_CloseCurly) {
+        ExecResult const r = ExecStatement(ctx, bRun && result == Exec_Next);
+        result = result == Exec_Next ? r : result;
+    }
+    GetAndAdvance(ctx);
+    PopVariables(ctx, scope);
+    ctx->scopeBase = outerScopeBase;
+    return result;
+}
+
+// The body of an if, else, while or for, which is a scope of its own even without braces.
+static ExecResult
+ExecScoped(Context *ctx, bool bRun)
+{
+    uint const scope = ctx->vars.size(), outerScopeBase = ctx->scopeBase;
+    ctx->scopeBase = scope;
+    ExecResult const r = ExecStatement(ctx, bRun);
+    PopVariables(ctx, scope);
+    ctx->scopeBase = outerScopeBase;
+    return r;
+}
+
+static uint32_t
+HashCall(uint32_t function, const ParseOpArg *args, uint nArgs)
+{
+    uint64_t h = (function + 1) * 0x9e3779b97f4a7c15u;
+    for (uint i = 0; i < nArgs; ++i) {
+        for (uint l = 0; l < LeafVectorSize(args[i].typedesc); ++l) {
+            h = (h ^ args[i].imm.small.u64x4[l]) * 0xff51afd7ed558ccdu;
+            h ^= h >> 32;
+        }
+    }
+    return uint32_t(h);
+}
+
+static const MemoEntry *
+FindMemo(const Context *ctx, uint32_t function, uint32_t hash, const ParseOpArg *args, uint nArgs)
+{
+    const ConstexprMemo& memo = ctx->memo;
+    if (memo.table.is_empty()) {
+        return nullptr;
+    }
+    uint const mask = memo.table.size() - 1;
+    for (uint h = hash & mask; memo.table.data()[h]; h = (h + 1) & mask) {
+        const MemoEntry& e = memo.entries.data()[memo.table.data()[h] - 1];
+        if (e.hash != hash || e.function != function) {
+            continue;
+        }
+        const uint64_t *lanes = memo.lanes.data() + e.firstLane;
+        bool bSame = true;
+        for (uint i = 0; i < nArgs && bSame; ++i) {
+            uint const n = LeafVectorSize(args[i].typedesc);
+            bSame = memcmp(lanes, args[i].imm.small.u64x4, n * sizeof(uint64_t)) == 0;
+            lanes += n;
+        }
+        if (bSame) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+// Unless that would take the memo past half the memory budget, the other half is for variables.
+static void
+InsertMemo(Context *ctx, uint32_t function, uint32_t hash, const ParseOpArg *args, uint nArgs, const ParseOpArg& result)
+{
+    ConstexprMemo& memo = ctx->memo;
+    uint64_t const memoBytes = ConstexprBytes(ctx) - uint64_t(ctx->vars.size()) * sizeof(ConstexprVariable);
+    uint64_t const growth = sizeof(MemoEntry) + nArgs * ImmLanes * sizeof(uint64_t) +
+        (2 * (memo.entries.size() + 1) > memo.table.size() ? Max(64u, memo.table.size()) * sizeof(uint32_t) : 0);
+    if (memoBytes + growth > ctx->options->constexprMemoryBytes / 2) {
+        return;
+    }
+    GrowTable(&memo.table, memo.entries.size(), [&memo](uint i) { return memo.entries[i].hash; });
+    MemoEntry *const e = memo.entries.uninitialized_push();
+    e->function = function;
+    e->hash = hash;
+    e->firstLane = memo.lanes.size();
+    e->result = result;
+    for (uint i = 0; i < nArgs; ++i) {
+        memo.lanes.push_n(args[i].imm.small.u64x4, LeafVectorSize(args[i].typedesc));
+    }
+    uint const mask = memo.table.size() - 1;
+    uint h = hash & mask;
+    while (memo.table[h]) {
+        h = (h + 1) & mask;
+    }
+    memo.table[h] = memo.entries.size();
+}
+
+static void
+CallConstexprFunction(Context *ctx, uint32_t function, ParseOpArg *args, uint nArgs, int32_t line, ParseOpArg *result)
+{
+    ConstexprFunction const fn = ctx->functions[function];
+    if (nArgs != fn.nParams) {
+        NotImplemented("wrong number of arguments");
+    }
+    *result = { };
+    result->typedesc = fn.returnType;
+    result->flags = ArgFlagImmediate;
+    if (ctx->deadDepth) {
+        return; // discarded, and may be what the condition keeps from recursing forever
+    }
+    for (uint i = 0; i < nArgs; ++i) {
+        if (!(args[i].flags & ArgFlagImmediate)) {
+            NotImplemented("constexpr call with a specialization constant argument");
+        }
+        ConvertToDeclaredType(&args[i], ctx->paramTypes[fn.firstParam + i]);
+    }
+
+    if (ctx->callDepth == 0) {
+        ctx->steps = 0;
+        ctx->outermostCallLine = line;
+    }
+    if (++ctx->steps > ctx->options->constexprStepBudget) {
+        ConstexprFallback(ctx, ConstexprBudget_Steps);
+    }
+    uint32_t const hash = HashCall(function, args, nArgs);
+    if (const MemoEntry *const e = FindMemo(ctx, function, hash, args, nArgs)) {
+        *result = e->result;
+        return;
+    }
+    if (ctx->callDepth == ConstexprMaxCallDepth) {
+        ConstexprFallback(ctx, ConstexprBudget_Depth);
+    }
+
+    TokenStreamState saved;
+    memcpy(saved.tokenbuf, ctx->tokenbuf, sizeof saved.tokenbuf);
+    saved.pReplay = ctx->pReplay;
+    saved.peekIndex = ctx->peekIndex;
+    uint const callerFrameBase = ctx->frameBase, callerScopeBase = ctx->scopeBase;
+    ctx->frameBase = ctx->scopeBase = ctx->vars.size();
+    ctx->callDepth += 1;
+    for (uint i = 0; i < nArgs; ++i) {
+        PushVariable(ctx, ctx->paramNames[fn.firstParam + i], true, args[i]);
+    }
+
+    ctx->pReplay = ctx->functionTokens.data() + fn.body;
+    ReplayFrom(ctx, ctx->pReplay);
+    ExecResult const r = ExecBlock(ctx, true, ctx->frameBase); // the body is in the parameters' scope
+    if (r != Exec_Return) {
+        NotImplemented(r == Exec_Next ? "constexpr function ends without a return" : "break or continue outside a loop");
+    }
+    ParseOpArg value = ctx->returnValue;
+    ConvertToDeclaredType(&value, fn.returnType);
+
+    PopVariables(ctx, ctx->frameBase);
+    ctx->frameBase = callerFrameBase;
+    ctx->scopeBase = callerScopeBase;
+    ctx->callDepth -= 1;
+    memcpy(ctx->tokenbuf, saved.tokenbuf, sizeof saved.tokenbuf);
+    ctx->pReplay = saved.pReplay;
+    ctx->peekIndex = saved.peekIndex;
+
+    InsertMemo(ctx, function, hash, args, nArgs, value);
+    *result = value;
+}
+
+// A constexpr variable, or a call of a constexpr function. Peek() is the name; false if it is neither.
+static bool
+ParseConstexprName(Context *ctx, ParseOpArg *arg, uint exprParseFlags)
+{
+    const Token *const tok = Peek(ctx);
+    uint32_t const name = FindName(ctx, tok->data.nameBegin, tok->nameLength, false);
+    if (name == ~0u) {
+        return false;
+    }
+    if (const ConstexprVariable *const var = FindVariable(ctx, name)) {
+        *arg = var->value;
+        GetAndAdvance(ctx);
+        if (var->arrayId) {
+            ParseArrayElement(ctx, var->arrayId, arg->typedesc, arg, exprParseFlags);
+        }
+        return true;
+    }
+    uint32_t const function = ctx->names[name].function;
+    if (function == ~0u) {
+        return false;
+    }
+    int32_t const line = tok->lineno;
+    GetAndAdvance(ctx);
+
+    enum { MaxArgs = 8 };
+    ParseOpArg args[MaxArgs];
+    uint nArgs = 0;
+    Expect(ctx, Token_OpenParen);
+    if (Peek(ctx)->kind == Token_CloseParen) {
+        GetAndAdvance(ctx);
+    }
+    else for (;;) {
+        if (nArgs == MaxArgs) {
+            NotImplemented("more than 8 arguments");
+        }
+        ParsedExprResult sub;
+        ParseExpr(ctx, &sub, exprParseFlags & ~ExprParseFlagCommaContinues);
+        args[nArgs++] = sub.arg;
+        TokenKind const k = GetAndAdvance(ctx)->kind;
+        if (k == Token_CloseParen) {
+            break;
+        }
+        if (k != Token_Comma) {
+            NotImplemented("Handle Expect(token) mismatch");
+        }
+    }
+    CallConstexprFunction(ctx, function, args, nArgs, line, arg);
+    return true;
+}
+
+// After "constexpr": a variable, or at the top level also a function. Its body is kept as tokens, to replay.
+static void
+ParseConstexprDefinition(Context *ctx, bool bTopLevel)
+{
+    TypeDescriptor type;
+    if (!ParseDeclaredType(ctx, &type)) {
+        NotImplemented("expected a type");
+    }
+    uint32_t const name = ExpectName(ctx);
+    if (Peek(ctx)->kind != Token_OpenParen) {
+        if (Peek(ctx)->kind == Token_OpenBracket) {
+            ParseArrayDeclaration(ctx, name, type, true);
+        }
+        else {
+            ParseVariableInit(ctx, name, type, false, true);
+        }
+        Expect(ctx, Token_SemiColon);
+        if (bTopLevel) {
+            ctx->nGlobals = ctx->vars.size();
+        }
+        return;
+    }
+    if (!bTopLevel) {
+        NotImplemented("functions inside functions");
+    }
+    if (ctx->names[name].function != ~0u) {
+        NotImplemented("function defined twice");
+    }
+
+    ConstexprFunction fn = { };
+    fn.returnType = type;
+    fn.name = name;
+    fn.firstParam = ctx->paramTypes.size();
+    GetAndAdvance(ctx);
+    if (Peek(ctx)->kind == Token_CloseParen) {
+        GetAndAdvance(ctx);
+    }
+    else for (;;) {
+        TypeDescriptor paramType;
+        if (!ParseDeclaredType(ctx, &paramType)) {
+            NotImplemented("expected a parameter type");
+        }
+        ctx->paramTypes.push(paramType);
+        ctx->paramNames.push(ExpectName(ctx));
+        fn.nParams += 1;
+        TokenKind const k = GetAndAdvance(ctx)->kind;
+        if (k == Token_CloseParen) {
+            break;
+        }
+        if (k != Token_Comma) {
+            NotImplemented("Handle Expect(token) mismatch");
+        }
+    }
+
+    if (Peek(ctx)->kind != Token_OpenCurly) {
+        NotImplemented("expected a function body");
+    }
+    fn.body = ctx->functionTokens.size();
+    int depth = 0;
+    do {
+        const Token *const tok = GetAndAdvance(ctx);
+        if (tok->kind == Token_EOI) {
+            NotImplemented("missing '}'");
+        }
+        depth += tok->kind == Token_OpenCurly;
+        depth -= tok->kind == Token_CloseCurly;
+        ctx->functionTokens.push(*tok);
+    } while (depth);
+    Token end = { };
+    end.kind = Token_EOI;
+    end.lineno = ctx->functionTokens[ctx->functionTokens.size() - 1].lineno;
+    ctx->functionTokens.push(end);
+
+    ctx->names[name].function = ctx->functions.size();
+    ctx->functions.push(fn);
+}
+
+// constexpr definitions, then the "void main(){" that Compile() skips as text when the source starts with it.
+static void
+CompileTopLevel(Context *ctx)
+{
+    while (Peek(ctx)->kind == Token_Kw_constexpr) {
+        GetAndAdvance(ctx);
+        ParseConstexprDefinition(ctx, true);
+    }
+    Expect(ctx, Token_Kw_void);
+    const Token *const name = GetAndAdvance(ctx);
+    if (name->kind != Token_Name || name->nameLength != 4 || memcmp(name->data.nameBegin, "main", 4) != 0) {
+        NotImplemented("only void main(){ so far");
+    }
     Expect(ctx, Token_OpenParen);
-    ParseExpr(ctx, result, exprParseFlags);
     Expect(ctx, Token_CloseParen);
+    Expect(ctx, Token_OpenCurly);
+    ctx->scopeBase = ctx->vars.size(); // main's locals may shadow the globals
 }
 
 
-void Compile(view<const char> source, MessageStream *oms)
+static TokenKind (*
+ScannerVariant(ScanFeatureFlags features))(Scanner *, Token *)
 {
-    ASSERT(source.length >= 20);
+    switch (features) {
+    case ScanFeatures_MachineGenerated: return Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>;
+    case ScanFeature_Comments:          return Scanner_NextTokenRawT<ScanFeature_Comments>;
+    case ScanFeature_TrackLines:        return Scanner_NextTokenRawT<ScanFeature_TrackLines>;
+    case ScanFeatures_Full:             return Scanner_NextTokenRawT<ScanFeatures_Full>;
+    default:
+        ASSERT(0);
+        unreachable;
+    }
+}
+
+static void
+InitContext(Context *ctx, MessageStream *oms, const CompileOptions *options, view<const char> source, uint32_t lineno)
+{
+    ctx->oms = oms;
+    ctx->options = options;
+    ctx->specInfo = options->pSpecInfo;
+    ASSERT(options->specConstants.length == 0 || ctx->specInfo);
+    ctx->pool = options->pConstantPool ? options->pConstantPool : &ctx->ownPool;
+    ctx->pfnNextToken = ScannerVariant(options->scanFeatures);
+
+    Scanner_Init(&ctx->scanner, source);
+    ctx->scanner.lineno = lineno;
+    ctx->peekIndex = 0;
+    ctx->pfnNextToken(&ctx->scanner, &ctx->tokenbuf[0]);
+}
+
+static view<const char>
+SkipFunctionOpening(view<const char> source)
+{
+    ASSERT(source.length >= 12);
     constexpr view<const char> prefix = "void main(){"_view;
     static_assert(prefix.length == 12, "");
     ASSERT(memcmp(source.ptr, prefix.ptr, prefix.length) == 0);
     source.ptr += 12;
     source.length -= 12;
+    return source;
+}
 
-    Context ctx;
-    ctx.oms = oms;
-
-    Scanner_Init(&ctx.scanner, source);
-    ctx.peekIndex = 0;
-    Scanner_NextTokenRaw(&ctx.scanner, &ctx.tokenbuf[0]);
-
+// Statements up to the end of the function or of the source, whichever comes first.
+static TokenKind
+CompileStatements(Context *ctx)
+{
     for (;;) {
-        const Token t = *GetAndAdvance(&ctx); // copy
+        const Token t = *GetAndAdvance(ctx); // copy
 
         switch (t.kind) {
         case Token_EOI:
-            return;
         case Token_CloseCurly:
-            return;
+            return t.kind;
+        case Token_Kw_constexpr:
+            ParseConstexprDefinition(ctx, false);
+            break;
         case Token_Kw_static_assert: {
             ParsedExprResult result;
-            auto *pStart = ctx.scanner.pSrcCurr - 1;
-            ParseParenthesizedExpr(&ctx, &result, ExprParseFlagMustBeConstexpr);
-            auto *pEnd = ctx.scanner.pSrcCurr;
-            Expect(&ctx, Token_SemiColon);
+            auto *pStart = ctx->scanner.pSrcCurr - 1;
+            Expect(ctx, Token_OpenParen);
+            ParseExpr(ctx, &result, ExprParseFlagMustBeConstexpr);
+            if (Peek(ctx)->kind == Token_Comma) { // the message, not reported yet
+                GetAndAdvance(ctx);
+                Expect(ctx, Token_StringLiteral);
+            }
+            Expect(ctx, Token_CloseParen);
+            auto *pEnd = ctx->scanner.pSrcCurr;
+            Expect(ctx, Token_SemiColon);
 
+            if (result.arg.flags & ArgFlagSpecConstantOp) {
+                DeferredStaticAssert *const d = ctx->specInfo->deferredAsserts.uninitialized_push();
+                d->node = uint32_t(result.arg.imm.small.u64);
+                d->line = t.lineno;
+                break;
+            }
             if (!(result.arg.flags & ArgFlagImmediate)) {
                 NotImplemented("not constexpr");
             }
+            if (LeafVectorSize(result.arg.typedesc) != 1) {
+                NotImplemented("static_assert of a vector");
+            }
 
             // TODO: check is bool or implcitly convertible to bool:
             
             if (!result.arg.imm.small.s64) {
-                Message *m = oms->PushRaw();
+                Message *m = ctx->oms->PushRaw();
                 *m = { };
                 m->line = t.lineno;
                 m->type = Message_StaticAssertFailed;
                  // debug
-                printf("static_assert failed on line %d: ", t.lineno);
-                fwrite(pStart, 1, pEnd - pStart, stdout);
-                puts("");
+                devel_printf("static_assert failed on line %d: %.*s\n", t.lineno, ctx->pReplay ? 0 : int(pEnd - pStart), reinterpret_cast<const char *>(pStart));
             }
         } break;
 
@@ -436,3 +2177,238 @@ void Compile(view<const char> source, MessageStream *oms)
         }
     }
 }
+
+
+// Where the parser was: the token last handed out, the one an Expect() failed on.
+static int32_t
+LastTokenLine(const Context *ctx)
+{
+    return ctx->tokenbuf[(ctx->peekIndex - 1) & TokenBufModMask].lineno;
+}
+
+static CompileResult
+ReportCompileAbort(MessageStream *oms, const CompileAbort& abort, int32_t line)
+{
+    Message *const m = oms->PushAbort();
+    *m = { };
+    m->type = Message_CompileAborted;
+    m->miscU8 = abort.result;
+    m->line = line;
+    oms->abortInfo = abort.info;
+    return abort.result;
+}
+
+CompileResult Compile(view<const char> source, MessageStream *oms, const CompileOptions *options)
+{
+    CompileOptions const defaultOptions;
+    if (!options) {
+        options = &defaultOptions;
+    }
+
+    ASSERT(source.length >= 20);
+    bool const bMainFirst = memcmp(source.ptr, "void main(){", 12) == 0;
+    if (bMainFirst) {
+        source = SkipFunctionOpening(source);
+    }
+
+    AllocTagScope allocTag(AllocTag_Parser);
+
+    AllocBudgetScope budget(options->memoryBudgetBytes);
+    Context ctx;
+    CompileAbortScope abortScope;
+    CompileResult result = CompileResult_Ok;
+    try {
+        if (options->specConstants.length) {
+            memset(ctx.specConstantNodes.uninitialized_push_n(options->specConstants.length), 0xff,
+                options->specConstants.length * sizeof(uint32_t));
+        }
+        InitContext(&ctx, oms, options, source, 1);
+        if (!bMainFirst) {
+            CompileTopLevel(&ctx);
+        }
+        CompileStatements(&ctx);
+    }
+    catch (const CompileAbort& abort) {
+        result = ReportCompileAbort(oms, abort, LastTokenLine(&ctx));
+    }
+    if (options->pPeakBytes) {
+        *options->pPeakBytes = budget.PeakBytes();
+    }
+    return result;
+}
+
+CompileResult CompilePreprocessed(view<const Token> tokens, MessageStream *oms, const CompileOptions *options)
+{
+    CompileOptions const defaultOptions;
+    if (!options) {
+        options = &defaultOptions;
+    }
+    ASSERT(tokens.length && tokens.ptr[tokens.length - 1].kind == Token_EOI);
+
+    AllocTagScope allocTag(AllocTag_Parser);
+
+    AllocBudgetScope budget(options->memoryBudgetBytes);
+    Context ctx;
+    CompileAbortScope abortScope;
+    CompileResult result = CompileResult_Ok;
+    try {
+        if (options->specConstants.length) {
+            memset(ctx.specConstantNodes.uninitialized_push_n(options->specConstants.length), 0xff,
+                options->specConstants.length * sizeof(uint32_t));
+        }
+        InitContext(&ctx, oms, options, ""_view, 1);
+        ctx.tokenbuf[0] = tokens.ptr[0];
+        ctx.pReplay = tokens.ptr + (tokens.ptr[0].kind != Token_EOI);
+        CompileTopLevel(&ctx);
+        CompileStatements(&ctx);
+    }
+    catch (const CompileAbort& abort) {
+        result = ReportCompileAbort(oms, abort, LastTokenLine(&ctx));
+    }
+    if (options->pPeakBytes) {
+        *options->pPeakBytes = budget.PeakBytes();
+    }
+    return result;
+}
+
+CompileResult CompilePrefix(view<const char> source, MessageStream *oms, const CompileOptions *options, CompilePrefixState *pOut)
+{
+    pOut->options = options ? *options : CompileOptions{ };
+    pOut->options.pSpecInfo = &pOut->specInfo;
+    ASSERT(pOut->specInfo.nodes.size() == 0 && pOut->specInfo.deferredAsserts.size() == 0);
+    source = SkipFunctionOpening(source);
+
+    AllocTagScope allocTag(AllocTag_Parser);
+
+    AllocBudgetScope budget(pOut->options.memoryBudgetBytes);
+    Context ctx;
+    CompileAbortScope abortScope;
+    CompileResult result = CompileResult_Ok;
+    try {
+        if (pOut->options.specConstants.length) {
+            memset(ctx.specConstantNodes.uninitialized_push_n(pOut->options.specConstants.length), 0xff,
+                pOut->options.specConstants.length * sizeof(uint32_t));
+        }
+        InitContext(&ctx, oms, &pOut->options, source, 1);
+        if (CompileStatements(&ctx) != Token_EOI) {
+            NotImplemented("prefix closes the function, there is nothing left for a suffix");
+        }
+
+        pOut->specConstantNodes.clear();
+        if (ctx.specConstantNodes.size()) {
+            memcpy(pOut->specConstantNodes.uninitialized_push_n(ctx.specConstantNodes.size()), ctx.specConstantNodes.data(),
+                ctx.specConstantNodes.size() * sizeof(uint32_t));
+        }
+        pOut->lineno = ctx.scanner.lineno;
+    }
+    catch (const CompileAbort& abort) {
+        result = ReportCompileAbort(oms, abort, LastTokenLine(&ctx));
+    }
+    if (pOut->options.pPeakBytes) {
+        *pOut->options.pPeakBytes = budget.PeakBytes();
+    }
+    return result;
+}
+
+CompileResult CompileSuffix(const CompilePrefixState& prefix, view<const char> suffix, MessageStream *oms, SpecializationInfo *pSpecInfo)
+{
+    AllocTagScope allocTag(AllocTag_Parser);
+
+    // Nothing of the prefix is copied: SpecNodes are numbered on from the prefix's, and the spec constant
+    // table is only copied if the suffix uses a constant the prefix never did.
+    // Without one the caller won't Specialize(), so the suffix's nodes and deferred asserts go to a local one.
+    SpecializationInfo localSpecInfo;
+    if (!pSpecInfo) {
+        pSpecInfo = &localSpecInfo;
+    }
+    CompileOptions options = prefix.options;
+    options.pSpecInfo = pSpecInfo;
+    ASSERT(pSpecInfo->nodes.size() == 0 && pSpecInfo->deferredAsserts.size() == 0);
+    pSpecInfo->parent = &prefix.specInfo;
+    pSpecInfo->nodeBase = prefix.specInfo.nodeBase + prefix.specInfo.nodes.size();
+
+    AllocBudgetScope budget(options.memoryBudgetBytes);
+    Context ctx;
+    CompileAbortScope abortScope;
+    CompileResult result = CompileResult_Ok;
+    try {
+        ctx.prefixSpecConstantNodes = { prefix.specConstantNodes.data(), prefix.specConstantNodes.size() };
+        InitContext(&ctx, oms, &options, suffix, prefix.lineno);
+        CompileStatements(&ctx);
+    }
+    catch (const CompileAbort& abort) {
+        result = ReportCompileAbort(oms, abort, LastTokenLine(&ctx));
+    }
+    if (options.pPeakBytes) {
+        *options.pPeakBytes = budget.PeakBytes();
+    }
+    return result;
+}
+
+// The parent chain first, since a suffix's nodes may use the prefix's.
+static void
+EvaluateSpecNodes(const SpecializationInfo& info, view<const int64_t> specValues, uint64_t *v)
+{
+    if (info.parent) {
+        EvaluateSpecNodes(*info.parent, specValues, v);
+    }
+    uint const nNodes = info.nodes.size();
+    const SpecNode *const nodes = info.nodes.data();
+
+    // Same kernels as compile-time folding, so the results can't differ:
+    for (uint j = 0; j < nNodes; ++j) {
+        uint const i = info.nodeBase + j;
+        const SpecNode& node = nodes[j];
+        switch (node.kind) {
+        case SpecNode_Literal:
+            v[i] = uint64_t(node.value);
+            break;
+        case SpecNode_Constant:
+            v[i] = uint64_t(node.specId < specValues.length ? specValues.ptr[node.specId] : node.value);
+            break;
+        case SpecNode_Op: {
+            uint64_t lanes[3][ImmLanes];
+            for (uint k = 0; k < node.nOperands; ++k) {
+                ASSERT(node.operands[k] < i);
+                for (uint l = 0; l < ImmLanes; ++l) lanes[k][l] = v[node.operands[k]];
+            }
+            TypelessOp const op = TypelessOp(node.op);
+            if (op == TypelessOp_TernarySelect) {
+                SelectLanes(lanes[0], lanes[1], lanes[2]);
+            }
+            else if (IsUnary(op)) {
+                FoldUnaryLanes(op, lanes[0]);
+            }
+            else {
+                FoldBinaryLanes(op, lanes[0], lanes[1], node.bUnsigned);
+            }
+            v[i] = lanes[0][0];
+        } break;
+        }
+    }
+}
+
+static void
+CheckDeferredAsserts(const SpecializationInfo& info, const uint64_t *v, MessageStream *oms)
+{
+    if (info.parent) {
+        CheckDeferredAsserts(*info.parent, v, oms);
+    }
+    for (const DeferredStaticAssert& d : info.deferredAsserts) {
+        if (v[d.node] == 0) {
+            Message *m = oms->PushRaw();
+            *m = { };
+            m->line = d.line;
+            m->type = Message_StaticAssertFailed;
+        }
+    }
+}
+
+void
+Specialize(const SpecializationInfo& info, view<const int64_t> specValues, MessageStream *oms)
+{
+    Array<uint64_t> values;
+    uint64_t *const v = values.uninitialized_push_n(info.nodeBase + info.nodes.size());
+    EvaluateSpecNodes(info, specValues, v);
+    CheckDeferredAsserts(info, v, oms);
+}
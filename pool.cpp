@@ -0,0 +1,83 @@
+#include "pool.h"
+
+#if defined __linux__
+#include <sys/mman.h>
+#endif
+
+// Charged to tag like an allocation, and checked against the budget, before it is mapped.
+static char *
+MapHugePageChunk(AllocTag tag)
+{
+#if defined __linux__
+    AllocTagScope allocTag(tag);
+    ChargeMappedBytes(PoolChunkBytes);
+
+    // Explicit hugetlbfs pages first; these need reserved pages (vm.nr_hugepages), so often fail.
+    void *m = mmap(nullptr, PoolChunkBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (m != MAP_FAILED) {
+        return static_cast<char *>(m);
+    }
+
+    // Else a 2 MB aligned normal mapping with a transparent huge page hint: over-map and trim.
+    char *const raw = static_cast<char *>(mmap(nullptr, 2 * PoolChunkBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (raw == MAP_FAILED) {
+        UnchargeMappedBytes(PoolChunkBytes, tag);
+        OutOfMemory("mmap");
+    }
+    uintptr_t const aligned = (uintptr_t(raw) + PoolChunkBytes - 1) & ~uintptr_t(PoolChunkBytes - 1);
+    char *const pChunk = reinterpret_cast<char *>(aligned);
+    if (pChunk != raw) {
+        munmap(raw, pChunk - raw);
+    }
+    munmap(pChunk + PoolChunkBytes, (raw + 2 * PoolChunkBytes) - (pChunk + PoolChunkBytes));
+    madvise(pChunk, PoolChunkBytes, MADV_HUGEPAGE);
+    return pChunk;
+#else
+    AllocTagScope allocTag(tag);
+    return static_cast<char *>(AllocateBytes(PoolChunkBytes));
+#endif
+}
+
+static void
+UnmapHugePageChunk(char *pChunk, AllocTag tag)
+{
+#if defined __linux__
+    munmap(pChunk, PoolChunkBytes);
+    UnchargeMappedBytes(PoolChunkBytes, tag);
+#else
+    (void)tag;
+    Deallocate(pChunk);
+#endif
+}
+
+void
+VoidPool_AddChunk(VoidPool *pool)
+{
+    if (pool->nChunks == pool->capChunks) {
+        pool->capChunks = Max<uint32_t>(8, pool->capChunks * 2);
+        pool->chunks = Reallocate<char *>(pool->chunks, pool->capChunks);
+    }
+
+    if (pool->nChunks == 0) {
+        pool->chunkTag = GetAllocTag();
+    }
+    char *const pChunk = (pool->flags & PoolFlag_HugePages)
+        ? MapHugePageChunk(pool->chunkTag)
+        : static_cast<char *>(AllocateBytes(PoolChunkBytes));
+    pool->chunks[pool->nChunks++] = pChunk;
+}
+
+void
+VoidPool_Destroy(VoidPool *pool)
+{
+    for (uint32_t i = 0; i < pool->nChunks; ++i) {
+        if (pool->flags & PoolFlag_HugePages) {
+            UnmapHugePageChunk(pool->chunks[i], pool->chunkTag);
+        }
+        else {
+            Deallocate(pool->chunks[i]);
+        }
+    }
+    Deallocate(pool->chunks);
+    *pool = { };
+}
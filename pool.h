@@ -0,0 +1,102 @@
+#pragma once
+
+#include "common.h"
+
+#include "default_alloc.h"
+
+/*
+ * Fixed-size node pools. Nodes are named by 32-bit PoolIndex instead of pointers, which halves
+ * the size of references between nodes and keeps them valid across chunk additions.
+ *
+ * A pool belongs to one thread, so its freelist is that thread's freelist and nothing is locked.
+ * Freeing a node through a different pool than it came from is illegal.
+ */
+enum PoolIndex : uint32_t { NullPoolIndex };
+
+typedef uint8_t PoolFlags;
+enum : PoolFlags {
+    PoolFlag_HugePages = 1u << 0, // map chunks straight from the OS with 2 MB pages where it allows, else normal pages
+};
+
+enum : uint32_t {
+    PoolChunkBytesLog2 = 21, // 2 MB, one huge page on x86-64
+    PoolChunkBytes = 1u << PoolChunkBytesLog2,
+};
+
+// The non-templated part, same idea as VoidArray.
+struct VoidPool {
+    char **chunks;
+    uint32_t nChunks;
+    uint32_t capChunks;
+    uint32_t freeHead;  // most recently freed index, 0 if none
+    uint32_t nextFresh; // next never-handed-out index
+    PoolFlags flags;
+    AllocTag chunkTag; // with PoolFlag_HugePages, what the mapped chunks are charged to: the tag of the first one's
+};
+
+void VoidPool_AddChunk(VoidPool *pool);
+void VoidPool_Destroy(VoidPool *pool);
+
+constexpr uint PoolSlotsLog2(uint sizeOfT)
+{
+    uint log2 = 0;
+    while ((2u << log2) * sizeOfT <= PoolChunkBytes) {
+        log2 += 1;
+    }
+    return log2;
+}
+
+template<class T>
+class Pool {
+    static_assert(__is_trivial(T), "T must be trivial");
+    static_assert(sizeof(T) >= sizeof(uint32_t), "free nodes hold the next free index");
+
+    enum : uint32_t {
+        SlotsLog2 = PoolSlotsLog2(sizeof(T)),
+        SlotMask = (1u << SlotsLog2) - 1,
+    };
+
+    VoidPool p;
+
+public:
+    explicit Pool(PoolFlags flags = 0) : p{ } {
+        p.flags = flags;
+        p.nextFresh = 1; // index 0 stays null
+    }
+    ~Pool() {
+        VoidPool_Destroy(&p);
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    T *get(PoolIndex i) const
+    {
+        ASSERT(i != NullPoolIndex && i < p.nextFresh);
+        return reinterpret_cast<T *>(p.chunks[i >> SlotsLog2]) + (i & SlotMask);
+    }
+    T& operator[](PoolIndex i) const { return *get(i); }
+
+    PoolIndex alloc() // contents are uninitialized
+    {
+        uint32_t i = p.freeHead;
+        if (i) {
+            p.freeHead = *reinterpret_cast<uint32_t *>(get(PoolIndex(i)));
+            return PoolIndex(i);
+        }
+        i = p.nextFresh;
+        if ((i >> SlotsLog2) == p.nChunks) { // unlikely
+            VoidPool_AddChunk(&p);
+        }
+        p.nextFresh = i + 1;
+        return PoolIndex(i);
+    }
+
+    void free(PoolIndex i)
+    {
+        *reinterpret_cast<uint32_t *>(get(i)) = p.freeHead;
+        p.freeHead = i;
+    }
+
+    uint32_t high_water() const { return p.nextFresh - 1; } // nodes ever handed out, not counting reuse
+};
@@ -0,0 +1,1113 @@
+#include "common.h"
+
+#include "preprocess.h"
+#include "message.h"
+#include "default_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <mutex>
+
+#if defined __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+enum { MaxIncludeDepth = 200, MaxPathLength = 4096 };
+
+/*
+    One header as read from disk. Never changed once in the cache; when the file changes on disk a new entry replaces
+    it, and the old one is kept until ClearIncludeCache() since earlier output may still point into its text.
+**/
+struct CachedFile {
+    char *path;
+    uint64_t pathHash;
+    int64_t mtime; // seconds, so a same-second edit is only caught by a size change
+    uint64_t size;
+    char *text; // size + 1, with the '\0' the scanner needs
+    Token *tokens; // scanned with ScanFeatures_Full, ends with Token_EOI
+    uint nTokens;
+
+    const ubyte *guardName; // whole file is inside #ifndef guardName/#define guardName, or null
+    uint8_t guardLength;
+    bool bPragmaOnce;
+};
+
+static struct IncludeCache {
+    std::mutex mutex;
+    Array<CachedFile *> files;
+    Array<CachedFile *> retired;
+    IncludeCacheStats stats;
+} g_includeCache;
+
+static uint64_t
+HashBytes(const void *p, size_t n) // FNV-1a
+{
+    uint64_t h = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ static_cast<const ubyte *>(p)[i]) * 0x100000001b3u;
+    }
+    return h;
+}
+
+// Keywords too, since "#if" and "#else" are spelled with them.
+static bool
+NameIs(const Token& t, view<const char> s)
+{
+    return (t.kind == Token_Name || (t.kind >= Token_Kw_static_assert && t.kind <= Token_Kw_continue)) && t.nameLength == s.length && memcmp(t.data.nameBegin, s.ptr, s.length) == 0;
+}
+
+// Index past the last token on the same line as toks[i].
+static uint
+LineEnd(const Token *toks, uint i)
+{
+    int32_t const line = toks[i].lineno;
+    while (toks[i].kind != Token_EOI && toks[i].lineno == line) {
+        ++i;
+    }
+    return i;
+}
+
+static bool
+IsDirectiveStart(const Token *toks, uint i)
+{
+    return toks[i].kind == Token_Hash && (i == 0 || toks[i - 1].lineno != toks[i].lineno);
+}
+
+static bool
+IsConditionalOpen(const Token& t)
+{
+    return NameIs(t, "if"_view) || NameIs(t, "ifdef"_view) || NameIs(t, "ifndef"_view);
+}
+
+// #pragma once outside any conditional, or "#ifndef X" "#define X" first and the matching #endif last.
+static void
+DetectIncludeGuard(CachedFile *f)
+{
+    const Token *const toks = f->tokens;
+    uint depth = 0;
+    bool bGuardOpen = false, bGuardClosed = false, bOnlyGuard = true;
+    for (uint i = 0; toks[i].kind != Token_EOI;) {
+        uint const end = LineEnd(toks, i);
+        if (bGuardClosed) {
+            bOnlyGuard = false; // something after the guard's #endif
+        }
+        if (!IsDirectiveStart(toks, i) || end == i + 1) {
+            bOnlyGuard &= depth > 0;
+            i = end;
+            continue;
+        }
+        const Token& d = toks[i + 1];
+        if (i == 0 && NameIs(d, "ifndef"_view) && end == i + 3 && toks[i + 2].kind == Token_Name &&
+            IsDirectiveStart(toks, end) && end + 3 == LineEnd(toks, end) &&
+            NameIs(toks[end + 1], "define"_view) && toks[end + 2].kind == Token_Name &&
+            toks[end + 2].nameLength == toks[i + 2].nameLength &&
+            memcmp(toks[end + 2].data.nameBegin, toks[i + 2].data.nameBegin, toks[i + 2].nameLength) == 0) {
+            f->guardName = toks[i + 2].data.nameBegin;
+            f->guardLength = toks[i + 2].nameLength;
+            bGuardOpen = true;
+        }
+        if (IsConditionalOpen(d)) {
+            depth += 1;
+        }
+        else if (NameIs(d, "endif"_view) && depth) {
+            depth -= 1;
+            bGuardClosed = bGuardOpen && depth == 0;
+        }
+        else if (NameIs(d, "pragma"_view) && end > i + 2 && NameIs(toks[i + 2], "once"_view) && depth == 0) {
+            f->bPragmaOnce = true;
+        }
+        else {
+            bOnlyGuard &= depth > 0;
+        }
+        i = end;
+    }
+    if (!(bGuardClosed && bOnlyGuard)) {
+        f->guardName = nullptr;
+        f->guardLength = 0;
+    }
+}
+
+static void
+ScanAll(view<const char> text, Array<Token> *pTokens)
+{
+    Scanner scanner;
+    Scanner_Init(&scanner, text);
+    do {
+        Scanner_NextTokenRaw(&scanner, pTokens->uninitialized_push());
+    } while (pTokens->end()[-1].kind != Token_EOI);
+}
+
+static CachedFile *
+LoadFile(const char *path, uint64_t pathHash, const struct stat& st)
+{
+    FILE *const fp = fopen(path, "rb");
+    if (!fp) {
+        return nullptr;
+    }
+    AllocTagScope allocTag(AllocTag_Lexer);
+    CachedFile *const f = AllocateZeroed<CachedFile>(1);
+    size_t const pathLength = strlen(path);
+    f->path = Allocate<char>(pathLength + 1);
+    memcpy(f->path, path, pathLength + 1);
+    f->pathHash = pathHash;
+    f->mtime = int64_t(st.st_mtime);
+    f->size = uint64_t(st.st_size);
+    f->text = Allocate<char>(f->size + 1);
+    f->size = fread(f->text, 1, f->size, fp); // may have changed since the stat
+    f->text[f->size] = '\0';
+    fclose(fp);
+
+    Array<Token> tokens;
+    ScanAll({ f->text, uint(f->size) }, &tokens);
+    f->nTokens = tokens.size();
+    f->tokens = Allocate<Token>(f->nTokens);
+    memcpy(f->tokens, tokens.data(), f->nTokens * sizeof(Token));
+
+    DetectIncludeGuard(f);
+    return f;
+}
+
+static void
+FreeCachedFile(CachedFile *f)
+{
+    Deallocate(f->path);
+    Deallocate(f->text);
+    Deallocate(f->tokens);
+    Deallocate(f);
+}
+
+// With cache->mutex held; the slot is only good until it's released.
+static CachedFile **
+FindCachedFile(IncludeCache *cache, const char *path, uint64_t pathHash)
+{
+    for (CachedFile *&e : cache->files) {
+        if (e->pathHash == pathHash && strcmp(e->path, path) == 0) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+static bool
+IsCurrent(const CachedFile *f, const struct stat& st)
+{
+    return f->mtime == int64_t(st.st_mtime) && f->size == uint64_t(st.st_size);
+}
+
+IncludeCacheStats GetIncludeCacheStats()
+{
+    std::lock_guard<std::mutex> lock(g_includeCache.mutex);
+    return g_includeCache.stats;
+}
+
+void ClearIncludeCache()
+{
+    std::lock_guard<std::mutex> lock(g_includeCache.mutex);
+    for (CachedFile *f : g_includeCache.files) {
+        FreeCachedFile(f);
+    }
+    for (CachedFile *f : g_includeCache.retired) {
+        FreeCachedFile(f);
+    }
+    g_includeCache.files.clear();
+    g_includeCache.retired.clear();
+}
+
+
+/*
+    Precompiled module layout. Every reference is an index or an offset from the start of the file, so a module is
+    used wherever it is mapped, and nothing in it is written after that. Sections are 8-byte aligned.
+**/
+enum : uint32_t { ModuleMagic = 0x4d434b56 /* "VKCM" */, ModuleVersion = 5 }; // 2: TokenKind values changed, 3: keywords added, 4: brackets, 5: file sizes
+
+struct PrecompiledModule {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fileBytes;
+    uint32_t nMacros, macrosOffset;       // ModuleMacro[]
+    uint32_t tableSize, tableOffset;      // uint32_t[], hashed like Preprocessor::macroTable
+    uint32_t nTokens, tokensOffset;       // ModuleToken[]: the macros' replacement lists, then the output tokens
+    uint32_t firstOutputToken;
+    uint32_t nFiles, filesOffset;         // ModuleFile[]
+    uint32_t stringsBytes, stringsOffset;
+};
+
+// A header the module's source included, so later includes of it can be skipped without going to disk.
+struct ModuleFile {
+    uint32_t pathOffset; // '\0'-terminated
+    uint32_t guardOffset;
+    uint32_t guardLength; // 0 if no whole-file guard
+    uint32_t bPragmaOnce;
+    uint32_t size; // bytes, for IncludeCacheStats::bytesSaved when skipped
+};
+
+struct ModuleMacro {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t firstToken;
+    uint32_t nTokens;
+};
+
+// A Token with its name pointer as a string offset.
+struct ModuleToken {
+    TokenKind kind;
+    BuiltinTypeKind numberLiteralBuiltinType;
+    bool bNumberLiteralUnsigned;
+    uint8_t nameLength;
+    int32_t lineno;
+    uint64_t payload; // data.numberRawU64, or the name's string offset
+};
+
+template<class T>
+static const T *
+ModuleSection(const PrecompiledModule *mod, uint32_t offset)
+{
+    return reinterpret_cast<const T *>(reinterpret_cast<const char *>(mod) + offset);
+}
+
+static bool
+HasNamePayload(TokenKind k)
+{
+    return k == Token_Name || k == Token_DotName || k == Token_StringLiteral;
+}
+
+static Token
+ModuleTokenAt(const PrecompiledModule *mod, uint32_t i)
+{
+    const ModuleToken& mt = ModuleSection<ModuleToken>(mod, mod->tokensOffset)[i];
+    Token t = { };
+    t.kind = mt.kind;
+    t.numberLiteralBuiltinType = mt.numberLiteralBuiltinType;
+    t.bNumberLiteralUnsigned = mt.bNumberLiteralUnsigned;
+    t.nameLength = mt.nameLength;
+    t.lineno = mt.lineno;
+    if (HasNamePayload(mt.kind)) {
+        t.data.nameBegin = ModuleSection<ubyte>(mod, mod->stringsOffset) + mt.payload;
+    }
+    else {
+        t.data.numberRawU64 = mt.payload;
+    }
+    return t;
+}
+
+static const ModuleMacro *
+ModuleFindMacro(const PrecompiledModule *mod, const ubyte *name, uint nameLength)
+{
+    const uint32_t *const table = ModuleSection<uint32_t>(mod, mod->tableOffset);
+    const ModuleMacro *const macros = ModuleSection<ModuleMacro>(mod, mod->macrosOffset);
+    const ubyte *const strings = ModuleSection<ubyte>(mod, mod->stringsOffset);
+    uint const mask = mod->tableSize - 1;
+    for (uint h = uint(HashBytes(name, nameLength)) & mask;; h = (h + 1) & mask) {
+        if (table[h] == 0) {
+            return nullptr;
+        }
+        const ModuleMacro& m = macros[table[h] - 1];
+        if (m.nameLength == nameLength && memcmp(strings + m.nameOffset, name, nameLength) == 0) {
+            return &m;
+        }
+    }
+}
+
+
+struct Macro {
+    const ubyte *name;
+    uint8_t nameLength;
+    bool bDefined; // #undef leaves the entry, so a later #define reuses it, and it hides the module's
+    bool bExpanding; // a macro is not expanded inside its own expansion
+    uint32_t firstToken; // in Preprocessor::macroTokens
+    uint32_t nTokens;
+};
+
+struct Conditional {
+    bool bParentActive;
+    bool bTaken; // some branch of this #if chain was active
+    bool bElseSeen;
+};
+
+struct Preprocessor {
+    MessageStream *oms;
+    const PreprocessOptions *options;
+    Array<Token> *pOut;
+
+    Array<Macro> macros;
+    Array<uint32_t> macroTable; // open addressing on the name's hash: index into macros + 1, 0 if empty
+    Array<Token> macroTokens;
+    Array<const CachedFile *> onceIncluded;
+    Array<const CachedFile *> included; // only kept if bKeepIncluded, by WritePrecompiledModule()
+    bool bKeepIncluded;
+    uint includeDepth;
+
+    const PrecompiledModule *module; // its macros are looked up in place, under the ones above
+    SmallArray<const ModuleMacro *, 16> expandingModuleMacros; // the module is read-only, so no bExpanding there
+};
+
+static uint32_t *
+FindMacroSlot(Preprocessor *pp, const ubyte *name, uint nameLength)
+{
+    uint const mask = pp->macroTable.size() - 1;
+    for (uint h = uint(HashBytes(name, nameLength)) & mask;; h = (h + 1) & mask) {
+        uint32_t *const slot = &pp->macroTable[h];
+        if (*slot == 0) {
+            return slot;
+        }
+        const Macro& m = pp->macros[*slot - 1];
+        if (m.nameLength == nameLength && memcmp(m.name, name, nameLength) == 0) {
+            return slot;
+        }
+    }
+}
+
+// The entry for name, defined or not, if this preprocessor has seen it.
+static Macro *
+FindLocalMacro(Preprocessor *pp, const ubyte *name, uint nameLength)
+{
+    if (pp->macroTable.is_empty()) {
+        return nullptr;
+    }
+    uint32_t const i = *FindMacroSlot(pp, name, nameLength);
+    return i ? &pp->macros[i - 1] : nullptr;
+}
+
+static bool
+IsDefined(Preprocessor *pp, const ubyte *name, uint nameLength)
+{
+    if (const Macro *m = FindLocalMacro(pp, name, nameLength)) {
+        return m->bDefined;
+    }
+    return pp->module && ModuleFindMacro(pp->module, name, nameLength);
+}
+
+// New entries start out undefined.
+static Macro *
+AddLocalMacro(Preprocessor *pp, const ubyte *name, uint nameLength)
+{
+    // Keep the table at most half full:
+    if (pp->macroTable.size() < 2 * (pp->macros.size() + 1)) {
+        uint const newSize = pp->macroTable.size() ? 2 * pp->macroTable.size() : 64;
+        pp->macroTable.clear();
+        memset(pp->macroTable.uninitialized_push_n(newSize), 0, newSize * sizeof(uint32_t));
+        for (uint i = 0; i < pp->macros.size(); ++i) {
+            *FindMacroSlot(pp, pp->macros[i].name, pp->macros[i].nameLength) = i + 1;
+        }
+    }
+    uint32_t *const slot = FindMacroSlot(pp, name, nameLength);
+    if (*slot == 0) {
+        pp->macros.push({ name, uint8_t(nameLength), false, false, 0, 0 });
+        *slot = pp->macros.size();
+    }
+    return &pp->macros[*slot - 1];
+}
+
+static void
+DefineMacro(Preprocessor *pp, const Token *toks, uint n)
+{
+    if (n == 0 || toks[0].kind != Token_Name) {
+        NotImplemented("#define without a name");
+    }
+    if (toks[0].data.nameBegin[toks[0].nameLength] == '(') {
+        NotImplemented("function-like macros");
+    }
+    Macro *const m = AddLocalMacro(pp, toks[0].data.nameBegin, toks[0].nameLength);
+    m->bDefined = true;
+    m->firstToken = pp->macroTokens.size();
+    m->nTokens = n - 1;
+    pp->macroTokens.push_n(toks + 1, n - 1);
+}
+
+// Appends t, or what it expands to, as if it were on line lineno.
+static void
+ExpandToken(Preprocessor *pp, const Token& t, int32_t lineno, Array<Token> *out)
+{
+    if (t.kind == Token_Name) {
+        if (Macro *const m = FindLocalMacro(pp, t.data.nameBegin, t.nameLength)) {
+            if (m->bDefined && !m->bExpanding) {
+                m->bExpanding = true;
+                uint32_t const first = m->firstToken, n = m->nTokens;
+                for (uint32_t i = 0; i < n; ++i) {
+                    ExpandToken(pp, pp->macroTokens[first + i], lineno, out);
+                }
+                m->bExpanding = false; // macros can't be defined while expanding, so m hasn't moved
+                return;
+            }
+        }
+        else if (pp->module) {
+            const ModuleMacro *const mm = ModuleFindMacro(pp->module, t.data.nameBegin, t.nameLength);
+            bool bExpanding = false;
+            for (const ModuleMacro *e : pp->expandingModuleMacros) {
+                bExpanding |= e == mm;
+            }
+            if (mm && !bExpanding) {
+                pp->expandingModuleMacros.push(mm);
+                for (uint32_t i = 0; i < mm->nTokens; ++i) {
+                    ExpandToken(pp, ModuleTokenAt(pp->module, mm->firstToken + i), lineno, out);
+                }
+                pp->expandingModuleMacros.pop();
+                return;
+            }
+        }
+    }
+    Token *const o = out->uninitialized_push();
+    *o = t;
+    o->lineno = lineno;
+}
+
+
+/*
+    #if expressions, with the operators the scanner has. Names left after expansion are 0, as in C.
+    Evaluated in int64_t with wrapping arithmetic.
+**/
+struct IfExpr {
+    const Token *p;
+    const Token *end;
+};
+
+static int
+IfBinaryPrec(TokenKind k)
+{
+    switch (k) {
+    case Token_Mul: case Token_Div: case Token_Mod: return 10;
+    case Token_Plus: case Token_Minus: return 9;
+    case Token_LeftShift: case Token_RightShift: return 8;
+    case Token_LessThan: case Token_GreaterThan: case Token_LessEq: case Token_GreaterEq: return 7;
+    case Token_CmpEqual: case Token_CmpNotEq: return 6;
+    case Token_Amp: return 5;
+    case Token_Caret: return 4;
+    case Token_VBar: return 3;
+    case Token_LogicAnd: return 2;
+    case Token_LogicOr: return 1;
+    default: return 0;
+    }
+}
+
+static int64_t EvalIfExpr(IfExpr *e, int minPrec);
+
+static int64_t
+EvalIfPrimary(IfExpr *e)
+{
+    if (e->p == e->end) {
+        NotImplemented("#if expression ends early");
+    }
+    const Token& t = *e->p++;
+    switch (t.kind) {
+    case Token_NumberLiteral: return int64_t(t.data.numberRawU64);
+    case Token_Name: case Token_Kw_void: case Token_Kw_char: case Token_Kw_bool: case Token_Kw_short:
+    case Token_Kw_int: case Token_Kw_long: case Token_Kw_half: case Token_Kw_float: case Token_Kw_double:
+    case Token_Kw_constexpr: case Token_Kw_return: case Token_Kw_if: case Token_Kw_else: case Token_Kw_for:
+    case Token_Kw_while: case Token_Kw_break: case Token_Kw_continue:
+        return 0;
+    case Token_UnaryLogicalNot: return !EvalIfPrimary(e);
+    case Token_UnaryBitwiseNot: return ~EvalIfPrimary(e);
+    case Token_Minus: return int64_t(0 - uint64_t(EvalIfPrimary(e)));
+    case Token_Plus: return EvalIfPrimary(e);
+    case Token_OpenParen: {
+        int64_t const v = EvalIfExpr(e, 0);
+        if (e->p == e->end || e->p->kind != Token_CloseParen) {
+            NotImplemented("#if expression missing ')'");
+        }
+        e->p++;
+        return v;
+    }
+    default:
+        NotImplemented("unexpected token in #if expression");
+    }
+}
+
+static int64_t
+EvalIfExpr(IfExpr *e, int minPrec)
+{
+    int64_t lhs = EvalIfPrimary(e);
+    for (;;) {
+        if (e->p == e->end) {
+            return lhs;
+        }
+        TokenKind const k = e->p->kind;
+        if (k == Token_Question && minPrec == 0) {
+            e->p++;
+            int64_t const a = EvalIfExpr(e, 0);
+            if (e->p == e->end || e->p->kind != Token_Colon) {
+                NotImplemented("#if expression missing ':'");
+            }
+            e->p++;
+            int64_t const b = EvalIfExpr(e, 0);
+            lhs = lhs ? a : b;
+            continue;
+        }
+        int const prec = IfBinaryPrec(k);
+        if (prec == 0 || prec <= minPrec) {
+            return lhs;
+        }
+        e->p++;
+        int64_t const rhs = EvalIfExpr(e, prec); // all left associative
+        uint64_t const a = uint64_t(lhs), b = uint64_t(rhs);
+        if ((k == Token_Div || k == Token_Mod) && rhs == 0) {
+            NotImplemented("division by zero in #if");
+        }
+        switch (k) {
+        case Token_Mul:         lhs = int64_t(a * b); break;
+        case Token_Div:         lhs = rhs == -1 ? int64_t(0 - a) : lhs / rhs; break;
+        case Token_Mod:         lhs = rhs == -1 ? 0 : lhs % rhs; break;
+        case Token_Plus:        lhs = int64_t(a + b); break;
+        case Token_Minus:       lhs = int64_t(a - b); break;
+        case Token_LeftShift:   lhs = int64_t(a << (b & 63)); break;
+        case Token_RightShift:  lhs = lhs >> (b & 63); break;
+        case Token_LessThan:    lhs = lhs < rhs; break;
+        case Token_GreaterThan: lhs = lhs > rhs; break;
+        case Token_LessEq:      lhs = lhs <= rhs; break;
+        case Token_GreaterEq:   lhs = lhs >= rhs; break;
+        case Token_CmpEqual:    lhs = lhs == rhs; break;
+        case Token_CmpNotEq:    lhs = lhs != rhs; break;
+        case Token_Amp:         lhs = int64_t(a & b); break;
+        case Token_Caret:       lhs = int64_t(a ^ b); break;
+        case Token_VBar:        lhs = int64_t(a | b); break;
+        case Token_LogicAnd:    lhs = lhs && rhs; break;
+        case Token_LogicOr:     lhs = lhs || rhs; break;
+        default: unreachable;
+        }
+    }
+}
+
+// defined X and defined(X) first, since their operand must not be expanded, then everything else is.
+static bool
+EvalIfCondition(Preprocessor *pp, const Token *toks, uint n)
+{
+    Array<Token> expanded;
+    for (uint i = 0; i < n; ++i) {
+        if (NameIs(toks[i], "defined"_view)) {
+            bool const bParen = i + 1 < n && toks[i + 1].kind == Token_OpenParen;
+            uint const iName = i + 1 + bParen;
+            if (iName >= n || toks[iName].kind != Token_Name || (bParen && (iName + 1 >= n || toks[iName + 1].kind != Token_CloseParen))) {
+                NotImplemented("malformed defined()");
+            }
+            Token *const t = expanded.uninitialized_push();
+            *t = { };
+            t->kind = Token_NumberLiteral;
+            t->data.numberRawU64 = IsDefined(pp, toks[iName].data.nameBegin, toks[iName].nameLength);
+            i = iName + bParen;
+            continue;
+        }
+        ExpandToken(pp, toks[i], toks[i].lineno, &expanded);
+    }
+    IfExpr e = { expanded.data(), expanded.end() };
+    int64_t const v = EvalIfExpr(&e, 0);
+    if (e.p != e.end) {
+        NotImplemented("trailing tokens in #if expression");
+    }
+    return v != 0;
+}
+
+
+static void PreprocessTokens(Preprocessor *pp, const Token *toks, const char *path);
+
+// Length of the directory part of path, including the last '/'.
+static uint
+DirectoryLength(const char *path)
+{
+    const char *const slash = path ? strrchr(path, '/') : nullptr;
+    return slash ? uint(slash - path + 1) : 0;
+}
+
+static bool
+MakePath(char (&buf)[MaxPathLength], const char *dir, uint dirLength, const Token& name)
+{
+    if (dirLength + name.nameLength + 1 > MaxPathLength) {
+        return false;
+    }
+    memcpy(buf, dir, dirLength);
+    memcpy(buf + dirLength, name.data.nameBegin, name.nameLength);
+    buf[dirLength + name.nameLength] = '\0';
+    return true;
+}
+
+// Looks in the cache, then on disk. Returns false if there is no such file.
+static bool
+IncludeFile(Preprocessor *pp, const char *path)
+{
+    if (pp->module) {
+        const ModuleFile *const files = ModuleSection<ModuleFile>(pp->module, pp->module->filesOffset);
+        const ubyte *const strings = ModuleSection<ubyte>(pp->module, pp->module->stringsOffset);
+        for (uint i = 0; i < pp->module->nFiles; ++i) {
+            const ModuleFile& mf = files[i];
+            if (strcmp(reinterpret_cast<const char *>(strings + mf.pathOffset), path) == 0 &&
+                (mf.bPragmaOnce || (mf.guardLength && IsDefined(pp, strings + mf.guardOffset, mf.guardLength)))) {
+                std::lock_guard<std::mutex> lock(g_includeCache.mutex);
+                g_includeCache.stats.nSkipped += 1;
+                g_includeCache.stats.bytesSaved += mf.size;
+                return true;
+            }
+        }
+    }
+
+    // The lock is held only to look at and update the table, not across stat() and loading.
+    uint64_t const pathHash = HashBytes(path, strlen(path));
+    CachedFile *cached = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(g_includeCache.mutex);
+        IncludeCache& cache = g_includeCache;
+        CachedFile **const ppEntry = FindCachedFile(&cache, path, pathHash);
+        if (ppEntry) {
+            cached = *ppEntry;
+            bool bSkip = cached->guardName && IsDefined(pp, cached->guardName, cached->guardLength);
+            for (const CachedFile *once : pp->onceIncluded) {
+                bSkip |= once == cached;
+            }
+
+            if (bSkip) {
+                cache.stats.nSkipped += 1;
+                cache.stats.bytesSaved += cached->size;
+                return true;
+            }
+        }
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    const CachedFile *f = nullptr;
+    if (cached && IsCurrent(cached, st)) {
+        std::lock_guard<std::mutex> lock(g_includeCache.mutex);
+        g_includeCache.stats.nHits += 1;
+        g_includeCache.stats.bytesSaved += cached->size;
+        f = cached;
+    }
+    else {
+        CachedFile *const loaded = LoadFile(path, pathHash, st);
+        if (!loaded) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(g_includeCache.mutex);
+        IncludeCache& cache = g_includeCache;
+        cache.stats.nMisses += 1;
+        CachedFile **const ppEntry = FindCachedFile(&cache, path, pathHash); // again, the table may have grown
+        if (ppEntry && *ppEntry != cached && IsCurrent(*ppEntry, st)) { // another thread loaded it meanwhile
+            FreeCachedFile(loaded);
+            f = *ppEntry;
+        }
+        else {
+            if (ppEntry) {
+                cache.retired.push(*ppEntry);
+                *ppEntry = loaded;
+            }
+            else {
+                cache.files.push(loaded);
+            }
+            f = loaded;
+        }
+    }
+
+    // Entries never change, so no lock needed from here.
+    if (f->bPragmaOnce) {
+        pp->onceIncluded.push(f);
+    }
+    if (pp->bKeepIncluded) {
+        pp->included.push(f);
+    }
+    if (++pp->includeDepth > MaxIncludeDepth) {
+        NotImplemented("#include nested too deeply");
+    }
+    PreprocessTokens(pp, f->tokens, f->path);
+    pp->includeDepth -= 1;
+    return true;
+}
+
+static void
+Include(Preprocessor *pp, const Token *toks, uint n, const char *includerPath, int32_t lineno)
+{
+    if (n == 0 || toks[0].kind == Token_LessThan) {
+        NotImplemented("#include <...>, only \"...\" so far");
+    }
+    if (n != 1 || toks[0].kind != Token_StringLiteral) {
+        NotImplemented("malformed #include");
+    }
+    const Token& name = toks[0];
+    char path[MaxPathLength];
+    bool bFound = false;
+    if (name.nameLength && name.data.nameBegin[0] == '/') {
+        bFound = MakePath(path, "", 0, name) && IncludeFile(pp, path);
+    }
+    else {
+        bFound = MakePath(path, includerPath, DirectoryLength(includerPath), name) && IncludeFile(pp, path);
+        for (uint i = 0; !bFound && i < pp->options->includeDirs.length; ++i) {
+            const char *const dir = pp->options->includeDirs.ptr[i];
+            uint const dirLength = uint(strlen(dir));
+            if (dirLength == 0 || dirLength + 1 >= MaxPathLength) {
+                continue;
+            }
+            char dirSlash[MaxPathLength];
+            memcpy(dirSlash, dir, dirLength);
+            dirSlash[dirLength] = '/';
+            bFound = MakePath(path, dirSlash, dirLength + (dir[dirLength - 1] != '/'), name) && IncludeFile(pp, path);
+        }
+    }
+    if (!bFound) {
+        Message *m = pp->oms->PushRaw();
+        *m = { };
+        m->line = lineno;
+        m->type = Message_IncludeNotFound;
+    }
+}
+
+static void
+PreprocessTokens(Preprocessor *pp, const Token *toks, const char *path)
+{
+    SmallArray<Conditional, 16> conds;
+    bool bActive = true;
+
+    for (uint i = 0; toks[i].kind != Token_EOI;) {
+        if (!IsDirectiveStart(toks, i)) {
+            if (bActive) {
+                ExpandToken(pp, toks[i], toks[i].lineno, pp->pOut);
+            }
+            ++i;
+            continue;
+        }
+
+        uint const end = LineEnd(toks, i);
+        if (end == i + 1) {
+            i = end; // a lone '#'
+            continue;
+        }
+        int32_t const lineno = toks[i].lineno;
+        const Token& d = toks[i + 1];
+        const Token *const args = &toks[i + 2];
+        uint const nArgs = end - (i + 2);
+        i = end;
+
+        // Conditionals are tracked even in inactive regions, everything else only matters in active ones:
+        if (IsConditionalOpen(d)) {
+            Conditional c = { bActive, false, false };
+            if (bActive) {
+                if (NameIs(d, "if"_view)) {
+                    bActive = EvalIfCondition(pp, args, nArgs);
+                }
+                else {
+                    if (nArgs != 1 || args[0].kind != Token_Name) {
+                        NotImplemented("malformed #ifdef/#ifndef");
+                    }
+                    bActive = IsDefined(pp, args[0].data.nameBegin, args[0].nameLength) == NameIs(d, "ifdef"_view);
+                }
+                c.bTaken = bActive;
+            }
+            conds.push(c);
+        }
+        else if (NameIs(d, "elif"_view) || NameIs(d, "else"_view)) {
+            if (conds.size() == 0 || conds.end()[-1].bElseSeen) {
+                NotImplemented("#elif/#else without #if");
+            }
+            Conditional& c = conds.end()[-1];
+            c.bElseSeen = NameIs(d, "else"_view);
+            bActive = c.bParentActive && !c.bTaken && (c.bElseSeen || EvalIfCondition(pp, args, nArgs));
+            c.bTaken |= bActive;
+        }
+        else if (NameIs(d, "endif"_view)) {
+            if (conds.size() == 0) {
+                NotImplemented("#endif without #if");
+            }
+            bActive = conds.pop().bParentActive;
+        }
+        else if (!bActive) {
+        }
+        else if (NameIs(d, "include"_view)) {
+            Include(pp, args, nArgs, path, lineno);
+        }
+        else if (NameIs(d, "define"_view)) {
+            DefineMacro(pp, args, nArgs);
+        }
+        else if (NameIs(d, "undef"_view)) {
+            if (nArgs != 1 || args[0].kind != Token_Name) {
+                NotImplemented("malformed #undef");
+            }
+            AddLocalMacro(pp, args[0].data.nameBegin, args[0].nameLength)->bDefined = false;
+        }
+        else if (NameIs(d, "pragma"_view)) {
+            // #pragma once was found when the file was cached, the rest are for later stages.
+        }
+        else if (NameIs(d, "error"_view)) {
+            Message *m = pp->oms->PushRaw();
+            *m = { };
+            m->line = lineno;
+            m->type = Message_ErrorDirective;
+        }
+        else {
+            NotImplemented("unknown preprocessor directive");
+        }
+    }
+
+    if (conds.size()) {
+        NotImplemented("#if without #endif");
+    }
+}
+
+CompileResult Preprocess(view<const char> source, MessageStream *oms, const PreprocessOptions *options, Array<Token> *pOut)
+{
+    PreprocessOptions const defaultOptions;
+    if (!options) {
+        options = &defaultOptions;
+    }
+
+    AllocTagScope allocTag(AllocTag_Lexer);
+
+    CompileAbortScope abortScope;
+    try {
+        Array<Token> tokens;
+        ScanAll(source, &tokens);
+
+        Preprocessor pp = { };
+        pp.oms = oms;
+        pp.options = options;
+        pp.pOut = pOut;
+        pp.module = options->module;
+        if (pp.module) {
+            for (uint32_t i = pp.module->firstOutputToken; i < pp.module->nTokens; ++i) {
+                pOut->push(ModuleTokenAt(pp.module, i));
+            }
+        }
+        PreprocessTokens(&pp, tokens.data(), options->path);
+
+        Token *const eoi = pOut->uninitialized_push();
+        *eoi = tokens.end()[-1];
+    }
+    catch (const CompileAbort& abort) {
+        pOut->clear();
+        Message *const m = oms->PushAbort();
+        *m = { };
+        m->type = Message_CompileAborted;
+        m->miscU8 = abort.result;
+        oms->abortInfo = abort.info;
+        return abort.result;
+    }
+    return CompileResult_Ok;
+}
+
+
+static uint32_t
+AppendModuleString(Array<char> *strings, const void *p, uint n)
+{
+    uint32_t const offset = strings->size();
+    strings->push_n(static_cast<const char *>(p), n);
+    return offset;
+}
+
+static void
+AppendModuleToken(Array<ModuleToken> *tokens, Array<char> *strings, const Token& t)
+{
+    ModuleToken *const mt = tokens->uninitialized_push();
+    *mt = { };
+    mt->kind = t.kind;
+    mt->numberLiteralBuiltinType = t.numberLiteralBuiltinType;
+    mt->bNumberLiteralUnsigned = t.bNumberLiteralUnsigned;
+    mt->nameLength = t.nameLength;
+    mt->lineno = t.lineno;
+    mt->payload = HasNamePayload(t.kind) ? AppendModuleString(strings, t.data.nameBegin, t.nameLength) : t.data.numberRawU64;
+}
+
+// Appends a section, 8-byte aligned, and returns its offset.
+static uint32_t
+AppendModuleSection(Array<char> *file, const void *p, size_t n)
+{
+    while (file->size() & 7) {
+        file->push(0);
+    }
+    uint32_t const offset = file->size();
+    file->push_n(static_cast<const char *>(p), uint(n));
+    return offset;
+}
+
+bool WritePrecompiledModule(view<const char> source, MessageStream *oms, const PreprocessOptions *options, const char *outPath)
+{
+    PreprocessOptions const defaultOptions;
+    if (!options) {
+        options = &defaultOptions;
+    }
+    if (options->module) {
+        NotImplemented("a module built on another module");
+    }
+
+    AllocTagScope allocTag(AllocTag_Lexer);
+
+    Array<Token> tokens, output;
+    ScanAll(source, &tokens);
+    Preprocessor pp = { };
+    pp.oms = oms;
+    pp.options = options;
+    pp.bKeepIncluded = true;
+    pp.pOut = &output;
+    PreprocessTokens(&pp, tokens.data(), options->path);
+
+    Array<char> strings;
+    Array<ModuleToken> moduleTokens;
+    Array<ModuleMacro> moduleMacros;
+    for (const Macro& m : pp.macros) {
+        if (!m.bDefined) {
+            continue;
+        }
+        ModuleMacro *const mm = moduleMacros.uninitialized_push();
+        mm->nameOffset = AppendModuleString(&strings, m.name, m.nameLength);
+        mm->nameLength = m.nameLength;
+        mm->firstToken = moduleTokens.size();
+        mm->nTokens = m.nTokens;
+        for (uint32_t i = 0; i < m.nTokens; ++i) {
+            AppendModuleToken(&moduleTokens, &strings, pp.macroTokens[m.firstToken + i]);
+        }
+    }
+    uint32_t const firstOutputToken = moduleTokens.size();
+    for (const Token& t : output) {
+        AppendModuleToken(&moduleTokens, &strings, t);
+    }
+
+    uint32_t tableSize = 16;
+    while (tableSize < 2 * moduleMacros.size()) {
+        tableSize *= 2;
+    }
+    Array<uint32_t> table;
+    memset(table.uninitialized_push_n(tableSize), 0, tableSize * sizeof(uint32_t));
+    for (uint i = 0; i < moduleMacros.size(); ++i) {
+        const ModuleMacro& mm = moduleMacros[i];
+        uint h = uint(HashBytes(strings.data() + mm.nameOffset, mm.nameLength)) & (tableSize - 1);
+        while (table[h]) {
+            h = (h + 1) & (tableSize - 1);
+        }
+        table[h] = i + 1;
+    }
+
+    Array<ModuleFile> files;
+    for (const CachedFile *f : pp.included) {
+        ModuleFile *const mf = files.uninitialized_push();
+        mf->pathOffset = AppendModuleString(&strings, f->path, uint(strlen(f->path) + 1));
+        mf->guardOffset = f->guardLength ? AppendModuleString(&strings, f->guardName, f->guardLength) : 0;
+        mf->guardLength = f->guardLength;
+        mf->bPragmaOnce = f->bPragmaOnce;
+        mf->size = uint32_t(f->size);
+    }
+
+    PrecompiledModule header = { };
+    Array<char> file;
+    file.push_n(reinterpret_cast<const char *>(&header), sizeof(header));
+    header.magic = ModuleMagic;
+    header.version = ModuleVersion;
+    header.nMacros = moduleMacros.size();
+    header.macrosOffset = AppendModuleSection(&file, moduleMacros.data(), moduleMacros.size() * sizeof(ModuleMacro));
+    header.tableSize = tableSize;
+    header.tableOffset = AppendModuleSection(&file, table.data(), tableSize * sizeof(uint32_t));
+    header.nTokens = moduleTokens.size();
+    header.tokensOffset = AppendModuleSection(&file, moduleTokens.data(), moduleTokens.size() * sizeof(ModuleToken));
+    header.firstOutputToken = firstOutputToken;
+    header.nFiles = files.size();
+    header.filesOffset = AppendModuleSection(&file, files.data(), files.size() * sizeof(ModuleFile));
+    header.stringsBytes = strings.size();
+    header.stringsOffset = AppendModuleSection(&file, strings.data(), strings.size());
+    header.fileBytes = file.size();
+    memcpy(file.data(), &header, sizeof(header));
+
+    FILE *const fp = fopen(outPath, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool const bWritten = fwrite(file.data(), 1, file.size(), fp) == file.size();
+    return fclose(fp) == 0 && bWritten;
+}
+
+// Everything a lookup or expansion could touch is checked once here, so using the module needs no checks.
+static bool
+ValidateModule(const PrecompiledModule *mod, size_t fileBytes)
+{
+    auto sectionOk = [&](uint32_t offset, uint32_t n, size_t elemBytes) {
+        return offset % 8 == 0 && offset >= sizeof(PrecompiledModule) && offset <= fileBytes &&
+            n <= (fileBytes - offset) / elemBytes;
+    };
+    if (fileBytes < sizeof(PrecompiledModule) || mod->magic != ModuleMagic || mod->version != ModuleVersion ||
+        mod->fileBytes != fileBytes || !sectionOk(mod->macrosOffset, mod->nMacros, sizeof(ModuleMacro)) ||
+        !sectionOk(mod->tableOffset, mod->tableSize, sizeof(uint32_t)) ||
+        !sectionOk(mod->tokensOffset, mod->nTokens, sizeof(ModuleToken)) ||
+        !sectionOk(mod->filesOffset, mod->nFiles, sizeof(ModuleFile)) ||
+        !sectionOk(mod->stringsOffset, mod->stringsBytes, 1)) {
+        return false;
+    }
+    // Power of two, with an empty slot so lookups end:
+    if (mod->tableSize == 0 || (mod->tableSize & (mod->tableSize - 1)) || mod->tableSize <= mod->nMacros ||
+        mod->firstOutputToken > mod->nTokens) {
+        return false;
+    }
+    const ModuleMacro *const macros = ModuleSection<ModuleMacro>(mod, mod->macrosOffset);
+    for (uint32_t i = 0; i < mod->nMacros; ++i) {
+        if (macros[i].nameLength > mod->stringsBytes || macros[i].nameOffset > mod->stringsBytes - macros[i].nameLength ||
+            macros[i].nTokens > mod->firstOutputToken || macros[i].firstToken > mod->firstOutputToken - macros[i].nTokens) {
+            return false;
+        }
+    }
+    const uint32_t *const table = ModuleSection<uint32_t>(mod, mod->tableOffset);
+    for (uint32_t i = 0; i < mod->tableSize; ++i) {
+        if (table[i] > mod->nMacros) {
+            return false;
+        }
+    }
+    const ModuleToken *const tokens = ModuleSection<ModuleToken>(mod, mod->tokensOffset);
+    for (uint32_t i = 0; i < mod->nTokens; ++i) {
+        if (HasNamePayload(tokens[i].kind) && tokens[i].payload + tokens[i].nameLength > mod->stringsBytes) {
+            return false;
+        }
+    }
+    const ModuleFile *const files = ModuleSection<ModuleFile>(mod, mod->filesOffset);
+    const char *const strings = ModuleSection<char>(mod, mod->stringsOffset);
+    for (uint32_t i = 0; i < mod->nFiles; ++i) {
+        const ModuleFile& mf = files[i];
+        if (mf.pathOffset >= mod->stringsBytes || !memchr(strings + mf.pathOffset, '\0', mod->stringsBytes - mf.pathOffset) ||
+            mf.guardLength > mod->stringsBytes || mf.guardOffset > mod->stringsBytes - mf.guardLength) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const PrecompiledModule *MapPrecompiledModule(const char *path)
+{
+#if defined __linux__
+    int const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(PrecompiledModule))) {
+        m = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (m == MAP_FAILED) {
+        return nullptr;
+    }
+    const PrecompiledModule *const mod = static_cast<const PrecompiledModule *>(m);
+    if (!ValidateModule(mod, size_t(st.st_size))) {
+        munmap(m, size_t(st.st_size));
+        return nullptr;
+    }
+    return mod;
+#else
+    struct stat st;
+    FILE *const fp = stat(path, &st) == 0 ? fopen(path, "rb") : nullptr;
+    if (!fp) {
+        return nullptr;
+    }
+    // Allocate() is 16-byte aligned, as the 8-byte aligned sections need.
+    char *const p = Allocate<char>(size_t(st.st_size) + 1);
+    size_t const n = fread(p, 1, size_t(st.st_size), fp);
+    fclose(fp);
+    const PrecompiledModule *const mod = reinterpret_cast<const PrecompiledModule *>(p);
+    if (!ValidateModule(mod, n)) {
+        Deallocate(p);
+        return nullptr;
+    }
+    return mod;
+#endif
+}
+
+void UnmapPrecompiledModule(const PrecompiledModule *mod)
+{
+#if defined __linux__
+    munmap(const_cast<PrecompiledModule *>(mod), mod->fileBytes);
+#else
+    Deallocate(mod);
+#endif
+}
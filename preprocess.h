@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+#include "lex.h"
+#include "Array.h"
+
+class MessageStream;
+struct PrecompiledModule;
+
+/*
+ * #include "", #define, #undef, #if, #ifdef, #ifndef, #elif, #else, #endif, #pragma once and #error, over tokens.
+ *
+ * Headers are scanned once per process: their tokens are cached by path and revalidated against the file's mtime
+ * and size. A header with #pragma once, or whose whole content is inside an #ifndef X/#define X ... #endif guard,
+ * is skipped on later includes while the guard holds, without going to the file system at all.
+ *
+ * Only object-like macros so far. Tokens keep the line numbers of the file they came from.
+ */
+struct PreprocessOptions {
+    const char *path = nullptr; // of the source; includes are looked for next to it first
+    view<const char *const> includeDirs = { }; // then in these, in order
+
+    // As if the module's source were included first: its macros are defined and its tokens come first.
+    const PrecompiledModule *module = nullptr;
+};
+
+// The output ends with a Token_EOI. Its names point into the source text and into cached headers.
+// On failure it is left empty, with a Message_CompileAborted last in oms as for Compile().
+CompileResult Preprocess(view<const char> source, MessageStream *oms, const PreprocessOptions *options, Array<Token> *pOut);
+
+struct IncludeCacheStats {
+    uint64_t nHits;      // cached tokens used, the file was only stat'ed
+    uint64_t nMisses;    // read and scanned: first include, or changed on disk
+    uint64_t nSkipped;   // #pragma once or guard already defined, not looked up on disk
+    uint64_t bytesSaved; // header bytes not read and scanned thanks to hits and skips
+};
+
+// Process-wide, all threads together.
+IncludeCacheStats GetIncludeCacheStats();
+
+// No tokens from an earlier Preprocess() may still be in use.
+void ClearIncludeCache();
+
+/*
+ * Precompiled modules: what preprocessing a shared library of headers leaves behind (its macros, the guards
+ * of the files it included and any tokens it produced) written once, then mmapped by each compile and used in place.
+ * Internally everything is offsets from the start of the file, and all of it is validated when mapped.
+ * Output tokens from a Preprocess() using a module point into it, so it must stay mapped while they are used.
+ */
+bool WritePrecompiledModule(view<const char> source, MessageStream *oms, const PreprocessOptions *options, const char *outPath);
+const PrecompiledModule *MapPrecompiledModule(const char *path); // null if missing or not a valid module
+void UnmapPrecompiledModule(const PrecompiledModule *module);
@@ -0,0 +1,183 @@
+#include "common.h"
+
+#include "prescan.h"
+
+#include <string.h>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define PRESCAN_SSE2 1
+#else
+    #define PRESCAN_SSE2 0
+#endif
+
+#if defined _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Bit i is set if byte i of the 64-byte block is that character.
+struct BlockMasks {
+    uint64_t lbrace, rbrace, semicolon, quote, slash, star, newline;
+};
+
+static void
+ClassifyBlock(const ubyte *p, BlockMasks *m)
+{
+    *m = { };
+#if PRESCAN_SSE2
+    __m128i const lbrace = _mm_set1_epi8('{'), rbrace = _mm_set1_epi8('}'), semicolon = _mm_set1_epi8(';'),
+        quote = _mm_set1_epi8('"'), slash = _mm_set1_epi8('/'), star = _mm_set1_epi8('*'), newline = _mm_set1_epi8('\n');
+    for (uint k = 0; k < 4; ++k) {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * k));
+        uint const shift = 16 * k;
+        m->lbrace    |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, lbrace))))    << shift;
+        m->rbrace    |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, rbrace))))    << shift;
+        m->semicolon |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, semicolon)))) << shift;
+        m->quote     |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote))))     << shift;
+        m->slash     |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, slash))))     << shift;
+        m->star      |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, star))))      << shift;
+        m->newline   |= uint64_t(uint(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline))))   << shift;
+    }
+#else
+    for (uint i = 0; i < 64; ++i) {
+        uint64_t const bit = uint64_t(1) << i;
+        switch (p[i]) {
+        case '{':  m->lbrace    |= bit; break;
+        case '}':  m->rbrace    |= bit; break;
+        case ';':  m->semicolon |= bit; break;
+        case '"':  m->quote     |= bit; break;
+        case '/':  m->slash     |= bit; break;
+        case '*':  m->star      |= bit; break;
+        case '\n': m->newline   |= bit; break;
+        }
+    }
+#endif
+}
+
+static uint
+CountTrailingZeros64(uint64_t x)
+{
+    ASSERT(x);
+#if defined _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return uint(i);
+#else
+    return uint(__builtin_ctzll(x));
+#endif
+}
+
+enum PrescanState : uint8_t {
+    Prescan_Code,
+    Prescan_LineComment,
+    Prescan_BlockComment,
+    Prescan_String,
+};
+
+/*
+    Same rules as Scanner_NextTokenRawT<ScanFeatures_Full>: "//" runs to the newline, a block comment from its opening
+    slash and star to the first closing star and slash that doesn't reuse its own '*', and a string to the next '"' or
+    newline, with no escapes.
+
+    Which positions matter depends on the state (in a block comment only the '/' of a "*\/" does), so each block
+    is walked over the bits of one mask per state, starting at the first position not yet consumed.
+**/
+void BuildStructuralIndex(view<const char> source, StructuralIndex *pOut)
+{
+    const ubyte *const src = reinterpret_cast<const ubyte *>(source.ptr);
+    uint const n = source.length;
+    ASSERT(src[n] == '\0');
+
+    pOut->blocks.clear();
+    pOut->semicolons.clear();
+    pOut->bUnbalanced = false;
+
+    PrescanState state = Prescan_Code;
+    uint depth = 0;
+    uint32_t open = 0;
+    uint resume = 0; // first offset not consumed yet
+    uint64_t prevStar = 0; // '*' in the last byte of the previous block, for a "*\/" across blocks
+    ubyte tail[64];
+
+    for (uint base = 0; base < n; base += 64) {
+        const ubyte *p = src + base;
+        if (n - base < 64) { // the loads must not go past the '\0'
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, n - base);
+            p = tail;
+        }
+        BlockMasks m;
+        ClassifyBlock(p, &m);
+        uint64_t const commentEnd = m.slash & (m.star << 1 | prevStar);
+        prevStar = m.star >> 63;
+
+        for (;;) {
+            uint64_t candidates = 0;
+            switch (state) {
+            case Prescan_Code:         candidates = m.lbrace | m.rbrace | m.semicolon | m.quote | m.slash; break;
+            case Prescan_LineComment:  candidates = m.newline; break;
+            case Prescan_BlockComment: candidates = commentEnd; break;
+            case Prescan_String:       candidates = m.quote | m.newline; break;
+            }
+            if (resume > base) {
+                candidates &= resume - base >= 64 ? 0 : ~uint64_t(0) << (resume - base);
+            }
+            if (!candidates) {
+                break;
+            }
+            uint const i = base + CountTrailingZeros64(candidates);
+            resume = i + 1;
+
+            switch (state) {
+            case Prescan_Code:
+                switch (src[i]) {
+                case '{':
+                    if (depth++ == 0) {
+                        open = i;
+                    }
+                    break;
+                case '}':
+                    if (depth == 0) {
+                        pOut->bUnbalanced = true;
+                    }
+                    else if (--depth == 0) {
+                        pOut->blocks.push({ open, i });
+                    }
+                    break;
+                case ';':
+                    if (depth == 0) {
+                        pOut->semicolons.push(i);
+                    }
+                    break;
+                case '"':
+                    state = Prescan_String;
+                    break;
+                case '/':
+                    // src[i + 1] is at most the '\0' after the source:
+                    if (src[i + 1] == '/') {
+                        state = Prescan_LineComment;
+                        resume = i + 2;
+                    }
+                    else if (src[i + 1] == '*') {
+                        state = Prescan_BlockComment;
+                        resume = i + 3; // "/*/" does not close
+                    }
+                    break;
+                }
+                break;
+            case Prescan_String:
+                pOut->bUnbalanced |= src[i] == '\n';
+                state = Prescan_Code;
+                break;
+            case Prescan_LineComment:
+            case Prescan_BlockComment:
+                state = Prescan_Code;
+                break;
+            }
+        }
+    }
+
+    if (depth || state == Prescan_BlockComment || state == Prescan_String) {
+        pOut->bUnbalanced = true;
+    }
+}
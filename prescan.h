@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * Structural pre-scan: finds the top-level {} blocks (function bodies) and top-level ';'s of a source without
+ * tokenizing it, skipping comments and string literals the same way the scanner does. Bytes are classified 64 at
+ * a time with SSE2 where available, and only the few interesting positions are then walked one by one.
+ *
+ * Meant to split a source into independent pieces before lexing and parsing them. Like the scanner, the source
+ * must be followed by a '\0'.
+ */
+struct StructuralRange {
+    uint32_t open;  // offset of the '{'
+    uint32_t close; // offset of its matching '}'
+};
+
+struct StructuralIndex {
+    Array<StructuralRange> blocks;
+    Array<uint32_t> semicolons; // outside any block
+    bool bUnbalanced; // a '}' without a '{', a '{' never closed, or an unterminated comment or string
+};
+
+void BuildStructuralIndex(view<const char> source, StructuralIndex *pOut);
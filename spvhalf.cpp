@@ -0,0 +1,536 @@
+#include "common.h"
+
+#include "spvhalf.h"
+#include "spvpool.h"
+#include "spvreader.h"
+#include "half.h"
+
+#include <string.h>
+#include <math.h>
+
+enum : uint16_t {
+    HalfFlag_Seed = 1 << 0,       // decorated RelaxedPrecision, or converted up from 16 bits, in a function
+    HalfFlag_Candidate = 1 << 1,  // a float op that could be demoted
+    HalfFlag_Relaxed = 1 << 2,    // a seed, a demoted candidate or a folded constant op
+    HalfFlag_Reached = 1 << 3,    // from a seed, through relaxed candidates
+    HalfFlag_Constant = 1 << 4,   // a 32-bit float constant that fits in a half
+    HalfFlag_ConstantOp = 1 << 5, // a candidate op on constants alone, with its value in half
+    HalfFlag_Decorated = 1 << 6,  // RelaxedPrecision already
+    HalfFlag_Precise = 1 << 7,    // NoContraction, left alone
+    HalfFlag_Narrow = 1 << 8,     // a seed that demoted ops use: an OpFConvert down after it
+    HalfFlag_Widen = 1 << 9,      // a demoted value that other instructions use: an OpFConvert up after it
+};
+
+enum : uint32_t { SpvDecoration_RelaxedPrecision = 0, SpvDecoration_NoContraction = 42, SpvCapability_Float16 = 9 };
+
+struct HalfConversion {
+    uint32_t type, id, source;
+};
+
+struct Demoter {
+    view<const uint32_t> module;
+    uint32_t bound; // of the input
+    uint8_t mode; // SpvHalfMode
+    Array<uint32_t> defOffsets; // per input id: where its instruction is, 0 if not defined
+    Array<uint32_t> valueTypes; // per input id: its result type, 0 if none
+    Array<uint8_t> floatLanes; // per input type: 1 for a 32-bit float, the components for a vector of them, else 0
+    Array<uint8_t> halfLanes; // the same for 16-bit floats
+    Array<uint16_t> flags; // per input id: HalfFlag_
+    Array<uint32_t> halfAt; // per input id: index + 1 of the lanes in halfValues of a constant or constant op, or 0
+    Array<uint16_t> halfValues;
+    Array<uint32_t> useCounts; // per input id: uses in functions
+    Array<uint32_t> relaxedUses; // of a constant op: by relaxed ops
+    Array<uint32_t> narrowIds; // per input id: its 16-bit version, once there is one
+    Array<uint32_t> wideIds; // per input id: its 32-bit version, once there is one, for demoted values and folds
+    Array<uint32_t> candidates; // offsets of the candidates and constant ops, in the module's order
+    uint32_t halfTypes[5]; // per lanes: the 16-bit float type, 0 if none yet
+    SpvPool pool; // new types and constants
+};
+
+static bool
+IsDemoted(Demoter *d, uint32_t id)
+{
+    return (d->flags[id] & (HalfFlag_Relaxed | HalfFlag_Candidate | HalfFlag_Seed | HalfFlag_ConstantOp)) ==
+        (HalfFlag_Relaxed | HalfFlag_Candidate);
+}
+
+static bool
+IsFolded(Demoter *d, uint32_t id)
+{
+    return (d->flags[id] & (HalfFlag_Relaxed | HalfFlag_ConstantOp)) == (HalfFlag_Relaxed | HalfFlag_ConstantOp);
+}
+
+static uint
+FloatLanes(Demoter *d, uint32_t id) // of a value, 0 if it isn't 32-bit float
+{
+    return id < d->bound ? d->floatLanes[d->valueTypes[id]] : 0;
+}
+
+// Calls visit(i, id) for the operands of a 32-bit float type.
+template<class Visit> static void
+ForEachFloatOperand(Demoter *d, const uint32_t *inst, Visit visit)
+{
+    SpvForEachOperandWord(inst, SpvLookupOp(uint16_t(inst[0])), [&](uint i, char kind) {
+        if ((kind == 'i' || kind == 'f') && FloatLanes(d, inst[i])) {
+            visit(i, inst[i]);
+        }
+    });
+}
+
+static bool
+IsCandidateOp(uint16_t opcode)
+{
+    switch (opcode) {
+    case SpvOp_FNegate: case SpvOp_FAdd: case SpvOp_FSub: case SpvOp_FMul: case SpvOp_FDiv: case SpvOp_FRem:
+    case SpvOp_FMod: case SpvOp_VectorTimesScalar: case SpvOp_Dot: case SpvOp_CompositeExtract:
+    case SpvOp_CompositeConstruct: case SpvOp_VectorShuffle: case SpvOp_Phi: case SpvOp_Select:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+    The lanes of an op on constants alone, in half, exactly rounded: false if it is not one that folds, or it leaves
+    the range of half.
+**/
+static bool
+FoldConstantOp(Demoter *d, const uint32_t *inst, uint16_t *lanes)
+{
+    uint16_t const opcode = uint16_t(inst[0]);
+    uint const nOperands = (inst[0] >> 16) - 3;
+    if (opcode != SpvOp_FNegate && opcode != SpvOp_FAdd && opcode != SpvOp_FSub && opcode != SpvOp_FMul &&
+        opcode != SpvOp_FDiv && opcode != SpvOp_VectorTimesScalar) {
+        return false;
+    }
+    const uint16_t *operands[2];
+    uint nOperandLanes[2];
+    for (uint k = 0; k < nOperands; ++k) {
+        uint32_t const id = inst[3 + k];
+        if (!(d->flags[id] & (HalfFlag_Constant | HalfFlag_ConstantOp))) {
+            return false;
+        }
+        operands[k] = &d->halfValues[d->halfAt[id] - 1];
+        nOperandLanes[k] = FloatLanes(d, id);
+    }
+    uint const n = d->floatLanes[inst[1]];
+    for (uint i = 0; i < n; ++i) {
+        uint16_t const a = operands[0][i];
+        uint16_t const b = nOperands == 2 ? operands[1][nOperandLanes[1] == 1 ? 0 : i] : 0;
+        switch (opcode) {
+        case SpvOp_FNegate: lanes[i] = Half_Negate(a); break;
+        case SpvOp_FAdd:    lanes[i] = Half_Add(a, b); break;
+        case SpvOp_FSub:    lanes[i] = Half_Sub(a, b); break;
+        case SpvOp_FDiv:    lanes[i] = Half_Div(a, b); break;
+        default:            lanes[i] = Half_Mul(a, b); break;
+        }
+        if (!Half_IsFinite(lanes[i]) && Half_IsFinite(a) && Half_IsFinite(b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+AddHalfValues(Demoter *d, uint32_t id, const uint16_t *lanes, uint n)
+{
+    d->halfAt[id] = d->halfValues.size() + 1;
+    d->halfValues.push_n(lanes, n);
+}
+
+/*
+    Demotes the candidates whose float operands are all relaxed or constant, starting from all of them and taking
+    back those that aren't until none change, so that loops are demoted whole; then takes back those not reached
+    from a seed, which a loop of only constants would be, and goes again until that takes back none either.
+**/
+static void
+PropagatePrecision(Demoter *d)
+{
+    for (uint32_t at : d->candidates) {
+        const uint32_t *const inst = d->module.ptr + at;
+        if (!(d->flags[inst[2]] & HalfFlag_ConstantOp)) {
+            d->flags[inst[2]] |= HalfFlag_Relaxed;
+        }
+    }
+    for (;;) {
+        bool bChanged = true;
+        while (bChanged) {
+            bChanged = false;
+            for (uint32_t at : d->candidates) {
+                const uint32_t *const inst = d->module.ptr + at;
+                uint16_t& flags = d->flags[inst[2]];
+                if ((flags & (HalfFlag_Relaxed | HalfFlag_Seed)) != HalfFlag_Relaxed) {
+                    continue;
+                }
+                ForEachFloatOperand(d, inst, [&](uint, uint32_t id) {
+                    if (!(d->flags[id] & (HalfFlag_Relaxed | HalfFlag_Constant | HalfFlag_ConstantOp))) {
+                        flags &= ~HalfFlag_Relaxed;
+                    }
+                });
+                bChanged |= !(flags & HalfFlag_Relaxed);
+            }
+        }
+
+        for (uint32_t at : d->candidates) {
+            uint16_t& flags = d->flags[d->module.ptr[at + 2]];
+            if (!(flags & HalfFlag_Seed)) {
+                flags &= ~HalfFlag_Reached;
+            }
+        }
+        bool bGrew = true;
+        while (bGrew) {
+            bGrew = false;
+            for (uint32_t at : d->candidates) {
+                const uint32_t *const inst = d->module.ptr + at;
+                uint16_t& flags = d->flags[inst[2]];
+                if ((flags & (HalfFlag_Relaxed | HalfFlag_Reached)) != HalfFlag_Relaxed) {
+                    continue;
+                }
+                ForEachFloatOperand(d, inst, [&](uint, uint32_t id) {
+                    flags |= d->flags[id] & HalfFlag_Reached;
+                });
+                bGrew |= (flags & HalfFlag_Reached) != 0;
+            }
+        }
+        bool bTakenBack = false;
+        for (uint32_t at : d->candidates) {
+            uint16_t& flags = d->flags[d->module.ptr[at + 2]];
+            if ((flags & (HalfFlag_Relaxed | HalfFlag_Reached | HalfFlag_Seed | HalfFlag_ConstantOp)) ==
+                HalfFlag_Relaxed) {
+                flags &= ~HalfFlag_Relaxed;
+                bTakenBack = true;
+            }
+        }
+        if (!bTakenBack) {
+            return;
+        }
+    }
+}
+
+// Constant ops are folded if all their uses are by relaxed ops: users come later, so from the last one back.
+static void
+RelaxConstantOps(Demoter *d)
+{
+    auto const CountRelaxedUses = [d](const uint32_t *inst) {
+        ForEachFloatOperand(d, inst, [&](uint, uint32_t id) {
+            d->relaxedUses[id] += (d->flags[id] & HalfFlag_ConstantOp) != 0;
+        });
+    };
+    for (uint32_t at : d->candidates) {
+        const uint32_t *const inst = d->module.ptr + at;
+        if ((d->flags[inst[2]] & (HalfFlag_Relaxed | HalfFlag_ConstantOp)) == HalfFlag_Relaxed) {
+            CountRelaxedUses(inst);
+        }
+    }
+    for (uint k = d->candidates.size(); k-- > 0;) {
+        const uint32_t *const inst = d->module.ptr + d->candidates[k];
+        uint32_t const id = inst[2];
+        if ((d->flags[id] & HalfFlag_ConstantOp) && d->useCounts[id] && d->relaxedUses[id] == d->useCounts[id]) {
+            d->flags[id] |= HalfFlag_Relaxed;
+            CountRelaxedUses(inst);
+        }
+    }
+}
+
+static uint32_t
+HalfType(Demoter *d, uint n)
+{
+    uint32_t& type = d->halfTypes[n];
+    if (!type) {
+        type = n == 1 ? SpvPool_FloatType(&d->pool, 16) : SpvPool_VectorType(&d->pool, SpvTypeId(HalfType(d, 1)), n);
+    }
+    return type;
+}
+
+// A constant of the lanes in half, of the 16-bit type or converted to the 32-bit one.
+static uint32_t
+HalfConstant(Demoter *d, const uint16_t *lanes, uint n, bool bWide, uint32_t wideType)
+{
+    uint32_t scalarType = bWide ? wideType : HalfType(d, 1);
+    if (bWide && n > 1) {
+        scalarType = d->module.ptr[d->defOffsets[wideType] + 2];
+    }
+    SpvValueId ids[4];
+    for (uint i = 0; i < n; ++i) {
+        float const f = Half_ToFloat(lanes[i]);
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        ids[i] = bWide ? SpvPool_Float(&d->pool, SpvTypeId(scalarType), 32, bits) :
+            SpvPool_Float(&d->pool, SpvTypeId(scalarType), 16, lanes[i]);
+    }
+    if (n == 1) {
+        return ids[0];
+    }
+    return SpvPool_Composite(&d->pool, SpvTypeId(bWide ? wideType : HalfType(d, n)), { ids, n });
+}
+
+// What a demoted op uses in place of a float operand.
+static uint32_t
+NarrowOperand(Demoter *d, uint32_t id)
+{
+    if (IsDemoted(d, id)) {
+        return id;
+    }
+    uint32_t& narrow = d->narrowIds[id];
+    if (!narrow) {
+        ASSERT(d->halfAt[id]);
+        narrow = HalfConstant(d, &d->halfValues[d->halfAt[id] - 1], FloatLanes(d, id), false, 0);
+    }
+    return narrow;
+}
+
+// What anything else uses in place of an operand, if not the operand.
+static uint32_t
+WideOperand(Demoter *d, uint32_t id)
+{
+    if (id >= d->bound || !(IsFolded(d, id) || (d->mode == SpvHalf_Float16 && IsDemoted(d, id)))) {
+        return id;
+    }
+    uint32_t& wide = d->wideIds[id];
+    if (!wide) {
+        ASSERT(IsFolded(d, id));
+        wide = HalfConstant(d, &d->halfValues[d->halfAt[id] - 1], FloatLanes(d, id), true, d->valueTypes[id]);
+    }
+    return wide;
+}
+
+bool SpvDemotePrecision(view<const uint32_t> module, const SpvHalfOptions& options, Array<uint32_t> *pOut,
+                        SpvHalfReport *pReport)
+{
+    pOut->clear();
+    *pReport = { };
+    SpvValidationError error;
+    if (!SpvValidate(module, &error)) {
+        return false;
+    }
+
+    Demoter demoter;
+    Demoter *const d = &demoter;
+    d->module = module;
+    d->bound = module.ptr[3];
+    d->mode = options.mode;
+    uint32_t const bound = d->bound;
+    memset(d->defOffsets.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->valueTypes.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->floatLanes.uninitialized_push_n(bound), 0, bound);
+    memset(d->halfLanes.uninitialized_push_n(bound), 0, bound);
+    memset(d->flags.uninitialized_push_n(bound), 0, bound * sizeof(uint16_t));
+    memset(d->halfAt.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->useCounts.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->relaxedUses.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->narrowIds.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->wideIds.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(d->halfTypes, 0, sizeof(d->halfTypes));
+
+    // Types, constants, decorations and uses; the candidates, and which of them are ops on constants, in order.
+    uint const headerWords = sizeof(SpvHeader) / sizeof(uint32_t);
+    uint functionsBegin = module.length;
+    bool bHasFloat16 = false;
+    for (uint at = headerWords; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const inst = module.ptr + at;
+        uint16_t const opcode = uint16_t(inst[0]);
+        const SpvOpInfo *const op = SpvLookupOp(opcode);
+        uint const resultWord = SpvResultWord(op);
+        if (resultWord) {
+            d->defOffsets[inst[resultWord]] = at;
+            d->valueTypes[inst[resultWord]] = resultWord == 2 ? inst[1] : 0;
+        }
+        functionsBegin = opcode == SpvOp_Function ? Min(functionsBegin, at) : functionsBegin;
+        bHasFloat16 |= opcode == SpvOp_Capability && inst[1] == SpvCapability_Float16;
+        if (opcode == SpvOp_TypeFloat) {
+            d->floatLanes[inst[1]] = inst[2] == 32;
+            d->halfLanes[inst[1]] = inst[2] == 16;
+            d->halfTypes[1] = inst[2] == 16 && !d->halfTypes[1] ? inst[1] : d->halfTypes[1];
+        }
+        else if (opcode == SpvOp_TypeVector && inst[3] <= 4) {
+            d->floatLanes[inst[1]] = d->floatLanes[inst[2]] ? uint8_t(inst[3]) : 0;
+            d->halfLanes[inst[1]] = d->halfLanes[inst[2]] ? uint8_t(inst[3]) : 0;
+            if (d->halfLanes[inst[2]] && !d->halfTypes[inst[3]]) {
+                d->halfTypes[inst[3]] = inst[1];
+            }
+        }
+        else if (opcode == SpvOp_Decorate && inst[2] == SpvDecoration_RelaxedPrecision) {
+            d->flags[inst[1]] |= HalfFlag_Decorated;
+        }
+        else if (opcode == SpvOp_Decorate && inst[2] == SpvDecoration_NoContraction) {
+            d->flags[inst[1]] |= HalfFlag_Precise;
+        }
+        else if (opcode == SpvOp_Constant && d->floatLanes[inst[1]] == 1) {
+            float f;
+            memcpy(&f, &inst[3], sizeof(f));
+            uint16_t const h = Half_FromFloat(f);
+            if (Half_IsFinite(h) || !isfinite(f)) {
+                d->flags[inst[2]] |= HalfFlag_Constant;
+                AddHalfValues(d, inst[2], &h, 1);
+            }
+        }
+        else if (opcode == SpvOp_ConstantComposite && d->floatLanes[inst[1]]) {
+            uint16_t lanes[4];
+            bool bFits = true;
+            for (uint i = 3; i < inst[0] >> 16; ++i) {
+                bFits &= (d->flags[inst[i]] & HalfFlag_Constant) != 0;
+                lanes[i - 3] = bFits ? d->halfValues[d->halfAt[inst[i]] - 1] : 0;
+            }
+            if (bFits) {
+                d->flags[inst[2]] |= HalfFlag_Constant;
+                AddHalfValues(d, inst[2], lanes, d->floatLanes[inst[1]]);
+            }
+        }
+        if (at < functionsBegin) {
+            continue;
+        }
+        SpvForEachOperandWord(inst, op, [&](uint i, char kind) {
+            if (kind == 'i' || kind == 'f') {
+                d->useCounts[inst[i]] += 1;
+            }
+        });
+        if (resultWord != 2 || !d->floatLanes[inst[1]]) {
+            continue;
+        }
+        uint32_t const id = inst[2];
+        if ((d->flags[id] & HalfFlag_Decorated) ||
+            (opcode == SpvOp_FConvert && d->halfLanes[d->valueTypes[inst[3]]])) {
+            d->flags[id] |= HalfFlag_Seed | HalfFlag_Relaxed | HalfFlag_Reached;
+            d->narrowIds[id] = opcode == SpvOp_FConvert ? inst[3] : 0;
+        }
+        if (IsCandidateOp(opcode) && !(d->flags[id] & HalfFlag_Precise)) {
+            d->flags[id] |= HalfFlag_Candidate;
+            d->candidates.push(at);
+            uint16_t lanes[4];
+            if (!(d->flags[id] & HalfFlag_Seed) && FoldConstantOp(d, inst, lanes)) {
+                d->flags[id] |= HalfFlag_ConstantOp;
+                AddHalfValues(d, id, lanes, d->floatLanes[inst[1]]);
+            }
+        }
+    }
+
+    PropagatePrecision(d);
+    RelaxConstantOps(d);
+
+    // The OpFConverts, which take the ids after the input's, and the pool the ones after them.
+    uint32_t nextId = bound;
+    for (uint at = functionsBegin; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const inst = module.ptr + at;
+        uint const resultWord = SpvResultWord(SpvLookupOp(uint16_t(inst[0])));
+        uint32_t const result = resultWord ? inst[resultWord] : 0;
+        if (IsFolded(d, result)) {
+            pReport->nFolded += 1;
+            continue;
+        }
+        if (IsDemoted(d, result)) {
+            pReport->nDemoted += 1;
+        }
+        if (options.mode != SpvHalf_Float16) {
+            continue;
+        }
+        if (IsDemoted(d, result)) {
+            ForEachFloatOperand(d, inst, [&](uint, uint32_t id) {
+                if ((d->flags[id] & HalfFlag_Seed) && !d->narrowIds[id]) {
+                    d->flags[id] |= HalfFlag_Narrow;
+                    d->narrowIds[id] = nextId++;
+                }
+            });
+            continue;
+        }
+        SpvForEachOperandWord(inst, SpvLookupOp(uint16_t(inst[0])), [&](uint i, char kind) {
+            uint32_t const id = inst[i];
+            if ((kind == 'i' || kind == 'f') && IsDemoted(d, id) && !d->wideIds[id]) {
+                d->flags[id] |= HalfFlag_Widen;
+                d->wideIds[id] = nextId++;
+            }
+        });
+    }
+    pReport->nConversions = nextId - bound;
+    d->pool.firstId = nextId;
+
+    // The functions, with the demoted ops retyped or decorated, the folds gone and the conversions after the values.
+    Array<uint32_t> functions;
+    Array<HalfConversion> pending; // written before the first instruction that can't come before them
+    uint nInput = 0, nOutput = 0;
+    for (uint at = functionsBegin; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const inst = module.ptr + at;
+        uint16_t const opcode = uint16_t(inst[0]);
+        uint const resultWord = SpvResultWord(SpvLookupOp(opcode));
+        uint32_t const result = resultWord ? inst[resultWord] : 0;
+        nInput += 1;
+        if (pending.size() && opcode != SpvOp_FunctionParameter && opcode != SpvOp_Label &&
+            opcode != SpvOp_Phi && opcode != SpvOp_Variable) {
+            for (const HalfConversion& c : pending) {
+                uint32_t const convert[] = { 4 << 16 | SpvOp_FConvert, c.type, c.id, c.source };
+                functions.push_n(convert, lengthof(convert));
+            }
+            nOutput += pending.size();
+            pending.clear();
+        }
+        if (IsFolded(d, result)) {
+            continue;
+        }
+        uint const start = functions.size();
+        functions.push_n(inst, inst[0] >> 16);
+        uint32_t *const out = functions.data() + start;
+        nOutput += 1;
+        if (options.mode == SpvHalf_Float16 && IsDemoted(d, result)) {
+            out[1] = HalfType(d, d->floatLanes[inst[1]]);
+            ForEachFloatOperand(d, inst, [&](uint i, uint32_t id) {
+                out[i] = NarrowOperand(d, id);
+            });
+        }
+        else {
+            SpvForEachOperandWord(inst, SpvLookupOp(opcode), [&](uint i, char kind) {
+                if (kind == 'i' || kind == 'f') {
+                    out[i] = WideOperand(d, inst[i]);
+                }
+            });
+        }
+        if (result && (d->flags[result] & HalfFlag_Narrow)) {
+            pending.push({ HalfType(d, FloatLanes(d, result)), d->narrowIds[result], result });
+        }
+        if (result && (d->flags[result] & HalfFlag_Widen)) {
+            pending.push({ d->valueTypes[result], d->wideIds[result], result });
+        }
+    }
+
+    // The rest around them: Float16 after the capabilities, the decorations after the module's, the pool before the
+    // functions, and the names and decorations of the folds dropped.
+    bool const bFloat16 = options.mode == SpvHalf_Float16 && pReport->nDemoted && !bHasFloat16;
+    bool const bDecorate = options.mode == SpvHalf_RelaxedPrecision;
+    bool bCapabilityDone = !bFloat16, bDecorationsDone = !bDecorate;
+    pOut->push_n(module.ptr, headerWords);
+    for (uint at = headerWords; at <= functionsBegin; at += module.ptr[at] >> 16) {
+        const uint32_t *const inst = at < module.length ? module.ptr + at : nullptr;
+        uint16_t const opcode = inst ? uint16_t(inst[0]) : uint16_t(SpvOp_Function);
+        uint8_t const layout = SpvLookupOp(opcode)->layout;
+        if (!bCapabilityDone && opcode != SpvOp_Capability) {
+            uint32_t const capability[] = { 2 << 16 | SpvOp_Capability, SpvCapability_Float16 };
+            pOut->push_n(capability, lengthof(capability));
+            nOutput += 1;
+            bCapabilityDone = true;
+        }
+        if (!bDecorationsDone && layout >= SpvLayout_Global && layout != SpvLayout_Anywhere) {
+            for (uint32_t ofs : d->candidates) {
+                uint32_t const id = module.ptr[ofs + 2];
+                if (IsDemoted(d, id) && !(d->flags[id] & HalfFlag_Decorated)) {
+                    uint32_t const decorate[] = { 3 << 16 | SpvOp_Decorate, id, SpvDecoration_RelaxedPrecision };
+                    pOut->push_n(decorate, lengthof(decorate));
+                    nOutput += 1;
+                }
+            }
+            bDecorationsDone = true;
+        }
+        if (at == functionsBegin) {
+            break;
+        }
+        nInput += 1;
+        if ((opcode == SpvOp_Name || opcode == SpvOp_Decorate) && inst[1] < bound && IsFolded(d, inst[1])) {
+            continue;
+        }
+        pOut->push_n(inst, inst[0] >> 16);
+        nOutput += 1;
+    }
+    pOut->push_n(d->pool.words.data(), d->pool.words.size());
+    nOutput += d->pool.idOffsets.size();
+    pOut->push_n(functions.data(), functions.size());
+    (*pOut)[3] = SpvPool_NextId(&d->pool);
+    pReport->instructionDelta = int32_t(nOutput) - int32_t(nInput);
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * Half precision for mobile targets over a SPIR-V module: float arithmetic that only needs mediump is found and either
+ * decorated RelaxedPrecision, for the driver to run at 16 bits, or retyped to native 16-bit floats.
+ *
+ * Precision flows forward from the values already decorated RelaxedPrecision, and from OpFConverts up from 16 bits,
+ * as GLSL's precision qualifiers do: a float op (arithmetic, OpDot, building, taking apart and shuffling vectors, OpPhi
+ * and OpSelect) of 32-bit scalars or vectors is demoted if all its float operands are relaxed or constants that fit in
+ * a half, and it is reached from a relaxed one. Loops are fine, a phi and what feeds it back are demoted together. An
+ * op on constants alone (negation, +, -, * and /, and vector times scalar) takes the precision of its users: if they
+ * are all demoted, it is folded in half precision, exactly rounded as in half.h, to a new constant.
+ *
+ * With Float16, demoted values get the 16-bit float type of their width, constants they use are converted to half,
+ * and an OpFConvert goes between them and whatever else uses them or feeds them, right after the value's definition
+ * (after the block's OpPhis for one). The module gets the Float16 capability.
+ *
+ * New types and constants are hash-consed in a SpvPool and go at the end of the global section, with the module's
+ * 16-bit float types used where it has them.
+ */
+enum SpvHalfMode : uint8_t {
+    SpvHalf_RelaxedPrecision,
+    SpvHalf_Float16,
+};
+
+struct SpvHalfOptions {
+    uint8_t mode = SpvHalf_RelaxedPrecision; // SpvHalfMode
+};
+
+struct SpvHalfReport {
+    uint nDemoted; // values decorated or made 16-bit, not counting the seeds nor what was folded
+    uint nFolded; // ops on constants folded in half precision
+    uint nConversions; // OpFConverts added between 16 and 32 bits
+    int32_t instructionDelta;
+};
+
+// The module must pass SpvValidate(), which is checked first: false if not, with pOut left empty.
+bool SpvDemotePrecision(view<const uint32_t> module, const SpvHalfOptions& options, Array<uint32_t> *pOut,
+                        SpvHalfReport *pReport);
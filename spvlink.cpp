@@ -0,0 +1,486 @@
+#include "common.h"
+
+#include "spvlink.h"
+#include "spvreader.h"
+
+#include <string.h>
+
+enum : uint32_t {
+    SpvDecoration_LinkageAttributes = 41,
+    SpvLinkageType_Import = 1,
+    SpvCapability_Linkage = 5,
+};
+
+enum SpvLinkIdFlags : uint8_t {
+    SpvLinkId_Decorated = 1 << 0, // not deduplicated
+    SpvLinkId_Import    = 1 << 1, // replaced by an export of another module
+    SpvLinkId_Export    = 1 << 2,
+    SpvLinkId_Duplicate = 1 << 3, // maps to an earlier identical type, constant or OpExtInstImport, not emitted
+};
+
+struct SpvLinkModule {
+    view<const uint32_t> words;
+    uint idBase; // of its ids in the per-id arrays
+    uint32_t sectionBegin[SpvLayout_Function + 2]; // word offsets, indexed by SpvLayout; the last is the end
+};
+
+struct SpvLinkSymbol {
+    const char *name; // into the module's words
+    uint32_t nameLength;
+    uint32_t moduleIndex;
+    uint32_t id; // in its module
+    uint32_t wordOffset; // of its LinkageAttributes
+    uint32_t typeId; // output id of the function or pointer type it's declared with, 0 until seen
+    bool bImport;
+};
+
+struct SpvHashSlot {
+    uint32_t hash;
+    uint32_t index; // ~0u if empty
+};
+
+// Open addressing with linear probing. Callers probe themselves, comparing whatever index refers to.
+struct SpvHashTable {
+    Array<SpvHashSlot> slots; // a power of 2 of them
+    uint nUsed = 0;
+};
+
+static void
+HashTable_Insert(SpvHashTable *t, uint32_t hash, uint32_t index)
+{
+    if (2 * (t->nUsed + 1) > t->slots.size()) {
+        uint const newSize = Max(64u, 2 * t->slots.size());
+        Array<SpvHashSlot> old;
+        old.push_n(t->slots.data(), t->slots.size());
+        t->slots.clear();
+        SpvHashSlot *const slots = t->slots.uninitialized_push_n(newSize);
+        for (uint i = 0; i < newSize; ++i) {
+            slots[i] = { 0, ~0u };
+        }
+        t->nUsed = 0;
+        for (const SpvHashSlot& s : old) {
+            if (s.index != ~0u) {
+                HashTable_Insert(t, s.hash, s.index);
+            }
+        }
+    }
+    uint const mask = t->slots.size() - 1;
+    uint i = hash & mask;
+    while (t->slots[i].index != ~0u) {
+        i = (i + 1) & mask;
+    }
+    t->slots[i] = { hash, index };
+    t->nUsed += 1;
+}
+
+static uint32_t
+HashWords(const uint32_t *w, uint n)
+{
+    uint32_t h = 0x811c9dc5u;
+    for (uint i = 0; i < n; ++i) {
+        h = (h ^ w[i]) * 0x01000193u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static uint32_t
+HashBytes(const char *p, uint n)
+{
+    uint32_t h = 0x811c9dc5u;
+    for (uint i = 0; i < n; ++i) {
+        h = (h ^ ubyte(p[i])) * 0x01000193u;
+    }
+    return h;
+}
+
+static bool
+SameString(const uint32_t *a, const uint32_t *b)
+{
+    uint const n = SpvStringWords(a);
+    return n == SpvStringWords(b) && memcmp(a, b, n * sizeof(uint32_t)) == 0;
+}
+
+// Words with ids mapped through remap, which is indexed by the module's ids.
+static void
+RemapInstruction(const uint32_t *inst, const SpvOpInfo *op, const uint32_t *remap, uint32_t *dst)
+{
+    dst[0] = inst[0];
+    SpvForEachOperandWord(inst, op, [&](uint i, char kind) {
+        dst[i] = kind == 'l' ? inst[i] : remap[inst[i]];
+    });
+}
+
+// What makes two types or constants the same: the words, ids mapped and the result id left out.
+static void
+DedupKey(const uint32_t *inst, const SpvOpInfo *op, const uint32_t *remap, Array<uint32_t> *pKey)
+{
+    pKey->clear();
+    pKey->push(inst[0]);
+    SpvForEachOperandWord(inst, op, [&](uint i, char kind) {
+        if (kind != 'r') {
+            pKey->push(kind == 'l' ? inst[i] : remap[inst[i]]);
+        }
+    });
+}
+
+struct SpvLinker {
+    view<const view<const uint32_t>> inputs;
+    Array<SpvLinkModule> modules;
+    Array<uint32_t> remap;  // per id of each module, from its idBase: the output id
+    Array<uint8_t> idFlags; // SpvLinkIdFlags, likewise
+    Array<uint32_t> symbolOfId; // likewise, ~0u if it has no LinkageAttributes
+    Array<SpvLinkSymbol> symbols;
+    SpvHashTable exports; // names to symbols
+    SpvHashTable dedup;   // keys to the (module, word offset) of the first of each, in dedupSources
+    Array<uint32_t> dedupSources; // pairs
+    Array<uint32_t> extInstImports; // pairs of (module, word offset) of the ones emitted, few
+    Array<uint32_t> key, otherKey;
+    uint32_t nextId = 1;
+    SpvLinkError *pError = nullptr;
+};
+
+static bool
+LinkFail(SpvLinker *l, uint moduleIndex, uint wordOffset, const char *what)
+{
+    *l->pError = { moduleIndex, wordOffset, what };
+    return false;
+}
+
+static const SpvLinkSymbol *
+FindExport(SpvLinker *l, const char *name, uint nameLength)
+{
+    if (l->exports.slots.is_empty()) {
+        return nullptr;
+    }
+    uint32_t const hash = HashBytes(name, nameLength);
+    uint const mask = l->exports.slots.size() - 1;
+    for (uint i = hash & mask; l->exports.slots[i].index != ~0u; i = (i + 1) & mask) {
+        const SpvLinkSymbol& s = l->symbols[l->exports.slots[i].index];
+        if (l->exports.slots[i].hash == hash && s.nameLength == nameLength && memcmp(s.name, name, nameLength) == 0) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+// The output id of an identical type or constant seen before, else 0 after remembering this one.
+static uint32_t
+FindOrAddDuplicate(SpvLinker *l, uint moduleIndex, const uint32_t *inst, const SpvOpInfo *op)
+{
+    const SpvLinkModule& m = l->modules[moduleIndex];
+    DedupKey(inst, op, &l->remap[m.idBase], &l->key);
+    uint32_t const hash = HashWords(l->key.data(), l->key.size());
+    if (!l->dedup.slots.is_empty()) {
+        uint const mask = l->dedup.slots.size() - 1;
+        for (uint i = hash & mask; l->dedup.slots[i].index != ~0u; i = (i + 1) & mask) {
+            if (l->dedup.slots[i].hash != hash) {
+                continue;
+            }
+            uint const index = l->dedup.slots[i].index;
+            const SpvLinkModule& other = l->modules[l->dedupSources[index]];
+            const uint32_t *const otherInst = other.words.ptr + l->dedupSources[index + 1];
+            DedupKey(otherInst, op, &l->remap[other.idBase], &l->otherKey);
+            if (l->otherKey.size() == l->key.size() && memcmp(l->otherKey.data(), l->key.data(), l->key.size() * sizeof(uint32_t)) == 0) {
+                return l->remap[other.idBase + otherInst[SpvResultWord(op)]];
+            }
+        }
+    }
+    HashTable_Insert(&l->dedup, hash, l->dedupSources.size());
+    l->dedupSources.push(moduleIndex);
+    l->dedupSources.push(uint32_t(inst - m.words.ptr));
+    return 0;
+}
+
+// Pass 1 over one module: section bounds, linkage symbols, and output ids for all it defines except imports.
+static bool
+MapModuleIds(SpvLinker *l, uint moduleIndex)
+{
+    SpvLinkModule& m = l->modules[moduleIndex];
+    uint32_t *const remap = &l->remap[m.idBase];
+    uint8_t *const flags = &l->idFlags[m.idBase];
+    uint32_t *const symbolOfId = &l->symbolOfId[m.idBase];
+
+    SpvReader r;
+    const SpvHeader *header;
+    if (!SpvReader_Begin(&r, m.words, &header)) {
+        return LinkFail(l, moduleIndex, 0, "no module header");
+    }
+    uint section = SpvLayout_Capability;
+    m.sectionBegin[section] = sizeof(SpvHeader) / sizeof(uint32_t);
+    bool bInFunction = false, bInImportedFunction = false;
+
+    SpvInstruction inst;
+    while (SpvReader_Next(&r, &inst)) {
+        const uint32_t *const w = inst.words;
+        uint const offset = uint(w - m.words.ptr);
+        const SpvOpInfo *const op = SpvLookupOp(inst.opcode);
+        bInFunction |= inst.opcode == SpvOp_Function;
+        uint const instSection = bInFunction ? uint(SpvLayout_Function) : op->layout;
+        for (; section < instSection && instSection != SpvLayout_Anywhere; ++section) {
+            m.sectionBegin[section + 1] = offset;
+        }
+
+        switch (inst.opcode) {
+        case SpvOp_Decorate:
+        case SpvOp_MemberDecorate:
+            if (inst.opcode == SpvOp_Decorate && w[2] == SpvDecoration_LinkageAttributes) {
+                SpvLinkSymbol s = { };
+                s.name = reinterpret_cast<const char *>(w + 3);
+                s.nameLength = uint32_t(strlen(s.name)); // validated, so the '\0' is there
+                s.moduleIndex = moduleIndex;
+                s.id = w[1];
+                s.wordOffset = offset;
+                s.bImport = w[inst.nWords - 1] == SpvLinkageType_Import;
+                if (!s.bImport) {
+                    if (FindExport(l, s.name, s.nameLength)) {
+                        return LinkFail(l, moduleIndex, offset, "exported twice");
+                    }
+                    HashTable_Insert(&l->exports, HashBytes(s.name, s.nameLength), l->symbols.size());
+                }
+                symbolOfId[s.id] = l->symbols.size();
+                flags[s.id] |= s.bImport ? SpvLinkId_Import : SpvLinkId_Export;
+                l->symbols.push(s);
+            }
+            else {
+                flags[w[1]] |= SpvLinkId_Decorated;
+            }
+            continue;
+        case SpvOp_ExtInstImport:
+            for (uint i = 0; i < l->extInstImports.size(); i += 2) {
+                const SpvLinkModule& other = l->modules[l->extInstImports[i]];
+                const uint32_t *const otherInst = other.words.ptr + l->extInstImports[i + 1];
+                if (SameString(w + 2, otherInst + 2)) {
+                    remap[w[1]] = l->remap[other.idBase + otherInst[1]];
+                    flags[w[1]] |= SpvLinkId_Duplicate;
+                    break;
+                }
+            }
+            if (!(flags[w[1]] & SpvLinkId_Duplicate)) {
+                remap[w[1]] = l->nextId++;
+                l->extInstImports.push(moduleIndex);
+                l->extInstImports.push(offset);
+            }
+            continue;
+        case SpvOp_Function:
+            if (flags[w[2]] & (SpvLinkId_Import | SpvLinkId_Export)) {
+                l->symbols[symbolOfId[w[2]]].typeId = remap[w[4]];
+            }
+            bInImportedFunction = flags[w[2]] & SpvLinkId_Import;
+            break;
+        case SpvOp_FunctionEnd:
+            bInFunction = bInImportedFunction = false;
+            continue;
+        case SpvOp_Variable:
+            if (!bInFunction && flags[w[2]] & (SpvLinkId_Import | SpvLinkId_Export)) {
+                l->symbols[symbolOfId[w[2]]].typeId = remap[w[1]];
+            }
+            break;
+        }
+
+        uint const resultWord = SpvResultWord(op);
+        if (!resultWord || bInImportedFunction || flags[w[resultWord]] & SpvLinkId_Import) {
+            continue;
+        }
+        uint32_t const id = w[resultWord];
+        if (!bInFunction && op->flags & (SpvOpFlag_Type | SpvOpFlag_Constant) && !(flags[id] & SpvLinkId_Decorated)) {
+            if (uint32_t const same = FindOrAddDuplicate(l, moduleIndex, w, op)) {
+                remap[id] = same;
+                flags[id] |= SpvLinkId_Duplicate;
+                continue;
+            }
+        }
+        remap[id] = l->nextId++;
+    }
+    for (; section <= SpvLayout_Function; ++section) {
+        m.sectionBegin[section + 1] = m.words.length;
+    }
+    return true;
+}
+
+static void
+EmitRemapped(SpvLinker *l, const SpvLinkModule& m, const uint32_t *inst, const SpvOpInfo *op, Array<uint32_t> *pOut)
+{
+    RemapInstruction(inst, op, &l->remap[m.idBase], pOut->uninitialized_push_n(inst[0] >> 16));
+}
+
+// Pass 2 over one section of one module. bStrings: of the debug section, only the OpStrings, which come first.
+static void
+EmitSection(SpvLinker *l, const SpvLinkModule& m, uint section, bool bStrings, Array<uint32_t> *pOut)
+{
+    const uint8_t *const flags = &l->idFlags[m.idBase];
+    SpvReader r = { m.words.ptr + m.sectionBegin[section], m.words.ptr + m.sectionBegin[section + 1] };
+    bool bInImportedFunction = false;
+    SpvInstruction inst;
+    while (SpvReader_Next(&r, &inst)) {
+        const uint32_t *const w = inst.words;
+        const SpvOpInfo *const op = SpvLookupOp(inst.opcode);
+        uint const resultWord = SpvResultWord(op);
+        switch (inst.opcode) {
+        case SpvOp_Nop:
+            continue;
+        case SpvOp_String:
+            if (!bStrings) {
+                continue;
+            }
+            break;
+        case SpvOp_Name:
+        case SpvOp_MemberName:
+            if (bStrings || flags[w[1]] & (SpvLinkId_Import | SpvLinkId_Duplicate)) {
+                continue;
+            }
+            break;
+        case SpvOp_Decorate:
+        case SpvOp_MemberDecorate:
+            if (flags[w[1]] & SpvLinkId_Import || (inst.opcode == SpvOp_Decorate && w[2] == SpvDecoration_LinkageAttributes)) {
+                continue;
+            }
+            break;
+        case SpvOp_Function:
+            bInImportedFunction = flags[w[2]] & SpvLinkId_Import;
+            break;
+        case SpvOp_FunctionEnd:
+            if (bInImportedFunction) {
+                bInImportedFunction = false;
+                continue;
+            }
+            break;
+        default:
+            if (section == SpvLayout_Global && resultWord && flags[w[resultWord]] & (SpvLinkId_Import | SpvLinkId_Duplicate)) {
+                continue;
+            }
+            break;
+        }
+        if (!bInImportedFunction) {
+            EmitRemapped(l, m, w, op, pOut);
+        }
+    }
+}
+
+bool SpvLinkModules(view<const view<const uint32_t>> inputs, SpvLinkError *pError, Array<uint32_t> *pOut)
+{
+    pOut->clear();
+    SpvLinker linker;
+    SpvLinker *const l = &linker;
+    l->inputs = inputs;
+    l->pError = pError;
+    if (inputs.length == 0) {
+        return LinkFail(l, 0, 0, "no modules");
+    }
+
+    uint nIds = 0, nWords = sizeof(SpvHeader) / sizeof(uint32_t);
+    uint32_t version = 0;
+    for (uint i = 0; i < inputs.length; ++i) {
+        SpvValidationError error;
+        if (!SpvValidate(inputs.ptr[i], &error)) {
+            return LinkFail(l, i, error.wordOffset, error.what);
+        }
+        const SpvHeader *const header = reinterpret_cast<const SpvHeader *>(inputs.ptr[i].ptr);
+        SpvLinkModule& m = *l->modules.uninitialized_push();
+        m = { };
+        m.words = inputs.ptr[i];
+        m.idBase = nIds;
+        nIds += header->bound;
+        nWords += inputs.ptr[i].length;
+        version = Max(version, header->version);
+    }
+    memset(l->remap.uninitialized_push_n(nIds), 0, nIds * sizeof(uint32_t));
+    memset(l->idFlags.uninitialized_push_n(nIds), 0, nIds);
+    memset(l->symbolOfId.uninitialized_push_n(nIds), 0xff, nIds * sizeof(uint32_t));
+
+    // Pass 1:
+    for (uint i = 0; i < inputs.length; ++i) {
+        if (!MapModuleIds(l, i)) {
+            return false;
+        }
+    }
+    for (const SpvLinkSymbol& s : l->symbols) {
+        if (!s.bImport) {
+            continue;
+        }
+        const SpvLinkSymbol *const e = FindExport(l, s.name, s.nameLength);
+        if (!e) {
+            return LinkFail(l, s.moduleIndex, s.wordOffset, "import not exported by any module");
+        }
+        if (e->typeId != s.typeId) {
+            return LinkFail(l, s.moduleIndex, s.wordOffset, "import and export types differ");
+        }
+        l->remap[l->modules[s.moduleIndex].idBase + s.id] = l->remap[l->modules[e->moduleIndex].idBase + e->id];
+    }
+
+    // Pass 2, section by section across the modules:
+    pOut->reserve(nWords);
+    SpvHeader *const header = reinterpret_cast<SpvHeader *>(pOut->uninitialized_push_n(sizeof(SpvHeader) / sizeof(uint32_t)));
+    *header = { SpvMagic, version, 0, l->nextId, 0 };
+
+    const uint32_t *memoryModel = nullptr;
+    for (uint i = 0; i < inputs.length; ++i) {
+        const SpvLinkModule& m = l->modules[i];
+        SpvReader r = { m.words.ptr + m.sectionBegin[SpvLayout_MemoryModel], m.words.ptr + m.sectionBegin[SpvLayout_MemoryModel + 1] };
+        SpvInstruction inst;
+        while (SpvReader_Next(&r, &inst)) {
+            if (inst.opcode != SpvOp_MemoryModel) {
+                continue;
+            }
+            if (memoryModel && (memoryModel[1] != inst.words[1] || memoryModel[2] != inst.words[2])) {
+                pOut->clear();
+                return LinkFail(l, i, uint(inst.words - m.words.ptr), "memory models differ");
+            }
+            memoryModel = inst.words;
+        }
+    }
+
+    // Capabilities and extensions: only a few distinct ones, so a linear search over those emitted so far.
+    uint const capabilitiesBegin = pOut->size();
+    for (const SpvLinkModule& m : l->modules) {
+        SpvReader r = { m.words.ptr + m.sectionBegin[SpvLayout_Capability], m.words.ptr + m.sectionBegin[SpvLayout_Capability + 1] };
+        SpvInstruction inst;
+        while (SpvReader_Next(&r, &inst)) {
+            if (inst.opcode != SpvOp_Capability || inst.words[1] == SpvCapability_Linkage) {
+                continue;
+            }
+            bool bSeen = false;
+            for (uint i = capabilitiesBegin; i < pOut->size() && !bSeen; i += 2) {
+                bSeen = (*pOut)[i + 1] == inst.words[1];
+            }
+            if (!bSeen) {
+                pOut->push_n(inst.words, inst.nWords);
+            }
+        }
+    }
+    uint const extensionsBegin = pOut->size();
+    for (const SpvLinkModule& m : l->modules) {
+        SpvReader r = { m.words.ptr + m.sectionBegin[SpvLayout_Extension], m.words.ptr + m.sectionBegin[SpvLayout_Extension + 1] };
+        SpvInstruction inst;
+        while (SpvReader_Next(&r, &inst)) {
+            if (inst.opcode != SpvOp_Extension) {
+                continue;
+            }
+            bool bSeen = false;
+            for (uint i = extensionsBegin; i < pOut->size() && !bSeen; i += (*pOut)[i] >> 16) {
+                bSeen = SameString(&(*pOut)[i + 1], inst.words + 1);
+            }
+            if (!bSeen) {
+                pOut->push_n(inst.words, inst.nWords);
+            }
+        }
+    }
+    for (uint i = 0; i < l->extInstImports.size(); i += 2) {
+        const SpvLinkModule& m = l->modules[l->extInstImports[i]];
+        const uint32_t *const inst = m.words.ptr + l->extInstImports[i + 1];
+        EmitRemapped(l, m, inst, SpvLookupOp(SpvOp_ExtInstImport), pOut);
+    }
+    pOut->push_n(memoryModel, memoryModel[0] >> 16);
+
+    for (uint section = SpvLayout_EntryPoint; section <= SpvLayout_Function; ++section) {
+        for (const SpvLinkModule& m : l->modules) {
+            EmitSection(l, m, section, section == SpvLayout_Debug, pOut);
+        }
+        if (section == SpvLayout_Debug) {
+            for (const SpvLinkModule& m : l->modules) {
+                EmitSection(l, m, section, false, pOut);
+            }
+        }
+    }
+    return true;
+}
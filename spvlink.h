@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * Links separately compiled SPIR-V modules into one, in the spirit of spirv-link.
+ *
+ * Functions and global variables declared with an Import LinkageAttributes decoration are replaced by the one
+ * exported under the same name, whose type must be the same. Types and constants with the same opcode and operands
+ * are emitted once (hash-consed on their words, with ids already mapped to the output's), except decorated ones,
+ * whose decorations would then have to match too. Capabilities, extensions and OpExtInstImports are merged, and
+ * the memory models must agree. Output ids are dense, numbered in the order the modules and their results come.
+ * The output is a complete module: the Linkage capability and all LinkageAttributes are dropped.
+ *
+ * Two passes over the inputs, each linear in their total word count: one maps every id to its output id, the
+ * other writes each instruction, ids mapped, straight to the output. Inputs must pass SpvValidate(), checked first.
+ */
+struct SpvLinkError {
+    uint moduleIndex;
+    uint wordOffset; // of the instruction in that module
+    const char *what;
+};
+
+// On failure pOut is left empty.
+bool SpvLinkModules(view<const view<const uint32_t>> modules, SpvLinkError *pError, Array<uint32_t> *pOut);
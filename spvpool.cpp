@@ -0,0 +1,231 @@
+#include "common.h"
+
+#include "spvpool.h"
+#include "spvreader.h"
+#include "default_alloc.h"
+
+#include <string.h>
+
+// All words but the result id's, which is left 0 until the instruction is known to be new.
+static uint32_t
+HashInstruction(const uint32_t *inst, uint nWords)
+{
+    uint64_t h = 0;
+    for (uint i = 0; i < nWords; ++i) {
+        h = (h + inst[i]) * 0x9e3779b97f4a7c15u;
+        h ^= h >> 29;
+    }
+    return uint32_t(h ^ h >> 32);
+}
+
+static void
+GrowTable(SpvPool *pool)
+{
+    uint const nIds = pool->idOffsets.size();
+    if (2 * (nIds + 1) <= pool->table.size()) {
+        return;
+    }
+    uint const size = Max(64u, 2 * pool->table.size());
+    pool->table.clear();
+    uint32_t *const slots = pool->table.uninitialized_push_n(size);
+    memset(slots, 0, size * sizeof(uint32_t));
+    for (uint i = 0; i < nIds; ++i) {
+        uint h = pool->idHashes[i] & (size - 1);
+        while (slots[h]) {
+            h = (h + 1) & (size - 1);
+        }
+        slots[h] = i + 1;
+    }
+}
+
+/*
+    The instruction from words[start] to the end was just pushed, with 0 for its result id at words[start +
+    resultWord]. If the pool has it already, it is popped again and the id it has returned; else it gets the next id.
+**/
+static SpvId
+Intern(SpvPool *pool, uint start, uint resultWord)
+{
+    uint const nWords = pool->words.size() - start;
+    ASSERT(pool->words[start] >> 16 == nWords && pool->words[start + resultWord] == 0);
+    uint32_t const hash = HashInstruction(pool->words.data() + start, nWords);
+
+    GrowTable(pool);
+    uint const mask = pool->table.size() - 1;
+    uint h = hash & mask;
+    for (; pool->table[h]; h = (h + 1) & mask) {
+        uint const index = pool->table[h] - 1;
+        if (pool->idHashes[index] != hash) {
+            continue;
+        }
+        const uint32_t *const other = pool->words.data() + pool->idOffsets[index];
+        const uint32_t *const inst = pool->words.data() + start;
+        if (other[0] == inst[0] && memcmp(other + 1, inst + 1, (resultWord - 1) * sizeof(uint32_t)) == 0 &&
+            memcmp(other + resultWord + 1, inst + resultWord + 1, (nWords - resultWord - 1) * sizeof(uint32_t)) == 0) {
+            pool->words.set_size(start);
+            return SpvId(pool->firstId + index);
+        }
+    }
+    SpvId const id = SpvPool_NextId(pool);
+    pool->words[start + resultWord] = id;
+    pool->table[h] = pool->idOffsets.size() + 1;
+    pool->idOffsets.push(start);
+    pool->idHashes.push(hash);
+    return id;
+}
+
+static uint
+PushOp(SpvPool *pool, uint16_t opcode, uint nWords) // returns where it starts
+{
+    ASSERT(nWords <= 0xffff); // the word count's 16 bits
+    uint const start = pool->words.size();
+    pool->words.push(uint32_t(nWords) << 16 | opcode);
+    return start;
+}
+
+SpvTypeId SpvPool_BoolType(SpvPool *pool)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    uint const start = PushOp(pool, SpvOp_TypeBool, 2);
+    pool->words.push(0);
+    return SpvTypeId(Intern(pool, start, 1));
+}
+
+SpvTypeId SpvPool_IntType(SpvPool *pool, uint width, bool bSigned)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    ASSERT(width == 8 || width == 16 || width == 32 || width == 64);
+    pool->intWidths |= width == 8 ? SpvPoolInt_8 : width == 16 ? SpvPoolInt_16 : width == 64 ? SpvPoolInt_64 : 0;
+    uint const start = PushOp(pool, SpvOp_TypeInt, 4);
+    pool->words.push(0);
+    pool->words.push(width);
+    pool->words.push(bSigned);
+    return SpvTypeId(Intern(pool, start, 1));
+}
+
+SpvTypeId SpvPool_FloatType(SpvPool *pool, uint width)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    ASSERT(width == 16 || width == 32 || width == 64);
+    pool->floatWidths |= width == 16 ? SpvPoolFloat_16 : width == 64 ? SpvPoolFloat_64 : 0;
+    uint const start = PushOp(pool, SpvOp_TypeFloat, 3);
+    pool->words.push(0);
+    pool->words.push(width);
+    return SpvTypeId(Intern(pool, start, 1));
+}
+
+SpvTypeId SpvPool_VectorType(SpvPool *pool, SpvTypeId component, uint n)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    ASSERT(n >= 2 && n <= 4);
+    uint const start = PushOp(pool, SpvOp_TypeVector, 4);
+    pool->words.push(0);
+    pool->words.push(component);
+    pool->words.push(n);
+    return SpvTypeId(Intern(pool, start, 1));
+}
+
+SpvTypeId SpvPool_ArrayType(SpvPool *pool, SpvTypeId element, uint32_t length)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    ASSERT(length);
+    SpvValueId const lengthId = SpvPool_Int(pool, SpvPool_IntType(pool, 32, false), length);
+    uint const start = PushOp(pool, SpvOp_TypeArray, 4);
+    pool->words.push(0);
+    pool->words.push(element);
+    pool->words.push(lengthId);
+    return SpvTypeId(Intern(pool, start, 1));
+}
+
+SpvValueId SpvPool_Bool(SpvPool *pool, bool value)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    SpvTypeId const type = SpvPool_BoolType(pool);
+    uint const start = PushOp(pool, value ? SpvOp_ConstantTrue : SpvOp_ConstantFalse, 3);
+    pool->words.push(type);
+    pool->words.push(0);
+    return SpvValueId(Intern(pool, start, 2));
+}
+
+SpvValueId SpvPool_Int(SpvPool *pool, SpvTypeId intType, uint64_t value)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    const uint32_t *const type = SpvPool_Instruction(pool, intType);
+    ASSERT(type && uint16_t(type[0]) == SpvOp_TypeInt);
+    uint const width = type[2];
+    if (width < 32) {
+        uint const shift = 64 - width;
+        value = type[3] ? uint64_t(int64_t(value << shift) >> shift) : value << shift >> shift;
+    }
+    uint const nLiteral = width == 64 ? 2 : 1;
+    uint const start = PushOp(pool, SpvOp_Constant, 3 + nLiteral);
+    pool->words.push(intType);
+    pool->words.push(0);
+    pool->words.push(uint32_t(value));
+    if (nLiteral == 2) {
+        pool->words.push(uint32_t(value >> 32));
+    }
+    return SpvValueId(Intern(pool, start, 2));
+}
+
+SpvValueId SpvPool_Float(SpvPool *pool, SpvTypeId floatType, uint width, uint64_t bits)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    ASSERT(width == 16 || width == 32 || width == 64);
+    uint const nLiteral = width == 64 ? 2 : 1;
+    uint const start = PushOp(pool, SpvOp_Constant, 3 + nLiteral);
+    pool->words.push(floatType);
+    pool->words.push(0);
+    pool->words.push(width == 16 ? uint32_t(bits & 0xffff) : uint32_t(bits));
+    if (nLiteral == 2) {
+        pool->words.push(uint32_t(bits >> 32));
+    }
+    return SpvValueId(Intern(pool, start, 2));
+}
+
+SpvValueId SpvPool_Composite(SpvPool *pool, SpvTypeId type, view<const SpvValueId> constituents)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    uint const start = PushOp(pool, SpvOp_ConstantComposite, 3 + constituents.length);
+    pool->words.push(type);
+    pool->words.push(0);
+    static_assert(sizeof(SpvValueId) == sizeof(uint32_t), "");
+    pool->words.push_n(reinterpret_cast<const uint32_t *>(constituents.ptr), constituents.length);
+    return SpvValueId(Intern(pool, start, 2));
+}
+
+void SpvPool_Name(SpvPool *pool, SpvId id, view<const char> name)
+{
+    AllocTagScope allocTag(AllocTag_Types);
+    uint const nStringWords = name.length / 4 + 1; // always room for the '\0'
+    pool->names.push(uint32_t(2 + nStringWords) << 16 | SpvOp_Name);
+    pool->names.push(id);
+    uint32_t *const string = pool->names.uninitialized_push_n(nStringWords);
+    memset(string, 0, nStringWords * sizeof(uint32_t));
+    memcpy(string, name.ptr, name.length);
+}
+
+const uint32_t *SpvPool_Instruction(const SpvPool *pool, SpvId id)
+{
+    uint const index = id - pool->firstId;
+    if (id < pool->firstId || index >= pool->idOffsets.size()) {
+        return nullptr;
+    }
+    return pool->words.data() + pool->idOffsets.data()[index];
+}
+
+uint64_t SpvPool_IntValue(const SpvPool *pool, SpvValueId constant)
+{
+    const uint32_t *const inst = SpvPool_Instruction(pool, constant);
+    ASSERT(inst);
+    uint16_t const opcode = uint16_t(inst[0]);
+    if (opcode != SpvOp_Constant) {
+        ASSERT(opcode == SpvOp_ConstantTrue || opcode == SpvOp_ConstantFalse);
+        return opcode == SpvOp_ConstantTrue;
+    }
+    const uint32_t *const type = SpvPool_Instruction(pool, inst[1]);
+    uint const width = type[2];
+    if (width == 64) {
+        return inst[3] | uint64_t(inst[4]) << 32;
+    }
+    return type[3] ? uint64_t(int64_t(int32_t(inst[3]))) : inst[3];
+}
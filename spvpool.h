@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * A module's types and constants section, hash-consed: asking for a type or constant that is already there returns
+ * its id, so equal elements of constant tables, and equal sub-arrays, are emitted once and shared. Instructions are
+ * written straight to words, each after the ones it uses, ready to go after the annotations. Beside the words there
+ * is only an offset and a hash per id and the hash table, so memory is proportional to the unique types and
+ * constants, however large the tables made of them.
+ *
+ * Ids are global (see spvsection.h), from firstId on. Integer constants keep the low bits of the value: below 32
+ * bits sign-extended for signed types and zero-extended for unsigned ones, as SPIR-V wants them.
+ */
+enum : uint8_t { SpvPoolInt_8 = 1 << 0, SpvPoolInt_16 = 1 << 1, SpvPoolInt_64 = 1 << 2 };
+enum : uint8_t { SpvPoolFloat_16 = 1 << 0, SpvPoolFloat_64 = 1 << 1 };
+
+struct SpvPool {
+    Array<uint32_t> words;
+    Array<uint32_t> names; // OpName of each SpvPool_Name(), for the debug section
+    Array<uint32_t> idOffsets; // per id from firstId: where its instruction starts in words
+    Array<uint32_t> idHashes;
+    Array<uint32_t> table; // open addressing on the hash: id - firstId + 1, 0 if empty
+    SpvId firstId = 1;
+    uint8_t intWidths = 0; // SpvPoolInt_ bits of the integer types used, each needs its capability
+    uint8_t floatWidths = 0; // SpvPoolFloat_ bits, the same for float types
+};
+
+inline SpvId
+SpvPool_NextId(const SpvPool *pool) // the Bound, if the pool's are the module's last ids
+{
+    return SpvId(pool->firstId + pool->idOffsets.size());
+}
+
+// Empty again for another module, keeping the memory.
+inline void
+SpvPool_Clear(SpvPool *pool)
+{
+    pool->words.clear();
+    pool->names.clear();
+    pool->idOffsets.clear();
+    pool->idHashes.clear();
+    pool->table.clear();
+    pool->intWidths = 0;
+    pool->floatWidths = 0;
+}
+
+SpvTypeId SpvPool_BoolType(SpvPool *pool);
+SpvTypeId SpvPool_IntType(SpvPool *pool, uint width, bool bSigned); // width 8, 16, 32 or 64
+SpvTypeId SpvPool_FloatType(SpvPool *pool, uint width); // width 16, 32 or 64
+SpvTypeId SpvPool_VectorType(SpvPool *pool, SpvTypeId component, uint n);
+SpvTypeId SpvPool_ArrayType(SpvPool *pool, SpvTypeId element, uint32_t length); // length > 0
+
+SpvValueId SpvPool_Bool(SpvPool *pool, bool value);
+SpvValueId SpvPool_Int(SpvPool *pool, SpvTypeId intType, uint64_t value); // truncated to the type's width
+
+// A float constant from the IEEE bits in the low width bits. The type needn't be from the pool, it can be the module's.
+SpvValueId SpvPool_Float(SpvPool *pool, SpvTypeId floatType, uint width, uint64_t bits);
+
+// A vector or array of the constants, as many as the type has; the type's OpConstantComposite. At most 65532 of them,
+// as a SPIR-V instruction's word count has 16 bits.
+SpvValueId SpvPool_Composite(SpvPool *pool, SpvTypeId type, view<const SpvValueId> constituents);
+
+void SpvPool_Name(SpvPool *pool, SpvId id, view<const char> name);
+
+// What is in the pool, for using its constants at compile time. The instruction's words, null if not from the pool.
+const uint32_t *SpvPool_Instruction(const SpvPool *pool, SpvId id);
+
+// A bool or integer constant's value, sign- or zero-extended from its width to 64 bits.
+uint64_t SpvPool_IntValue(const SpvPool *pool, SpvValueId constant);
@@ -0,0 +1,569 @@
+#include "common.h"
+
+#include "spvreader.h"
+#include "default_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+struct SpvOpTable {
+    SpvOpInfo info[256];
+};
+
+static constexpr SpvOpTable
+MakeSpvOpTable()
+{
+    SpvOpTable t = { };
+#define SPV_OP(opcode, name, operands, layout, flags) t.info[opcode] = { "Op" #name, operands, SpvLayout_##layout, flags }
+    SPV_OP(  0, Nop,                   "",       Anywhere, 0);
+    SPV_OP(  1, Undef,                 "tr",     Global, SpvOpFlag_InBlock);
+    SPV_OP(  5, Name,                  "fs",     Debug, 0);
+    SPV_OP(  6, MemberName,            "fls",    Debug, 0);
+    SPV_OP(  7, String,                "rs",     Debug, 0);
+    SPV_OP( 10, Extension,             "s",      Extension, 0);
+    SPV_OP( 11, ExtInstImport,         "rs",     ExtInstImport, 0);
+    SPV_OP( 12, ExtInst,               "trili*", Function, 0);
+    SPV_OP( 14, MemoryModel,           "ll",     MemoryModel, 0);
+    SPV_OP( 15, EntryPoint,            "lfsf*",  EntryPoint, 0);
+    SPV_OP( 16, ExecutionMode,         "fll*",   ExecutionMode, 0);
+    SPV_OP( 17, Capability,            "l",      Capability, 0);
+    SPV_OP( 19, TypeVoid,              "r",      Global, SpvOpFlag_Type);
+    SPV_OP( 20, TypeBool,              "r",      Global, SpvOpFlag_Type);
+    SPV_OP( 21, TypeInt,               "rll",    Global, SpvOpFlag_Type);
+    SPV_OP( 22, TypeFloat,             "rl",     Global, SpvOpFlag_Type);
+    SPV_OP( 23, TypeVector,            "rtl",    Global, SpvOpFlag_Type);
+    SPV_OP( 24, TypeMatrix,            "rtl",    Global, SpvOpFlag_Type);
+    SPV_OP( 28, TypeArray,             "rti",    Global, SpvOpFlag_Type);
+    SPV_OP( 29, TypeRuntimeArray,      "rt",     Global, SpvOpFlag_Type);
+    SPV_OP( 30, TypeStruct,            "rt*",    Global, SpvOpFlag_Type);
+    SPV_OP( 32, TypePointer,           "rlt",    Global, SpvOpFlag_Type);
+    SPV_OP( 33, TypeFunction,          "rtt*",   Global, SpvOpFlag_Type);
+    SPV_OP( 41, ConstantTrue,          "tr",     Global, SpvOpFlag_Constant);
+    SPV_OP( 42, ConstantFalse,         "tr",     Global, SpvOpFlag_Constant);
+    SPV_OP( 43, Constant,              "trl*",   Global, SpvOpFlag_Constant);
+    SPV_OP( 44, ConstantComposite,     "tri*",   Global, SpvOpFlag_Constant);
+    SPV_OP( 46, ConstantNull,          "tr",     Global, SpvOpFlag_Constant);
+    SPV_OP( 48, SpecConstantTrue,      "tr",     Global, 0);
+    SPV_OP( 49, SpecConstantFalse,     "tr",     Global, 0);
+    SPV_OP( 50, SpecConstant,          "trl*",   Global, 0);
+    SPV_OP( 51, SpecConstantComposite, "tri*",   Global, 0);
+    SPV_OP( 52, SpecConstantOp,        "trli*",  Global, 0);
+    SPV_OP( 54, Function,              "trlt",   Function, 0);
+    SPV_OP( 55, FunctionParameter,     "tr",     Function, 0);
+    SPV_OP( 56, FunctionEnd,           "",       Function, 0);
+    SPV_OP( 57, FunctionCall,          "trfi*",  Function, 0);
+    SPV_OP( 59, Variable,              "trli?",  Global, SpvOpFlag_InBlock);
+    SPV_OP( 61, Load,                  "tril*",  Function, 0);
+    SPV_OP( 62, Store,                 "iil*",   Function, 0);
+    SPV_OP( 65, AccessChain,           "trii*",  Function, 0);
+    SPV_OP( 71, Decorate,              "fll*",   Annotation, 0);
+    SPV_OP( 72, MemberDecorate,        "flll*",  Annotation, 0);
+    SPV_OP( 79, VectorShuffle,         "triil*", Function, 0);
+    SPV_OP( 80, CompositeConstruct,    "tri*",   Function, 0);
+    SPV_OP( 81, CompositeExtract,      "tril*",  Function, 0);
+    SPV_OP( 82, CompositeInsert,       "triil*", Function, 0);
+    SPV_OP(109, ConvertFToU,           "tri",    Function, 0);
+    SPV_OP(110, ConvertFToS,           "tri",    Function, 0);
+    SPV_OP(111, ConvertSToF,           "tri",    Function, 0);
+    SPV_OP(112, ConvertUToF,           "tri",    Function, 0);
+    SPV_OP(113, UConvert,              "tri",    Function, 0);
+    SPV_OP(114, SConvert,              "tri",    Function, 0);
+    SPV_OP(115, FConvert,              "tri",    Function, 0);
+    SPV_OP(124, Bitcast,               "tri",    Function, 0);
+    SPV_OP(126, SNegate,               "tri",    Function, 0);
+    SPV_OP(127, FNegate,               "tri",    Function, 0);
+    SPV_OP(128, IAdd,                  "trii",   Function, 0);
+    SPV_OP(129, FAdd,                  "trii",   Function, 0);
+    SPV_OP(130, ISub,                  "trii",   Function, 0);
+    SPV_OP(131, FSub,                  "trii",   Function, 0);
+    SPV_OP(132, IMul,                  "trii",   Function, 0);
+    SPV_OP(133, FMul,                  "trii",   Function, 0);
+    SPV_OP(134, UDiv,                  "trii",   Function, 0);
+    SPV_OP(135, SDiv,                  "trii",   Function, 0);
+    SPV_OP(136, FDiv,                  "trii",   Function, 0);
+    SPV_OP(137, UMod,                  "trii",   Function, 0);
+    SPV_OP(138, SRem,                  "trii",   Function, 0);
+    SPV_OP(139, SMod,                  "trii",   Function, 0);
+    SPV_OP(140, FRem,                  "trii",   Function, 0);
+    SPV_OP(141, FMod,                  "trii",   Function, 0);
+    SPV_OP(142, VectorTimesScalar,     "trii",   Function, 0);
+    SPV_OP(143, MatrixTimesScalar,     "trii",   Function, 0);
+    SPV_OP(144, VectorTimesMatrix,     "trii",   Function, 0);
+    SPV_OP(145, MatrixTimesVector,     "trii",   Function, 0);
+    SPV_OP(146, MatrixTimesMatrix,     "trii",   Function, 0);
+    SPV_OP(147, OuterProduct,          "trii",   Function, 0);
+    SPV_OP(148, Dot,                   "trii",   Function, 0);
+    SPV_OP(154, Any,                   "tri",    Function, 0);
+    SPV_OP(155, All,                   "tri",    Function, 0);
+    SPV_OP(156, IsNan,                 "tri",    Function, 0);
+    SPV_OP(157, IsInf,                 "tri",    Function, 0);
+    SPV_OP(164, LogicalEqual,          "trii",   Function, 0);
+    SPV_OP(165, LogicalNotEqual,       "trii",   Function, 0);
+    SPV_OP(166, LogicalOr,             "trii",   Function, 0);
+    SPV_OP(167, LogicalAnd,            "trii",   Function, 0);
+    SPV_OP(168, LogicalNot,            "tri",    Function, 0);
+    SPV_OP(169, Select,                "triii",  Function, 0);
+    SPV_OP(170, IEqual,                "trii",   Function, 0);
+    SPV_OP(171, INotEqual,             "trii",   Function, 0);
+    SPV_OP(172, UGreaterThan,          "trii",   Function, 0);
+    SPV_OP(173, SGreaterThan,          "trii",   Function, 0);
+    SPV_OP(174, UGreaterThanEqual,     "trii",   Function, 0);
+    SPV_OP(175, SGreaterThanEqual,     "trii",   Function, 0);
+    SPV_OP(176, ULessThan,             "trii",   Function, 0);
+    SPV_OP(177, SLessThan,             "trii",   Function, 0);
+    SPV_OP(178, ULessThanEqual,        "trii",   Function, 0);
+    SPV_OP(179, SLessThanEqual,        "trii",   Function, 0);
+    SPV_OP(180, FOrdEqual,             "trii",   Function, 0);
+    SPV_OP(181, FUnordEqual,           "trii",   Function, 0);
+    SPV_OP(182, FOrdNotEqual,          "trii",   Function, 0);
+    SPV_OP(183, FUnordNotEqual,        "trii",   Function, 0);
+    SPV_OP(184, FOrdLessThan,          "trii",   Function, 0);
+    SPV_OP(185, FUnordLessThan,        "trii",   Function, 0);
+    SPV_OP(186, FOrdGreaterThan,       "trii",   Function, 0);
+    SPV_OP(187, FUnordGreaterThan,     "trii",   Function, 0);
+    SPV_OP(188, FOrdLessThanEqual,     "trii",   Function, 0);
+    SPV_OP(189, FUnordLessThanEqual,   "trii",   Function, 0);
+    SPV_OP(190, FOrdGreaterThanEqual,  "trii",   Function, 0);
+    SPV_OP(191, FUnordGreaterThanEqual,"trii",   Function, 0);
+    SPV_OP(194, ShiftRightLogical,     "trii",   Function, 0);
+    SPV_OP(195, ShiftRightArithmetic,  "trii",   Function, 0);
+    SPV_OP(196, ShiftLeftLogical,      "trii",   Function, 0);
+    SPV_OP(197, BitwiseOr,             "trii",   Function, 0);
+    SPV_OP(198, BitwiseXor,            "trii",   Function, 0);
+    SPV_OP(199, BitwiseAnd,            "trii",   Function, 0);
+    SPV_OP(200, Not,                   "tri",    Function, 0);
+    SPV_OP(245, Phi,                   "trf*",   Function, 0);
+    SPV_OP(246, LoopMerge,             "ffl*",   Function, 0);
+    SPV_OP(247, SelectionMerge,        "fl",     Function, 0);
+    SPV_OP(248, Label,                 "r",      Function, 0);
+    SPV_OP(249, Branch,                "f",      Function, SpvOpFlag_Terminator);
+    SPV_OP(250, BranchConditional,     "iffl*",  Function, SpvOpFlag_Terminator);
+    SPV_OP(252, Kill,                  "",       Function, SpvOpFlag_Terminator);
+    SPV_OP(253, Return,                "",       Function, SpvOpFlag_Terminator);
+    SPV_OP(254, ReturnValue,           "i",      Function, SpvOpFlag_Terminator);
+    SPV_OP(255, Unreachable,           "",       Function, SpvOpFlag_Terminator);
+#undef SPV_OP
+    return t;
+}
+
+static constexpr SpvOpTable SpvOps = MakeSpvOpTable();
+
+const SpvOpInfo *SpvLookupOp(uint16_t opcode)
+{
+    return opcode < lengthof(SpvOps.info) && SpvOps.info[opcode].name ? &SpvOps.info[opcode] : nullptr;
+}
+
+static bool
+HasZeroByte(uint32_t w)
+{
+    return ((w - 0x01010101u) & ~w & 0x80808080u) != 0;
+}
+
+
+enum SpvIdKind : uint8_t {
+    SpvIdKind_Undefined,
+    SpvIdKind_Type,
+    SpvIdKind_Value, // anything not a type: values, labels, functions, strings, imports
+};
+
+struct SpvForwardRef {
+    uint32_t id;
+    uint32_t wordOffset; // of the referencing instruction
+};
+
+enum : uint32_t { SpvMaxBound = 0x400000 }; // the universal limit on the Bound, 4194304
+
+static bool
+Fail(SpvValidationError *pError, uint wordOffset, const char *what)
+{
+    pError->wordOffset = wordOffset;
+    pError->what = what;
+    return false;
+}
+
+// One pass, in instruction order; only ids referenced forward are remembered for later.
+bool SpvValidate(view<const uint32_t> module, SpvValidationError *pError)
+{
+    SpvReader r;
+    const SpvHeader *header;
+    if (!SpvReader_Begin(&r, module, &header)) {
+        return Fail(pError, 0, "shorter than a header");
+    }
+    if (header->magic != SpvMagic) {
+        return Fail(pError, 0, header->magic == 0x03022307 ? "other byte order" : "bad magic number");
+    }
+    if ((header->version & 0xff0000ff) || header->version < 0x00010000 || header->version > 0x00010600) {
+        return Fail(pError, 0, "unknown version");
+    }
+    uint32_t const bound = header->bound;
+    if (bound == 0 || bound > SpvMaxBound) {
+        return Fail(pError, 0, "bound out of range");
+    }
+    if (header->schema != 0) {
+        return Fail(pError, 0, "schema not 0");
+    }
+
+    Array<uint8_t> idKinds;
+    memset(idKinds.uninitialized_push_n(bound), SpvIdKind_Undefined, bound);
+    uint8_t *const kinds = idKinds.data();
+    Array<SpvForwardRef> forwardRefs;
+
+    uint layout = SpvLayout_Capability; // of the last instruction outside functions
+    bool bInFunction = false, bInBlock = false, bSeenLabel = false;
+    uint nMemoryModels = 0;
+
+    SpvInstruction inst;
+    while (SpvReader_Next(&r, &inst)) {
+        uint const offset = uint(inst.words - module.ptr);
+        const SpvOpInfo *const op = SpvLookupOp(inst.opcode);
+        if (!op) {
+            return Fail(pError, offset, "unknown opcode");
+        }
+
+        // Layout:
+        if (inst.opcode == SpvOp_Function) {
+            if (bInFunction) {
+                return Fail(pError, offset, "OpFunction inside a function");
+            }
+            bInFunction = true;
+            bInBlock = bSeenLabel = false;
+            layout = SpvLayout_Function;
+        }
+        else if (bInFunction) {
+            switch (inst.opcode) {
+            case SpvOp_FunctionParameter:
+                if (bSeenLabel) {
+                    return Fail(pError, offset, "OpFunctionParameter after the first block");
+                }
+                break;
+            case SpvOp_Label:
+                if (bInBlock) {
+                    return Fail(pError, offset, "OpLabel inside a block");
+                }
+                bInBlock = bSeenLabel = true;
+                break;
+            case SpvOp_FunctionEnd:
+                if (bInBlock) {
+                    return Fail(pError, offset, "block without a terminator");
+                }
+                bInFunction = false;
+                break;
+            default:
+                if (!bInBlock) {
+                    return Fail(pError, offset, "instruction outside a block");
+                }
+                if (op->layout != SpvLayout_Function && op->layout != SpvLayout_Anywhere && !(op->flags & SpvOpFlag_InBlock)) {
+                    return Fail(pError, offset, "instruction not allowed in a function");
+                }
+                bInBlock = !(op->flags & SpvOpFlag_Terminator);
+                break;
+            }
+        }
+        else if (op->layout == SpvLayout_Function) {
+            return Fail(pError, offset, "instruction outside a function");
+        }
+        else if (op->layout != SpvLayout_Anywhere) {
+            if (op->layout < layout) {
+                return Fail(pError, offset, "instruction out of layout order");
+            }
+            layout = op->layout;
+        }
+        nMemoryModels += inst.opcode == SpvOp_MemoryModel;
+
+        // Operands:
+        const uint32_t *w = inst.words + 1;
+        const uint32_t *const end = inst.words + inst.nWords;
+        uint32_t resultId = 0;
+        for (const char *p = op->operands; *p; ++p) {
+            char const kind = *p;
+            bool const bMany = p[1] == '*';
+            bool const bOptional = bMany || p[1] == '?';
+            p += bOptional;
+            do {
+                if (w == end) {
+                    if (bOptional) {
+                        break;
+                    }
+                    return Fail(pError, offset, "too few operands");
+                }
+                if (kind == 'l') {
+                    ++w;
+                    continue;
+                }
+                if (kind == 's') {
+                    while (w != end && !HasZeroByte(*w)) {
+                        ++w;
+                    }
+                    if (w == end) {
+                        return Fail(pError, offset, "unterminated string");
+                    }
+                    ++w;
+                    continue;
+                }
+                uint32_t const id = *w++;
+                if (id == 0 || id >= bound) {
+                    return Fail(pError, offset, "id out of bounds");
+                }
+                switch (kind) {
+                case 'r':
+                    if (kinds[id] != SpvIdKind_Undefined) {
+                        return Fail(pError, offset, "id defined twice");
+                    }
+                    resultId = id;
+                    break;
+                case 't':
+                    if (kinds[id] != SpvIdKind_Type) {
+                        return Fail(pError, offset, kinds[id] ? "type operand is not a type" : "type used before its definition");
+                    }
+                    break;
+                case 'i':
+                    if (kinds[id] == SpvIdKind_Undefined) {
+                        return Fail(pError, offset, "id used before its definition");
+                    }
+                    break;
+                case 'f':
+                    if (kinds[id] == SpvIdKind_Undefined) {
+                        forwardRefs.push({ id, offset });
+                    }
+                    break;
+                }
+            } while (bMany);
+        }
+        if (w != end) {
+            return Fail(pError, offset, "too many operands");
+        }
+        if (resultId) { // only now, so an instruction can't use its own result
+            kinds[resultId] = op->flags & SpvOpFlag_Type ? SpvIdKind_Type : SpvIdKind_Value;
+        }
+    }
+
+    if (r.cur != r.end) {
+        return Fail(pError, uint(r.cur - module.ptr), "bad word count");
+    }
+    if (bInFunction) {
+        return Fail(pError, module.length, "OpFunction without OpFunctionEnd");
+    }
+    if (nMemoryModels != 1) {
+        return Fail(pError, module.length, "not exactly one OpMemoryModel");
+    }
+    for (const SpvForwardRef& ref : forwardRefs) {
+        if (kinds[ref.id] == SpvIdKind_Undefined) {
+            return Fail(pError, ref.wordOffset, "forward reference to an id never defined");
+        }
+    }
+    return true;
+}
+
+
+// Disassembly goes through this buffer, so pfnWrite is called once per few KB rather than per token.
+struct SpvTextBuffer {
+    SpvTextWriteFn pfnWrite;
+    void *user;
+    uint n;
+    char text[8192];
+};
+
+static void
+FlushText(SpvTextBuffer *b)
+{
+    if (b->n) {
+        b->pfnWrite(b->user, b->text, b->n);
+        b->n = 0;
+    }
+}
+
+static void
+PutText(SpvTextBuffer *b, const char *s, uint n)
+{
+    while (n > sizeof(b->text) - b->n) {
+        uint const part = sizeof(b->text) - b->n;
+        memcpy(b->text + b->n, s, part);
+        b->n += part;
+        FlushText(b);
+        s += part;
+        n -= part;
+    }
+    memcpy(b->text + b->n, s, n);
+    b->n += n;
+}
+
+static void
+PutCString(SpvTextBuffer *b, const char *s)
+{
+    PutText(b, s, uint(strlen(s)));
+}
+
+static void
+PutU32(SpvTextBuffer *b, const char *prefix, uint32_t x) // " 123", "%123"; prefix of at most 4 chars
+{
+    char digits[16];
+    char *p = endof(digits);
+    do {
+        *--p = char('0' + x % 10);
+        x /= 10;
+    } while (x);
+    uint const nPrefix = uint(strlen(prefix));
+    p -= nPrefix;
+    memcpy(p, prefix, nPrefix);
+    PutText(b, p, uint(endof(digits) - p));
+}
+
+// Returns past the word with the '\0', or end if there is none.
+static const uint32_t *
+PutString(SpvTextBuffer *b, const uint32_t *w, const uint32_t *end)
+{
+    PutText(b, " \"", 2);
+    for (; w != end; ++w) {
+        for (uint i = 0; i < 4; ++i) {
+            char const c = char(*w >> 8 * i);
+            if (c == '\0') {
+                PutText(b, "\"", 1);
+                return w + 1;
+            }
+            if (c == '"' || c == '\\') {
+                PutText(b, "\\", 1);
+            }
+            PutText(b, &c, 1);
+        }
+    }
+    PutText(b, "\"", 1);
+    return end;
+}
+
+void SpvDisassemble(view<const uint32_t> module, SpvTextWriteFn pfnWrite, void *user)
+{
+    SpvTextBuffer buffer;
+    SpvTextBuffer *const b = &buffer;
+    b->pfnWrite = pfnWrite;
+    b->user = user;
+    b->n = 0;
+
+    SpvReader r;
+    const SpvHeader *header;
+    if (!SpvReader_Begin(&r, module, &header)) {
+        PutCString(b, "; shorter than a SPIR-V header\n");
+        FlushText(b);
+        return;
+    }
+    PutCString(b, "; SPIR-V\n; Version:");
+    PutU32(b, " ", header->version >> 16 & 0xff);
+    PutU32(b, ".", header->version >> 8 & 0xff);
+    PutCString(b, "\n; Generator:");
+    PutU32(b, " ", header->generator);
+    PutCString(b, "\n; Bound:");
+    PutU32(b, " ", header->bound);
+    PutCString(b, "\n; Schema:");
+    PutU32(b, " ", header->schema);
+    PutCString(b, "\n");
+
+    SpvInstruction inst;
+    while (SpvReader_Next(&r, &inst)) {
+        const uint32_t *w = inst.words + 1;
+        const uint32_t *const end = inst.words + inst.nWords;
+        const SpvOpInfo *const op = SpvLookupOp(inst.opcode);
+        if (!op) {
+            PutU32(b, "Op", inst.opcode);
+            for (; w != end; ++w) {
+                PutU32(b, " ", *w);
+            }
+            PutText(b, "\n", 1);
+            continue;
+        }
+
+        const char *p = op->operands;
+        const uint32_t *type = nullptr;
+        if (*p == 't' && w != end) {
+            type = w++;
+            ++p;
+        }
+        if (*p == 'r' && w != end) {
+            PutU32(b, "%", *w++);
+            PutText(b, " = ", 3);
+            ++p;
+        }
+        PutCString(b, op->name);
+        if (type) {
+            PutU32(b, " %", *type);
+        }
+        for (; *p && w != end; ++p) {
+            char const kind = *p;
+            bool const bMany = p[1] == '*';
+            p += bMany || p[1] == '?';
+            do {
+                if (kind == 's') {
+                    w = PutString(b, w, end);
+                }
+                else {
+                    PutU32(b, kind == 'l' ? " " : " %", *w++);
+                }
+            } while (bMany && w != end);
+        }
+        for (; w != end; ++w) { // more operands than the table has
+            PutU32(b, " ", *w);
+        }
+        PutText(b, "\n", 1);
+    }
+    if (r.cur != r.end) {
+        PutCString(b, "; bad word count at word");
+        PutU32(b, " ", uint32_t(r.cur - module.ptr));
+        PutText(b, "\n", 1);
+    }
+    FlushText(b);
+}
+
+
+bool SpvMapFile(const char *path, SpvMappedFile *pOut)
+{
+    *pOut = { };
+#if defined __linux__
+    int const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size % sizeof(uint32_t) == 0 && st.st_size < off_t(1) << 34) {
+        m = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (m == MAP_FAILED) {
+        return false;
+    }
+#else
+    struct stat st;
+    FILE *const fp = stat(path, &st) == 0 && st.st_size > 0 && st.st_size % sizeof(uint32_t) == 0 ? fopen(path, "rb") : nullptr;
+    if (!fp) {
+        return false;
+    }
+    void *const m = Allocate<uint32_t>(size_t(st.st_size) / sizeof(uint32_t));
+    size_t const n = fread(m, 1, size_t(st.st_size), fp);
+    fclose(fp);
+    if (n != size_t(st.st_size)) {
+        Deallocate(m);
+        return false;
+    }
+#endif
+    pOut->words = { static_cast<const uint32_t *>(m), uint(size_t(st.st_size) / sizeof(uint32_t)) };
+    pOut->mapping = m;
+    return true;
+}
+
+void SpvUnmapFile(SpvMappedFile *file)
+{
+    if (!file->mapping) {
+        return;
+    }
+#if defined __linux__
+    munmap(file->mapping, size_t(file->words.length) * sizeof(uint32_t));
+#else
+    Deallocate(file->mapping);
+#endif
+    *file = { };
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * Reading SPIR-V modules without the SDK: a word-stream reader, a structural validator and a disassembler, over a
+ * module in memory (e.g. from SpvLinkSections()) or mapped from a file. Nothing is copied, instructions point into
+ * the module's words.
+ *
+ * The validator is the subset of spirv-val that catches emitter bugs in one cheap pass: the header, each
+ * instruction's word count against its operands, ids below the Bound and defined once, result types and operands
+ * defined before use (except where SPIR-V allows forward references: names, decorations, entry points, calls,
+ * branch targets and OpPhi), and the logical layout's section order and block structure. Only the opcodes in the
+ * table in spvreader.cpp are known, any other is an error. Modules must be in the host's byte order.
+ */
+enum : uint32_t { SpvMagic = 0x07230203 };
+
+struct SpvHeader {
+    uint32_t magic;
+    uint32_t version; // 0x00010300 for 1.3
+    uint32_t generator;
+    uint32_t bound; // all ids are below it
+    uint32_t schema;
+};
+
+struct SpvInstruction {
+    const uint32_t *words; // words[0] holds the word count and the opcode
+    uint16_t opcode;
+    uint16_t nWords; // including words[0]
+};
+
+struct SpvReader {
+    const uint32_t *cur;
+    const uint32_t *end;
+};
+
+// False if the module is shorter than its header. The header itself is not checked.
+inline bool
+SpvReader_Begin(SpvReader *r, view<const uint32_t> module, const SpvHeader **ppHeader)
+{
+    if (module.length < sizeof(SpvHeader) / sizeof(uint32_t)) {
+        return false;
+    }
+    *ppHeader = reinterpret_cast<const SpvHeader *>(module.ptr);
+    r->cur = module.ptr + sizeof(SpvHeader) / sizeof(uint32_t);
+    r->end = module.ptr + module.length;
+    return true;
+}
+
+// False at the end, and on a word count of 0 or past the end; r->cur is then left on it, before r->end.
+inline bool
+SpvReader_Next(SpvReader *r, SpvInstruction *inst)
+{
+    if (r->cur == r->end) {
+        return false;
+    }
+    uint32_t const first = *r->cur;
+    uint const nWords = first >> 16;
+    if (nWords == 0 || nWords > uint(r->end - r->cur)) {
+        return false;
+    }
+    inst->words = r->cur;
+    inst->opcode = uint16_t(first);
+    inst->nWords = uint16_t(nWords);
+    r->cur += nWords;
+    return true;
+}
+
+// Logical layout sections, in the order a module must have them.
+enum SpvLayout : uint8_t {
+    SpvLayout_Capability,
+    SpvLayout_Extension,
+    SpvLayout_ExtInstImport,
+    SpvLayout_MemoryModel,
+    SpvLayout_EntryPoint,
+    SpvLayout_ExecutionMode,
+    SpvLayout_Debug,      // OpString, OpName, OpMemberName
+    SpvLayout_Annotation, // OpDecorate, OpMemberDecorate
+    SpvLayout_Global,     // types, constants, global variables
+    SpvLayout_Function,   // OpFunction and all that goes in one
+    SpvLayout_Anywhere,   // OpNop
+};
+
+enum SpvOpFlags : uint8_t {
+    SpvOpFlag_Type       = 1 << 0, // the result is a type
+    SpvOpFlag_Terminator = 1 << 1, // ends a block
+    SpvOpFlag_InBlock    = 1 << 2, // SpvLayout_Global, but also allowed in a block
+    SpvOpFlag_Constant   = 1 << 3, // not specializable, so two with the same operands are the same value
+};
+
+/*
+    Operands, one character each:
+        'r'  the result id
+        't'  a type: the result type, or a type operand of a type, function or variable declaration
+        'i'  an id defined before this instruction
+        'f'  an id that may also be defined later, a forward reference
+        'l'  a literal word
+        's'  a literal string, up to and including the word with its '\0'
+    followed by '*' for any number of them, or '?' for an optional one. Either can only be last.
+**/
+struct SpvOpInfo {
+    const char *name; // null for opcodes not in the table
+    const char *operands;
+    uint8_t layout;
+    uint8_t flags;
+};
+
+const SpvOpInfo *SpvLookupOp(uint16_t opcode);
+
+// Index of the result id word in an instruction with these operands, 0 if none.
+inline uint
+SpvResultWord(const SpvOpInfo *op)
+{
+    return op->operands[0] == 'r' ? 1 : op->operands[0] == 't' && op->operands[1] == 'r' ? 2 : 0;
+}
+
+// The words of a literal string starting at w, up to and including the one with the '\0'.
+inline uint
+SpvStringWords(const uint32_t *w)
+{
+    uint n = 1;
+    while (!((w[n - 1] - 0x01010101u) & ~w[n - 1] & 0x80808080u)) { // no zero byte
+        n += 1;
+    }
+    return n;
+}
+
+/*
+    Calls visit(i, kind) for each operand word i of a valid instruction, with kind one of "rtifl": the pattern
+    character of the word, 'l' for the words of a string.
+**/
+template<class Visit> void
+SpvForEachOperandWord(const uint32_t *inst, const SpvOpInfo *op, Visit visit)
+{
+    uint const nWords = inst[0] >> 16;
+    uint i = 1;
+    for (const char *p = op->operands; *p && i < nWords; ++p) {
+        char const kind = *p;
+        bool const bMany = p[1] == '*';
+        p += bMany || p[1] == '?';
+        do {
+            if (kind == 's') {
+                uint const end = i + SpvStringWords(inst + i);
+                for (; i < end; ++i) {
+                    visit(i, 'l');
+                }
+            }
+            else {
+                visit(i++, kind);
+            }
+        } while (bMany && i < nWords);
+    }
+}
+
+// The opcodes code looks at by value:
+enum : uint16_t {
+    SpvOp_Nop = 0,
+    SpvOp_Name = 5,
+    SpvOp_MemberName = 6,
+    SpvOp_String = 7,
+    SpvOp_Extension = 10,
+    SpvOp_ExtInstImport = 11,
+    SpvOp_MemoryModel = 14,
+    SpvOp_Capability = 17,
+    SpvOp_TypeVoid = 19,
+    SpvOp_TypeBool = 20,
+    SpvOp_TypeInt = 21,
+    SpvOp_TypeFloat = 22,
+    SpvOp_TypeVector = 23,
+    SpvOp_TypeArray = 28,
+    SpvOp_TypeFunction = 33,
+    SpvOp_ConstantTrue = 41,
+    SpvOp_ConstantFalse = 42,
+    SpvOp_Constant = 43,
+    SpvOp_ConstantComposite = 44,
+    SpvOp_Function = 54,
+    SpvOp_FunctionParameter = 55,
+    SpvOp_FunctionEnd = 56,
+    SpvOp_Variable = 59,
+    SpvOp_Decorate = 71,
+    SpvOp_MemberDecorate = 72,
+    SpvOp_VectorShuffle = 79,
+    SpvOp_CompositeConstruct = 80,
+    SpvOp_CompositeExtract = 81,
+    SpvOp_FConvert = 115,
+    SpvOp_SNegate = 126,
+    SpvOp_FNegate = 127,
+    SpvOp_IAdd = 128,
+    SpvOp_FAdd = 129,
+    SpvOp_ISub = 130,
+    SpvOp_FSub = 131,
+    SpvOp_IMul = 132,
+    SpvOp_FMul = 133,
+    SpvOp_UDiv = 134,
+    SpvOp_SDiv = 135,
+    SpvOp_FDiv = 136,
+    SpvOp_UMod = 137,
+    SpvOp_SRem = 138,
+    SpvOp_SMod = 139,
+    SpvOp_FRem = 140,
+    SpvOp_FMod = 141,
+    SpvOp_VectorTimesScalar = 142,
+    SpvOp_Dot = 148,
+    SpvOp_Select = 169,
+    SpvOp_IEqual = 170,
+    SpvOp_INotEqual = 171,
+    SpvOp_UGreaterThan = 172,
+    SpvOp_SGreaterThan = 173,
+    SpvOp_UGreaterThanEqual = 174,
+    SpvOp_SGreaterThanEqual = 175,
+    SpvOp_ULessThan = 176,
+    SpvOp_SLessThan = 177,
+    SpvOp_ULessThanEqual = 178,
+    SpvOp_SLessThanEqual = 179,
+    SpvOp_FOrdLessThan = 184,
+    SpvOp_ShiftRightLogical = 194,
+    SpvOp_ShiftRightArithmetic = 195,
+    SpvOp_ShiftLeftLogical = 196,
+    SpvOp_BitwiseOr = 197,
+    SpvOp_BitwiseXor = 198,
+    SpvOp_BitwiseAnd = 199,
+    SpvOp_Not = 200,
+    SpvOp_Phi = 245,
+    SpvOp_LoopMerge = 246,
+    SpvOp_Label = 248,
+    SpvOp_Branch = 249,
+    SpvOp_BranchConditional = 250,
+    SpvOp_Return = 253,
+    SpvOp_ReturnValue = 254,
+};
+
+struct SpvValidationError {
+    uint wordOffset; // of the failing instruction from the start of the module, 0 for the header
+    const char *what;
+};
+
+bool SpvValidate(view<const uint32_t> module, SpvValidationError *pError);
+
+// "%5 = OpIAdd %1 %4 %4", one line per instruction after a few "; " header lines, in the style of spirv-dis.
+// Text goes out through pfnWrite in chunks of a few KB. A malformed module is disassembled up to where it breaks.
+typedef void (*SpvTextWriteFn)(void *user, const char *text, uint nBytes);
+void SpvDisassemble(view<const uint32_t> module, SpvTextWriteFn pfnWrite, void *user);
+
+// A .spv file, mmapped where possible. False if it can't be read, is empty or isn't a whole number of words.
+struct SpvMappedFile {
+    view<const uint32_t> words;
+    void *mapping;
+};
+
+bool SpvMapFile(const char *path, SpvMappedFile *pOut);
+void SpvUnmapFile(SpvMappedFile *file);
@@ -0,0 +1,26 @@
+#include "common.h"
+
+#include "spvsection.h"
+
+#include <string.h>
+
+SpvId SpvLinkSections(view<const SpvSection *const> sections, SpvId firstId, Array<uint32_t> *pOut)
+{
+    uint nWords = 0;
+    for (const SpvSection *s : sections) {
+        nWords += s->words.size();
+    }
+    pOut->reserve(pOut->size() + nWords);
+
+    // Each section's base only depends on the ones before it, so this is the whole ordering decision:
+    SpvId base = firstId;
+    for (const SpvSection *s : sections) {
+        uint32_t *const dst = pOut->uninitialized_push_n(s->words.size());
+        memcpy(dst, s->words.data(), s->words.size() * sizeof(uint32_t));
+        for (uint32_t i : s->localIdWords) {
+            dst[i] += base;
+        }
+        base = SpvId(base + s->nLocalIds);
+    }
+    return base;
+}
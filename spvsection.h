@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * A section of SPIR-V words, typically one function, emitted on its own with its own id space.
+ *
+ * Ids a section defines are local: numbered from 0 in the order the section allocates them, and each word
+ * holding one is recorded. Ids defined outside any section (types, constants, imports) are global and are
+ * written as is. SpvLinkSections() then moves each section's local ids to right after the previous section's,
+ * patching only the recorded words. The result depends only on the section order, not on which thread
+ * emitted what or when, and the ids are dense, so the module's Bound is exactly the number of ids used.
+ */
+struct SpvSection {
+    Array<uint32_t> words;
+    Array<uint32_t> localIdWords; // indices into words that hold a local id
+    uint32_t nLocalIds = 0;
+};
+
+inline SpvId
+SpvSection_NewLocalId(SpvSection *section)
+{
+    return SpvId(section->nLocalIds++);
+}
+
+inline void
+SpvSection_PushOp(SpvSection *section, uint16_t opcode, uint nWords) // nWords includes this one
+{
+    section->words.push(uint32_t(nWords) << 16 | opcode);
+}
+
+inline void
+SpvSection_PushWord(SpvSection *section, uint32_t word) // a literal, or a global id
+{
+    section->words.push(word);
+}
+
+inline void
+SpvSection_PushLocalId(SpvSection *section, SpvId localId)
+{
+    ASSERT(localId < section->nLocalIds);
+    section->localIdWords.push(section->words.size());
+    section->words.push(localId);
+}
+
+// Appends the sections in order, with local ids renumbered from firstId on. Returns the id after the last one used.
+SpvId SpvLinkSections(view<const SpvSection *const> sections, SpvId firstId, Array<uint32_t> *pOut);
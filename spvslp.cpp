@@ -0,0 +1,477 @@
+#include "common.h"
+
+#include "spvslp.h"
+#include "spvpool.h"
+#include "spvreader.h"
+
+#include <string.h>
+
+enum : uint8_t {
+    IdFlag_Decorated = 1 << 0,
+    IdFlag_InTree = 1 << 1, // a lane of the tree being grown
+    IdFlag_Claimed = 1 << 2, // a lane of a packed tree
+    IdFlag_Removed = 1 << 3, // its instruction isn't written
+};
+
+enum : uint32_t {
+    SlpRef_Leaf = 1u << 31, // a node's operand: a node index, or a leaf index with this
+    SlpAction_Remove = 1,   // actions over 1 are the index of the node to write there + 2
+};
+
+enum SlpLeafKind : uint8_t {
+    SlpLeaf_Source,   // the vector the lanes were extracted from, in order
+    SlpLeaf_Constant, // an OpConstantComposite
+    SlpLeaf_Splat,    // an OpCompositeConstruct of one value
+    SlpLeaf_Shuffle,  // an OpVectorShuffle of the vectors the lanes were extracted from
+    SlpLeaf_Gather,   // an OpCompositeConstruct
+};
+
+struct SlpNode {
+    uint32_t lanes[4]; // the scalar ops' results
+    uint32_t operands[2]; // SlpRef
+    uint32_t emitAt; // offset of the instruction the vector op goes in place of
+    uint32_t type; // the vector's, once packed
+    uint32_t id; // the vector's, once written, but for the root's, which is the seed's
+    uint16_t opcode;
+    uint8_t nOperands;
+    uint8_t nLanes; // of its tree
+    uint8_t externalMask; // lanes still used as scalars elsewhere, extracted after the vector op
+};
+
+struct SlpLeaf {
+    uint32_t values[4]; // the scalars, or for SlpLeaf_Shuffle the component indices
+    uint32_t sources[2]; // the vectors extracted from, for SlpLeaf_Source and SlpLeaf_Shuffle; 0 if just one
+    uint32_t type; // the scalars', the vector's once packed
+    uint32_t id; // the vector, once written
+    uint8_t nLanes; // of its tree
+    uint8_t kind; // SlpLeafKind
+};
+
+struct SlpVectorizer {
+    view<const uint32_t> module;
+    const SpvSlpOptions *options;
+    uint32_t bound; // of the input
+    Array<uint32_t> defOffsets; // per input id: where its instruction is, 0 if not defined
+    Array<uint32_t> useCounts; // per input id: uses in functions
+    Array<uint32_t> firstUses; // per input id: offset of the first instruction using it, ~0u if none
+    Array<uint32_t> secondUses; // and the second, the same for an instruction using it twice
+    Array<uint8_t> idFlags; // per input id: IdFlag_
+    Array<uint32_t> actions; // per input id: what to do at the instruction defining it, 0 to copy it
+    Array<uint32_t> vectorTypes; // per input scalar type * 3 + components - 2: the vector type, 0 if none yet
+    Array<SlpNode> nodes; // of all packed trees, and the one being grown
+    Array<SlpLeaf> leaves;
+    Array<uint32_t> treeIds; // flagged IdFlag_InTree
+    Array<uint32_t> treeExtracts; // OpCompositeExtracts whose only use the tree replaces
+    SpvPool pool; // new vector types and constants
+    uint nLanes; // of the tree being grown, the written ones have theirs
+    uint nodesBegin; // its first node
+    uint blockBegin; // of its seed's block
+    int delta; // its instructions less those it replaces
+    bool bFailed;
+};
+
+static const uint32_t *
+Definition(SlpVectorizer *s, uint32_t id)
+{
+    return id < s->bound && s->defOffsets[id] ? s->module.ptr + s->defOffsets[id] : nullptr;
+}
+
+static uint32_t
+ValueType(SlpVectorizer *s, uint32_t id) // 0 if it isn't a value
+{
+    const uint32_t *const def = Definition(s, id);
+    return def && SpvResultWord(SpvLookupOp(uint16_t(def[0]))) == 2 ? def[1] : 0;
+}
+
+static bool
+IsScalarType(SlpVectorizer *s, uint32_t type)
+{
+    const uint32_t *const def = Definition(s, type);
+    return def && (uint16_t(def[0]) == SpvOp_TypeInt || uint16_t(def[0]) == SpvOp_TypeFloat);
+}
+
+static bool
+IsLanewise(uint16_t opcode) // the vector op is the scalar one on each component
+{
+    return (opcode >= SpvOp_SNegate && opcode <= SpvOp_FMod) || (opcode >= SpvOp_ShiftRightLogical && opcode <= SpvOp_Not);
+}
+
+static uint
+CountUses(const uint32_t *inst, uint32_t id)
+{
+    uint n = 0;
+    SpvForEachOperandWord(inst, SpvLookupOp(uint16_t(inst[0])), [&](uint i, char kind) {
+        n += (kind == 'i' || kind == 'f') && inst[i] == id;
+    });
+    return n;
+}
+
+static uint32_t
+VectorType(SlpVectorizer *s, uint32_t scalarType, uint n)
+{
+    uint32_t& type = s->vectorTypes[scalarType * 3 + n - 2];
+    if (!type) {
+        type = SpvPool_VectorType(&s->pool, SpvTypeId(scalarType), n);
+    }
+    return type;
+}
+
+static uint32_t BuildOperand(SlpVectorizer *s, const uint32_t *values, const uint32_t *parents, uint32_t minEmitAt);
+
+/*
+    The lanes as a node, if they are the same lanewise op in the seed's block, none yet in a tree, and their vector
+    op can go after the last of them without any other use of them coming first. ~0u if not.
+**/
+static uint32_t
+BuildNode(SlpVectorizer *s, const uint32_t *values, const uint32_t *parents, uint32_t minEmitAt)
+{
+    const uint32_t *const w = s->module.ptr;
+    uint const n = s->nLanes;
+    const uint32_t *const first = Definition(s, values[0]);
+    if (!first || s->nodes.size() - s->nodesBegin >= s->options->maxNodes || !IsLanewise(uint16_t(first[0])) ||
+        !IsScalarType(s, first[1])) {
+        return ~0u;
+    }
+    uint32_t emitAt = minEmitAt;
+    uint32_t laneOffsets[4];
+    for (uint j = 0; j < n; ++j) {
+        const uint32_t *const def = Definition(s, values[j]);
+        laneOffsets[j] = def ? uint32_t(def - w) : 0;
+        if (!def || laneOffsets[j] < s->blockBegin || laneOffsets[j] >= parents[j] || def[0] != first[0] ||
+            def[1] != first[1] || (s->idFlags[values[j]] & (IdFlag_Decorated | IdFlag_InTree | IdFlag_Claimed))) {
+            return ~0u;
+        }
+        for (uint k = 0; k < j; ++k) {
+            if (values[k] == values[j]) {
+                return ~0u;
+            }
+        }
+        emitAt = Max(emitAt, laneOffsets[j]);
+    }
+    uint8_t externalMask = 0;
+    for (uint j = 0; j < n; ++j) {
+        uint32_t const v = values[j];
+        uint const parentUses = CountUses(w + parents[j], v);
+        if (s->useCounts[v] == parentUses) {
+            continue;
+        }
+        uint32_t const earliest = s->firstUses[v] == parents[j] ? s->secondUses[v] : s->firstUses[v];
+        if (parentUses > 1 || earliest <= emitAt) {
+            return ~0u;
+        }
+        externalMask |= 1 << j;
+    }
+
+    for (uint j = 0; j < n; ++j) {
+        s->idFlags[values[j]] |= IdFlag_InTree;
+        s->treeIds.push(values[j]);
+    }
+    uint const index = s->nodes.size();
+    SlpNode& node = *s->nodes.uninitialized_push();
+    node = { };
+    memcpy(node.lanes, values, n * sizeof(uint32_t));
+    node.emitAt = emitAt;
+    node.opcode = uint16_t(first[0]);
+    node.nOperands = uint8_t((first[0] >> 16) - 3);
+    node.nLanes = uint8_t(n);
+    node.externalMask = externalMask;
+    s->delta += 1 - int(n) + __builtin_popcount(externalMask);
+    uint32_t operands[2][4];
+    for (uint k = 0; k < node.nOperands; ++k) {
+        for (uint j = 0; j < n; ++j) {
+            operands[k][j] = w[laneOffsets[j] + 3 + k];
+        }
+        uint32_t const ref = k == 1 && memcmp(operands[1], operands[0], n * sizeof(uint32_t)) == 0 ?
+            s->nodes[index].operands[0] : BuildOperand(s, operands[k], laneOffsets, 0);
+        s->nodes[index].operands[k] = ref;
+    }
+    return index;
+}
+
+static uint32_t
+BuildLeaf(SlpVectorizer *s, const uint32_t *values)
+{
+    uint const n = s->nLanes;
+    SlpLeaf leaf = { };
+    memcpy(leaf.values, values, n * sizeof(uint32_t));
+    leaf.nLanes = uint8_t(n);
+    leaf.type = ValueType(s, values[0]);
+    bool bSame = true, bConstants = true, bExtracts = true;
+    uint nSources = 0, firstSize = 0;
+    uint32_t indices[4];
+    for (uint j = 0; j < n; ++j) {
+        const uint32_t *const def = Definition(s, values[j]);
+        s->bFailed |= ValueType(s, values[j]) != leaf.type;
+        bSame &= values[j] == values[0];
+        bConstants &= def && uint16_t(def[0]) == SpvOp_Constant;
+        const uint32_t *const source = def && uint16_t(def[0]) == SpvOp_CompositeExtract && def[0] >> 16 == 5 ?
+            Definition(s, ValueType(s, def[3])) : nullptr;
+        if (!bExtracts || !source || uint16_t(source[0]) != SpvOp_TypeVector || source[2] != leaf.type) {
+            bExtracts = false;
+            continue;
+        }
+        uint k = def[3] == leaf.sources[0] ? 0 : def[3] == leaf.sources[1] ? 1 : nSources;
+        if (k == 2) {
+            bExtracts = false;
+            continue;
+        }
+        if (k == nSources) {
+            leaf.sources[nSources++] = def[3];
+            firstSize = k == 0 ? source[3] : firstSize;
+        }
+        indices[j] = def[4] + (k ? firstSize : 0);
+    }
+
+    if (bConstants) {
+        leaf.kind = SlpLeaf_Constant;
+    }
+    else if (bSame) {
+        leaf.kind = SlpLeaf_Splat;
+        s->delta += 1;
+    }
+    else if (bExtracts) {
+        bool bInOrder = nSources == 1 && firstSize == n;
+        for (uint j = 0; j < n; ++j) {
+            bInOrder &= indices[j] == j;
+            if (s->useCounts[values[j]] == 1 && !(s->idFlags[values[j]] & IdFlag_Decorated)) {
+                s->treeExtracts.push(values[j]);
+                s->delta -= 1;
+            }
+        }
+        leaf.kind = bInOrder ? SlpLeaf_Source : SlpLeaf_Shuffle;
+        s->delta += !bInOrder;
+        memcpy(leaf.values, indices, n * sizeof(uint32_t));
+    }
+    else {
+        leaf.kind = SlpLeaf_Gather;
+        s->delta += 1;
+    }
+    s->leaves.push(leaf);
+    return (s->leaves.size() - 1) | SlpRef_Leaf;
+}
+
+static uint32_t
+BuildOperand(SlpVectorizer *s, const uint32_t *values, const uint32_t *parents, uint32_t minEmitAt)
+{
+    uint32_t const node = BuildNode(s, values, parents, minEmitAt);
+    return node != ~0u ? node : BuildLeaf(s, values);
+}
+
+// Packs the tree grown from the OpCompositeConstruct at seedAt, if it is worth it.
+static void
+TrySeed(SlpVectorizer *s, uint seedAt, SpvSlpReport *pReport)
+{
+    const uint32_t *const seed = s->module.ptr + seedAt;
+    const uint32_t *const type = Definition(s, seed[1]);
+    uint const n = (seed[0] >> 16) - 3;
+    if (uint16_t(type[0]) != SpvOp_TypeVector || type[3] != n || n < 2 || n > 4) {
+        return;
+    }
+    s->nLanes = n;
+    s->nodesBegin = s->nodes.size();
+    s->delta = -1; // the seed
+    s->bFailed = false;
+    s->treeIds.clear();
+    s->treeExtracts.clear();
+    uint const leavesBegin = s->leaves.size();
+    uint32_t const parents[4] = { seedAt, seedAt, seedAt, seedAt };
+    uint32_t const root = BuildOperand(s, seed + 3, parents, seedAt);
+
+    // The leaves' values must not come from the tree.
+    bool bPack = !(root & SlpRef_Leaf) && !s->bFailed && -s->delta >= s->options->minSaving;
+    for (uint i = leavesBegin; i < s->leaves.size() && bPack; ++i) {
+        const SlpLeaf& leaf = s->leaves[i];
+        for (uint j = 0; j < n && (leaf.kind == SlpLeaf_Splat || leaf.kind == SlpLeaf_Gather); ++j) {
+            bPack &= !(s->idFlags[leaf.values[j]] & IdFlag_InTree);
+        }
+    }
+    for (uint32_t id : s->treeIds) {
+        s->idFlags[id] &= ~IdFlag_InTree;
+    }
+    if (!bPack) {
+        s->nodes.set_size(s->nodesBegin);
+        s->leaves.set_size(leavesBegin);
+        return;
+    }
+
+    for (uint i = s->nodesBegin; i < s->nodes.size(); ++i) {
+        SlpNode& node = s->nodes[i];
+        bool const bRoot = i == root;
+        node.type = bRoot ? seed[1] : VectorType(s, ValueType(s, node.lanes[0]), n);
+        node.id = bRoot ? seed[2] : 0;
+        for (uint j = 0; j < n; ++j) {
+            uint32_t const lane = node.lanes[j];
+            s->idFlags[lane] |= IdFlag_Claimed | (node.externalMask & 1 << j ? 0 : IdFlag_Removed);
+            s->actions[lane] = s->defOffsets[lane] == node.emitAt ? i + 2 : SlpAction_Remove;
+        }
+        if (bRoot) {
+            s->actions[seed[2]] = i + 2;
+        }
+    }
+    for (uint i = leavesBegin; i < s->leaves.size(); ++i) {
+        SlpLeaf& leaf = s->leaves[i];
+        leaf.type = VectorType(s, leaf.type, n);
+        if (leaf.kind == SlpLeaf_Constant) {
+            static_assert(sizeof(SpvValueId) == sizeof(uint32_t), "");
+            leaf.id = SpvPool_Composite(&s->pool, SpvTypeId(leaf.type),
+                { reinterpret_cast<const SpvValueId *>(leaf.values), n });
+        }
+        leaf.id = leaf.kind == SlpLeaf_Source ? leaf.sources[0] : leaf.id;
+        pReport->nShuffles += leaf.kind >= SlpLeaf_Splat;
+    }
+    for (uint32_t id : s->treeExtracts) {
+        s->idFlags[id] |= IdFlag_Removed;
+        s->actions[id] = SlpAction_Remove;
+    }
+    uint const nNodes = s->nodes.size() - s->nodesBegin;
+    pReport->nTrees += 1;
+    pReport->nScalarOps += nNodes * n;
+    pReport->nVectorOps += nNodes;
+}
+
+static uint32_t
+WriteLeaf(SlpVectorizer *s, uint index, uint32_t *pNextId, Array<uint32_t> *pOut)
+{
+    SlpLeaf& leaf = s->leaves[index];
+    if (leaf.id) {
+        return leaf.id;
+    }
+    uint const n = leaf.nLanes;
+    leaf.id = (*pNextId)++;
+    if (leaf.kind == SlpLeaf_Shuffle) {
+        uint32_t const words[] = { uint32_t(5 + n) << 16 | SpvOp_VectorShuffle, leaf.type, leaf.id, leaf.sources[0],
+            leaf.sources[1] ? leaf.sources[1] : leaf.sources[0] };
+        pOut->push_n(words, lengthof(words));
+    }
+    else {
+        uint32_t const words[] = { uint32_t(3 + n) << 16 | SpvOp_CompositeConstruct, leaf.type, leaf.id };
+        pOut->push_n(words, lengthof(words));
+    }
+    pOut->push_n(leaf.values, n);
+    return leaf.id;
+}
+
+// The node's vector op with what its leaves need before it, and the extracts of its lanes used elsewhere after.
+static void
+WriteNode(SlpVectorizer *s, uint index, uint32_t *pNextId, Array<uint32_t> *pOut)
+{
+    uint const n = s->nodes[index].nLanes;
+    uint32_t operands[2];
+    for (uint k = 0; k < s->nodes[index].nOperands; ++k) {
+        uint32_t const ref = s->nodes[index].operands[k];
+        operands[k] = ref & SlpRef_Leaf ? WriteLeaf(s, ref & ~SlpRef_Leaf, pNextId, pOut) : s->nodes[ref].id;
+        ASSERT(operands[k]);
+    }
+    SlpNode& node = s->nodes[index];
+    node.id = node.id ? node.id : (*pNextId)++;
+    pOut->push(uint32_t(3 + node.nOperands) << 16 | node.opcode);
+    pOut->push(node.type);
+    pOut->push(node.id);
+    pOut->push_n(operands, node.nOperands);
+    uint32_t const scalarType = ValueType(s, node.lanes[0]);
+    for (uint j = 0; j < n; ++j) {
+        if (node.externalMask & 1 << j) {
+            uint32_t const words[] = { 5 << 16 | SpvOp_CompositeExtract, scalarType, node.lanes[j], node.id, j };
+            pOut->push_n(words, lengthof(words));
+        }
+    }
+}
+
+bool SpvSlpVectorize(view<const uint32_t> module, const SpvSlpOptions& options, Array<uint32_t> *pOut,
+                     SpvSlpReport *pReport)
+{
+    pOut->clear();
+    *pReport = { };
+    SpvValidationError error;
+    if (!SpvValidate(module, &error)) {
+        return false;
+    }
+
+    SlpVectorizer vectorizer;
+    SlpVectorizer *const s = &vectorizer;
+    s->module = module;
+    s->options = &options;
+    s->bound = module.ptr[3];
+    uint32_t const bound = s->bound;
+    memset(s->defOffsets.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(s->useCounts.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(s->firstUses.uninitialized_push_n(bound), 0xff, bound * sizeof(uint32_t));
+    memset(s->secondUses.uninitialized_push_n(bound), 0xff, bound * sizeof(uint32_t));
+    memset(s->idFlags.uninitialized_push_n(bound), 0, bound);
+    memset(s->actions.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(s->vectorTypes.uninitialized_push_n(3 * bound), 0, 3 * bound * sizeof(uint32_t));
+    s->pool.firstId = bound;
+
+    // Definitions, uses, decorations and vector types.
+    uint const headerWords = sizeof(SpvHeader) / sizeof(uint32_t);
+    uint functionsBegin = module.length;
+    for (uint at = headerWords; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const inst = module.ptr + at;
+        uint16_t const opcode = uint16_t(inst[0]);
+        const SpvOpInfo *const op = SpvLookupOp(opcode);
+        uint const resultWord = SpvResultWord(op);
+        if (resultWord) {
+            s->defOffsets[inst[resultWord]] = at;
+        }
+        functionsBegin = opcode == SpvOp_Function ? Min(functionsBegin, at) : functionsBegin;
+        if (opcode == SpvOp_Decorate) {
+            s->idFlags[inst[1]] |= IdFlag_Decorated;
+        }
+        if (opcode == SpvOp_TypeVector && inst[3] - 2 < 3u && !s->vectorTypes[inst[2] * 3 + inst[3] - 2]) {
+            s->vectorTypes[inst[2] * 3 + inst[3] - 2] = inst[1];
+        }
+        if (at < functionsBegin) {
+            continue;
+        }
+        SpvForEachOperandWord(inst, op, [&](uint i, char kind) {
+            if (kind == 'i' || kind == 'f') {
+                uint32_t const id = inst[i];
+                s->useCounts[id] += 1;
+                s->secondUses[id] = s->firstUses[id] != ~0u && s->secondUses[id] == ~0u ? at : s->secondUses[id];
+                s->firstUses[id] = s->firstUses[id] == ~0u ? at : s->firstUses[id];
+            }
+        });
+    }
+
+    // The trees, seed by seed.
+    for (uint at = functionsBegin; at < module.length; at += module.ptr[at] >> 16) {
+        uint16_t const opcode = uint16_t(module.ptr[at]);
+        s->blockBegin = opcode == SpvOp_Label ? at : s->blockBegin;
+        if (opcode == SpvOp_CompositeConstruct) {
+            TrySeed(s, at, pReport);
+        }
+    }
+
+    // The module again, with the pool's types and constants after the module's and the trees in place.
+    uint32_t nextId = SpvPool_NextId(&s->pool);
+    pOut->push_n(module.ptr, headerWords);
+    uint nInput = 0, nOutput = 0;
+    for (uint at = headerWords; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const inst = module.ptr + at;
+        uint16_t const opcode = uint16_t(inst[0]);
+        uint const resultWord = SpvResultWord(SpvLookupOp(opcode));
+        uint32_t const action = resultWord ? s->actions[inst[resultWord]] : 0;
+        nInput += 1;
+        if (at == functionsBegin) {
+            pOut->push_n(s->pool.words.data(), s->pool.words.size());
+            nOutput += s->pool.idOffsets.size();
+        }
+        if (((opcode == SpvOp_Name || opcode == SpvOp_Decorate) && (s->idFlags[inst[1]] & IdFlag_Removed)) ||
+            action == SlpAction_Remove) {
+            continue;
+        }
+        if (action) {
+            uint const start = pOut->size();
+            WriteNode(s, action - 2, &nextId, pOut);
+            for (uint i = start; i < pOut->size(); i += (*pOut)[i] >> 16) {
+                nOutput += 1;
+            }
+            continue;
+        }
+        pOut->push_n(inst, inst[0] >> 16);
+        nOutput += 1;
+    }
+    (*pOut)[3] = nextId;
+    pReport->instructionDelta = int32_t(nOutput) - int32_t(nInput);
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * Superword-level parallelism over a SPIR-V module: component-wise code, the lanes of a vector computed one scalar
+ * op at a time, is packed back into vector ops.
+ *
+ * Seeds are the OpCompositeConstructs of a vector from scalars. From one, a tree is grown bottom-up: the
+ * constituents become a vector op if they are the same op on the same scalar type in the seed's block, each used
+ * only by its lane above or after the vector op is written, and their operands are grown the same way. Operands that
+ * can't be are leaves: the vector they were extracted from, in order, costs nothing, nor do constants, which become
+ * an OpConstantComposite; other extracts from up to two vectors cost an OpVectorShuffle, and a splat of a value or
+ * any other scalars an OpCompositeConstruct. Scalars still used elsewhere are extracted again after their vector op,
+ * an instruction each. A tree is packed if the module comes out at least minSaving instructions smaller.
+ *
+ * Lanes with decorations are never packed. New vector types and constants are hash-consed in a SpvPool and go at the
+ * end of the global section, after the module's own, whose vector types are used where they exist.
+ */
+struct SpvSlpOptions {
+    uint maxNodes = 16; // vector ops in one tree
+    int minSaving = 1;
+};
+
+struct SpvSlpReport {
+    uint nTrees;
+    uint nScalarOps; // replaced by vector ops
+    uint nVectorOps;
+    uint nShuffles; // OpVectorShuffles and OpCompositeConstructs written to feed them
+    int32_t instructionDelta;
+};
+
+// The module must pass SpvValidate(), which is checked first: false if not, with pOut left empty.
+bool SpvSlpVectorize(view<const uint32_t> module, const SpvSlpOptions& options, Array<uint32_t> *pOut,
+                     SpvSlpReport *pReport);
@@ -0,0 +1,809 @@
+#include "common.h"
+
+#include "spvunroll.h"
+#include "spvreader.h"
+
+#include <string.h>
+
+enum : uint32_t {
+    MaxTripCount = 1 << 16, // not simulated further, the trip count is then unknown
+    LoopControl_Unroll = 1 << 0,
+    LoopControl_DontUnroll = 1 << 1,
+};
+
+enum : uint8_t { IdFlag_InFunction = 1 << 0, IdFlag_Emitted = 1 << 1 };
+
+struct UnrollBlock {
+    uint32_t label;
+    uint32_t begin, end; // word offsets in the module: of its OpLabel, and past its terminator
+    uint32_t term; // of its terminator
+    uint32_t loopMerge; // of its OpLoopMerge, 0 if it isn't a loop header
+    uint32_t nInstructions;
+};
+
+struct UnrollConstant {
+    uint64_t value; // zero-extended from the width
+    uint32_t type; // 0 if the id isn't a bool or integer constant
+    uint32_t width; // 1 for bools
+};
+
+struct UnrollPhi {
+    uint32_t id;
+    uint32_t init; // the value from before the loop
+    uint32_t next; // from the continue block
+};
+
+// Phis in the merge block of a fully unrolled loop, whose parent is now the last copy of the continue block.
+struct UnrollPhiFix {
+    uint32_t merge;
+    uint32_t header;
+    uint32_t parent;
+};
+
+struct UnrollLoopShape {
+    uint first, last; // block indices of the header and the continue target
+    uint32_t merge, entry; // labels of the merge block and of the body's first block
+    uint32_t compare; // offset of the header's comparison
+    bool bTrueIsBody; // the comparison is true to stay in the loop
+    uint nInstructions; // of the blocks after the header
+};
+
+struct Unroller {
+    view<const uint32_t> module;
+    const SpvUnrollOptions *options;
+    SpvUnrollReport *pReport;
+    uint32_t bound; // of the input
+    uint32_t nextId;
+    Array<uint32_t> defOffsets; // per input id: where its instruction is, 0 if it isn't defined
+    Array<uint32_t> rename; // per input id: what it is in the output after an unrolled loop, 0 if itself
+    Array<uint32_t> copyIds; // per input id: what it is in the copy of a loop body being written, 0 if itself
+    Array<uint32_t> blockOfLabel; // per input id of a label in the current function: its index in blocks
+    Array<uint8_t> idFlags; // per input id: IdFlag_
+    Array<UnrollConstant> constants; // per output id
+    Array<uint32_t> constantIds; // all of them, to rehash
+    Array<uint32_t> constantTable; // open addressing on type and value: the id, 0 if empty
+    Array<UnrollBlock> blocks; // of the current function
+    Array<UnrollPhiFix> phiFixes; // of the current function
+    Array<UnrollPhi> phis; // of the loop being unrolled
+    Array<uint32_t> phiValues; // what each of them is in the copy being written
+    Array<uint32_t> newConstants; // instructions, for the end of the global section
+    Array<uint32_t> functions; // the output's functions
+    uint nEmitted; // instructions in functions
+};
+
+static uint64_t
+Truncate(uint64_t value, uint width)
+{
+    return width >= 64 ? value : value & ((uint64_t(1) << width) - 1);
+}
+
+static int64_t
+SignExtend(uint64_t value, uint width)
+{
+    uint const shift = 64 - width;
+    return int64_t(value << shift) >> shift;
+}
+
+static bool
+IsComparison(uint16_t opcode)
+{
+    return opcode >= SpvOp_IEqual && opcode <= SpvOp_SLessThanEqual;
+}
+
+/*
+    An integer op on constants zero-extended from their width, wrapping at the width like the compiler's constant
+    folding; comparisons give 0 or 1. False for other ops, and where SPIR-V leaves the result undefined: division by
+    zero and shifts by the width or more.
+**/
+static bool
+FoldOp(uint16_t opcode, uint64_t a, uint64_t b, uint width, uint64_t *pResult)
+{
+    int64_t const sa = SignExtend(a, width), sb = SignExtend(b, width);
+    uint64_t r;
+    switch (opcode) {
+    case SpvOp_SNegate: r = 0 - a; break;
+    case SpvOp_Not: r = ~a; break;
+    case SpvOp_IAdd: r = a + b; break;
+    case SpvOp_ISub: r = a - b; break;
+    case SpvOp_IMul: r = a * b; break;
+    case SpvOp_UDiv:
+    case SpvOp_UMod:
+        if (b == 0) {
+            return false;
+        }
+        r = opcode == SpvOp_UDiv ? a / b : a % b;
+        break;
+    case SpvOp_SDiv:
+    case SpvOp_SRem:
+    case SpvOp_SMod: {
+        if (b == 0) {
+            return false;
+        }
+        if (opcode == SpvOp_SDiv) {
+            r = sb == -1 ? 0 - a : uint64_t(sa / sb);
+            break;
+        }
+        int64_t m = sb == -1 ? 0 : sa % sb;
+        if (opcode == SpvOp_SMod && m != 0 && (m < 0) != (sb < 0)) { // the sign of the divisor
+            m += sb;
+        }
+        r = uint64_t(m);
+        break;
+    }
+    case SpvOp_ShiftRightLogical:
+    case SpvOp_ShiftRightArithmetic:
+    case SpvOp_ShiftLeftLogical:
+        if (b >= width) {
+            return false;
+        }
+        r = opcode == SpvOp_ShiftLeftLogical ? a << b : opcode == SpvOp_ShiftRightLogical ? a >> b : uint64_t(sa >> b);
+        break;
+    case SpvOp_BitwiseOr: r = a | b; break;
+    case SpvOp_BitwiseXor: r = a ^ b; break;
+    case SpvOp_BitwiseAnd: r = a & b; break;
+    case SpvOp_IEqual: *pResult = a == b; return true;
+    case SpvOp_INotEqual: *pResult = a != b; return true;
+    case SpvOp_UGreaterThan: *pResult = a > b; return true;
+    case SpvOp_SGreaterThan: *pResult = sa > sb; return true;
+    case SpvOp_UGreaterThanEqual: *pResult = a >= b; return true;
+    case SpvOp_SGreaterThanEqual: *pResult = sa >= sb; return true;
+    case SpvOp_ULessThan: *pResult = a < b; return true;
+    case SpvOp_SLessThan: *pResult = sa < sb; return true;
+    case SpvOp_ULessThanEqual: *pResult = a <= b; return true;
+    case SpvOp_SLessThanEqual: *pResult = sa <= sb; return true;
+    default: return false;
+    }
+    *pResult = Truncate(r, width);
+    return true;
+}
+
+static uint32_t
+NewId(Unroller *u)
+{
+    u->constants.push(UnrollConstant{});
+    return u->nextId++;
+}
+
+static uint32_t
+MapId(Unroller *u, uint32_t id)
+{
+    ASSERT(id < u->bound);
+    return u->copyIds[id] ? u->copyIds[id] : u->rename[id] ? u->rename[id] : id;
+}
+
+static const uint32_t *
+Definition(Unroller *u, uint32_t id)
+{
+    return id < u->bound && u->defOffsets[id] ? u->module.ptr + u->defOffsets[id] : nullptr;
+}
+
+static uint
+TypeWidth(Unroller *u, uint32_t type) // 1 for bool, the integer type's width, 0 for other types
+{
+    const uint32_t *const t = Definition(u, type);
+    uint16_t const opcode = t ? uint16_t(t[0]) : 0;
+    return opcode == SpvOp_TypeBool ? 1 : opcode == SpvOp_TypeInt && t[2] <= 64 ? t[2] : 0;
+}
+
+static uint
+BlockOf(Unroller *u, uint32_t label) // ~0u if it isn't one of the current function's
+{
+    uint const b = label < u->bound ? u->blockOfLabel[label] : ~0u;
+    return b < u->blocks.size() && u->blocks[b].label == label ? b : ~0u;
+}
+
+static uint32_t
+HashConstant(uint32_t type, uint64_t value)
+{
+    uint64_t const h = (value ^ uint64_t(type) << 40) * 0x9e3779b97f4a7c15u;
+    return uint32_t(h >> 32);
+}
+
+// The slot of the constant in constantTable, or the empty one where it would go.
+static uint
+FindConstantSlot(Unroller *u, uint32_t type, uint64_t value)
+{
+    uint const mask = u->constantTable.size() - 1;
+    uint h = HashConstant(type, value) & mask;
+    for (; u->constantTable[h]; h = (h + 1) & mask) {
+        const UnrollConstant& c = u->constants[u->constantTable[h]];
+        if (c.type == type && c.value == value) {
+            break;
+        }
+    }
+    return h;
+}
+
+static void
+GrowConstantTable(Unroller *u)
+{
+    if (2 * (u->constantIds.size() + 1) <= u->constantTable.size()) {
+        return;
+    }
+    uint const size = Max(64u, 2 * u->constantTable.size());
+    u->constantTable.clear();
+    memset(u->constantTable.uninitialized_push_n(size), 0, size * sizeof(uint32_t));
+    for (uint32_t id : u->constantIds) {
+        const UnrollConstant& c = u->constants[id];
+        u->constantTable[FindConstantSlot(u, c.type, c.value)] = id;
+    }
+}
+
+// The first of equal constants is the one folding results use.
+static void
+AddModuleConstant(Unroller *u, const uint32_t *inst)
+{
+    uint16_t const opcode = uint16_t(inst[0]);
+    uint const width = TypeWidth(u, inst[1]);
+    if (opcode == SpvOp_Constant ? width <= 1 : opcode != SpvOp_ConstantTrue && opcode != SpvOp_ConstantFalse) {
+        return;
+    }
+    uint64_t value = opcode == SpvOp_ConstantTrue;
+    if (opcode == SpvOp_Constant) {
+        value = Truncate(width == 64 ? inst[3] | uint64_t(inst[4]) << 32 : inst[3], width);
+    }
+    u->constants[inst[2]] = { value, inst[1], width };
+    GrowConstantTable(u);
+    uint const slot = FindConstantSlot(u, inst[1], value);
+    if (!u->constantTable[slot]) {
+        u->constantTable[slot] = inst[2];
+        u->constantIds.push(inst[2]);
+    }
+}
+
+// The id of the constant, added to the module if there isn't one yet.
+static uint32_t
+ConstantId(Unroller *u, uint32_t type, uint64_t value)
+{
+    GrowConstantTable(u);
+    uint const slot = FindConstantSlot(u, type, value);
+    if (u->constantTable[slot]) {
+        return u->constantTable[slot];
+    }
+    uint const width = TypeWidth(u, type);
+    uint32_t const id = NewId(u);
+    u->constants[id] = { value, type, width };
+    u->constantTable[slot] = id;
+    u->constantIds.push(id);
+    if (width == 1) {
+        uint32_t const inst[] = { 3 << 16 | uint32_t(value ? SpvOp_ConstantTrue : SpvOp_ConstantFalse), type, id };
+        u->newConstants.push_n(inst, lengthof(inst));
+        return id;
+    }
+    bool const bSigned = Definition(u, type)[3];
+    uint32_t const low = width < 32 && bSigned ? uint32_t(SignExtend(value, width)) : uint32_t(value);
+    uint32_t const inst[] = { uint32_t(width == 64 ? 5 : 4) << 16 | SpvOp_Constant, type, id, low, uint32_t(value >> 32) };
+    u->newConstants.push_n(inst, width == 64 ? 5 : 4);
+    return id;
+}
+
+/*
+    What a copied instruction with its operands mapped is, if it can be folded: a constant, or for an OpSelect on a
+    constant the operand it selects. 0 if it can't.
+**/
+static uint32_t
+Fold(Unroller *u, const uint32_t *out)
+{
+    uint const nWords = out[0] >> 16;
+    uint16_t const opcode = uint16_t(out[0]);
+    if (opcode == SpvOp_Select) {
+        const UnrollConstant& c = u->constants[out[3]];
+        return c.width == 1 ? c.value ? out[4] : out[5] : 0;
+    }
+    if (opcode < SpvOp_SNegate || opcode > SpvOp_Not || (nWords != 4 && nWords != 5)) { // operands are ids
+        return 0;
+    }
+    const UnrollConstant& a = u->constants[out[3]];
+    const UnrollConstant& b = u->constants[nWords == 5 ? out[4] : out[3]];
+    uint64_t value;
+    if (!a.type || !b.type || !TypeWidth(u, out[1]) || !FoldOp(opcode, a.value, b.value, a.width, &value)) {
+        return 0;
+    }
+    return ConstantId(u, out[1], value);
+}
+
+/*
+    Writes the instruction with its operands mapped. In a copy of a loop body (bCopy) the result gets a new id unless
+    copyIds has one for it already, and with bFold it isn't written at all if it folds, copyIds getting what it folded
+    to instead.
+**/
+static void
+EmitInstruction(Unroller *u, const uint32_t *inst, uint32_t blockLabel, bool bCopy, bool bFold)
+{
+    uint const nWords = inst[0] >> 16;
+    uint16_t const opcode = uint16_t(inst[0]);
+    const SpvOpInfo *const op = SpvLookupOp(opcode);
+    uint const start = u->functions.size();
+    uint32_t *const out = u->functions.uninitialized_push_n(nWords);
+    memcpy(out, inst, nWords * sizeof(uint32_t));
+    SpvForEachOperandWord(inst, op, [&](uint i, char kind) {
+        if (kind == 'i' || kind == 'f') {
+            out[i] = MapId(u, inst[i]);
+        }
+    });
+    if (opcode == SpvOp_Phi && !bCopy) {
+        for (const UnrollPhiFix& fix : u->phiFixes) {
+            for (uint i = 4; fix.merge == blockLabel && i < nWords; i += 2) {
+                out[i] = inst[i] == fix.header ? fix.parent : out[i];
+            }
+        }
+    }
+    uint const resultWord = SpvResultWord(op);
+    if (resultWord) {
+        uint32_t const result = inst[resultWord];
+        uint32_t const folded = bFold ? Fold(u, out) : 0;
+        if (folded) {
+            u->functions.set_size(start);
+            u->copyIds[result] = folded;
+            return;
+        }
+        if (bCopy) {
+            u->copyIds[result] = u->copyIds[result] ? u->copyIds[result] : NewId(u);
+            out[resultWord] = u->copyIds[result];
+        }
+        if (out[resultWord] < u->bound) {
+            u->idFlags[out[resultWord]] |= IdFlag_Emitted;
+        }
+    }
+    u->nEmitted += 1;
+}
+
+static void
+EmitBranch(Unroller *u, uint32_t target)
+{
+    u->functions.push(2 << 16 | SpvOp_Branch);
+    u->functions.push(target);
+    u->nEmitted += 1;
+}
+
+// The block's instructions, its terminator replaced by a branch to backEdge if that isn't 0.
+static void
+EmitBlock(Unroller *u, uint b, bool bCopy, bool bFold, uint32_t backEdge)
+{
+    const UnrollBlock& block = u->blocks[b];
+    for (uint at = block.begin; at < block.end; at += u->module.ptr[at] >> 16) {
+        if (backEdge && at == block.term) {
+            EmitBranch(u, backEdge);
+            break;
+        }
+        EmitInstruction(u, u->module.ptr + at, block.label, bCopy, bFold);
+    }
+}
+
+static uint
+Successors(const uint32_t *term, uint32_t *succs) // room for 2
+{
+    uint16_t const opcode = uint16_t(term[0]);
+    if (opcode == SpvOp_Branch) {
+        succs[0] = term[1];
+        return 1;
+    }
+    if (opcode == SpvOp_BranchConditional) {
+        succs[0] = term[2];
+        succs[1] = term[3];
+        return 2;
+    }
+    return 0;
+}
+
+static bool
+UsesId(const uint32_t *inst, uint32_t id)
+{
+    bool bUses = false;
+    SpvForEachOperandWord(inst, SpvLookupOp(uint16_t(inst[0])), [&](uint i, char kind) {
+        bUses |= (kind == 'i' || kind == 'f') && inst[i] == id;
+    });
+    return bUses;
+}
+
+/*
+    Whether the loop at block h has the shape SpvUnrollLoops() can unroll (see spvunroll.h), with its phis in
+    u->phis if so. s->last and s->nInstructions are set either way, s->last to h if the continue target isn't after
+    the header.
+**/
+static bool
+MatchLoop(Unroller *u, uint h, UnrollLoopShape *s)
+{
+    const uint32_t *const w = u->module.ptr;
+    const UnrollBlock& header = u->blocks[h];
+    uint const c = BlockOf(u, w[header.loopMerge + 2]);
+    s->first = h;
+    s->last = c != ~0u && c > h ? c : h;
+    s->nInstructions = 0;
+    for (uint b = h + 1; b <= s->last; ++b) {
+        s->nInstructions += u->blocks[b].nInstructions;
+    }
+    s->merge = w[header.loopMerge + 1];
+    if (s->last == h) {
+        return false;
+    }
+
+    // Label, phis, the comparison, OpLoopMerge and OpBranchConditional on it.
+    u->phis.clear();
+    uint at = header.begin + 2;
+    for (; uint16_t(w[at]) == SpvOp_Phi; at += w[at] >> 16) {
+        if (w[at] >> 16 != 7) {
+            return false;
+        }
+        bool const bFirstIsBack = w[at + 4] == u->blocks[c].label;
+        uint32_t const outside = w[at + (bFirstIsBack ? 6 : 4)];
+        uint const o = BlockOf(u, outside);
+        if ((!bFirstIsBack && w[at + 6] != u->blocks[c].label) || (o != ~0u && o >= h && o <= c)) {
+            return false;
+        }
+        u->phis.push({ w[at + 2], w[at + (bFirstIsBack ? 5 : 3)], w[at + (bFirstIsBack ? 3 : 5)] });
+    }
+    const uint32_t *const term = w + header.term;
+    if (!IsComparison(uint16_t(w[at])) || at + 5 != header.loopMerge || uint16_t(term[0]) != SpvOp_BranchConditional ||
+        header.loopMerge + (w[header.loopMerge] >> 16) != header.term || term[1] != w[at + 2]) {
+        return false;
+    }
+    s->compare = at;
+    s->entry = term[2] == s->merge ? term[3] : term[2];
+    s->bTrueIsBody = term[2] == s->entry;
+    if (s->entry != u->blocks[h + 1].label || (term[2] != s->merge && term[3] != s->merge) ||
+        uint16_t(w[u->blocks[h + 1].begin + 2]) == SpvOp_Phi) {
+        return false;
+    }
+
+    // Only the header enters and leaves the body, no loops in it, and the comparison is only for the header.
+    for (uint b = 0; b < u->blocks.size(); ++b) {
+        const UnrollBlock& block = u->blocks[b];
+        bool const bInBody = b > h && b <= c;
+        if (bInBody && block.loopMerge) {
+            return false;
+        }
+        uint32_t succs[2];
+        uint const nSuccs = Successors(w + block.term, succs);
+        if (bInBody && (!nSuccs || (b == c && uint16_t(w[block.term]) != SpvOp_Branch))) {
+            return false;
+        }
+        for (uint i = 0; i < nSuccs && b != h; ++i) {
+            uint const to = BlockOf(u, succs[i]);
+            bool const bToBody = to != ~0u && to > h && to <= c;
+            if (b == c ? succs[i] != header.label : bInBody != bToBody) {
+                return false;
+            }
+        }
+        for (uint i = block.begin; i < block.end; i += w[i] >> 16) {
+            if (i != header.term && UsesId(w + i, w[s->compare + 2])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Folds the induction phi through the loop from its first value until the comparison exits. SpvUnroll_UnknownTrips
+    if the comparison isn't of a phi with a constant, stepped by one op with a constant, or it takes too long.
+**/
+static uint32_t
+TripCount(Unroller *u, const UnrollLoopShape& s)
+{
+    const uint32_t *const w = u->module.ptr;
+    const uint32_t *const compare = w + s.compare;
+    for (const UnrollPhi& phi : u->phis) {
+        uint const side = compare[3] == phi.id ? 0 : compare[4] == phi.id ? 1 : 2;
+        const uint32_t *const step = Definition(u, phi.next);
+        uint const stepAt = step ? uint(step - w) : 0;
+        if (side == 2 || stepAt < u->blocks[s.first].end || stepAt >= u->blocks[s.last].end || step[0] >> 16 != 5 ||
+            IsComparison(uint16_t(step[0]))) {
+            continue;
+        }
+        uint const stepSide = step[3] == phi.id ? 0 : step[4] == phi.id ? 1 : 2;
+        const UnrollConstant& limit = u->constants[MapId(u, compare[4 - side])];
+        const UnrollConstant& init = u->constants[MapId(u, phi.init)];
+        const UnrollConstant& by = u->constants[MapId(u, step[4 - stepSide])];
+        if (stepSide == 2 || !limit.type || !init.type || !by.type || init.width != limit.width) {
+            continue;
+        }
+        uint64_t v = init.value;
+        for (uint32_t n = 0; n <= MaxTripCount; ++n) {
+            uint64_t bStay;
+            FoldOp(uint16_t(compare[0]), side ? limit.value : v, side ? v : limit.value, limit.width, &bStay);
+            if (bool(bStay) != s.bTrueIsBody) {
+                return n;
+            }
+            if (!FoldOp(uint16_t(step[0]), stepSide ? by.value : v, stepSide ? v : by.value, init.width, &v)) {
+                break;
+            }
+        }
+    }
+    return SpvUnroll_UnknownTrips;
+}
+
+/*
+    Sets copyIds for a copy of the body: its labels get new ids, but for the entry, and its results get them as they
+    are written; with bOwnIds they all keep their own. The phis are their current values.
+**/
+static void
+BeginCopy(Unroller *u, const UnrollLoopShape& s, uint32_t entry, bool bOwnIds)
+{
+    const uint32_t *const w = u->module.ptr;
+    for (uint at = u->blocks[s.first + 1].begin; at < u->blocks[s.last].end; at += w[at] >> 16) {
+        uint const resultWord = SpvResultWord(SpvLookupOp(uint16_t(w[at])));
+        if (resultWord) {
+            u->copyIds[w[at + resultWord]] = bOwnIds ? w[at + resultWord] : 0;
+        }
+    }
+    for (uint b = s.first + 1; b <= s.last && !bOwnIds; ++b) {
+        u->copyIds[u->blocks[b].label] = b == s.first + 1 ? entry : NewId(u);
+    }
+    for (uint i = 0; i < u->phis.size(); ++i) {
+        u->copyIds[u->phis[i].id] = u->phiValues[i];
+    }
+}
+
+static void
+EndCopy(Unroller *u) // the phis' values for the next copy
+{
+    for (uint i = 0; i < u->phis.size(); ++i) {
+        u->phiValues[i] = MapId(u, u->phis[i].next);
+    }
+}
+
+static void
+ClearCopyIds(Unroller *u, const UnrollLoopShape& s)
+{
+    const uint32_t *const w = u->module.ptr;
+    for (uint at = u->blocks[s.first + 1].begin; at < u->blocks[s.last].end; at += w[at] >> 16) {
+        uint const resultWord = SpvResultWord(SpvLookupOp(uint16_t(w[at])));
+        if (resultWord) {
+            u->copyIds[w[at + resultWord]] = 0;
+        }
+    }
+    for (const UnrollPhi& phi : u->phis) {
+        u->copyIds[phi.id] = 0;
+    }
+}
+
+// The header becomes a branch into the first copy, the last copy's continue block branches to the merge block.
+static void
+EmitFullUnroll(Unroller *u, const UnrollLoopShape& s, uint32_t nTrips)
+{
+    const UnrollBlock& header = u->blocks[s.first];
+    u->phiValues.clear();
+    for (const UnrollPhi& phi : u->phis) {
+        u->phiValues.push(MapId(u, phi.init));
+    }
+    u->functions.push(2 << 16 | SpvOp_Label);
+    u->functions.push(header.label);
+    u->idFlags[header.label] |= IdFlag_Emitted;
+    u->nEmitted += 1;
+    uint32_t entry = nTrips ? NewId(u) : s.merge;
+    EmitBranch(u, entry);
+    uint32_t parent = header.label;
+    for (uint32_t k = 0; k < nTrips; ++k) {
+        BeginCopy(u, s, entry, false);
+        entry = k + 1 < nTrips ? NewId(u) : s.merge;
+        for (uint b = s.first + 1; b <= s.last; ++b) {
+            EmitBlock(u, b, true, u->options->bPropagateConstants, b == s.last ? entry : 0);
+        }
+        parent = u->copyIds[u->blocks[s.last].label];
+        EndCopy(u);
+    }
+    ClearCopyIds(u, s);
+    for (uint i = 0; i < u->phis.size(); ++i) {
+        u->rename[u->phis[i].id] = u->phiValues[i];
+    }
+    if (parent != header.label) {
+        u->phiFixes.push({ s.merge, header.label, parent });
+    }
+}
+
+/*
+    The header branches into the first of the factor copies, each branching to the next. The last copy keeps the
+    body's own ids, so the header's phis still take their values from it.
+**/
+static void
+EmitPartialUnroll(Unroller *u, const UnrollLoopShape& s, uint factor)
+{
+    const UnrollBlock& header = u->blocks[s.first];
+    uint32_t entry = NewId(u);
+    uint const start = u->functions.size();
+    EmitBlock(u, s.first, false, false, 0);
+    uint32_t *const term = u->functions.data() + start + (header.term - header.begin);
+    term[term[2] == s.entry ? 2 : 3] = entry;
+
+    u->phiValues.clear();
+    for (const UnrollPhi& phi : u->phis) {
+        u->phiValues.push(phi.id);
+    }
+    for (uint j = 0; j < factor; ++j) {
+        BeginCopy(u, s, entry, j + 1 == factor);
+        entry = j + 2 == factor ? s.entry : NewId(u);
+        for (uint b = s.first + 1; b <= s.last; ++b) {
+            EmitBlock(u, b, true, false, b == s.last && j + 1 < factor ? entry : 0);
+        }
+        EndCopy(u);
+    }
+    ClearCopyIds(u, s);
+}
+
+// Writes the loop at block h, unrolled or with a hint. Returns the block after what it wrote.
+static uint
+EmitLoop(Unroller *u, uint h)
+{
+    const SpvUnrollOptions& options = *u->options;
+    const UnrollBlock& header = u->blocks[h];
+    uint32_t const control = u->module.ptr[header.loopMerge + 3];
+    UnrollLoopShape s;
+    bool const bShape = MatchLoop(u, h, &s);
+    SpvUnrollLoop loop = { header.label, SpvUnroll_UnknownTrips, 1, 0, SpvUnroll_Kept };
+    if (bShape) {
+        loop.tripCount = TripCount(u, s);
+    }
+    bool const bKnown = loop.tripCount != SpvUnroll_UnknownTrips;
+    if (control & (LoopControl_Unroll | LoopControl_DontUnroll)) {
+        loop.decision = SpvUnroll_Kept;
+    }
+    else if (bKnown && uint64_t(loop.tripCount) * s.nInstructions <= options.fullBudget) {
+        loop.decision = SpvUnroll_Full;
+        loop.factor = loop.tripCount;
+    }
+    else {
+        loop.decision = bKnown || s.nInstructions > options.hintBudget ? SpvUnroll_HintDontUnroll : SpvUnroll_HintUnroll;
+        for (uint f = bKnown ? Min(options.maxFactor, loop.tripCount) : 0; f >= 2; --f) {
+            if (loop.tripCount % f == 0 && f * s.nInstructions <= options.partialBudget) {
+                loop.decision = SpvUnroll_Partial;
+                loop.factor = f;
+                break;
+            }
+        }
+    }
+
+    uint const nBefore = u->nEmitted;
+    uint next = h + 1;
+    if (loop.decision == SpvUnroll_Full || loop.decision == SpvUnroll_Partial) {
+        if (loop.decision == SpvUnroll_Full) {
+            EmitFullUnroll(u, s, loop.tripCount);
+        }
+        else {
+            EmitPartialUnroll(u, s, loop.factor);
+        }
+        uint nInput = 0;
+        for (uint b = s.first; b <= s.last; ++b) {
+            nInput += u->blocks[b].nInstructions;
+        }
+        loop.instructionDelta = int32_t(u->nEmitted - nBefore) - int32_t(nInput);
+        next = s.last + 1;
+    }
+    else {
+        uint const start = u->functions.size();
+        EmitBlock(u, h, false, false, 0);
+        if (loop.decision != SpvUnroll_Kept) {
+            u->functions[start + (header.loopMerge - header.begin) + 3] |=
+                loop.decision == SpvUnroll_HintUnroll ? LoopControl_Unroll : LoopControl_DontUnroll;
+        }
+    }
+    u->pReport->loops.push(loop);
+    return next;
+}
+
+// The function from its OpFunction to its OpFunctionEnd at end.
+static void
+EmitFunction(Unroller *u, uint begin, uint end)
+{
+    const uint32_t *const w = u->module.ptr;
+    u->blocks.clear();
+    u->phiFixes.clear();
+    uint firstLabel = end;
+    for (uint at = begin; at < end; at += w[at] >> 16) {
+        uint16_t const opcode = uint16_t(w[at]);
+        const SpvOpInfo *const op = SpvLookupOp(opcode);
+        uint const resultWord = SpvResultWord(op);
+        if (resultWord) {
+            u->idFlags[w[at + resultWord]] |= IdFlag_InFunction;
+        }
+        if (opcode == SpvOp_Label) {
+            firstLabel = Min(firstLabel, at);
+            u->blockOfLabel[w[at + 1]] = u->blocks.size();
+            u->blocks.push({ w[at + 1], at, 0, 0, 0, 0 });
+        }
+        if (at >= firstLabel) {
+            UnrollBlock& block = u->blocks[u->blocks.size() - 1];
+            block.nInstructions += 1;
+            block.loopMerge = opcode == SpvOp_LoopMerge ? at : block.loopMerge;
+            if (op->flags & SpvOpFlag_Terminator) {
+                block.term = at;
+                block.end = at + (w[at] >> 16);
+            }
+        }
+    }
+
+    for (uint at = begin; at <= end; at += w[at] >> 16) {
+        if (at == firstLabel) {
+            for (uint b = 0; b < u->blocks.size();) {
+                if (u->blocks[b].loopMerge) {
+                    b = EmitLoop(u, b);
+                }
+                else {
+                    EmitBlock(u, b++, false, false, 0);
+                }
+            }
+            at = end;
+        }
+        EmitInstruction(u, w + at, 0, false, false);
+    }
+}
+
+bool SpvUnrollLoops(view<const uint32_t> module, const SpvUnrollOptions& options, Array<uint32_t> *pOut,
+                    SpvUnrollReport *pReport)
+{
+    pOut->clear();
+    pReport->loops.clear();
+    pReport->instructionDelta = 0;
+    SpvValidationError error;
+    if (!SpvValidate(module, &error)) {
+        return false;
+    }
+
+    Unroller unroller;
+    Unroller *const u = &unroller;
+    u->module = module;
+    u->options = &options;
+    u->pReport = pReport;
+    SpvReader r;
+    const SpvHeader *header = nullptr;
+    if (!SpvReader_Begin(&r, module, &header)) {
+        return false;
+    }
+    u->bound = u->nextId = header->bound;
+    u->nEmitted = 0;
+    memset(u->defOffsets.uninitialized_push_n(u->bound), 0, u->bound * sizeof(uint32_t));
+    memset(u->rename.uninitialized_push_n(u->bound), 0, u->bound * sizeof(uint32_t));
+    memset(u->copyIds.uninitialized_push_n(u->bound), 0, u->bound * sizeof(uint32_t));
+    memset(u->blockOfLabel.uninitialized_push_n(u->bound), 0, u->bound * sizeof(uint32_t));
+    memset(u->idFlags.uninitialized_push_n(u->bound), 0, u->bound);
+    memset(u->constants.uninitialized_push_n(u->bound), 0, u->bound * sizeof(UnrollConstant));
+
+    // Where ids are defined, the constants, and the functions.
+    uint functionsBegin = module.length, nInput = 0;
+    SpvInstruction inst;
+    while (SpvReader_Next(&r, &inst)) {
+        uint const at = uint(inst.words - module.ptr);
+        uint const resultWord = SpvResultWord(SpvLookupOp(inst.opcode));
+        if (resultWord) {
+            u->defOffsets[inst.words[resultWord]] = at;
+        }
+        if (inst.opcode == SpvOp_Function) {
+            functionsBegin = Min(functionsBegin, at);
+        }
+        else if (at < functionsBegin) {
+            AddModuleConstant(u, inst.words);
+        }
+        nInput += 1;
+    }
+    for (uint at = functionsBegin, begin = at; at < module.length; at += module.ptr[at] >> 16) {
+        if (uint16_t(module.ptr[at]) == SpvOp_Function) {
+            begin = at;
+        }
+        else if (uint16_t(module.ptr[at]) == SpvOp_FunctionEnd) {
+            EmitFunction(u, begin, at);
+        }
+    }
+
+    // The header with the new Bound, what comes before the functions less the names and decorations of what is
+    // gone, the new constants, and the functions.
+    pOut->push_n(module.ptr, sizeof(SpvHeader) / sizeof(uint32_t));
+    (*pOut)[3] = u->nextId;
+    uint nOutput = u->nEmitted;
+    for (uint at = sizeof(SpvHeader) / sizeof(uint32_t); at < functionsBegin; at += module.ptr[at] >> 16) {
+        uint16_t const opcode = uint16_t(module.ptr[at]);
+        uint32_t const target = module.ptr[at + 1];
+        if ((opcode == SpvOp_Name || opcode == SpvOp_Decorate) &&
+            (u->idFlags[target] & (IdFlag_InFunction | IdFlag_Emitted)) == IdFlag_InFunction) {
+            continue;
+        }
+        pOut->push_n(module.ptr + at, module.ptr[at] >> 16);
+        nOutput += 1;
+    }
+    for (uint at = 0; at < u->newConstants.size(); at += u->newConstants[at] >> 16) {
+        nOutput += 1;
+    }
+    pOut->push_n(u->newConstants.data(), u->newConstants.size());
+    pOut->push_n(u->functions.data(), u->functions.size());
+    pReport->instructionDelta = int32_t(nOutput) - int32_t(nInput);
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.h"
+#include "Array.h"
+
+/*
+ * Loop unrolling over a SPIR-V module, with a cost model counted in instructions.
+ *
+ * The loops it unrolls are innermost structured loops whose header has only OpPhis, one integer comparison, the
+ * OpLoopMerge and an OpBranchConditional into the body or out to the merge block, and whose blocks run from the
+ * header to the continue target in the function's order, left only through the header. The trip count is known when
+ * the comparison is of a phi against a constant, and the phi starts at a constant and steps by an integer op with a
+ * constant: the step and the comparison are folded from the start value on, iteration by iteration, wrapping at the
+ * type's width as the compiler's constant folding does, until the loop would exit.
+ *
+ * A loop whose unrolled body fits in fullBudget instructions is unrolled fully, the header becoming a branch into the
+ * first copy of the body. Else, if a factor of the trip count up to maxFactor keeps the loop body within
+ * partialBudget, there are that many copies of the body per iteration. Fully unrolled bodies can then have their
+ * integer arithmetic, comparisons and OpSelects folded where the operands are constants, so that the counter and what
+ * is computed from it become constants, with new ones added to the module deduplicated.
+ *
+ * Loops it does not unroll get a LoopControl hint for the driver instead: Unroll if the body is within hintBudget
+ * instructions, DontUnroll if not or if the trip count is known and over budget. Loops that already have a hint keep
+ * it and are left alone.
+ */
+struct SpvUnrollOptions {
+    uint fullBudget = 256;   // instructions of all the copies of a fully unrolled body
+    uint partialBudget = 64; // of the copies in a partially unrolled loop's body
+    uint maxFactor = 8;
+    uint hintBudget = 32;
+    bool bPropagateConstants = true;
+};
+
+enum SpvUnrollDecision : uint8_t {
+    SpvUnroll_Full,
+    SpvUnroll_Partial,
+    SpvUnroll_HintUnroll,
+    SpvUnroll_HintDontUnroll,
+    SpvUnroll_Kept, // it had a hint already
+};
+
+enum : uint32_t { SpvUnroll_UnknownTrips = ~0u };
+
+struct SpvUnrollLoop {
+    uint32_t header; // the header's label in the input
+    uint32_t tripCount; // or SpvUnroll_UnknownTrips
+    uint32_t factor; // copies of the body: the trip count for a full unroll, 1 if not unrolled
+    int32_t instructionDelta; // instructions of the loop in the output less those in the input
+    uint8_t decision; // SpvUnrollDecision
+};
+
+struct SpvUnrollReport {
+    Array<SpvUnrollLoop> loops; // in the order of the module
+    int32_t instructionDelta; // of the whole module, with the new constants
+};
+
+// The module must pass SpvValidate(), which is checked first: false if not, with pOut left empty.
+bool SpvUnrollLoops(view<const uint32_t> module, const SpvUnrollOptions& options, Array<uint32_t> *pOut,
+                    SpvUnrollReport *pReport);
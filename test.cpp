@@ -2,11 +2,29 @@
 
 #include "message.h"
 #include "lex.h"
+#include "compile.h"
+#include "Array.h"
+#include "pool.h"
+#include "preprocess.h"
+#include "prescan.h"
+#include "spvsection.h"
+#include "spvreader.h"
+#include "spvlink.h"
+#include "spvpool.h"
+#include "dataflow.h"
+#include "spvunroll.h"
+#include "spvslp.h"
+#include "spvhalf.h"
+#include "half.h"
 
 #include <stdio.h>
 #include <stdlib.h> // strtoull, skips ws and checks for unary + or -
 #include <errno.h> // strtoull sets errno to ERANGE https://en.cppreference.com/w/cpp/string/byte/strtoul
 //#include <initializer_list>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <math.h>
 
 void Scanner_TestRaw()
 {
@@ -76,10 +94,36 @@ void Scanner_TestRaw()
 
         puts("okay");
     }
-}
 
+    // The machine-generated variant must give the same tokens on comment-free source, and no comments:
+    {
+        constexpr view<const char> input = "static_assert(1 + 2*3 == 7);\n\tint x = ~5 & 9 | 0;\r\n"_view;
+        Scanner full, lean;
+        Scanner_Init(&full, input);
+        Scanner_Init(&lean, input);
+        Token a, b;
+        do {
+            Scanner_NextTokenRawT<ScanFeatures_Full>(&full, &a);
+            Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b);
+            ASSERT(a.kind == b.kind && a.data.numberRawU64 == b.data.numberRawU64);
+            ASSERT(b.lineno == 1);
+        } while (a.kind != Token_EOI);
+        ASSERT(a.lineno == 3);
+
+        Scanner_Init(&lean, "int intx in"_view);
+        ASSERT(Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b) == Token_Kw_int);
+        ASSERT(Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b) == Token_Name && b.nameLength == 4);
+        ASSERT(Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b) == Token_Name && b.nameLength == 2);
+
+        Scanner_Init(&lean, "1 // 2"_view);
+        ASSERT(Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b) == Token_NumberLiteral);
+        ASSERT(Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b) == Token_Div); // not a comment there
+        ASSERT(Scanner_NextTokenRawT<ScanFeatures_MachineGenerated>(&lean, &b) == Token_Div);
+
+        puts("okay");
+    }
+}
 
-void Compile(view<const char> source, MessageStream *oms);
 
 static bool
 CheckStaticAssertFailOnLines(const MessageStream om, uint64_t bits)
@@ -116,7 +160,9 @@ int TestSimpleNoCode()
         {
             printf("Test: %s\n", name);
             pOm->clear();
-            Compile(source, pOm);
+            if (source.ptr) {
+                Compile(source, pOm);
+            }
         }
 
         ~Test()
@@ -147,6 +193,14 @@ int TestSimpleNoCode()
         }
     }
 
+    {
+        Test t(&ncf, "static_assert with a message", R"(void main(){
+        static_assert(1, "one");
+        static_assert(2 < 1, "two is not less than one");
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 3);
+    }
+
     {
         Test t(&ncf, "conxtexpr no vars", R"(void main(){
         static_assert(3 + 7 - 3*3 - 1); // fail, == 0, line 2
@@ -162,9 +216,77 @@ int TestSimpleNoCode()
         t.passed = CheckStaticAssertFailOnLines(om, 1 << 2 | 1 << 5 | 1 << 9);
     }
 
-#if 0
     {
-        Test t(&ncf, "conxtexpr vars", R"(void main(){
+        Test t(&ncf, "parentheses", R"(void main(){
+        static_assert((3 + 7) * 2 == 20);
+        static_assert(-(2 - 5) == 3);
+        static_assert(((1)) != 1); // fail, line 4
+        static_assert(2 * (3 + (4 - 1) * 2) == 18);
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 4);
+    }
+
+    {
+        Test t(&ncf, "vector immediates", R"(void main(){
+        static_assert(int3(1, 2, 3).z == 3);
+        static_assert((int2(1, 2) * 3 + 1).y == 7);
+        static_assert((int4(1, 2, 3, 4).wzyx - int4(4)).x == 0);
+        static_assert(int4(int2(5, 6), 7, 8).yz.y == 7);
+        static_assert((int3(9) == int3(9, 9, 8)).z); // fail, line 6
+        static_assert((2 * int2(3, 4) != int2(6, 0)).y);
+        static_assert(-int2(1, 2).y == -2);
+        static_assert(bool2(0, 5).y == 1);
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 6);
+    }
+
+    {
+        Test t(&ncf, "logical and ternary", R"(void main(){
+        static_assert(1 && 2);
+        static_assert(0 || 3 == 3);
+        static_assert(1 && 0 || 0); // fail, line 4
+        static_assert(1 ? 2 : 0);
+        static_assert((0 ? 1 : 0 ? 2 : 3) == 3);
+        static_assert(1 ? 0 ? 4 : 5 : 6); // nested middle, == 5
+        static_assert(0 ? 1 : 0); // fail, line 8
+        static_assert(1 | 0 && 2 == 2 ? 7 : 0);
+        static_assert((1 ? int2(1, 2) : int2(3, 4)).y == 2);
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 4 | 1 << 8);
+    }
+
+    {
+        Test t(&ncf, "full operator set", R"(void main(){
+        static_assert(7 / 2 == 3 && -7 / 2 == -3 && -7 % 3 == -1 && 7 % -3 == 1);
+        static_assert(1 << 4 == 16 && -16 >> 2 == -4 && 1 << 3 + 1 == 16);
+        static_assert(0 - 4294967296u >> 60 == 15 && -4294967296 >> 60 == -1 && 1 + 4294967296 << 30 >> 61 == 2);
+        static_assert(-1 < 0 && !(0u - 1u < 0u) && 3 <= 3 && 4 >= 4 && 5 > 4 == 1);
+        static_assert(3 <= 2 || 4 >= 5); // fail, line 6
+        static_assert((int2(7, -8) / 2).y == -4 && (int2(1, 2) << 1).y == 4 && (int3(5) % int3(1, 2, 3)).z == 2);
+        static_assert(-9223372036854775807 - 1 == (-9223372036854775807 - 1) / -1);
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 6);
+
+        static const view<const char> Rejected[] = {
+            "void main(){ static_assert(1 / 0); }"_view,
+            "void main(){ static_assert(int2(1, 2) % int2(1, 0)); }"_view,
+            "void main(){ static_assert(1 << 64); }"_view,
+            "void main(){ static_assert(1 << 32); }"_view,
+            "void main(){ static_assert(4294967296 << 64); }"_view,
+            "constexpr int f(int x) { return x >> 40; }\nvoid main(){ static_assert(f(1) == 0); }"_view,
+            "constexpr int f(int x) { x <<= 32; return x; }\nvoid main(){ static_assert(f(1) == 0); }"_view,
+            "void main(){ static_assert(1 >> -1); }"_view,
+            "void main(){ static_assert(1 += 2); }"_view,
+            "void main(){ static_assert(1 * / 2); }"_view,
+        };
+        for (view<const char> source : Rejected) {
+            om.clear();
+            t.passed &= Compile(source, &om) == CompileResult_NotImplemented;
+        }
+    }
+
+    {
+        Test t(&ncf, "constexpr vars", R"(void main(){
         constexpr int a = 0; // line 2
         constexpr int b = 1;
         constexpr int c = 7;
@@ -176,7 +298,335 @@ int TestSimpleNoCode()
 })"_view, &om);
         t.passed = CheckStaticAssertFailOnLines(om, 1 << 6 | 1 << 9);
     }
-#endif
+
+    {
+        Test t(&ncf, "constexpr functions", R"(constexpr long fib(int n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+constexpr int binom(int n, int k) {
+    int r = 1;
+    for (int i = 1; i <= k; ++i) {
+        r = r * (n - k + i) / i;
+    }
+    return r;
+}
+constexpr int morton(int x, int y) {
+    int m = 0;
+    int bit = 0;
+    while (1) {
+        if (bit == 16) break;
+        m |= (x >> bit & 1) << 2 * bit | (y >> bit & 1) << (2 * bit + 1);
+        bit += 1;
+    }
+    return m;
+}
+constexpr int down(int n) { return n == 0 ? 0 : down(n - 1); }
+constexpr int safeDiv(int x) { return x != 0 && 100 / x > 10; }
+constexpr int2 swap(int2 v) { return int2(v.y, v.x); }
+constexpr int shadow(int x) { { int x = 2; if (x) int x = 3; } for (int i = 0; i < 2; ++i) int x = i; return x; }
+constexpr int Ten = binom(5, 2);
+void main(){
+        static_assert(fib(40) == 102334155); // line 25, only linear in 40 with the memo
+        static_assert(binom(8, 4) == 70);
+        static_assert(morton(3, 5) == 39);
+        constexpr int t = Ten * 2;
+        static_assert(t == 20 && down(200) == 0);
+        static_assert(safeDiv(0) == 0 && safeDiv(5) == 1);
+        static_assert(swap(int2(1, 2)).x == 2 && shadow(7) == 7);
+        static_assert(fib(3) == 3); // fail, line 32
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, uint64_t(1) << 32);
+
+        static const view<const char> Rejected[] = {
+            "constexpr int f(int n) { if (n) return 1; }\nvoid main(){ static_assert(f(0)); }"_view,
+            "constexpr int f(int n) { n = 1; }\nvoid main(){ constexpr int a = 1; a = 2; }"_view,
+            "constexpr int f(int n) { return g(n); }\nvoid main(){ static_assert(f(0)); }"_view,
+            "constexpr int f(int n) { return n; }\nvoid main(){ static_assert(f(1, 2)); }"_view,
+            "constexpr int f(int x) { int x = 5; return x; }\nvoid main(){ static_assert(f(1)); }"_view,
+            "constexpr int f(int n) { int a = 1; int a = 2; return a; }\nvoid main(){ static_assert(f(1)); }"_view,
+            "constexpr int A = 1;\nconstexpr int A = 2;\nvoid main(){ }"_view,
+            "void main(){ constexpr int a = 1; constexpr int a = 2; }"_view,
+        };
+        for (view<const char> source : Rejected) {
+            om.clear();
+            t.passed &= Compile(source, &om) == CompileResult_NotImplemented;
+        }
+        om.clear();
+        t.passed &= Compile("constexpr int A = 1;\nvoid main(){ constexpr int A = 2; static_assert(A == 2); }"_view, &om) ==
+                     CompileResult_Ok && om.size() == 0;
+
+        // Values wrap to the declared type's width, the same in a scalar as in an array element:
+        om.clear();
+        t.passed &= Compile(R"(constexpr int f(int x) { return x * 65536 * 65536; }
+constexpr int inc(int x) { int r = x; r += 1; return r; }
+constexpr char C = 200;
+constexpr short S = 40000;
+constexpr char Cs[] = { 200, C };
+constexpr short Ss[] = { 40000, S };
+void main(){
+        static_assert(f(1) == 0 && f(3) == 0 && inc(2147483647) == -2147483647 - 1);
+        static_assert(C == -56 && Cs[0] == C && Cs[1] == C && S == -25536 && Ss[0] == S && Ss[1] == S);
+        constexpr int big = 4294967296 + 7;
+        static_assert(big == 7);
+})"_view, &om) == CompileResult_Ok && om.size() == 0;
+    }
+
+    {
+        Test t(&ncf, "constexpr budgets", view<const char>{ }, &om);
+        CompileResult result = Compile(R"(constexpr int spin(int n) { while (1) { n += 1; } return n; }
+void main(){
+        static_assert(1);
+        static_assert(spin(0)); // line 4
+})"_view, &om);
+        t.passed = result == CompileResult_NotImplemented && om.begin()[0].type == Message_ConstexprBudgetExceeded &&
+            om.begin()[0].miscU8 == ConstexprBudget_Steps && om.begin()[0].line == 4;
+
+        om.clear();
+        result = Compile(R"(constexpr int deep(int n) { return n == 0 ? 0 : deep(n - 1) + 1; }
+void main(){
+        static_assert(deep(1000) == 1000);
+})"_view, &om);
+        t.passed &= result == CompileResult_NotImplemented && om.begin()[0].type == Message_ConstexprBudgetExceeded &&
+            om.begin()[0].miscU8 == ConstexprBudget_Depth && om.begin()[0].line == 3;
+
+        // Each call is its own budget, and a small memory budget only turns off the memo:
+        CompileOptions options;
+        options.constexprStepBudget = 100;
+        options.constexprMemoryBytes = 512;
+        om.clear();
+        result = Compile(R"(constexpr int sum(int n) { int s = 0; for (int i = 0; i < n; ++i) s += i; return s; }
+void main(){
+        static_assert(sum(10) == 45 && sum(10) == 45 && sum(9) == 36);
+})"_view, &om, &options);
+        t.passed &= result == CompileResult_Ok && om.size() == 0;
+    }
+
+    {
+        Test t(&ncf, "constant arrays", R"(constexpr int sq(int i) { return i * i; }
+constexpr int Squares[8] = { sq(0), sq(1), sq(2), sq(3), sq(4), sq(5), sq(6), sq(7) };
+constexpr int2 Offsets[][2] = { { int2(1, 0), int2(0, 1) }, { int2(-1, 0) }, };
+constexpr int sumSquares(int n) { int s = 0; for (int i = 0; i < n; ++i) s += Squares[i]; return s; }
+constexpr int pick(int i) { constexpr int t[3] = { 5, 6, 7 }; return t[i]; }
+void main(){
+        static_assert(Squares[7] == 49 && sumSquares(8) == 140 && pick(2) == 7);
+        static_assert(Offsets[0][1].y == 1 && Offsets[1][0].x == -1 && Offsets[1][1].x == 0);
+        constexpr char Bytes[4] = { 255, 128 };
+        constexpr bool Flags[3] = { 1, 0, 5 };
+        static_assert(Bytes[0] == -1 && Bytes[1] == -128 && Bytes[3] == 0 && Flags[2] == 1 && Flags[1] == 0);
+        static_assert(0 ? Squares[100] : 1);
+        static_assert(Squares[1] == 2); // fail, line 13
+})"_view, &om);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 13);
+
+        static const view<const char> Rejected[] = {
+            "void main(){ constexpr int a[2] = { 1, 2 }; static_assert(a[2]); }"_view,
+            "void main(){ constexpr int a[2] = { 1, 2, 3 }; }"_view,
+            "void main(){ constexpr int a[2][2] = { 1, 2, 3, 4 }; }"_view,
+            "void main(){ constexpr int a[] = { }; }"_view,
+            "void main(){ constexpr int a[2] = { 1, 2 }; static_assert(a); }"_view,
+            "constexpr int f() { int a[1] = { 1 }; return a[0]; }\nvoid main(){ static_assert(f()); }"_view,
+        };
+        for (view<const char> source : Rejected) {
+            om.clear();
+            t.passed &= Compile(source, &om) == CompileResult_NotImplemented;
+        }
+
+        // Elements hold what a scalar of their type would, whether wrapped on the way in or read back:
+        om.clear();
+        t.passed &= Compile(R"(constexpr int Big[] = { 4294967296 + 7, -4294967296 - 1 };
+constexpr short3 V[1] = { short3(65536 + 3, 32768, -32769) };
+void main(){
+        constexpr short s = 32768;
+        static_assert(Big[0] == 7 && Big[1] == -1 && V[0].x == 3 && V[0].y == s && V[0].z == 32767);
+})"_view, &om) == CompileResult_Ok && om.size() == 0;
+
+        // An unsized array is as long as one OpConstantComposite can be, and says why it can't be longer:
+        for (uint n = 65532; n <= 65533; ++n) {
+            Array<char> source;
+            source.push_n("void main(){ constexpr int a[] = {\n", 35);
+            for (uint i = 0; i < n; ++i) source.push_n("0,", 2);
+            source.push_n("};\nstatic_assert(a[65531] == 0); }\0", 35);
+            om.clear();
+            CompileResult const result = Compile({ source.data(), source.size() - 1 }, &om);
+            t.passed &= n == 65532 ? result == CompileResult_Ok && om.size() == 0 :
+                result == CompileResult_NotImplemented && om.abortInfo && strstr(om.abortInfo, "65535 words");
+        }
+    }
+
+    {
+        printf("Test: %s\n", "conditional lowering report");
+        CompileOptions options;
+        options.bReportConditionalLowering = true;
+        om.clear();
+        Compile(R"(void main(){
+        static_assert(1 && 1);
+        static_assert(0 || 1 ? 2 : 0);
+})"_view, &om, &options);
+        uint nSites = 0;
+        for (const Message& m : om) {
+            if (m.type == Message_ConditionalLowering && m.miscU8 == 1 /* ExprMode_Immediate */ && (m.line == 2 || m.line == 3)) {
+                nSites += 1;
+            }
+        }
+        if (nSites != 3 || om.size() != 3) {
+            printf("Test: \"%s\" FAILED\n\n", "conditional lowering report");
+            ncf += 1;
+        }
+        else {
+            printf("Test: \"%s\" passed\n\n", "conditional lowering report");
+        }
+    }
+
+    {
+        static const SpecConstantDecl Decls[] = { { "A", 0, 1 }, { "B", 1, 2 } };
+        SpecializationInfo spec;
+        CompileOptions options;
+        options.specConstants = { Decls, lengthof(Decls) };
+        options.pSpecInfo = &spec;
+
+        Test t(&ncf, "specialization constants", view<const char>{ }, &om);
+        Compile(R"(void main(){
+        static_assert(A + B == 3);
+        static_assert(A * 2 != B ? 1 : 0);
+        static_assert(1 + 1 == 2);
+        static_assert(0); // fails at compile time, line 5
+        static_assert(-A == -1 || B && 0);
+})"_view, &om, &options);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 5) && spec.deferredAsserts.size() == 3;
+
+        static const int64_t Defaults[] = { 1, 2 };
+        om.clear();
+        Specialize(spec, { Defaults, lengthof(Defaults) }, &om);
+        t.passed &= CheckStaticAssertFailOnLines(om, 1 << 3);
+
+        static const int64_t Other[] = { 2, 5 };
+        om.clear();
+        Specialize(spec, { Other, lengthof(Other) }, &om);
+        t.passed &= CheckStaticAssertFailOnLines(om, 1 << 2 | 1 << 6);
+
+        om.clear();
+        Specialize(spec, { Other, 1 }, &om); // B takes its default
+        t.passed &= CheckStaticAssertFailOnLines(om, 1 << 2 | 1 << 6);
+    }
+
+    {
+        static const SpecConstantDecl Decls[] = { { "A", 0, 1 }, { "B", 1, 2 } };
+        CompileOptions options;
+        options.specConstants = { Decls, lengthof(Decls) };
+        CompilePrefixState prefix;
+
+        Test t(&ncf, "shared prefix", view<const char>{ }, &om);
+        CompilePrefix(R"(void main(){
+        static_assert(A == 1);
+        static_assert(0); // line 3, reported once here
+)"_view, &om, &options, &prefix);
+        t.passed = CheckStaticAssertFailOnLines(om, 1 << 3) && prefix.lineno == 4;
+
+        // Each suffix uses A's node from the prefix, only the second needs its own node for B:
+        SpecializationInfo specs[2];
+        static const view<const char> Suffixes[2] = {
+            R"(        static_assert(A + 1 == 2);
+        static_assert(1 == 2); // line 5
+})"_view,
+            R"(        static_assert(A + B == 4);
+})"_view,
+        };
+        for (uint i = 0; i < 2; ++i) {
+            om.clear();
+            CompileSuffix(prefix, Suffixes[i], &om, &specs[i]);
+            t.passed &= CheckStaticAssertFailOnLines(om, i == 0 ? 1 << 5 : 0);
+        }
+        t.passed &= prefix.specInfo.deferredAsserts.size() == 1 && specs[0].deferredAsserts.size() == 1 &&
+            specs[1].deferredAsserts.size() == 1 && specs[1].nodeBase == prefix.specInfo.nodes.size();
+        om.clear();
+        t.passed &= CompileSuffix(prefix, Suffixes[1], &om) == CompileResult_Ok && om.size() == 0;
+
+        static const int64_t Values[] = { 2, 2 };
+        om.clear();
+        Specialize(specs[0], { Values, lengthof(Values) }, &om);
+        t.passed &= CheckStaticAssertFailOnLines(om, 1 << 2 | 1 << 4);
+        om.clear();
+        Specialize(specs[1], { }, &om);
+        t.passed &= CheckStaticAssertFailOnLines(om, 1 << 4);
+        om.clear();
+        Specialize(specs[1], { Values, lengthof(Values) }, &om);
+        t.passed &= CheckStaticAssertFailOnLines(om, 1 << 2);
+    }
+
+    {
+        static const SpecConstantDecl Decls[] = { { "A", 0, 1 } };
+        CompileOptions options;
+        options.specConstants = { Decls, lengthof(Decls) };
+
+        Test t(&ncf, "aborted compile", view<const char>{ }, &om);
+        int64_t const liveBefore = GetLiveBytes();
+        {
+            SpecializationInfo spec;
+            options.pSpecInfo = &spec;
+            CompileResult const result = Compile(R"(void main(){
+        static_assert(A == 1);
+        static_assert(0);
+        static_assert((1 + 2);
+})"_view, &om, &options);
+            t.passed = result == CompileResult_NotImplemented && om.size() == 2 && om.abortInfo &&
+                om.begin()[0].type == Message_StaticAssertFailed && om.end()[-1].type == Message_CompileAborted &&
+                om.end()[-1].miscU8 == CompileResult_NotImplemented && om.end()[-1].line == 4;
+        }
+        t.passed &= GetLiveBytes() == liveBefore;
+
+        // Nothing is left behind for the next compile:
+        om.clear();
+        t.passed &= Compile(R"(void main(){
+        static_assert(0);
+})"_view, &om) == CompileResult_Ok && CheckStaticAssertFailOnLines(om, 1 << 2) && !om.abortInfo;
+    }
+
+    {
+        Test t(&ncf, "too many messages", view<const char>{ }, &om);
+        Array<char> source;
+        source.push_n("void main(){\n", 13);
+        for (uint i = 0; i < 300; ++i) {
+            source.push_n("static_assert(0);\n", 18);
+        }
+        source.push_n("}\0", 2);
+        CompileResult const result = Compile({ source.data(), source.size() - 1 }, &om);
+        t.passed = result == CompileResult_NotImplemented && om.size() == 256 && om.end()[-1].type == Message_CompileAborted &&
+            om.end()[-2].type == Message_StaticAssertFailed;
+    }
+
+    {
+        static const SpecConstantDecl Decls[] = { { "A", 0, 1 } };
+        Array<char> source;
+        source.push_n("void main(){\n", 13);
+        for (uint i = 0; i < 1000; ++i) {
+            source.push_n("static_assert(A * 3 != 2);\n", 27);
+        }
+        source.push_n("}\0", 2);
+
+        Test t(&ncf, "memory budget", view<const char>{ }, &om);
+        int64_t peak = -1;
+        int64_t const liveBefore = GetLiveBytes();
+        {
+            SpecializationInfo spec;
+            CompileOptions options;
+            options.specConstants = { Decls, lengthof(Decls) };
+            options.pSpecInfo = &spec;
+            options.pPeakBytes = &peak;
+            options.memoryBudgetBytes = 4096;
+            t.passed = Compile({ source.data(), source.size() - 1 }, &om, &options) == CompileResult_OverMemoryBudget &&
+                om.end()[-1].type == Message_CompileAborted && om.end()[-1].miscU8 == CompileResult_OverMemoryBudget &&
+                peak > 0 && peak <= 4096;
+        }
+        t.passed &= GetLiveBytes() == liveBefore;
+
+        SpecializationInfo spec;
+        CompileOptions options;
+        options.specConstants = { Decls, lengthof(Decls) };
+        options.pSpecInfo = &spec;
+        options.pPeakBytes = &peak;
+        options.memoryBudgetBytes = 1 << 20;
+        om.clear();
+        t.passed &= Compile({ source.data(), source.size() - 1 }, &om, &options) == CompileResult_Ok && om.size() == 0 &&
+            peak > 4096 && peak <= 1 << 20 && spec.deferredAsserts.size() == 1000;
+    }
 
     ASSERT(ncf >= 0);
     if (ncf) {
@@ -187,3 +637,1969 @@ int TestSimpleNoCode()
     }
     return ncf;
 }
+
+
+/*
+    Reference interpreter for the constant folder.
+
+    There is no IR or emitted module to execute yet, so the oracle works at the source level:
+    random literal-operator expressions are evaluated by a small precedence-climbing interpreter over
+    the raw token stream, which shares nothing with ParseExpr's operator stack, and the result
+    is compared against whether Compile() reports the static_assert as failed.
+
+    Levels follow the cppreference table ParseExpr's OpInfo uses; lower binds tighter.
+    ParseExpr currently folds everything in 64 bits, so this does too. Literals are signed, so are / % >> < <= > >=.
+    What C leaves undefined (division by zero, shift counts out of range) clears *pRefValid: the compiler
+    rejects those, so such expressions are not used.
+**/
+static bool *pRefValid;
+
+static int
+RefBinaryLevel(TokenKind k)
+{
+    switch (k) {
+    case Token_Mul:
+    case Token_Div:
+    case Token_Mod:      return 5;
+    case Token_Plus:
+    case Token_Minus:    return 6;
+    case Token_LeftShift:
+    case Token_RightShift: return 7;
+    case Token_LessThan:
+    case Token_LessEq:
+    case Token_GreaterThan:
+    case Token_GreaterEq: return 9;
+    case Token_CmpEqual:
+    case Token_CmpNotEq: return 10;
+    case Token_Amp:      return 11;
+    case Token_Caret:    return 12;
+    case Token_VBar:     return 13;
+    case Token_LogicAnd: return 14;
+    case Token_LogicOr:  return 15;
+    case Token_Question: return 16;
+    default:             return 0; // not a binary op, ends the expression
+    }
+}
+
+static int64_t RefEvalBinary(const Token **ppTok, int maxLevel);
+
+static int64_t
+RefEvalUnary(const Token **ppTok)
+{
+    const Token *tok = (*ppTok)++;
+    switch (tok->kind) {
+    case Token_Plus:            return +RefEvalUnary(ppTok);
+    case Token_Minus:           return int64_t(0 - uint64_t(RefEvalUnary(ppTok)));
+    case Token_UnaryLogicalNot: return !RefEvalUnary(ppTok);
+    case Token_UnaryBitwiseNot: return ~RefEvalUnary(ppTok);
+    case Token_NumberLiteral:   return int64_t(tok->data.numberRawU64);
+    case Token_OpenParen: {
+        int64_t const r = RefEvalBinary(ppTok, 31);
+        ASSERT((*ppTok)->kind == Token_CloseParen);
+        ++*ppTok;
+        return r;
+    }
+    default:
+        ASSERT(0);
+        return 0;
+    }
+}
+
+static int64_t
+RefEvalBinary(const Token **ppTok, int maxLevel)
+{
+    int64_t a = RefEvalUnary(ppTok);
+    for (int level; (level = RefBinaryLevel((*ppTok)->kind)) != 0 && level <= maxLevel; ) {
+        TokenKind const k = (*ppTok)++->kind;
+        if (k == Token_Question) {
+            int64_t const t = RefEvalBinary(ppTok, 31);
+            ASSERT((*ppTok)->kind == Token_Colon);
+            ++*ppTok;
+            int64_t const f = RefEvalBinary(ppTok, level); // right assoc
+            a = a ? t : f;
+            continue;
+        }
+        int64_t const b = RefEvalBinary(ppTok, level - 1); // left assoc
+        // The operands are all ints, so a shift count must be below 32:
+        if (((k == Token_Div || k == Token_Mod) && b == 0) || ((k == Token_LeftShift || k == Token_RightShift) && uint64_t(b) >= 32)) {
+            *pRefValid = false;
+            continue;
+        }
+        switch (k) {
+        case Token_Mul:      a = int64_t(uint64_t(a) * uint64_t(b)); break;
+        case Token_Div:      a = b == -1 ? int64_t(0 - uint64_t(a)) : a / b; break;
+        case Token_Mod:      a = b == -1 ? 0 : a % b; break;
+        case Token_Plus:     a = int64_t(uint64_t(a) + uint64_t(b)); break;
+        case Token_Minus:    a = int64_t(uint64_t(a) - uint64_t(b)); break;
+        case Token_LeftShift:  a = int64_t(uint64_t(a) << b); break;
+        case Token_RightShift: a = a >> b; break;
+        case Token_LessThan:    a = a < b; break;
+        case Token_LessEq:      a = a <= b; break;
+        case Token_GreaterThan: a = a > b; break;
+        case Token_GreaterEq:   a = a >= b; break;
+        case Token_CmpEqual: a = a == b; break;
+        case Token_CmpNotEq: a = a != b; break;
+        case Token_Amp:      a = a & b; break;
+        case Token_Caret:    a = a ^ b; break;
+        case Token_VBar:     a = a | b; break;
+        case Token_LogicAnd: a = a && b; break;
+        case Token_LogicOr:  a = a || b; break;
+        default: ASSERT(0);
+        }
+    }
+    return a;
+}
+
+static int64_t
+RefEvalSource(view<const char> expr, bool *pValid)
+{
+    *pValid = true;
+    pRefValid = pValid;
+    Token toks[64];
+    uint n = 0;
+    Scanner sc;
+    Scanner_Init(&sc, expr);
+    do {
+        ASSERT(n < lengthof(toks));
+        Scanner_NextTokenRaw(&sc, &toks[n]);
+    } while (toks[n++].kind != Token_EOI);
+
+    const Token *pTok = toks;
+    int64_t const r = RefEvalBinary(&pTok, 31);
+    ASSERT(pTok->kind == Token_EOI);
+    return r;
+}
+
+static uint32_t
+TestRandNext(uint32_t *state) // xorshift32, fixed seed so failures reproduce
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static uint
+GenRandomConstExpr(uint32_t *rng, char *buf, uint bufSize, uint depth = 0)
+{
+    static const char *const BinOps[] = {
+        "*", "/", "%", "+", "-", "<<", ">>", "<", "<=", ">", ">=", "==", "!=", "&", "^", "|", "&&", "||", "?"
+    };
+    static const char *const UnOps[] = { "-", "+", "~", "!" };
+
+    uint len = 0;
+    uint const nOperands = 1 + TestRandNext(rng) % (depth ? 3 : 6);
+    for (uint i = 0; i < nOperands; ++i) {
+        if (i) {
+            const char *const op = BinOps[TestRandNext(rng) % lengthof(BinOps)];
+            if (op[0] == '?') { // the middle of a ?: is any expression
+                len += snprintf(buf + len, bufSize - len, " ? ");
+                len += GenRandomConstExpr(rng, buf + len, bufSize - len, 2);
+                len += snprintf(buf + len, bufSize - len, " : ");
+            }
+            else {
+                len += snprintf(buf + len, bufSize - len, " %s ", op);
+            }
+        }
+        if (TestRandNext(rng) % 4 == 0) {
+            len += snprintf(buf + len, bufSize - len, "%s ", UnOps[TestRandNext(rng) % lengthof(UnOps)]);
+        }
+        if (depth < 2 && TestRandNext(rng) % 5 == 0) {
+            buf[len++] = '(';
+            len += GenRandomConstExpr(rng, buf + len, bufSize - len, depth + 1);
+            buf[len++] = ')';
+            buf[len] = '\0';
+        }
+        else {
+            len += snprintf(buf + len, bufSize - len, "%u", TestRandNext(rng) % 10);
+        }
+    }
+    ASSERT(len < bufSize);
+    return len;
+}
+
+int TestConstantFoldOracle()
+{
+    puts(__FUNCTION__);
+
+    enum { NumBatches = 16, LinesPerBatch = 60 };
+
+    MessageStream om;
+    uint32_t rng = 0x9e3779b9u;
+    int nFailedBatches = 0;
+
+    for (uint batch = 0; batch < NumBatches; ++batch) {
+        static char src[LinesPerBatch * 272];
+        uint len = snprintf(src, sizeof src, "void main(){\n");
+        uint64_t expectFailLines = 0;
+
+        for (uint line = 2; line < 2 + LinesPerBatch; ++line) {
+            char expr[256];
+            uint exprLen;
+            int64_t value;
+            for (bool bValid = false; !bValid; ) {
+                exprLen = GenRandomConstExpr(&rng, expr, sizeof expr);
+                value = RefEvalSource({ expr, exprLen }, &bValid);
+            }
+            if (value == 0) {
+                expectFailLines |= uint64_t(1) << line;
+            }
+            len += snprintf(src + len, sizeof src - len, "static_assert(%s);\n", expr);
+        }
+        len += snprintf(src + len, sizeof src - len, "}");
+        ASSERT(len < sizeof src);
+
+        om.clear();
+        Compile({ src, len }, &om);
+        if (!CheckStaticAssertFailOnLines(om, expectFailLines)) {
+            printf("Constant fold oracle mismatch in batch %u:\n%s\n", batch, src);
+            nFailedBatches += 1;
+        }
+    }
+
+    if (nFailedBatches) {
+        printf("Constant fold oracle FAILED: %d batches.\n", nFailedBatches);
+    }
+    else {
+        puts("Constant fold oracle passed.");
+    }
+    return nFailedBatches;
+}
+
+
+void TestSmallArray()
+{
+    puts(__FUNCTION__);
+
+    SmallArray<uint32_t, 4> arr;
+    ASSERT(arr.is_empty() && arr.is_inline() && arr.capacity() == 4);
+    for (uint32_t i = 0; i < 4; ++i) {
+        arr.push(i);
+    }
+    ASSERT(arr.is_inline());
+
+    arr.push(4); // spill
+    ASSERT(!arr.is_inline() && arr.size() == 5);
+
+    const uint32_t tmp[] = { 5, 6, 7, 8, 9, 10, 11 };
+    arr.push_n(tmp, lengthof(tmp));
+    ASSERT(arr.size() == 12);
+    uint32_t expect = 0;
+    for (uint32_t x : arr) {
+        ASSERT(x == expect++);
+        (void)x;
+    }
+    (void)expect;
+
+    SmallArray<uint32_t, 4> arr2;
+    arr2.push(1);
+    arr2.push_n(tmp, lengthof(tmp)); // spill by push_n
+    ASSERT(!arr2.is_inline() && arr2.size() == 8 && arr2[0] == 1 && arr2[7] == 11);
+    ASSERT(arr2.pop() == 11);
+
+    puts("okay");
+}
+
+
+void TestAllocStats()
+{
+    puts(__FUNCTION__);
+    {
+        // Budget scopes count live bytes in every build, ALLOC_STATS or not:
+        int64_t const live = GetLiveBytes();
+        AllocBudgetScope budget(1 << 20);
+        void *p = AllocateBytes(1000);
+        Deallocate(AllocateBytes(3000));
+        int64_t const peak = budget.PeakBytes();
+        Deallocate(p);
+        (void)live;
+        ASSERT(peak == 4000 && GetLiveBytes() == live);
+        printf("budget scope peak %lld bytes\n", (long long)peak);
+    }
+#if ALLOC_STATS
+    ResetAllocPeaks();
+    AllocStats const before = GetAllocStats();
+    {
+        AllocTagScope tag(AllocTag_Lexer);
+        Array<uint32_t> arr;
+        for (uint32_t i = 0; i < 100; ++i) {
+            arr.push(i);
+        }
+        void *p = AllocateBytes(1000);
+        AllocStats const mid = DiffAllocStats(before, GetAllocStats());
+        (void)mid;
+        ASSERT(mid.tags[AllocTag_Lexer].curBytes == int64_t(arr.capacity() * sizeof(uint32_t) + 1000));
+        ASSERT(mid.total.curBytes == mid.tags[AllocTag_Lexer].curBytes);
+        ASSERT(mid.tags[AllocTag_Lexer].nAllocs == 2 && mid.tags[AllocTag_Lexer].nReallocs > 1);
+        Deallocate(p);
+    }
+    AllocStats const d = DiffAllocStats(before, GetAllocStats());
+    ASSERT(d.total.curBytes == 0); // no leaks
+    ASSERT(d.tags[AllocTag_Lexer].peakBytes >= 1000 + 100 * int64_t(sizeof(uint32_t)));
+    ASSERT(d.tags[AllocTag_Lexer].nFrees == 2);
+    ASSERT(d.tags[AllocTag_Parser].nAllocs == 0);
+
+    // The constant pool charges its own tag, whatever the caller's:
+    AllocStats const beforePool = GetAllocStats();
+    {
+        AllocTagScope tag(AllocTag_Parser);
+        SpvPool pool;
+        SpvPool_Int(&pool, SpvPool_IntType(&pool, 32, true), 7);
+    }
+    AllocStats const dPool = DiffAllocStats(beforePool, GetAllocStats());
+    (void)dPool;
+    ASSERT(dPool.tags[AllocTag_Types].nAllocs > 0 && dPool.tags[AllocTag_Types].nAllocs == dPool.total.nAllocs);
+    ASSERT(dPool.tags[AllocTag_Types].curBytes == 0);
+    printf("peak %lld bytes, %llu bytes copied by realloc\n",
+        (long long)d.total.peakBytes, (unsigned long long)d.total.reallocCopyBytes);
+#endif
+    puts("okay");
+}
+
+
+void TestPool()
+{
+    puts(__FUNCTION__);
+
+    struct Node { uint32_t a, b, c, d; };
+    static const PoolFlags FlagCases[] = { 0, PoolFlag_HugePages };
+    for (PoolFlags flags : FlagCases) {
+        Pool<Node> pool(flags);
+        uint32_t const n = PoolChunkBytes / sizeof(Node) * 2 + 10; // spans 3 chunks
+        Array<PoolIndex> idx;
+        for (uint32_t i = 0; i < n; ++i) {
+            PoolIndex const k = pool.alloc();
+            ASSERT(k != NullPoolIndex);
+            pool[k] = { i, i + 1, i + 2, i + 3 };
+            idx.push(k);
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            ASSERT(pool[idx[i]].a == i && pool[idx[i]].d == i + 3);
+        }
+        pool.free(idx[5]);
+        pool.free(idx[n - 1]);
+        ASSERT(pool.alloc() == idx[n - 1]); // LIFO reuse
+        ASSERT(pool.alloc() == idx[5]);
+        ASSERT(pool.high_water() == n);
+    }
+
+    // Chunks count as live bytes and toward a budget's peak, mapped or allocated, until the pool goes:
+    for (PoolFlags flags : FlagCases) {
+        int64_t const live = GetLiveBytes();
+        AllocBudgetScope budget(0);
+        {
+            Pool<Node> pool(flags);
+            pool.alloc();
+            ASSERT(GetLiveBytes() - live >= PoolChunkBytes);
+        }
+        (void)live;
+        ASSERT(GetLiveBytes() == live && budget.PeakBytes() >= PoolChunkBytes);
+    }
+
+    puts("okay");
+}
+
+
+static void
+WriteTestFile(const char *dir, const char *name, const char *text)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *const fp = fopen(path, "wb");
+    ASSERT(fp);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+void TestPreprocessor()
+{
+    puts(__FUNCTION__);
+    char dir[] = "/tmp/vkc_pp_XXXXXX";
+    if (!mkdtemp(dir)) {
+        puts("skipped, no temp dir");
+        return;
+    }
+    static const char GuardedText[] = "#ifndef GUARDED_H\n#define GUARDED_H\n#define VALUE 3\n#include \"once.h\"\n#endif\n";
+    static const char OnceText[] = "#pragma once\n#define ONCE_VALUE (VALUE - 2)\n";
+    WriteTestFile(dir, "guarded.h", GuardedText);
+    WriteTestFile(dir, "once.h", OnceText);
+    WriteTestFile(dir, "body.h", "static_assert(VALUE == 3);\n");
+
+    static const char Source[] = R"(#include "guarded.h"
+#include "guarded.h"
+#include "once.h"
+void main(){
+#include "body.h"
+#include "body.h"
+#if VALUE * 2 == 6 && defined(ONCE_VALUE) && !defined NOPE
+    static_assert(VALUE + ONCE_VALUE == 4);
+#elif 1
+    static_assert(0);
+#else
+    static_assert(0);
+#endif
+#ifdef NOPE
+    static_assert(0);
+#elif VALUE > 2 ? 1 : 0
+    static_assert(VALUE == 2); // line 17
+#endif
+#undef VALUE
+#define VALUE 2
+    static_assert(VALUE == 2);
+#include "missing.h"
+})";
+    char path[512];
+    snprintf(path, sizeof(path), "%s/main.c", dir);
+    PreprocessOptions options;
+    options.path = path;
+
+    MessageStream om;
+    for (uint pass = 0; pass < 3; ++pass) {
+        if (pass == 2) {
+            WriteTestFile(dir, "body.h", "static_assert(VALUE == 3); \n"); // one byte longer, so changed even within the same second
+        }
+        IncludeCacheStats const before = GetIncludeCacheStats();
+        Array<Token> tokens;
+        om.clear();
+        Preprocess({ Source, lengthof(Source) - 1 }, &om, &options, &tokens);
+        ASSERT(om.size() == 1 && om.begin()->type == Message_IncludeNotFound && om.begin()->line == 22);
+        om.clear();
+        CompilePreprocessed({ tokens.data(), tokens.size() }, &om);
+        ASSERT(om.size() == 1 && om.begin()->type == Message_StaticAssertFailed && om.begin()->line == 17);
+
+        // guarded.h's second include and once.h's second are skipped, body.h is included twice:
+        IncludeCacheStats const after = GetIncludeCacheStats();
+        uint64_t const nHits = after.nHits - before.nHits, nMisses = after.nMisses - before.nMisses;
+        (void)nHits; (void)nMisses;
+        ASSERT(after.nSkipped - before.nSkipped == 2);
+        ASSERT(pass == 0 ? nMisses == 3 && nHits == 1 : pass == 1 ? nMisses == 0 && nHits == 4 : nMisses == 1 && nHits == 3);
+    }
+
+    // A module of guarded.h, mapped as a fresh process would: its macros are used in place, and both headers
+    // are skipped by their guards without being opened.
+    static const char ModuleSource[] = "#include \"guarded.h\"\n#define FROM_MODULE VALUE\n";
+    char modulePath[512];
+    snprintf(modulePath, sizeof(modulePath), "%s/lib.vkcm", dir);
+    om.clear();
+    bool const bWritten = WritePrecompiledModule({ ModuleSource, lengthof(ModuleSource) - 1 }, &om, &options, modulePath);
+    (void)bWritten;
+    ASSERT(bWritten && om.size() == 0);
+    ClearIncludeCache();
+    {
+        const PrecompiledModule *const mod = MapPrecompiledModule(modulePath);
+        ASSERT(mod);
+        static const char UsingSource[] = R"(#include "guarded.h"
+#include "once.h"
+void main(){
+    static_assert(FROM_MODULE + ONCE_VALUE == 4);
+#undef VALUE
+#ifdef VALUE
+    static_assert(0);
+#endif
+#define VALUE 5
+    static_assert(FROM_MODULE == 5);
+    static_assert(FROM_MODULE == 3); // line 11
+})";
+        PreprocessOptions moduleOptions = options;
+        moduleOptions.module = mod;
+        IncludeCacheStats const before = GetIncludeCacheStats();
+        Array<Token> tokens;
+        om.clear();
+        Preprocess({ UsingSource, lengthof(UsingSource) - 1 }, &om, &moduleOptions, &tokens);
+        IncludeCacheStats const after = GetIncludeCacheStats();
+        (void)before; (void)after;
+        ASSERT(om.size() == 0 && after.nSkipped - before.nSkipped == 2);
+        ASSERT(after.bytesSaved - before.bytesSaved == lengthof(GuardedText) - 1 + lengthof(OnceText) - 1);
+        ASSERT(after.nHits == before.nHits && after.nMisses == before.nMisses);
+        CompilePreprocessed({ tokens.data(), tokens.size() }, &om);
+        ASSERT(om.size() == 1 && om.begin()->type == Message_StaticAssertFailed && om.begin()->line == 11);
+        UnmapPrecompiledModule(mod);
+    }
+
+    // constexpr definitions before main, out of macros:
+    {
+        static const char Source[] = R"(#define SCALE 3
+constexpr int square(int x) { return x * x; }
+void main(){
+    static_assert(square(square(SCALE)) == 81);
+    static_assert(square(2) == 5); // line 5
+})";
+        Array<Token> tokens;
+        om.clear();
+        Preprocess({ Source, lengthof(Source) - 1 }, &om, &options, &tokens);
+        ASSERT(om.size() == 0);
+        CompilePreprocessed({ tokens.data(), tokens.size() }, &om);
+        ASSERT(om.size() == 1 && om.begin()->type == Message_StaticAssertFailed && om.begin()->line == 5);
+    }
+
+    // Truncated or foreign files are rejected when mapped:
+    WriteTestFile(dir, "lib.vkcm", "VKCM but not really a module");
+    ASSERT(!MapPrecompiledModule(modulePath));
+    remove(modulePath);
+
+    static const char *const Names[] = { "guarded.h", "once.h", "body.h" };
+    for (const char *name : Names) {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        remove(path);
+    }
+    remove(dir);
+    puts("okay");
+}
+
+
+// One byte at a time, straight from the scanner's rules; BuildStructuralIndex() must agree on every input.
+static void
+RefStructuralIndex(const char *src, uint n, Array<StructuralRange> *blocks, Array<uint32_t> *semicolons, bool *pbUnbalanced)
+{
+    uint depth = 0;
+    uint32_t open = 0;
+    bool bUnbalanced = false;
+    uint i = 0;
+    while (i < n) {
+        char const c = src[i++];
+        if (c == '/' && src[i] == '/') {
+            while (i < n && src[i] != '\n') i++;
+        }
+        else if (c == '/' && src[i] == '*') {
+            i += 2; // "/*/" does not close
+            while (i < n && !(src[i] == '/' && src[i - 1] == '*')) i++;
+            bUnbalanced |= i >= n;
+            i++;
+        }
+        else if (c == '"') {
+            while (i < n && src[i] != '"' && src[i] != '\n') i++;
+            bUnbalanced |= i >= n || src[i] == '\n';
+            i++;
+        }
+        else if (c == '{') {
+            if (depth++ == 0) open = i - 1;
+        }
+        else if (c == '}') {
+            if (depth == 0) bUnbalanced = true;
+            else if (--depth == 0) blocks->push({ open, i - 1 });
+        }
+        else if (c == ';' && depth == 0) {
+            semicolons->push(i - 1);
+        }
+    }
+    *pbUnbalanced = bUnbalanced || depth;
+}
+
+int TestStructuralIndex()
+{
+    puts(__FUNCTION__);
+
+    static const char Example[] = "void f(){ a; /* } */ } // {\nint x; void main(){ \"}\"; {}; }";
+    StructuralIndex index;
+    BuildStructuralIndex({ Example, lengthof(Example) - 1 }, &index);
+    ASSERT(index.blocks.size() == 2 && !index.bUnbalanced && index.semicolons.size() == 1);
+    ASSERT(Example[index.blocks[0].open] == '{' && Example[index.blocks[1].close] == '}');
+
+    // Random sources over the bytes that matter, at lengths around the 64-byte blocks:
+    static const char Alphabet[] = "{{}};;\"//**\n\nab ";
+    uint32_t rng = 0x2545f491u;
+    int nFailed = 0;
+    for (uint iter = 0; iter < 20000; ++iter) {
+        char src[300];
+        uint const n = TestRandNext(&rng) % (sizeof(src) - 1);
+        for (uint i = 0; i < n; ++i) {
+            src[i] = Alphabet[TestRandNext(&rng) % (lengthof(Alphabet) - 1)];
+        }
+        src[n] = '\0';
+
+        Array<StructuralRange> blocks;
+        Array<uint32_t> semicolons;
+        bool bUnbalanced;
+        RefStructuralIndex(src, n, &blocks, &semicolons, &bUnbalanced);
+        BuildStructuralIndex({ src, n }, &index);
+        bool bSame = index.bUnbalanced == bUnbalanced && index.blocks.size() == blocks.size() &&
+            index.semicolons.size() == semicolons.size();
+        for (uint i = 0; bSame && i < blocks.size(); ++i) {
+            bSame = index.blocks[i].open == blocks[i].open && index.blocks[i].close == blocks[i].close;
+        }
+        for (uint i = 0; bSame && i < semicolons.size(); ++i) {
+            bSame = index.semicolons[i] == semicolons[i];
+        }
+        if (!bSame) {
+            if (nFailed++ < 4) {
+                printf("Structural index mismatch on:\n%s\n", src);
+            }
+        }
+    }
+
+    if (nFailed) {
+        printf("Structural index FAILED on %d inputs.\n", nFailed);
+    }
+    else {
+        puts("Structural index passed.");
+    }
+    return nFailed;
+}
+
+
+// Function k: OpFunction, OpLabel, a chain of 3 + 5k OpIAdds on a global constant, OpReturn, OpFunctionEnd.
+static void
+EmitTestFunction(SpvSection *s, uint k)
+{
+    enum : SpvId { IntType = 1, VoidType = 2, FnType = 3, One = 4 }; // global
+    SpvId const fn = SpvSection_NewLocalId(s);
+    SpvSection_PushOp(s, 54 /* OpFunction */, 5);
+    SpvSection_PushWord(s, VoidType);
+    SpvSection_PushLocalId(s, fn);
+    SpvSection_PushWord(s, 0);
+    SpvSection_PushWord(s, FnType);
+    SpvSection_PushOp(s, 248 /* OpLabel */, 2);
+    SpvSection_PushLocalId(s, SpvSection_NewLocalId(s));
+    SpvId prev = One;
+    bool bPrevLocal = false;
+    for (uint i = 0; i < 3 + 5 * k; ++i) {
+        SpvId const sum = SpvSection_NewLocalId(s);
+        SpvSection_PushOp(s, 128 /* OpIAdd */, 5);
+        SpvSection_PushWord(s, IntType);
+        SpvSection_PushLocalId(s, sum);
+        if (bPrevLocal) {
+            SpvSection_PushLocalId(s, prev);
+        }
+        else {
+            SpvSection_PushWord(s, prev);
+        }
+        SpvSection_PushWord(s, One);
+        prev = sum;
+        bPrevLocal = true;
+    }
+    SpvSection_PushOp(s, 253 /* OpReturn */, 1);
+    SpvSection_PushOp(s, 56 /* OpFunctionEnd */, 1);
+}
+
+void TestSpvSectionLink()
+{
+    puts(__FUNCTION__);
+    enum { NumFunctions = 6, FirstLocal = 5 };
+
+    SpvSection sequential[NumFunctions];
+    for (uint k = 0; k < NumFunctions; ++k) {
+        EmitTestFunction(&sequential[k], k);
+    }
+
+    // One thread per function, started in reverse, so they finish in whatever order:
+    SpvSection parallel[NumFunctions];
+    {
+        std::thread threads[NumFunctions];
+        for (uint k = NumFunctions; k-- > 0;) {
+            threads[k] = std::thread(EmitTestFunction, &parallel[k], k);
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    const SpvSection *seqOrder[NumFunctions], *parOrder[NumFunctions];
+    for (uint k = 0; k < NumFunctions; ++k) {
+        seqOrder[k] = &sequential[k];
+        parOrder[k] = &parallel[k];
+    }
+    Array<uint32_t> a, b;
+    SpvId const boundA = SpvLinkSections({ seqOrder, NumFunctions }, SpvId(FirstLocal), &a);
+    SpvId const boundB = SpvLinkSections({ parOrder, NumFunctions }, SpvId(FirstLocal), &b);
+    ASSERT(boundA == boundB && a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(uint32_t)) == 0);
+    (void)boundB;
+
+    // Dense: every id in [FirstLocal, bound) is the result of exactly one instruction.
+    Array<uint8_t> defined;
+    memset(defined.uninitialized_push_n(boundA), 0, boundA);
+    for (uint i = 0; i < a.size(); i += a[i] >> 16) {
+        uint const opcode = a[i] & 0xffff;
+        uint const resultWord = opcode == 248 ? 1 : opcode == 54 || opcode == 128 ? 2 : 0;
+        if (resultWord) {
+            ASSERT(a[i + resultWord] >= FirstLocal && a[i + resultWord] < boundA && !defined[a[i + resultWord]]);
+            defined[a[i + resultWord]] = 1;
+        }
+    }
+    for (uint id = FirstLocal; id < boundA; ++id) {
+        ASSERT(defined[id]);
+    }
+    printf("%u words, bound %u\n", a.size(), boundA);
+    puts("okay");
+}
+
+
+static void
+AppendText(void *user, const char *text, uint nBytes)
+{
+    static_cast<Array<char> *>(user)->push_n(text, nBytes);
+}
+
+// The globals EmitTestFunction() uses, then its functions linked after them.
+static void
+BuildTestModule(uint nFunctions, Array<uint32_t> *pOut)
+{
+    static const uint32_t Prologue[] = {
+        SpvMagic, 0x00010000, 0, 0 /* bound */, 0,
+        2 << 16 | 17, 1,        // OpCapability Shader
+        3 << 16 | 14, 0, 1,     // OpMemoryModel Logical GLSL450
+        4 << 16 | 21, 1, 32, 1, // %1 = OpTypeInt 32 1
+        2 << 16 | 19, 2,        // %2 = OpTypeVoid
+        3 << 16 | 33, 3, 2,     // %3 = OpTypeFunction %2
+        4 << 16 | 43, 1, 4, 1,  // %4 = OpConstant %1 1
+    };
+    enum { FirstLocal = 5, MaxFunctions = 8 };
+    ASSERT(nFunctions <= MaxFunctions);
+    SpvSection sections[MaxFunctions];
+    const SpvSection *order[MaxFunctions];
+    for (uint k = 0; k < nFunctions; ++k) {
+        EmitTestFunction(&sections[k], k);
+        order[k] = &sections[k];
+    }
+    pOut->clear();
+    pOut->push_n(Prologue, lengthof(Prologue));
+    (*pOut)[3] = SpvLinkSections({ order, nFunctions }, SpvId(FirstLocal), pOut);
+}
+
+void TestSpvReader()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> module;
+    BuildTestModule(6, &module);
+    SpvValidationError error;
+    if (!SpvValidate({ module.data(), module.size() }, &error)) {
+        printf("linked module invalid at word %u: %s\n", error.wordOffset, error.what);
+        ASSERT(0);
+    }
+
+    BuildTestModule(1, &module);
+    static const char Expected[] =
+        "; SPIR-V\n; Version: 1.0\n; Generator: 0\n; Bound: 10\n; Schema: 0\n"
+        "OpCapability 1\n"
+        "OpMemoryModel 0 1\n"
+        "%1 = OpTypeInt 32 1\n"
+        "%2 = OpTypeVoid\n"
+        "%3 = OpTypeFunction %2\n"
+        "%4 = OpConstant %1 1\n"
+        "%5 = OpFunction %2 0 %3\n"
+        "%6 = OpLabel\n"
+        "%7 = OpIAdd %1 %4 %4\n"
+        "%8 = OpIAdd %1 %7 %4\n"
+        "%9 = OpIAdd %1 %8 %4\n"
+        "OpReturn\n"
+        "OpFunctionEnd\n";
+    Array<char> text;
+    SpvDisassemble({ module.data(), module.size() }, AppendText, &text);
+    if (text.size() != lengthof(Expected) - 1 || memcmp(text.data(), Expected, text.size()) != 0) {
+        printf("disassembly:\n%.*s", int(text.size()), text.data());
+        ASSERT(0);
+    }
+
+    // Each breaks the one-function module in one place, word 30 being the first OpIAdd:
+    static const struct {
+        uint index;
+        uint32_t value;
+        uint length; // truncated to this many words if not 0
+        const char *what;
+    } Broken[] = {
+        {  0, 0x12345678,    0, "bad magic number" },
+        {  0, 0x03022307,    0, "other byte order" },
+        {  1, 0x00020000,    0, "unknown version" },
+        {  3, 8,             0, "id out of bounds" },
+        { 15, 1,             0, "id defined twice" },
+        { 18, 5,             0, "type used before its definition" },
+        { 24, 4,             0, "type operand is not a type" },
+        { 38, 9,             0, "id used before its definition" },
+        { 38, 8,             0, "id used before its definition" }, // its own result
+        {  5, 2 << 16 | 14,  0, "too few operands" },
+        {  7, 3 << 16 | 17,  0, "too many operands" },
+        { 14, 2 << 16 | 17,  0, "instruction out of layout order" },
+        { 30, 5 << 16 | 300, 0, "unknown opcode" },
+        { 30, 0,             0, "bad word count" },
+        { 30, ~0u << 16 | 128, 0, "bad word count" }, // past the end
+        { 28, 2 << 16 | 0,   0, "instruction outside a block" },
+        { 45, 1 << 16 | 0,   0, "block without a terminator" },
+        {  0, SpvMagic,     46, "OpFunction without OpFunctionEnd" },
+        {  0, SpvMagic,      7, "not exactly one OpMemoryModel" },
+        {  0, SpvMagic,      3, "shorter than a header" },
+    };
+    Array<uint32_t> broken;
+    for (const auto& b : Broken) {
+        broken.clear();
+        broken.push_n(module.data(), b.length ? b.length : module.size());
+        broken[b.index] = b.value;
+        bool const bValid = SpvValidate({ broken.data(), broken.size() }, &error);
+        if (bValid || strcmp(error.what, b.what) != 0) {
+            printf("word %u = 0x%x: expected \"%s\", got \"%s\"\n", b.index, b.value, b.what, bValid ? "valid" : error.what);
+            ASSERT(0);
+        }
+    }
+
+    // Round trip through a file:
+    char path[] = "/tmp/vkc_spv_XXXXXX";
+    int const fd = mkstemp(path);
+    if (fd < 0) {
+        puts("skipped the file round trip, no temp file");
+        puts("okay");
+        return;
+    }
+    ssize_t const nWritten = write(fd, module.data(), module.size() * sizeof(uint32_t));
+    ASSERT(nWritten == ssize_t(module.size() * sizeof(uint32_t)));
+    close(fd);
+    SpvMappedFile file;
+    bool const bMapped = SpvMapFile(path, &file);
+    ASSERT(bMapped);
+    (void)nWritten; (void)bMapped;
+    ASSERT(file.words.length == module.size() && memcmp(file.words.ptr, module.data(), module.size() * sizeof(uint32_t)) == 0);
+    ASSERT(SpvValidate(file.words, &error));
+    SpvUnmapFile(&file);
+    FILE *const fp = fopen(path, "ab");
+    fputc(0, fp); // no longer whole words
+    fclose(fp);
+    ASSERT(!SpvMapFile(path, &file));
+    remove(path);
+    puts("okay");
+}
+
+
+// "add_one" and "main" as literal strings: little-endian bytes, '\0'-terminated and padded to words.
+enum : uint32_t { AddOneName0 = 0x5f646461, AddOneName1 = 0x00656e6f, MainName0 = 0x6e69616d, MainName1 = 0 };
+
+// Exports add_one(int) -> int.
+static const uint32_t LinkLibrary[] = {
+    SpvMagic, 0x00010000, 0, 8, 0,
+    2 << 16 | 17, 1,                                   // OpCapability Shader
+    2 << 16 | 17, 5,                                   // OpCapability Linkage
+    3 << 16 | 14, 0, 1,                                // OpMemoryModel Logical GLSL450
+    6 << 16 | 71, 4, 41, AddOneName0, AddOneName1, 0,  // OpDecorate %4 LinkageAttributes "add_one" Export
+    4 << 16 | 21, 1, 32, 1,                            // %1 = OpTypeInt 32 1
+    4 << 16 | 33, 2, 1, 1,                             // %2 = OpTypeFunction %1 %1
+    4 << 16 | 43, 1, 3, 1,                             // %3 = OpConstant %1 1
+    5 << 16 | 54, 1, 4, 0, 2,                          // %4 = OpFunction %1 None %2
+    3 << 16 | 55, 1, 5,                                // %5 = OpFunctionParameter %1
+    2 << 16 | 248, 6,                                  // %6 = OpLabel
+    5 << 16 | 128, 1, 7, 5, 3,                         // %7 = OpIAdd %1 %5 %3
+    2 << 16 | 254, 7,                                  // OpReturnValue %7
+    1 << 16 | 56,                                      // OpFunctionEnd
+};
+
+// Imports add_one and calls it with its own int type and constant 1, which are the library's again.
+static const uint32_t LinkMain[] = {
+    SpvMagic, 0x00010000, 0, 11, 0,
+    2 << 16 | 17, 1,
+    2 << 16 | 17, 5,
+    3 << 16 | 14, 0, 1,
+    4 << 16 | 5, 6, MainName0, MainName1,              // OpName %6 "main"
+    6 << 16 | 71, 5, 41, AddOneName0, AddOneName1, 1,  // OpDecorate %5 LinkageAttributes "add_one" Import
+    2 << 16 | 19, 1,                                   // %1 = OpTypeVoid
+    4 << 16 | 21, 2, 32, 1,                            // %2 = OpTypeInt 32 1
+    4 << 16 | 33, 3, 2, 2,                             // %3 = OpTypeFunction %2 %2
+    4 << 16 | 43, 2, 4, 1,                             // %4 = OpConstant %2 1
+    3 << 16 | 33, 7, 1,                                // %7 = OpTypeFunction %1
+    5 << 16 | 54, 2, 5, 0, 3,                          // %5 = OpFunction %2 None %3, a declaration
+    3 << 16 | 55, 2, 8,                                // %8 = OpFunctionParameter %2
+    1 << 16 | 56,                                      // OpFunctionEnd
+    5 << 16 | 54, 1, 6, 0, 7,                          // %6 = OpFunction %1 None %7
+    2 << 16 | 248, 9,                                  // %9 = OpLabel
+    5 << 16 | 57, 2, 10, 5, 4,                         // %10 = OpFunctionCall %2 %5 %4
+    1 << 16 | 253,                                     // OpReturn
+    1 << 16 | 56,                                      // OpFunctionEnd
+};
+
+static bool
+ExpectLinkError(view<const view<const uint32_t>> modules, const char *what)
+{
+    Array<uint32_t> out;
+    SpvLinkError error;
+    if (SpvLinkModules(modules, &error, &out)) {
+        printf("linked, expected \"%s\"\n", what);
+        return false;
+    }
+    if (strcmp(error.what, what) != 0 || !out.is_empty()) {
+        printf("expected \"%s\", got \"%s\" in module %u\n", what, error.what, error.moduleIndex);
+        return false;
+    }
+    return true;
+}
+
+void TestSpvLink()
+{
+    puts(__FUNCTION__);
+    view<const uint32_t> const library = { LinkLibrary, lengthof(LinkLibrary) };
+    view<const uint32_t> const main = { LinkMain, lengthof(LinkMain) };
+    view<const uint32_t> const both[] = { library, main };
+
+    Array<uint32_t> out;
+    SpvLinkError error;
+    if (!SpvLinkModules({ both, 2 }, &error, &out)) {
+        printf("link failed in module %u at word %u: %s\n", error.moduleIndex, error.wordOffset, error.what);
+        ASSERT(0);
+    }
+    SpvValidationError validationError;
+    ASSERT(SpvValidate({ out.data(), out.size() }, &validationError));
+    (void)validationError;
+
+    static const char Expected[] =
+        "; SPIR-V\n; Version: 1.0\n; Generator: 0\n; Bound: 13\n; Schema: 0\n"
+        "OpCapability 1\n"
+        "OpMemoryModel 0 1\n"
+        "OpName %10 \"main\"\n"
+        "%1 = OpTypeInt 32 1\n"
+        "%2 = OpTypeFunction %1 %1\n"
+        "%3 = OpConstant %1 1\n"
+        "%8 = OpTypeVoid\n"
+        "%9 = OpTypeFunction %8\n"
+        "%4 = OpFunction %1 0 %2\n"
+        "%5 = OpFunctionParameter %1\n"
+        "%6 = OpLabel\n"
+        "%7 = OpIAdd %1 %5 %3\n"
+        "OpReturnValue %7\n"
+        "OpFunctionEnd\n"
+        "%10 = OpFunction %8 0 %9\n"
+        "%11 = OpLabel\n"
+        "%12 = OpFunctionCall %1 %4 %3\n"
+        "OpReturn\n"
+        "OpFunctionEnd\n";
+    Array<char> text;
+    SpvDisassemble({ out.data(), out.size() }, AppendText, &text);
+    if (text.size() != lengthof(Expected) - 1 || memcmp(text.data(), Expected, text.size()) != 0) {
+        printf("linked:\n%.*s", int(text.size()), text.data());
+        ASSERT(0);
+    }
+
+    // Linked the other way around, the same functions, numbered in the other order:
+    view<const uint32_t> const reversed[] = { main, library };
+    bool const bLinked = SpvLinkModules({ reversed, 2 }, &error, &out);
+    ASSERT(bLinked);
+    (void)bLinked;
+    ASSERT(SpvValidate({ out.data(), out.size() }, &validationError) && out[3] == 13);
+
+    bool bOk = true;
+    bOk &= ExpectLinkError({ &main, 1 }, "import not exported by any module");
+    view<const uint32_t> const twice[] = { library, library, main };
+    bOk &= ExpectLinkError({ twice, 3 }, "exported twice");
+
+    uint32_t otherType[lengthof(LinkMain)];
+    memcpy(otherType, LinkMain, sizeof(LinkMain));
+    otherType[43] = 7; // the declaration's type: void()
+    view<const uint32_t> const mismatched[] = { library, { otherType, lengthof(otherType) } };
+    bOk &= ExpectLinkError({ mismatched, 2 }, "import and export types differ");
+
+    uint32_t otherModel[lengthof(LinkMain)];
+    memcpy(otherModel, LinkMain, sizeof(LinkMain));
+    otherModel[11] = 2; // OpenCL
+    view<const uint32_t> const models[] = { library, { otherModel, lengthof(otherModel) } };
+    bOk &= ExpectLinkError({ models, 2 }, "memory models differ");
+
+    uint32_t broken[lengthof(LinkMain)];
+    memcpy(broken, LinkMain, sizeof(LinkMain));
+    broken[3] = 10; // bound
+    view<const uint32_t> const invalid[] = { library, { broken, lengthof(broken) } };
+    bOk &= ExpectLinkError({ invalid, 2 }, "id out of bounds");
+    ASSERT(bOk);
+    puts("okay");
+}
+
+// A module of only the pool's names, types and constants, with the capabilities its integer widths need.
+static void
+BuildPoolModule(const SpvPool& pool, Array<uint32_t> *pOut)
+{
+    pOut->clear();
+    uint32_t const header[] = { SpvMagic, 0x00010000, 0, SpvPool_NextId(&pool), 0, 2 << 16 | SpvOp_Capability, 1 };
+    pOut->push_n(header, lengthof(header));
+    static const uint32_t Capabilities[3] = { 39 /* Int8 */, 22 /* Int16 */, 11 /* Int64 */ };
+    for (uint i = 0; i < 3; ++i) {
+        if (pool.intWidths >> i & 1) {
+            pOut->push(2 << 16 | SpvOp_Capability);
+            pOut->push(Capabilities[i]);
+        }
+    }
+    uint32_t const memoryModel[] = { 3 << 16 | SpvOp_MemoryModel, 0, 1 };
+    pOut->push_n(memoryModel, lengthof(memoryModel));
+    pOut->push_n(pool.names.data(), pool.names.size());
+    pOut->push_n(pool.words.data(), pool.words.size());
+}
+
+void TestSpvPool()
+{
+    puts(__FUNCTION__);
+    MessageStream om;
+    SpvPool pool;
+    CompileOptions options;
+    options.pConstantPool = &pool;
+    CompileResult result = Compile(R"(void main(){
+    constexpr int T[2][3] = { { 1, 2 }, { 1, 2 } };
+    constexpr long L[2] = { -1, 1 };
+    static_assert(T[1][1] == 2 && L[0] == -1);
+})"_view, &om, &options);
+    ASSERT(result == CompileResult_Ok && om.size() == 0);
+
+    Array<uint32_t> module;
+    BuildPoolModule(pool, &module);
+    SpvValidationError error;
+    ASSERT(SpvValidate({ module.data(), module.size() }, &error));
+    static const char Expected[] =
+        "; SPIR-V\n; Version: 1.0\n; Generator: 0\n; Bound: 17\n; Schema: 0\n"
+        "OpCapability 1\n"
+        "OpCapability 11\n"
+        "OpMemoryModel 0 1\n"
+        "OpName %11 \"T\"\n"
+        "OpName %16 \"L\"\n"
+        "%1 = OpTypeInt 32 1\n"
+        "%2 = OpTypeInt 32 0\n"
+        "%3 = OpConstant %2 3\n"
+        "%4 = OpTypeArray %1 %3\n"
+        "%5 = OpConstant %2 2\n"
+        "%6 = OpTypeArray %4 %5\n"
+        "%7 = OpConstant %1 1\n"
+        "%8 = OpConstant %1 2\n"
+        "%9 = OpConstant %1 0\n"
+        "%10 = OpConstantComposite %4 %7 %8 %9\n" // both rows are this one
+        "%11 = OpConstantComposite %6 %10 %10\n"
+        "%12 = OpTypeInt 64 1\n"
+        "%13 = OpTypeArray %12 %5\n"
+        "%14 = OpConstant %12 4294967295 4294967295\n"
+        "%15 = OpConstant %12 1 0\n"
+        "%16 = OpConstantComposite %13 %14 %15\n";
+    Array<char> text;
+    SpvDisassemble({ module.data(), module.size() }, AppendText, &text);
+    if (text.size() != lengthof(Expected) - 1 || memcmp(text.data(), Expected, text.size()) != 0) {
+        printf("pool:\n%.*s", int(text.size()), text.data());
+        ASSERT(0);
+    }
+
+    // A 64k-element table of 8 distinct rows takes 8 rows' worth of constants, and the pool keeps no more:
+    Array<char> source;
+    source.push_n("void main(){\nconstexpr short Lut[256][256] = {\n", 47);
+    for (uint i = 0; i < 256; ++i) {
+        source.push('{');
+        for (uint j = 0; j < 256; ++j) {
+            char number[16];
+            source.push_n(number, snprintf(number, sizeof(number), "%u,", (i % 8) * 256 + j));
+        }
+        source.push_n("},\n", 3);
+    }
+    source.push_n("};\nstatic_assert(Lut[13][7] == 1287 && Lut[255][255] == 2047);\n}\0", 65);
+    SpvPool big;
+    options.pConstantPool = &big;
+    om.clear();
+    result = Compile({ source.data(), source.size() - 1 }, &om, &options);
+    ASSERT(result == CompileResult_Ok && om.size() == 0);
+    uint const nConstants = 8 * 256 + 1 + 8 + 1; // the elements, the length of both dimensions, the rows, the table
+    (void)nConstants;
+    ASSERT(SpvPool_NextId(&big) - big.firstId == nConstants + 4 && big.intWidths == SpvPoolInt_16);
+    ASSERT(big.words.size() < 8 * 256 * 4 + 9 * 259 + 64);
+    ASSERT(big.idOffsets.size() == nConstants + 4 && big.table.size() <= 4 * (nConstants + 4));
+    BuildPoolModule(big, &module);
+    ASSERT(SpvValidate({ module.data(), module.size() }, &error));
+    (void)result;
+    (void)error;
+    puts("okay");
+}
+
+// A random gen/kill problem, lists of bits per block in CSR form.
+template<FlowDirection Direction, FlowMeet Meet>
+struct TestFlowPolicy {
+    static constexpr FlowDirection direction = Direction;
+    static constexpr FlowMeet meet = Meet;
+    uint nBits;
+    const uint32_t *genBegin, *gen, *killBegin, *kill;
+
+    view<const uint32_t> Gen(uint b) const { return { gen + genBegin[b], genBegin[b + 1] - genBegin[b] }; }
+    view<const uint32_t> Kill(uint b) const { return { kill + killBegin[b], killBegin[b + 1] - killBegin[b] }; }
+};
+
+static void
+RandomSortedBits(uint32_t *rng, uint nBits, uint maxCount, Array<uint32_t> *pBegin, Array<uint32_t> *pBits)
+{
+    pBegin->push(pBits->size());
+    uint const first = pBits->size();
+    for (uint n = TestRandNext(rng) % (maxCount + 1); n; --n) {
+        pBits->push(TestRandNext(rng) % nBits);
+    }
+    std::sort(pBits->begin() + first, pBits->end());
+    pBits->set_size(uint(std::unique(pBits->begin() + first, pBits->end()) - pBits->begin()));
+}
+
+/*
+    The fixpoint by brute force: every reachable block, in index order, until nothing changes. Returns the in and
+    out rows as bytes, 2 * nBits per block.
+**/
+template<class Policy> static void
+RefSolveDataflow(const FlowGraph *g, const Policy& policy, Array<uint8_t> *pRows)
+{
+    bool const bForward = Policy::direction == Flow_Forward;
+    bool const bUnion = Policy::meet == FlowMeet_Union;
+    uint const nBits = policy.nBits;
+    pRows->clear();
+    uint8_t *const rows = pRows->uninitialized_push_n(2 * g->nBlocks * nBits);
+    Array<uint32_t> order;
+    FlowGraph_ReversePostorder(g, &order);
+    Array<uint8_t> reachable;
+    memset(reachable.uninitialized_push_n(g->nBlocks), 0, g->nBlocks);
+    for (uint32_t b : order) {
+        reachable[b] = 1;
+    }
+    for (uint b = 0; b < g->nBlocks; ++b) {
+        memset(rows + 2 * b * nBits, 0, nBits);
+        memset(rows + (2 * b + 1) * nBits, !bUnion, nBits);
+    }
+    const uint32_t *const fromBegin = (bForward ? g->predBegin : g->succBegin).data();
+    const uint32_t *const from = (bForward ? g->preds : g->succs).data();
+    for (bool bChanged = true; bChanged;) {
+        bChanged = false;
+        for (uint b = 0; b < g->nBlocks; ++b) {
+            if (!reachable[b]) {
+                continue;
+            }
+            uint8_t *const in = rows + 2 * b * nBits, *const out = in + nBits;
+            for (uint bit = 0; bit < nBits; ++bit) {
+                uint8_t v = fromBegin[b] == fromBegin[b + 1] ? 0 : !bUnion;
+                for (uint i = fromBegin[b]; i < fromBegin[b + 1]; ++i) {
+                    uint8_t const o = rows[(2 * from[i] + 1) * nBits + bit];
+                    v = bUnion ? v | o : v & o;
+                }
+                in[bit] = v;
+            }
+            uint8_t next[256];
+            memcpy(next, in, nBits);
+            for (uint32_t bit : policy.Kill(b)) next[bit] = 0;
+            for (uint32_t bit : policy.Gen(b)) next[bit] = 1;
+            bChanged |= memcmp(next, out, nBits) != 0;
+            memcpy(out, next, nBits);
+        }
+    }
+}
+
+template<class Policy> static bool
+CheckDataflow(const FlowGraph *g, const Policy& policy, uint seed)
+{
+    Array<uint8_t> ref;
+    RefSolveDataflow(g, policy, &ref);
+    FlowOptions options;
+    FlowSolution dense, sparse;
+    SolveDataflow(g, policy, options, &dense);
+    options.maxDenseBytes = 0; // sparse where the meet allows it
+    SolveDataflow(g, policy, options, &sparse);
+    ASSERT(!dense.bSparse && sparse.bSparse == (Policy::meet == FlowMeet_Union));
+
+    Array<uint32_t> bits;
+    for (uint b = 0; b < g->nBlocks; ++b) {
+        for (int bOut = 0; bOut < 2; ++bOut) {
+            const uint8_t *const expected = &ref[(2 * b + bOut) * policy.nBits];
+            for (const FlowSolution *s : { &dense, &sparse }) {
+                FlowSolution_GetSet(s, b, bOut, &bits);
+                uint n = 0;
+                for (uint bit = 0; bit < policy.nBits; ++bit) {
+                    bool const bIn = FlowSolution_Contains(s, b, bOut, bit);
+                    if (bIn != bool(expected[bit]) || (bIn && (n >= bits.size() || bits[n++] != bit))) {
+                        printf("seed %u, direction %d, meet %d, %s: block %u %s, bit %u\n", seed, Policy::direction,
+                            Policy::meet, s->bSparse ? "sparse" : "dense", b, bOut ? "out" : "in", bit);
+                        return false;
+                    }
+                }
+                if (n != bits.size()) {
+                    printf("seed %u: block %u, GetSet has extra bits\n", seed, b);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    A function with a loop, and an OpPhi taking one value from before it and one from its body:
+        entry: %9 = %7 + 1         br header
+        header: %11 = phi(%9 entry, %15 body)   %12 = %11 < %7   loop merge exit, continue body   br %12 body exit
+        body: %15 = %11 + 1        br header
+        exit: return
+**/
+static const uint32_t FlowLoopModule[] = {
+    SpvMagic, 0x00010000, 0, 16, 0,
+    2 << 16 | 17, 1,                             // OpCapability Shader
+    3 << 16 | 14, 0, 1,                          // OpMemoryModel Logical GLSL450
+    2 << 16 | 19, 1,                             // %1 = OpTypeVoid
+    4 << 16 | 21, 2, 32, 1,                      // %2 = OpTypeInt 32 1
+    2 << 16 | 20, 3,                             // %3 = OpTypeBool
+    4 << 16 | 33, 4, 1, 2,                       // %4 = OpTypeFunction %1 %2
+    4 << 16 | 43, 2, 5, 1,                       // %5 = OpConstant %2 1
+    5 << 16 | 54, 1, 6, 0, 4,                    // %6 = OpFunction %1 None %4
+    3 << 16 | 55, 2, 7,                          // %7 = OpFunctionParameter %2
+    2 << 16 | 248, 8,                            // %8 = OpLabel
+    5 << 16 | 128, 2, 9, 7, 5,                   // %9 = OpIAdd %2 %7 %5
+    2 << 16 | 249, 10,                           // OpBranch %10
+    2 << 16 | 248, 10,                           // %10 = OpLabel
+    7 << 16 | 245, 2, 11, 9, 8, 15, 14,          // %11 = OpPhi %2 %9 %8 %15 %14
+    5 << 16 | 177, 3, 12, 11, 7,                 // %12 = OpSLessThan %3 %11 %7
+    4 << 16 | 246, 13, 14, 0,                    // OpLoopMerge %13 %14 None
+    4 << 16 | 250, 12, 14, 13,                   // OpBranchConditional %12 %14 %13
+    2 << 16 | 248, 14,                           // %14 = OpLabel
+    5 << 16 | 128, 2, 15, 11, 5,                 // %15 = OpIAdd %2 %11 %5
+    2 << 16 | 249, 10,                           // OpBranch %10
+    2 << 16 | 248, 13,                           // %13 = OpLabel
+    1 << 16 | 253,                               // OpReturn
+    1 << 16 | 56,                                // OpFunctionEnd
+};
+
+static bool
+ExpectIds(const SpvFunctionFlow *flow, const Array<uint32_t>& values, const uint32_t *ids) // ids end with 0
+{
+    uint i = 0;
+    for (; ids[i]; ++i) {
+        if (i == values.size() || flow->valueIds.data()[values.data()[i]] != ids[i]) {
+            return false;
+        }
+    }
+    return i == values.size();
+}
+
+void TestDataflow()
+{
+    puts(__FUNCTION__);
+    uint32_t rng = 0x9e3779b9;
+    bool bOk = true;
+    for (uint seed = 0; seed < 300 && bOk; ++seed) {
+        uint const nBlocks = 1 + TestRandNext(&rng) % 40;
+        uint const nBits = 1 + TestRandNext(&rng) % 200;
+        Array<uint32_t> edges;
+        for (uint b = 0; b < nBlocks; ++b) {
+            for (uint n = TestRandNext(&rng) % 3; n; --n) {
+                edges.push(b);
+                edges.push(TestRandNext(&rng) % nBlocks);
+            }
+        }
+        FlowGraph g;
+        FlowGraph_Build(&g, nBlocks, TestRandNext(&rng) % nBlocks, { edges.data(), edges.size() });
+        Array<uint32_t> genBegin, gen, killBegin, kill;
+        for (uint b = 0; b < nBlocks; ++b) {
+            RandomSortedBits(&rng, nBits, 6, &genBegin, &gen);
+            RandomSortedBits(&rng, nBits, 6, &killBegin, &kill);
+        }
+        genBegin.push(gen.size());
+        killBegin.push(kill.size());
+
+        TestFlowPolicy<Flow_Forward, FlowMeet_Union> const reaching = { nBits, genBegin.data(), gen.data(), killBegin.data(), kill.data() };
+        TestFlowPolicy<Flow_Backward, FlowMeet_Union> const live = { nBits, genBegin.data(), gen.data(), killBegin.data(), kill.data() };
+        TestFlowPolicy<Flow_Forward, FlowMeet_Intersect> const available = { nBits, genBegin.data(), gen.data(), killBegin.data(), kill.data() };
+        TestFlowPolicy<Flow_Backward, FlowMeet_Intersect> const anticipated = { nBits, genBegin.data(), gen.data(), killBegin.data(), kill.data() };
+        bOk = CheckDataflow(&g, reaching, seed) && CheckDataflow(&g, live, seed) && CheckDataflow(&g, available, seed) &&
+            CheckDataflow(&g, anticipated, seed);
+    }
+    ASSERT(bOk);
+
+    // Liveness over SPIR-V: blocks %8 %10 %14 %13 are 0 1 2 3.
+    view<const uint32_t> const module = { FlowLoopModule, lengthof(FlowLoopModule) };
+    SpvValidationError error;
+    bOk = SpvValidate(module, &error);
+    SpvFunctionFlow flow;
+    SpvBuildFunctionFlow({ FlowLoopModule + 26, lengthof(FlowLoopModule) - 26 }, 16, &flow);
+    ASSERT(flow.graph.nBlocks == 4 && flow.valueIds.size() == 5);
+    FlowSolution s;
+    SolveDataflow(&flow.graph, SpvLivenessPolicy{ flow.valueIds.size(), &flow }, FlowOptions(), &s);
+    static const uint32_t LiveIn[][3] = { { 7 }, { 7 }, { 7, 11 }, {} };
+    static const uint32_t LiveOut[][3] = { { 7 }, { 7, 11 }, { 7 }, {} };
+    Array<uint32_t> values;
+    for (uint b = 0; b < 4; ++b) {
+        FlowSolution_GetSet(&s, b, true, &values);
+        bOk &= ExpectIds(&flow, values, LiveIn[b]);
+        FlowSolution_GetSet(&s, b, false, &values);
+        bOk &= ExpectIds(&flow, values, LiveOut[b]);
+    }
+    ASSERT(flow.phiUseBegin[1] == 1 && flow.phiUseBegin[2] == 1 && flow.phiUseBegin[3] == 2);
+    ASSERT(flow.valueIds[flow.phiUses[0]] == 9 && flow.valueIds[flow.phiUses[1]] == 15);
+    for (uint32_t id : flow.idMap) {
+        bOk &= id == ~0u;
+    }
+    ASSERT(bOk);
+    puts("okay");
+}
+
+/*
+    int f() { int sum = 0; for (int i = 0; i < limit; ++i) sum += i * i; return sum; }, the limit %6 or, if it isn't
+    a constant, sum itself:
+        entry:  br header
+        header: %10 = phi(0 entry, %15 cont)   %11 = phi(0 entry, %16 cont)   %12 = %10 < limit
+                loop merge exit, continue cont, control   br %12 body exit
+        body:   %18 = %10 * %10          br cont
+        cont:   %15 = %10 + 1   %16 = %11 + %18   br header
+        exit:   return %11
+**/
+static void
+BuildUnrollModule(uint32_t limit, bool bConstantLimit, uint32_t control, Array<uint32_t> *pOut)
+{
+    uint32_t const words[] = {
+        SpvMagic, 0x00010000, 0, 19, 0,
+        2 << 16 | 17, 1,                         // OpCapability Shader
+        3 << 16 | 14, 0, 1,                      // OpMemoryModel Logical GLSL450
+        3 << 16 | 5, 11, 0x006d7573,             // OpName %11 "sum"
+        4 << 16 | 21, 1, 32, 1,                  // %1 = OpTypeInt 32 1
+        2 << 16 | 20, 2,                         // %2 = OpTypeBool
+        3 << 16 | 33, 3, 1,                      // %3 = OpTypeFunction %1
+        4 << 16 | 43, 1, 4, 0,                   // %4 = OpConstant %1 0
+        4 << 16 | 43, 1, 5, 1,                   // %5 = OpConstant %1 1
+        4 << 16 | 43, 1, 6, limit,               // %6 = OpConstant %1 limit
+        5 << 16 | 54, 1, 7, 0, 3,                // %7 = OpFunction %1 None %3
+        2 << 16 | 248, 8,                        // %8 = OpLabel
+        2 << 16 | 249, 9,                        // OpBranch %9
+        2 << 16 | 248, 9,                        // %9 = OpLabel
+        7 << 16 | 245, 1, 10, 4, 8, 15, 13,      // %10 = OpPhi %1 %4 %8 %15 %13
+        7 << 16 | 245, 1, 11, 4, 8, 16, 13,      // %11 = OpPhi %1 %4 %8 %16 %13
+        5 << 16 | 177, 2, 12, 10, bConstantLimit ? 6u : 11u, // %12 = OpSLessThan %2 %10 limit
+        4 << 16 | 246, 14, 13, control,          // OpLoopMerge %14 %13 control
+        4 << 16 | 250, 12, 17, 14,               // OpBranchConditional %12 %17 %14
+        2 << 16 | 248, 17,                       // %17 = OpLabel
+        5 << 16 | 132, 1, 18, 10, 10,            // %18 = OpIMul %1 %10 %10
+        2 << 16 | 249, 13,                       // OpBranch %13
+        2 << 16 | 248, 13,                       // %13 = OpLabel
+        5 << 16 | 128, 1, 15, 10, 5,             // %15 = OpIAdd %1 %10 %5
+        5 << 16 | 128, 1, 16, 11, 18,            // %16 = OpIAdd %1 %11 %18
+        2 << 16 | 249, 9,                        // OpBranch %9
+        2 << 16 | 248, 14,                       // %14 = OpLabel
+        2 << 16 | 254, 11,                       // OpReturnValue %11
+        1 << 16 | 56,                            // OpFunctionEnd
+    };
+    pOut->clear();
+    pOut->push_n(words, lengthof(words));
+}
+
+#if is_debug // only ASSERTs use these
+// Runs the only function of a module made of the ops in BuildUnrollModule(), returning what it returns.
+static uint32_t
+RunUnrollModule(view<const uint32_t> module)
+{
+    Array<uint32_t> values, labelAt;
+    uint32_t const bound = module.ptr[3];
+    memset(values.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(labelAt.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    uint at = 0;
+    for (uint i = 5; i < module.length; i += module.ptr[i] >> 16) {
+        const uint32_t *const w = module.ptr + i;
+        if (uint16_t(w[0]) == SpvOp_Constant) {
+            values[w[2]] = w[3];
+        }
+        if (uint16_t(w[0]) == SpvOp_Label) {
+            labelAt[w[1]] = i;
+            at = at ? at : i;
+        }
+    }
+    uint32_t block = 0, prev = 0;
+    for (uint nSteps = 0; nSteps < 1 << 24; ++nSteps) {
+        const uint32_t *const w = module.ptr + at;
+        at += w[0] >> 16;
+        switch (uint16_t(w[0])) {
+        case SpvOp_Label: prev = block; block = w[1]; break;
+        case SpvOp_Phi:
+            for (uint i = 4; i < w[0] >> 16; i += 2) {
+                values[w[2]] = w[i] == prev ? values[w[i - 1]] : values[w[2]];
+            }
+            break;
+        case SpvOp_IAdd: values[w[2]] = values[w[3]] + values[w[4]]; break;
+        case SpvOp_IMul: values[w[2]] = values[w[3]] * values[w[4]]; break;
+        case SpvOp_SLessThan: values[w[2]] = int32_t(values[w[3]]) < int32_t(values[w[4]]); break;
+        case SpvOp_Branch: at = labelAt[w[1]]; break;
+        case SpvOp_BranchConditional: at = labelAt[values[w[1]] ? w[2] : w[3]]; break;
+        case SpvOp_LoopMerge: break;
+        case SpvOp_ReturnValue: return values[w[1]];
+        default: ASSERT(!"op not in BuildUnrollModule()");
+        }
+    }
+    ASSERT(!"runs forever");
+    return 0;
+}
+
+static uint
+CountOps(view<const uint32_t> module, uint16_t opcode)
+{
+    uint n = 0;
+    for (uint i = 5; i < module.length; i += module.ptr[i] >> 16) {
+        n += uint16_t(module.ptr[i]) == opcode;
+    }
+    return n;
+}
+#endif
+
+// Unrolls, checks the output is valid and computes what the input does, and returns the one loop's report.
+static SpvUnrollLoop
+CheckUnroll(const Array<uint32_t>& in, const SpvUnrollOptions& options, Array<uint32_t> *pOut)
+{
+    SpvUnrollReport report;
+    bool const bUnrolled = SpvUnrollLoops({ in.data(), in.size() }, options, pOut, &report);
+    ASSERT(bUnrolled);
+    (void)bUnrolled;
+    SpvValidationError error;
+    ASSERT(SpvValidate({ pOut->data(), pOut->size() }, &error));
+    (void)error;
+    ASSERT(RunUnrollModule({ pOut->data(), pOut->size() }) == RunUnrollModule({ in.data(), in.size() }));
+    ASSERT(report.loops.size() == 1 && report.loops[0].header == 9);
+    return report.loops[0];
+}
+
+void TestSpvUnroll()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> in, out;
+    SpvUnrollOptions options;
+
+    // Fully unrolled and folded down to the sum: 0 + 1 + 4 + 9.
+    BuildUnrollModule(4, true, 0, &in);
+    SpvUnrollLoop loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_Full && loop.tripCount == 4 && loop.factor == 4);
+    ASSERT(loop.instructionDelta == 2 + 4 * 4 - 13);
+    view<const uint32_t> const unrolled = { out.data(), out.size() };
+    ASSERT(CountOps(unrolled, SpvOp_Phi) == 0 && CountOps(unrolled, SpvOp_LoopMerge) == 0);
+    ASSERT(CountOps(unrolled, SpvOp_IAdd) == 0 && CountOps(unrolled, SpvOp_IMul) == 0);
+    ASSERT(CountOps(unrolled, SpvOp_Name) == 0); // %11 is gone
+    ASSERT(CountOps(unrolled, SpvOp_Constant) == 3 + 5); // 2, 3, 5, 9 and 14 are new
+    const uint32_t *const ret = out.end() - 3;
+    ASSERT(uint16_t(ret[0]) == SpvOp_ReturnValue && RunUnrollModule(unrolled) == 14);
+    (void)unrolled;
+    (void)ret;
+
+    // Without folding the copies keep their ops; with no trips the header branches out.
+    options.bPropagateConstants = false;
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_Full && CountOps({ out.data(), out.size() }, SpvOp_IAdd) == 8);
+    options.bPropagateConstants = true;
+    BuildUnrollModule(0, true, 0, &in);
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_Full && loop.tripCount == 0 && loop.instructionDelta == 2 - 13);
+
+    // Over the full budget: 1000 trips by 8 copies, 1001 by 7; 1009 is prime, so the driver is told not to.
+    BuildUnrollModule(1000, true, 0, &in);
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_Partial && loop.tripCount == 1000 && loop.factor == 8);
+    ASSERT(CountOps({ out.data(), out.size() }, SpvOp_IMul) == 8 && loop.instructionDelta == 7 * 7);
+    BuildUnrollModule(1001, true, 0, &in);
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_Partial && loop.factor == 7);
+    BuildUnrollModule(1009, true, 0, &in);
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_HintDontUnroll && loop.factor == 1 && loop.instructionDelta == 0);
+    ASSERT(out.size() == in.size() && out[in.size() - 33] == 2); // DontUnroll
+    BuildUnrollModule(70000, true, 0, &in); // too many trips to count
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.tripCount == SpvUnroll_UnknownTrips);
+
+    // Unknown trip counts get hints by size, and hints already there are kept.
+    BuildUnrollModule(4, false, 0, &in);
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_HintUnroll && loop.tripCount == SpvUnroll_UnknownTrips);
+    ASSERT(out[in.size() - 33] == 1);
+    options.hintBudget = 6;
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_HintDontUnroll);
+    BuildUnrollModule(4, true, 2, &in);
+    loop = CheckUnroll(in, options, &out);
+    ASSERT(loop.decision == SpvUnroll_Kept && loop.tripCount == 4);
+    ASSERT(out.size() == in.size() && memcmp(out.data(), in.data(), in.size() * sizeof(uint32_t)) == 0);
+
+    in[3] = 0; // bound
+    SpvUnrollReport report;
+    bool const bInvalid = !SpvUnrollLoops({ in.data(), in.size() }, options, &out, &report);
+    ASSERT(bInvalid && out.size() == 0);
+    (void)bInvalid;
+    puts("okay");
+}
+
+static void
+PushSpvOp(Array<uint32_t> *p, uint16_t opcode, std::initializer_list<uint32_t> operands)
+{
+    p->push(uint32_t(1 + operands.size()) << 16 | opcode);
+    for (uint32_t word : operands) {
+        p->push(word);
+    }
+}
+
+/*
+    Functions vec3 f(vec3 v, vec3 w, float s), written component-wise, with %1 float, %2 vec3, %3 vec2, %4 the function
+    type, %5 2.0 and %6 3.0:
+        0: vec3(v.x * s + w.x, v.y * s + w.y, v.z * s + w.z)
+        1: vec3(v.y * s, v.x * s, v.z * s)
+        2: vec2 r = vec2(v.x * 2.0, v.y * 3.0); vec3(r.x, r.y, s)
+        3: a = v.x * s; r = vec3(a, v.y * s, v.z * s); d = a + s; r + vec3(d, d, d)
+        4: t = s + s; u = s - s; a = t * s; b = u * t; c = a * s; r = vec2(a, b); q = vec2(c, c * s); vec3(r.x, q.y, s)
+    Vectorizing 4 isn't worth it, for r it takes two gathers, and q has a lane depending on the other.
+**/
+enum { SlpTestFunctions = 5 };
+
+static void
+BuildSlpModule(Array<uint32_t> *pOut, uint32_t *functionIds)
+{
+    enum : uint32_t { Float = 1, Vec3 = 2, Vec2 = 3, FnType = 4, Two = 5, Three = 6 };
+    Array<uint32_t>& m = *pOut;
+    m.clear();
+    uint32_t const header[] = { SpvMagic, 0x00010000, 0, 0, 0 };
+    m.push_n(header, lengthof(header));
+    PushSpvOp(&m, SpvOp_Capability, { 1 });
+    PushSpvOp(&m, SpvOp_MemoryModel, { 0, 1 });
+    PushSpvOp(&m, SpvOp_TypeFloat, { Float, 32 });
+    PushSpvOp(&m, SpvOp_TypeVector, { Vec3, Float, 3 });
+    PushSpvOp(&m, SpvOp_TypeVector, { Vec2, Float, 2 });
+    PushSpvOp(&m, 33 /* OpTypeFunction */, { FnType, Vec3, Vec3, Vec3, Float });
+    PushSpvOp(&m, SpvOp_Constant, { Float, Two, 0x40000000 });
+    PushSpvOp(&m, SpvOp_Constant, { Float, Three, 0x40400000 });
+    uint32_t next = 7;
+    for (uint f = 0; f < SlpTestFunctions; ++f) {
+        uint32_t const fn = next++, v = next++, w = next++, s = next++;
+        functionIds[f] = fn;
+        PushSpvOp(&m, SpvOp_Function, { Vec3, fn, 0, FnType });
+        PushSpvOp(&m, SpvOp_FunctionParameter, { Vec3, v });
+        PushSpvOp(&m, SpvOp_FunctionParameter, { Vec3, w });
+        PushSpvOp(&m, SpvOp_FunctionParameter, { Float, s });
+        PushSpvOp(&m, SpvOp_Label, { next++ });
+        auto const Op = [&](uint16_t opcode, uint32_t type, std::initializer_list<uint32_t> operands) {
+            uint32_t const id = next++;
+            m.push(uint32_t(3 + operands.size()) << 16 | opcode);
+            m.push(type);
+            m.push(id);
+            for (uint32_t word : operands) {
+                m.push(word);
+            }
+            return id;
+        };
+        uint32_t result = 0;
+        if (f == 0) {
+            uint32_t lanes[3];
+            for (uint32_t j = 0; j < 3; ++j) {
+                uint32_t const vj = Op(SpvOp_CompositeExtract, Float, { v, j });
+                uint32_t const wj = Op(SpvOp_CompositeExtract, Float, { w, j });
+                lanes[j] = Op(SpvOp_FAdd, Float, { Op(SpvOp_FMul, Float, { vj, s }), wj });
+            }
+            result = Op(SpvOp_CompositeConstruct, Vec3, { lanes[0], lanes[1], lanes[2] });
+        }
+        else if (f == 1) {
+            uint32_t const vy = Op(SpvOp_CompositeExtract, Float, { v, 1 });
+            uint32_t const vx = Op(SpvOp_CompositeExtract, Float, { v, 0 });
+            uint32_t const vz = Op(SpvOp_CompositeExtract, Float, { v, 2 });
+            uint32_t const a = Op(SpvOp_FMul, Float, { vy, s }), b = Op(SpvOp_FMul, Float, { vx, s });
+            result = Op(SpvOp_CompositeConstruct, Vec3, { a, b, Op(SpvOp_FMul, Float, { vz, s }) });
+        }
+        else if (f == 2) {
+            uint32_t const a = Op(SpvOp_FMul, Float, { Op(SpvOp_CompositeExtract, Float, { v, 0 }), Two });
+            uint32_t const b = Op(SpvOp_FMul, Float, { Op(SpvOp_CompositeExtract, Float, { v, 1 }), Three });
+            uint32_t const r = Op(SpvOp_CompositeConstruct, Vec2, { a, b });
+            uint32_t const rx = Op(SpvOp_CompositeExtract, Float, { r, 0 });
+            result = Op(SpvOp_CompositeConstruct, Vec3, { rx, Op(SpvOp_CompositeExtract, Float, { r, 1 }), s });
+        }
+        else if (f == 3) {
+            uint32_t const a = Op(SpvOp_FMul, Float, { Op(SpvOp_CompositeExtract, Float, { v, 0 }), s });
+            uint32_t const b = Op(SpvOp_FMul, Float, { Op(SpvOp_CompositeExtract, Float, { v, 1 }), s });
+            uint32_t const c = Op(SpvOp_FMul, Float, { Op(SpvOp_CompositeExtract, Float, { v, 2 }), s });
+            uint32_t const r = Op(SpvOp_CompositeConstruct, Vec3, { a, b, c });
+            uint32_t const d = Op(SpvOp_FAdd, Float, { a, s });
+            result = Op(SpvOp_FAdd, Vec3, { r, Op(SpvOp_CompositeConstruct, Vec3, { d, d, d }) });
+        }
+        else {
+            uint32_t const t = Op(SpvOp_FAdd, Float, { s, s }), u = Op(SpvOp_FSub, Float, { s, s });
+            uint32_t const a = Op(SpvOp_FMul, Float, { t, s }), b = Op(SpvOp_FMul, Float, { u, t });
+            uint32_t const c = Op(SpvOp_FMul, Float, { a, s });
+            uint32_t const r = Op(SpvOp_CompositeConstruct, Vec2, { a, b });
+            uint32_t const q = Op(SpvOp_CompositeConstruct, Vec2, { c, Op(SpvOp_FMul, Float, { c, s }) });
+            uint32_t const rx = Op(SpvOp_CompositeExtract, Float, { r, 0 });
+            result = Op(SpvOp_CompositeConstruct, Vec3, { rx, Op(SpvOp_CompositeExtract, Float, { q, 1 }), s });
+        }
+        PushSpvOp(&m, SpvOp_ReturnValue, { result });
+        PushSpvOp(&m, SpvOp_FunctionEnd, { });
+    }
+    m[3] = next;
+}
+
+// Runs a function of a module made of the ops in BuildSlpModule(), with v = (1, 2, 3), w = (4, 5, 6) and s = 7.
+static void
+RunSlpFunction(view<const uint32_t> module, uint32_t function, float *result)
+{
+    uint32_t const bound = module.ptr[3];
+    Array<float> values;
+    Array<uint8_t> sizes; // per type and value
+    memset(values.uninitialized_push_n(4 * bound), 0, 4 * bound * sizeof(float));
+    memset(sizes.uninitialized_push_n(bound), 0, bound);
+    static const float Args[] = { 1, 2, 3, 0, 4, 5, 6, 0, 7, 0, 0, 0 };
+    uint nParams = 0;
+    bool bIn = false;
+    for (uint at = 5; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const w = module.ptr + at;
+        uint16_t const opcode = uint16_t(w[0]);
+        uint const nWords = w[0] >> 16;
+        float *const out = nWords > 2 ? &values[4 * w[2]] : nullptr;
+        bIn = opcode == SpvOp_Function ? w[2] == function : bIn;
+        if (opcode == SpvOp_TypeFloat || opcode == SpvOp_TypeVector) {
+            sizes[w[1]] = opcode == SpvOp_TypeFloat ? 1 : uint8_t(w[3]);
+            continue;
+        }
+        if (SpvResultWord(SpvLookupOp(opcode)) == 2) {
+            sizes[w[2]] = sizes[w[1]];
+        }
+        if (opcode == SpvOp_Constant) {
+            memcpy(out, &w[3], sizeof(float));
+        }
+        else if (opcode == SpvOp_ConstantComposite || (bIn && opcode == SpvOp_CompositeConstruct)) {
+            float *p = out;
+            for (uint i = 3; i < nWords; ++i) {
+                memcpy(p, &values[4 * w[i]], sizes[w[i]] * sizeof(float));
+                p += sizes[w[i]];
+            }
+        }
+        else if (!bIn) {
+            continue;
+        }
+        else if (opcode == SpvOp_FunctionParameter) {
+            memcpy(out, Args + 4 * nParams++, 4 * sizeof(float));
+        }
+        else if (opcode == SpvOp_CompositeExtract) {
+            out[0] = values[4 * w[3] + w[4]];
+        }
+        else if (opcode == SpvOp_VectorShuffle) {
+            for (uint i = 5; i < nWords; ++i) {
+                out[i - 5] = w[i] < sizes[w[3]] ? values[4 * w[3] + w[i]] : values[4 * w[4] + w[i] - sizes[w[3]]];
+            }
+        }
+        else if (opcode == SpvOp_FAdd || opcode == SpvOp_FSub || opcode == SpvOp_FMul) {
+            for (uint i = 0; i < sizes[w[1]]; ++i) {
+                float const a = values[4 * w[3] + i], b = values[4 * w[4] + i];
+                out[i] = opcode == SpvOp_FAdd ? a + b : opcode == SpvOp_FSub ? a - b : a * b;
+            }
+        }
+        else if (opcode == SpvOp_ReturnValue) {
+            memcpy(result, &values[4 * w[1]], 3 * sizeof(float));
+            return;
+        }
+        else {
+            ASSERT(opcode == SpvOp_Function || opcode == SpvOp_Label || opcode == SpvOp_FunctionEnd);
+        }
+    }
+    ASSERT(!"no such function");
+}
+
+#if is_debug // only ASSERTs use it
+/*
+    Whether the shuffles and constructs of vectors from scalars have as many components as their result types, and
+    the extracts index within their vectors. SpvValidate() doesn't look at types that closely.
+**/
+static bool
+SlpWidthsMatch(view<const uint32_t> module)
+{
+    Array<uint32_t> widths, valueTypes; // per type, per value
+    memset(widths.uninitialized_push_n(module.ptr[3]), 0, module.ptr[3] * sizeof(uint32_t));
+    memset(valueTypes.uninitialized_push_n(module.ptr[3]), 0, module.ptr[3] * sizeof(uint32_t));
+    for (uint at = 5; at < module.length; at += module.ptr[at] >> 16) {
+        const uint32_t *const w = module.ptr + at;
+        uint16_t const opcode = uint16_t(w[0]);
+        uint const nWords = w[0] >> 16;
+        if (opcode == SpvOp_TypeFloat) {
+            widths[w[1]] = 1;
+        }
+        else if (opcode == SpvOp_TypeVector) {
+            widths[w[1]] = w[3];
+        }
+        else if (SpvResultWord(SpvLookupOp(opcode)) == 2) {
+            valueTypes[w[2]] = w[1];
+        }
+        if (opcode == SpvOp_VectorShuffle && nWords - 5 != widths[w[1]]) {
+            return false;
+        }
+        if (opcode == SpvOp_CompositeConstruct && widths[valueTypes[w[3]]] == 1 && nWords - 3 != widths[w[1]]) {
+            return false;
+        }
+        if (opcode == SpvOp_CompositeExtract && w[4] >= widths[valueTypes[w[3]]]) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+void TestSpvSlp()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> in, out;
+    uint32_t functions[SlpTestFunctions];
+    BuildSlpModule(&in, functions);
+    SpvValidationError error;
+    ASSERT(SpvValidate({ in.data(), in.size() }, &error));
+    SpvSlpReport report;
+    bool bOk = SpvSlpVectorize({ in.data(), in.size() }, SpvSlpOptions(), &out, &report);
+    ASSERT(bOk);
+    ASSERT(SpvValidate({ out.data(), out.size() }, &error) && SlpWidthsMatch({ out.data(), out.size() }));
+    for (uint f = 0; f < SlpTestFunctions; ++f) {
+        float expected[3], actual[3];
+        RunSlpFunction({ in.data(), in.size() }, functions[f], expected);
+        RunSlpFunction({ out.data(), out.size() }, functions[f], actual);
+        ASSERT(memcmp(expected, actual, sizeof(expected)) == 0);
+    }
+
+    // 0: splat s, v * s + w; 1: shuffle v, splat s; 2: shuffle v, times (2, 3); 3: splat s, v * s, extract a.
+    ASSERT(report.nTrees == 4 && report.nScalarOps == 6 + 3 + 2 + 3 && report.nVectorOps == 5);
+    ASSERT(report.nShuffles == 1 + 2 + 1 + 1);
+    ASSERT(report.instructionDelta == (3 - 13) + (3 - 7) + (2 - 5) + (3 - 7) + 1); // and the (2, 3) constant
+    ASSERT(out.size() < in.size() && out[3] > in[3]);
+
+    // Nothing is worth less than vectorizing.
+    SpvSlpOptions options;
+    options.minSaving = 11;
+    bOk = SpvSlpVectorize({ in.data(), in.size() }, options, &out, &report);
+    ASSERT(bOk && report.nTrees == 0);
+    ASSERT(out.size() == in.size() && memcmp(out.data(), in.data(), in.size() * sizeof(uint32_t)) == 0);
+    options.minSaving = 10;
+    bOk = SpvSlpVectorize({ in.data(), in.size() }, options, &out, &report);
+    ASSERT(bOk && report.nTrees == 1);
+    (void)bOk;
+    (void)error;
+    puts("okay");
+}
+
+#if is_debug // only ASSERTs use these
+static uint16_t
+HalfOf(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return Half_FromFloat(f);
+}
+
+// The half r is the exact value rounded to nearest even, with infinity taken as 2^16 as rounding does.
+static bool
+IsRoundedHalf(double exact, uint16_t r)
+{
+    auto const Value = [](uint16_t h) {
+        return (h & 0x7fff) == 0x7c00 ? (h & 0x8000 ? -65536.0 : 65536.0) : double(Half_ToFloat(h));
+    };
+    if (!Half_IsFinite(r) && (r & 0x3ff)) {
+        return exact != exact;
+    }
+    double const d = fabs(Value(r) - exact);
+    for (int step : { -1, 1 }) {
+        uint16_t const other = uint16_t(r + step);
+        if ((r & 0x7fff) == (step < 0 ? 0 : 0x7c00) || (other & 0x7fff) > 0x7c00) {
+            continue; // past zero, where the sign flips, or past infinity
+        }
+        double const e = fabs(Value(other) - exact);
+        if (e < d || (e == d && (r & 1))) {
+            return false;
+        }
+    }
+    return (r & 0x7fff) != 0 || fabs(exact) <= 0x1p-25;
+}
+#endif
+
+void TestHalf()
+{
+    puts(__FUNCTION__);
+    ASSERT(HalfOf(0x3f800000) == 0x3c00 && HalfOf(0x477fe000) == 0x7bff); // 1, 65504
+    ASSERT(HalfOf(0x477ff000) == 0x7c00 && HalfOf(0x477fefff) == 0x7bff); // 65520 rounds up to infinity
+    ASSERT(HalfOf(0x33800000) == 0x0001 && HalfOf(0x33000000) == 0x0000); // 2^-24, 2^-25 to even
+    ASSERT(HalfOf(0x33400000) == 0x0001 && HalfOf(0xb3000001) == 0x8001); // 1.5 * 2^-25, just over -2^-25
+    ASSERT(HalfOf(0x3f801000) == 0x3c00 && HalfOf(0x3f803000) == 0x3c02); // 1 + 2^-11, 1 + 3 * 2^-11
+    ASSERT(HalfOf(0x3dcccccd) == 0x2e66 && HalfOf(0x387fe000) == 0x0400); // 0.1, to the smallest normal
+    ASSERT(HalfOf(0x7fc00000) == 0x7e00 && HalfOf(0xff800000) == 0xfc00); // NaN, -infinity
+
+    // Both paths agree on every half and on floats all over, and halves go through float and back unchanged.
+    for (uint h = 0; h < 0x10000; ++h) {
+        float const f = Half_ToFloat(uint16_t(h)), soft = Half_ToFloatSoft(uint16_t(h));
+        ASSERT(memcmp(&f, &soft, sizeof(f)) == 0);
+        (void)f; (void)soft;
+        ASSERT(Half_FromFloat(f) == (Half_IsFinite(uint16_t(h)) || !(h & 0x3ff) ? h : h | 0x200));
+    }
+    for (uint64_t bits = 0; bits < 1ull << 32; bits += 65521) {
+        float f;
+        uint32_t const w = uint32_t(bits);
+        memcpy(&f, &w, sizeof(f));
+        ASSERT(Half_FromFloat(f) == Half_FromFloatSoft(f));
+    }
+
+    // Done in float and rounded once, the arithmetic is exactly rounded; the sum, difference and product of halves
+    // are exact in double, and the quotient is close enough for the check.
+    uint32_t state = 1;
+    auto const Random = [&state]() {
+        state = state * 1664525 + 1013904223;
+        return uint16_t(state >> 16);
+    };
+    for (uint i = 0; i < 200000; ++i) {
+        uint16_t const a = Random(), b = i & 1 ? Random() : uint16_t(Random() & 0x83ff) | (a & 0x7c00);
+        if (!Half_IsFinite(a) || !Half_IsFinite(b)) {
+            continue;
+        }
+        double const x = Half_ToFloat(a), y = Half_ToFloat(b);
+        ASSERT(IsRoundedHalf(x + y, Half_Add(a, b)) && IsRoundedHalf(x - y, Half_Sub(a, b)));
+        ASSERT(IsRoundedHalf(x * y, Half_Mul(a, b)));
+        ASSERT(y == 0 || IsRoundedHalf(x / y, Half_Div(a, b)));
+        ASSERT(Half_Negate(Half_Sub(a, b)) == Half_Sub(b, a) || x == y);
+        (void)x; (void)y;
+    }
+    puts("okay");
+}
+
+/*
+    float f(float a, float b) with a decorated RelaxedPrecision, %1 float, %2 bool, %4 2.0, %5 0.5, %6 1e6, %7 64.0:
+        c = a * 2.0; k = 2.0 * 0.5; e = c + k;       demoted, with k folded to 1.0
+        g = e + b; h = e * 1e6; m = 0.5 * 0.5;       not: b isn't relaxed, 1e6 doesn't fit, m's user isn't demoted
+        g2 = g + m;
+        do { x = phi(e, x2); y = phi(2.0, y2);       x and x2 demoted, y isn't reached from a seed
+             x2 = x * 2.0; y2 = y + 0.5;
+        } while (x2 < 64.0);
+        return (x2 + y2) + (g2 + h);
+    With a = 3 and b = 5, the demoted values are all exact in half.
+**/
+enum : uint32_t { HalfTestC = 14, HalfTestK = 15 };
+
+static void
+BuildHalfModule(bool bNoContraction, Array<uint32_t> *pOut)
+{
+    enum : uint32_t { Float = 1, Bool = 2, FnType = 3, Two = 4, Half = 5, Million = 6, SixtyFour = 7 };
+    Array<uint32_t>& m = *pOut;
+    m.clear();
+    uint32_t const header[] = { SpvMagic, 0x00010000, 0, 32, 0 };
+    m.push_n(header, lengthof(header));
+    PushSpvOp(&m, SpvOp_Capability, { 1 });
+    PushSpvOp(&m, SpvOp_MemoryModel, { 0, 1 });
+    PushSpvOp(&m, SpvOp_Name, { HalfTestK, 'k' });
+    PushSpvOp(&m, SpvOp_Decorate, { 11, 0 }); // a RelaxedPrecision
+    if (bNoContraction) {
+        PushSpvOp(&m, SpvOp_Decorate, { HalfTestC, 42 });
+    }
+    PushSpvOp(&m, SpvOp_TypeFloat, { Float, 32 });
+    PushSpvOp(&m, SpvOp_TypeBool, { Bool });
+    PushSpvOp(&m, 33 /* OpTypeFunction */, { FnType, Float, Float, Float });
+    PushSpvOp(&m, SpvOp_Constant, { Float, Two, 0x40000000 });
+    PushSpvOp(&m, SpvOp_Constant, { Float, Half, 0x3f000000 });
+    PushSpvOp(&m, SpvOp_Constant, { Float, Million, 0x49742400 });
+    PushSpvOp(&m, SpvOp_Constant, { Float, SixtyFour, 0x42800000 });
+    PushSpvOp(&m, SpvOp_Function, { Float, 10, 0, FnType });
+    PushSpvOp(&m, SpvOp_FunctionParameter, { Float, 11 });
+    PushSpvOp(&m, SpvOp_FunctionParameter, { Float, 12 });
+    PushSpvOp(&m, SpvOp_Label, { 13 });
+    PushSpvOp(&m, SpvOp_FMul, { Float, HalfTestC, 11, Two });
+    PushSpvOp(&m, SpvOp_FMul, { Float, HalfTestK, Two, Half });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 16, HalfTestC, HalfTestK });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 17, 16, 12 });
+    PushSpvOp(&m, SpvOp_FMul, { Float, 18, 16, Million });
+    PushSpvOp(&m, SpvOp_FMul, { Float, 19, Half, Half });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 20, 17, 19 });
+    PushSpvOp(&m, SpvOp_Branch, { 21 });
+    PushSpvOp(&m, SpvOp_Label, { 21 });
+    PushSpvOp(&m, SpvOp_Phi, { Float, 22, 16, 13, 25, 24 });
+    PushSpvOp(&m, SpvOp_Phi, { Float, 23, Two, 13, 26, 24 });
+    PushSpvOp(&m, SpvOp_LoopMerge, { 27, 24, 0 });
+    PushSpvOp(&m, SpvOp_Branch, { 24 });
+    PushSpvOp(&m, SpvOp_Label, { 24 });
+    PushSpvOp(&m, SpvOp_FMul, { Float, 25, 22, Two });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 26, 23, Half });
+    PushSpvOp(&m, 184 /* OpFOrdLessThan */, { Bool, 28, 25, SixtyFour });
+    PushSpvOp(&m, SpvOp_BranchConditional, { 28, 21, 27 });
+    PushSpvOp(&m, SpvOp_Label, { 27 });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 29, 25, 26 });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 30, 20, 18 });
+    PushSpvOp(&m, SpvOp_FAdd, { Float, 31, 29, 30 });
+    PushSpvOp(&m, SpvOp_ReturnValue, { 31 });
+    PushSpvOp(&m, SpvOp_FunctionEnd, { });
+}
+
+// Runs the function of a module from BuildHalfModule() with a = 3 and b = 5, rounding 16-bit results to half.
+static float
+RunHalfModule(view<const uint32_t> module)
+{
+    uint32_t const bound = module.ptr[3];
+    Array<float> values;
+    Array<uint32_t> labelAt;
+    Array<uint8_t> widths; // per type and value
+    memset(values.uninitialized_push_n(bound), 0, bound * sizeof(float));
+    memset(labelAt.uninitialized_push_n(bound), 0, bound * sizeof(uint32_t));
+    memset(widths.uninitialized_push_n(bound), 0, bound);
+    uint at = 0, nParams = 0;
+    for (uint i = 5; i < module.length; i += module.ptr[i] >> 16) {
+        const uint32_t *const w = module.ptr + i;
+        uint16_t const opcode = uint16_t(w[0]);
+        if (opcode == SpvOp_TypeFloat) {
+            widths[w[1]] = uint8_t(w[2]);
+        }
+        if (SpvResultWord(SpvLookupOp(opcode)) == 2) {
+            widths[w[2]] = widths[w[1]];
+        }
+        if (opcode == SpvOp_Constant) {
+            memcpy(&values[w[2]], &w[3], sizeof(float));
+            values[w[2]] = widths[w[1]] == 16 ? Half_ToFloat(uint16_t(w[3])) : values[w[2]];
+        }
+        if (opcode == SpvOp_FunctionParameter) {
+            values[w[2]] = nParams++ ? 5.0f : 3.0f;
+        }
+        if (opcode == SpvOp_Label) {
+            labelAt[w[1]] = i;
+            at = at ? at : i;
+        }
+    }
+    uint32_t block = 0, prev = 0;
+    for (uint nSteps = 0; nSteps < 1 << 16; ++nSteps) {
+        const uint32_t *const w = module.ptr + at;
+        at += w[0] >> 16;
+        uint16_t const opcode = uint16_t(w[0]);
+        float result = 0;
+        switch (opcode) {
+        case SpvOp_Label: prev = block; block = w[1]; continue;
+        case SpvOp_Phi:
+            for (uint i = 4; i < w[0] >> 16; i += 2) {
+                result = w[i] == prev ? values[w[i - 1]] : result;
+            }
+            break;
+        case SpvOp_FAdd: result = values[w[3]] + values[w[4]]; break;
+        case SpvOp_FMul: result = values[w[3]] * values[w[4]]; break;
+        case SpvOp_FConvert: result = values[w[3]]; break;
+        case 184: result = values[w[3]] < values[w[4]]; break;
+        case SpvOp_Branch: at = labelAt[w[1]]; continue;
+        case SpvOp_BranchConditional: at = labelAt[values[w[1]] != 0 ? w[2] : w[3]]; continue;
+        case SpvOp_LoopMerge: continue;
+        case SpvOp_ReturnValue: return values[w[1]];
+        default: ASSERT(!"op not in BuildHalfModule()");
+        }
+        values[w[2]] = widths[w[1]] == 16 ? Half_ToFloat(Half_FromFloat(result)) : result;
+    }
+    ASSERT(!"runs forever");
+    return 0;
+}
+
+void TestSpvHalf()
+{
+    puts(__FUNCTION__);
+    Array<uint32_t> in, out;
+    BuildHalfModule(false, &in);
+    view<const uint32_t> const input = { in.data(), in.size() };
+    SpvValidationError error;
+    ASSERT(SpvValidate(input, &error));
+    float const expected = RunHalfModule(input);
+    ASSERT(expected == 116.0f + 7000012.25f);
+    (void)error; (void)expected;
+
+    // Decorated: c, e, x and x2, with k folded to a new 1.0 and its name gone.
+    SpvHalfOptions options;
+    SpvHalfReport report;
+    bool bOk = SpvDemotePrecision(input, options, &out, &report);
+    view<const uint32_t> output = { out.data(), out.size() };
+    ASSERT(bOk && SpvValidate(output, &error) && RunHalfModule(output) == expected);
+    ASSERT(report.nDemoted == 4 && report.nFolded == 1 && report.nConversions == 0);
+    ASSERT(report.instructionDelta == 4 - 2 + 1 && CountOps(output, SpvOp_Decorate) == 1 + 4);
+    ASSERT(CountOps(output, SpvOp_Name) == 0 && out[3] == in[3] + 1);
+
+    // 16-bit: converting a down, e and x2 up; a 16-bit float type, 2.0 and 1.0 as halves, and the capability.
+    options.mode = SpvHalf_Float16;
+    bOk = SpvDemotePrecision(input, options, &out, &report);
+    output = { out.data(), out.size() };
+    ASSERT(bOk && SpvValidate(output, &error) && RunHalfModule(output) == expected);
+    ASSERT(report.nDemoted == 4 && report.nFolded == 1 && report.nConversions == 3);
+    ASSERT(report.instructionDelta == 3 + 3 + 1 - 2 && CountOps(output, SpvOp_FConvert) == 3);
+    ASSERT(CountOps(output, SpvOp_Capability) == 2 && CountOps(output, SpvOp_TypeFloat) == 2);
+
+    // Run again, the module is already demoted: the conversion up from 16 bits is a seed, nothing else is reached.
+    Array<uint32_t> again;
+    bOk = SpvDemotePrecision(output, options, &again, &report);
+    ASSERT(bOk && report.nDemoted == 0 && report.nFolded == 0 && report.nConversions == 0);
+    ASSERT(again.size() == out.size() && memcmp(again.data(), out.data(), out.size() * sizeof(uint32_t)) == 0);
+
+    // A precise c stops it all, k's user included.
+    BuildHalfModule(true, &in);
+    for (uint8_t mode : { SpvHalf_RelaxedPrecision, SpvHalf_Float16 }) {
+        options.mode = mode;
+        bOk = SpvDemotePrecision({ in.data(), in.size() }, options, &out, &report);
+        ASSERT(bOk && report.nDemoted == 0 && report.nFolded == 0 && report.instructionDelta == 0);
+        ASSERT(out.size() == in.size() && memcmp(out.data(), in.data(), in.size() * sizeof(uint32_t)) == 0);
+    }
+
+    in[3] = 0; // bound
+    bOk = SpvDemotePrecision({ in.data(), in.size() }, options, &out, &report);
+    ASSERT(!bOk && out.size() == 0);
+    (void)bOk;
+    puts("okay");
+}
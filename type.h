@@ -19,6 +19,7 @@ bitstruct TypeDescriptor {
             unsigned : 1 // off = 8
             reference : 1 // off = 9
             readonly : 1 // off = 10
+            vectorSizeMinus1 : 2 // off = 11, 0 is a scalar
         } leaf;
     };
 };
@@ -37,6 +38,8 @@ enum : TypeDescLeafFlags {
     TypeDescLeafFlag_Readonly  = 1u <<10,
 };
 
+enum : unsigned { TypeDescLeafVectorShift = 11 };
+
 inline bool IsLeaf(TypeDescriptor td) { return (td & 0x3) == 0; }
 
 #define MaxUintN(n) (~0u >> (32 - (n)))
@@ -46,9 +49,23 @@ inline BuiltinTypeKind  LeafBuiltin(TypeDescriptor td)    { ASSERT((td & 0x3) ==
 inline bool             LeafIsUnsigned(TypeDescriptor td) { ASSERT((td & 0x3) == 0); return (td & TypeDescLeafFlag_Unsigned) != 0; }
 inline bool             LeafIsReference(TypeDescriptor td){ ASSERT((td & 0x3) == 0); return (td & TypeDescLeafFlag_Reference) != 0; }
 inline bool             LeafIsReadonly(TypeDescriptor td) { ASSERT((td & 0x3) == 0); return (td & TypeDescLeafFlag_Readonly) != 0; }
+inline uint             LeafVectorSize(TypeDescriptor td) { ASSERT((td & 0x3) == 0); return (td >> TypeDescLeafVectorShift & 3) + 1; } // 1 for scalars
 
 inline TypeDescriptor MakeLeafTypeDesc(BuiltinTypeKind builtin, TypeDescLeafFlags leafFlags) { return TypeDescriptor(uint32_t(builtin) << 2 | leafFlags); }
 
+// A vector of 2, 3 or 4 components; size 1 gives the scalar leaf.
+inline TypeDescriptor MakeLeafVectorTypeDesc(BuiltinTypeKind builtin, uint size, TypeDescLeafFlags leafFlags)
+{
+    ASSERT(size - 1 < 4u);
+    return TypeDescriptor(MakeLeafTypeDesc(builtin, leafFlags) | (size - 1) << TypeDescLeafVectorShift);
+}
+
+inline TypeDescriptor LeafWithVectorSize(TypeDescriptor td, uint size)
+{
+    ASSERT((td & 0x3) == 0 && size - 1 < 4u);
+    return TypeDescriptor((td & ~(3u << TypeDescLeafVectorShift)) | (size - 1) << TypeDescLeafVectorShift);
+}
+
 // haven't really looked at these much, could be interesting:
 // https://github.com/pervognsen/bitwise/blob/master/ion/type.c
 //